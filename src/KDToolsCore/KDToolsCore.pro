@@ -6,6 +6,7 @@ KDTOOLS += none
 CONFIG += kdtools \
     per_platform_sources
 HEADERS += kdtoolsglobal.h \
+    kdatomic.h \
     kdsignalblocker.h \
     kdsemaphorereleaser.h \
     kdrect.h \
@@ -15,6 +16,8 @@ HEADERS += kdtoolsglobal.h \
     kdautopointer.h \
     kdsharedmemorylocker.h \
     kdlockedsharedmemorypointer.h \
+    kdsharedmemoryringbuffer.h \
+    kdsharedmemoryarena.h \
     kdthreadrunner.h \
     kdgenericfactory.h \
     kdvariantconverter.h \
@@ -24,12 +27,16 @@ SOURCES += kdtoolsglobal.cpp \
     kdsemaphorereleaser.cpp \
     kdrect.cpp \
     kdlog.cpp \
+    kdlog_binary.cpp \
+    kdlog_mmap.cpp \
     kdsignalspy.cpp \
     kdsavefile.cpp \
     kdautopointer.cpp \
     pimpl_ptr.cpp \
     kdsharedmemorylocker.cpp \
     kdlockedsharedmemorypointer.cpp \
+    kdsharedmemoryringbuffer.cpp \
+    kdsharedmemoryarena.cpp \
     kdthreadrunner.cpp \
     kdgenericfactory.cpp \
     kdvariantconverter.cpp \
@@ -0,0 +1,117 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+#ifndef __KDTOOLSCORE__KDATOMIC_H__
+#define __KDTOOLSCORE__KDATOMIC_H__
+
+#include <KDToolsCore/kdtoolsglobal.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+
+// Qt 4 and Qt 5 disagree on how plain loads and stores of atomics
+// are spelled (Qt 4 has no acquire loads at all), so the lock-free
+// code in KDTools goes through these instead of using QAtomicInt
+// directly.
+// They take the QBasicAtomic* base classes, so that they work on
+// statically initialized atomics, too.
+
+#ifndef DOXYGEN_RUN
+namespace kdtools {
+
+    inline int atomicLoadRelaxed( const QBasicAtomicInt & a ) {
+#if QT_VERSION >= 0x050000
+        return a.load();
+#else
+        return a;
+#endif
+    }
+
+    inline int atomicLoadAcquire( const QBasicAtomicInt & a ) {
+#if QT_VERSION >= 0x050000
+        return a.loadAcquire();
+#else
+        return const_cast<QBasicAtomicInt&>( a ).fetchAndAddAcquire( 0 );
+#endif
+    }
+
+    inline void atomicStoreRelaxed( QBasicAtomicInt & a, int value ) {
+#if QT_VERSION >= 0x050000
+        a.store( value );
+#else
+        a = value;
+#endif
+    }
+
+    inline void atomicStoreRelease( QBasicAtomicInt & a, int value ) {
+#if QT_VERSION >= 0x050000
+        a.storeRelease( value );
+#else
+        a.fetchAndStoreRelease( value );
+#endif
+    }
+
+    template <typename T>
+    inline T * atomicLoadAcquire( const QBasicAtomicPointer<T> & p ) {
+#if QT_VERSION >= 0x050000
+        return p.loadAcquire();
+#else
+        return const_cast< QBasicAtomicPointer<T>& >( p ).fetchAndAddAcquire( 0 );
+#endif
+    }
+
+    template <typename T>
+    inline void atomicStoreRelease( QBasicAtomicPointer<T> & p, T * value ) {
+#if QT_VERSION >= 0x050000
+        p.storeRelease( value );
+#else
+        p.fetchAndStoreRelease( value );
+#endif
+    }
+
+    // A full memory barrier, for the rare protocols (seqlocks) whose
+    // plain data loads must not be reordered after a later atomic load:
+    inline void atomicFence() {
+#if defined( Q_CC_GNU )
+        __sync_synchronize();
+#else
+        // a locked read-modify-write is a full barrier wherever Qt runs
+        QAtomicInt fence;
+        fence.fetchAndAddOrdered( 1 );
+#endif
+    }
+
+    // Adds with two's complement wrap-around; sequence counters are
+    // compared by difference, so they are allowed to overflow:
+    inline int wrappingAdd( int lhs, int rhs ) {
+        return static_cast<int>( static_cast<unsigned int>( lhs ) + static_cast<unsigned int>( rhs ) );
+    }
+
+    inline int wrappingDifference( int lhs, int rhs ) {
+        return static_cast<int>( static_cast<unsigned int>( lhs ) - static_cast<unsigned int>( rhs ) );
+    }
+
+} // namespace kdtools
+#endif // DOXYGEN_RUN
+
+#endif /* __KDTOOLSCORE__KDATOMIC_H__ */
@@ -25,6 +25,12 @@
 #if QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN )
 #ifndef QT_NO_SHAREDMEMORY
 
+#include "kdatomic.h"
+
+#include <QThread>
+
+#include <cstring>
+
 namespace kdtools
 {
 }
@@ -58,6 +64,77 @@ size_t KDLockedSharedMemoryPointerBase::byteSize() const {
     return mem ? mem->size() : 0 ;
 }
 
+// The segment starts with the sequence counter, in a header of its
+// own. The counter is odd while a writer is updating the value behind
+// the header.
+static inline QBasicAtomicInt & sequenceCounter( void * data ) {
+    return *static_cast<QBasicAtomicInt*>( data );
+}
+
+static inline const QBasicAtomicInt & sequenceCounter( const void * data ) {
+    return *static_cast<const QBasicAtomicInt*>( data );
+}
+
+KDSeqlockSharedMemoryPointerBase::KDSeqlockSharedMemoryPointerBase( QSharedMemory * m, std::size_t size )
+    : mem( m ),
+      valueSize( size )
+{
+
+}
+
+KDSeqlockSharedMemoryPointerBase::KDSeqlockSharedMemoryPointerBase( QSharedMemory & m, std::size_t size )
+    : mem( &m ),
+      valueSize( size )
+{
+
+}
+
+KDSeqlockSharedMemoryPointerBase::~KDSeqlockSharedMemoryPointerBase() {}
+
+bool KDSeqlockSharedMemoryPointerBase::isValid() const {
+    return mem && mem->constData() && static_cast<std::size_t>( mem->size() ) >= HeaderSize + valueSize ;
+}
+
+bool KDSeqlockSharedMemoryPointerBase::tryLoad( void * dest ) const {
+    if ( !isValid() )
+        return false;
+    const char * const base = static_cast<const char*>( mem->constData() );
+    const QBasicAtomicInt & sequence = sequenceCounter( base );
+    const int begin = kdtools::atomicLoadAcquire( sequence );
+    if ( begin & 1 )
+        return false; // a writer is in progress
+    std::memcpy( dest, base + HeaderSize, valueSize );
+    // the copy must be complete before the counter is checked again:
+    kdtools::atomicFence();
+    return kdtools::atomicLoadRelaxed( sequence ) == begin;
+}
+
+void KDSeqlockSharedMemoryPointerBase::load( void * dest ) const {
+    assert( isValid() );
+    if ( !isValid() )
+        return;
+    for ( int spins = 0 ; !tryLoad( dest ) ; ++spins )
+        if ( spins >= 100 )
+            QThread::yieldCurrentThread();
+}
+
+void KDSeqlockSharedMemoryPointerBase::store( const void * src ) {
+    assert( isValid() );
+    if ( !isValid() )
+        return;
+    const KDSharedMemoryLocker locker( mem );
+    char * const base = static_cast<char*>( mem->data() );
+    QBasicAtomicInt & sequence = sequenceCounter( base );
+    // An odd counter here means a writer died halfway through; the
+    // value is torn, but the counter is already odd, as it should be.
+    if ( kdtools::atomicLoadRelaxed( sequence ) & 1 )
+        kdtools::atomicFence();
+    else
+        sequence.fetchAndAddOrdered( 1 );
+    std::memcpy( base + HeaderSize, src, valueSize );
+    sequence.fetchAndAddRelease( 1 );
+}
+
 /*!
   \class KDLockedSharedMemoryPointer
   \ingroup core raii smartptr
@@ -307,6 +384,77 @@ size_t KDLockedSharedMemoryPointerBase::byteSize() const {
  \since_f 2.2
 */
 
+/*!
+  \class KDSeqlockSharedMemoryPointer
+  \ingroup core smartptr
+  \brief Lock-free reading of a value in a Qt shared memory segment
+  \since_c 2.3
+
+  KDSeqlockSharedMemoryPointer gives access to a value of type \c T
+  in a QSharedMemory segment, like KDLockedSharedMemoryPointer, but
+  optimized for values that are read much more often than written,
+  e.g. status blocks polled by several processes.
+
+  Readers never take the segment's lock. They copy the value out with
+  load() and check a sequence counter, stored in front of the value,
+  to detect whether a writer changed it meanwhile; if so, they retry.
+  Only writers, calling store(), lock the segment, to serialize among
+  each other.
+
+  Create the segment with segmentSize() bytes; QSharedMemory
+  zero-initializes it. All processes must use the same \c T.
+
+  \note \c T must be a simple type that can be copied bytewise (no
+  pointers, no virtual functions), since torn copies are made and
+  discarded.
+
+  \note If a writer dies in the middle of store(), readers wait
+  until the next store() repairs the value.
+
+  \sa KDLockedSharedMemoryPointer
+*/
+
+/*!
+  \fn KDSeqlockSharedMemoryPointer::KDSeqlockSharedMemoryPointer( QSharedMemory * mem )
+
+  Constructor. Constructs a KDSeqlockSharedMemoryPointer for the value
+  in the data segment of \a mem. Unlike KDLockedSharedMemoryPointer,
+  this doesn't lock \a mem, so the object can be kept around.
+*/
+
+/*!
+  \fn KDSeqlockSharedMemoryPointer::KDSeqlockSharedMemoryPointer( QSharedMemory & mem )
+
+  \overload
+*/
+
+/*!
+  \fn int KDSeqlockSharedMemoryPointer::segmentSize()
+
+  Returns the size to create the shared memory segment with: the size
+  of \c T plus the header holding the sequence counter.
+*/
+
+/*!
+  \fn T KDSeqlockSharedMemoryPointer::load() const
+
+  Returns a consistent copy of the value, retrying while writers
+  modify it. Never locks the segment.
+*/
+
+/*!
+  \fn bool KDSeqlockSharedMemoryPointer::tryLoad( T * t ) const
+
+  Copies the value into \a t, trying only once. Returns \c false if
+  a writer interfered; \a t then holds garbage.
+*/
+
+/*!
+  \fn void KDSeqlockSharedMemoryPointer::store( const T & t )
+
+  Sets the value to \a t. Locks the segment for the duration of the
+  copy, so concurrent writers are serialized.
+*/
 
 #ifdef KDTOOLSCORE_UNITTESTS
 
@@ -375,6 +523,79 @@ namespace
     {
         return true;
     }
+
+    // all fields are derived from n, so a torn copy is detectable:
+    struct SeqlockStruct
+    {
+        SeqlockStruct( uint nn = 0 )
+            : n( nn ),
+              twice( 2 * nn ),
+              negated( ~nn ),
+              f( nn )
+        {
+        }
+        bool isConsistent() const
+        {
+            return twice == 2 * n && negated == ~n && f == n;
+        }
+        uint n;
+        uint twice;
+        uint negated;
+        double f;
+    };
+
+    class SeqlockThread : public QThread
+    {
+    public:
+        SeqlockThread( const QString& key, uint writes )
+            : mem( key ),
+              count( writes ),
+              writer( writes != 0 ),
+              torn( 0 ),
+              reads( 0 ),
+              stopRequested( 0 )
+        {
+            mem.attach();
+        }
+
+        // makes a reader return even if the final value never shows up
+        void requestStop()
+        {
+            kdtools::atomicStoreRelease( stopRequested, 1 );
+        }
+
+        void run()
+        {
+            kdtools::KDSeqlockSharedMemoryPointer< SeqlockStruct > p( &mem );
+            if( writer )
+            {
+                for( uint i = 1; i <= count; ++i )
+                    p.store( SeqlockStruct( i ) );
+                return;
+            }
+            uint last = 0;
+            while( true )
+            {
+                const SeqlockStruct s = p.load();
+                ++reads;
+                if( !s.isConsistent() || s.n < last )
+                    ++torn;
+                last = s.n;
+                if( s.n == finalValue || kdtools::atomicLoadAcquire( stopRequested ) )
+                    return;
+            }
+        }
+
+        QSharedMemory mem;
+        const uint count;
+        const bool writer;
+        uint torn;
+        uint reads;
+        QAtomicInt stopRequested;
+        static uint finalValue;
+    };
+
+    uint SeqlockThread::finalValue = 100000;
 }
 
 
@@ -492,6 +713,67 @@ KDAB_UNITTEST_SIMPLE( KDLockedSharedMemoryPointer, "kdtools/core" ) {
      }
 
 }
+
+KDAB_UNITTEST_SIMPLE( KDSeqlockSharedMemoryPointer, "kdtools/core" ) {
+
+    const QString key = QUuid::createUuid().toString();
+    QSharedMemory mem( key );
+    const int size = kdtools::KDSeqlockSharedMemoryPointer< SeqlockStruct >::segmentSize();
+    assertGreaterOrEqual( size, static_cast< int >( sizeof( SeqlockStruct ) ) );
+    const bool created = mem.create( size );
+    assertTrue( created );
+    if ( !created )
+        return; // don't execute tests if shm coulnd't be created
+
+    {
+        kdtools::KDSeqlockSharedMemoryPointer< SeqlockStruct > p( mem );
+        assertTrue( p );
+        assertEqual( p.load().n, 0u );
+        assertTrue( p.load().isConsistent() );
+        p.store( SeqlockStruct( 3 ) );
+        SeqlockStruct s;
+        assertTrue( p.tryLoad( &s ) );
+        assertEqual( s.n, 3u );
+        assertTrue( s.isConsistent() );
+        p.store( SeqlockStruct( 0 ) );
+    }
+
+    {
+        // a segment that isn't attached is not usable:
+        QSharedMemory detached( key + key );
+        kdtools::KDSeqlockSharedMemoryPointer< SeqlockStruct > p( detached );
+        assertFalse( p );
+        SeqlockStruct s;
+        assertFalse( p.tryLoad( &s ) );
+    }
+
+    {
+        // one writer, three readers, each with its own attachment;
+        // the readers must never see a torn or an older value:
+        SeqlockThread writer( key, SeqlockThread::finalValue );
+        SeqlockThread reader1( key, 0 );
+        SeqlockThread reader2( key, 0 );
+        SeqlockThread reader3( key, 0 );
+        reader1.start();
+        reader2.start();
+        reader3.start();
+        writer.start();
+        const bool written = writer.wait( 60000 );
+        // all threads must be done before the asserts can return:
+        reader1.requestStop();
+        reader2.requestStop();
+        reader3.requestStop();
+        writer.wait();
+        reader1.wait();
+        reader2.wait();
+        reader3.wait();
+        assertTrue( written );
+        assertEqual( reader1.torn, 0u );
+        assertEqual( reader2.torn, 0u );
+        assertEqual( reader3.torn, 0u );
+        assertGreater( reader1.reads, 0u );
+    }
+}
 #endif // KDTOOLSCORE_UNITTESTS
 #endif // QT_NO_SHAREDMEMORY
 #endif // QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN )
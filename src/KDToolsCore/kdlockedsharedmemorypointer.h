@@ -32,6 +32,7 @@
 #include <QtCore/QSharedMemory>
 
 #include <cassert>
+#include <cstddef>
 
 #ifndef DOXYGEN_RUN
 namespace kdtools {
@@ -126,6 +127,47 @@ public:
     KDAB_USING_SAFE_BOOL_OPERATOR( KDLockedSharedMemoryPointerBase )
 };
 
+class KDTOOLSCORE_EXPORT KDSeqlockSharedMemoryPointerBase {
+protected:
+    explicit KDSeqlockSharedMemoryPointerBase( QSharedMemory * mem, std::size_t valueSize );
+    explicit KDSeqlockSharedMemoryPointerBase( QSharedMemory & mem, std::size_t valueSize );
+    ~KDSeqlockSharedMemoryPointerBase();
+
+    // the sequence counter lives in a header of this size in front of the value:
+    enum { HeaderSize = 64 };
+
+    bool isValid() const;
+
+    bool tryLoad( void * dest ) const;
+    void load( void * dest ) const;
+    void store( const void * src );
+
+    KDAB_IMPLEMENT_SAFE_BOOL_OPERATOR_BASE( isValid() )
+
+private:
+    QSharedMemory * const mem;
+    const std::size_t valueSize;
+};
+
+template <typename T>
+class MAKEINCLUDES_EXPORT KDSeqlockSharedMemoryPointer KDAB_FINAL_CLASS : KDSeqlockSharedMemoryPointerBase {
+    KDAB_DISABLE_COPY( KDSeqlockSharedMemoryPointer );
+public:
+    explicit KDSeqlockSharedMemoryPointer( QSharedMemory * m )
+        : KDSeqlockSharedMemoryPointerBase( m, sizeof( T ) ) {}
+    explicit KDSeqlockSharedMemoryPointer( QSharedMemory & m )
+        : KDSeqlockSharedMemoryPointerBase( m, sizeof( T ) ) {}
+
+    static int segmentSize() { return HeaderSize + int( sizeof( T ) ); }
+
+    T load() const { T t; KDSeqlockSharedMemoryPointerBase::load( &t ); return t; }
+    bool tryLoad( T * t ) const { assert( t ); return KDSeqlockSharedMemoryPointerBase::tryLoad( t ); }
+
+    void store( const T & t ) { KDSeqlockSharedMemoryPointerBase::store( &t ); }
+
+    KDAB_USING_SAFE_BOOL_OPERATOR( KDSeqlockSharedMemoryPointerBase )
+};
+
 #ifndef DOXYGEN_RUN
 }
 #endif
@@ -23,13 +23,29 @@
 #include "kdlog.h"
 #include "kdlog_p.h"
 
+#include "kdatomic.h"
+#include "kdsavefile.h"
+
 #include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QRunnable>
 #include <QTextCodec>
+#include <QThread>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QtEndian>
 #include <QByteArray>
 #include <QString>
 #include <QVector>
+#include <QWaitCondition>
 
+#include <algorithm>
 #include <cassert>
 
 /*!
@@ -51,8 +67,10 @@
 
   Subclasses can be used with the \ref KDLog class.
 
-  \note At present, the classes of the \link kdlog KDLog
-  Module\endlink are \em not safe to use in another than the GUI thread.
+  \note Apart from KDAsyncLogDevice and KDThreadLocalLogDevice, the
+  log devices of the \link kdlog KDLog Module\endlink are \em not
+  safe to use in another than the GUI thread. Wrap them in one of
+  these two to log from several threads.
 */
 
 /*!
@@ -89,25 +107,121 @@ static void kdlogger_message_handler( QtMsgType type, const char * msg ) {
   \ingroup kdlog
   \brief A class for logging messages to a \ref KDLogDevice.
 
-  \note At present, the classes of the \link kdlog KDLog
-  Module\endlink are \em not safe to use in another than the GUI thread.
+  KDLog itself can be used from any thread, provided its log device
+  can. Of the devices shipped with the \link kdlog KDLog
+  Module\endlink, only KDAsyncLogDevice and KDThreadLocalLogDevice
+  are thread-safe.
 */
 
 class KDLog::Private {
     friend class ::KDLog;
 public:
-    Private( KDLogDevice * ld ) : logDevice( ld ) {}
+    Private( KDLogDevice * ld ) : logDevice( ld ), minimumSeverity( Info ) {}
     ~Private() {}
 
 private:
     KDLogDevice * logDevice;
+    QAtomicInt minimumSeverity;
 };
 
+static inline int severity_level( KDLog::Severity severity ) {
+    return severity & KDLog::LevelMask;
+}
+
+// Severities are ordered by their level bits. Ones that carry only
+// flags (Popup, User) have no level to filter by, and always pass.
+static inline bool severity_passes( KDLog::Severity severity, int minimumLevel ) {
+    const int level = severity_level( severity );
+    return level == 0 || level >= minimumLevel;
+}
+
 /*!
   \enum KDLog::Severity
 
   Specifies the urgency of the log message. Info is least urgent,
-  Error most urgent.
+  Error most urgent: Info < Debug < Warning < Error. Note that this
+  puts Debug \em above Info, so a minimumSeverity of Debug discards
+  Info messages, too.
+
+  Popup and User are flags that can be combined with a level. On
+  their own, they have no level, and pass every minimumSeverity.
+*/
+
+/*!
+  \property KDLog::Severity KDLog::minimumSeverity
+
+  Specifies the least urgent severity that is logged. Messages that
+  are less urgent are discarded before their format string is even
+  looked at, so disabled log levels cost little more than a function
+  call. Use the KDLOG_INFO(), KDLOG_DEBUG(), KDLOG_WARNING() and
+  KDLOG_ERROR() macros to not even evaluate the arguments in that
+  case. The default is Info, i.e. everything is logged.
+
+  Only the level part (LevelMask) of the severity is considered, in
+  the order given in KDLog::Severity; severities without a level
+  part always pass. The log device's own
+  KDLogDevice::minimumSeverity is honoured, too.
+
+  This property can be changed while other threads are logging.
+
+  Get this property's value using %minimumSeverity() and set it using
+  %setMinimumSeverity().
+
+  \sa isSeverityEnabled()
+*/
+void KDLog::setMinimumSeverity( Severity severity ) {
+    kdtools::atomicStoreRelaxed( d->minimumSeverity, severity_level( severity ) );
+}
+
+KDLog::Severity KDLog::minimumSeverity() const {
+    return Severity( QFlag( kdtools::atomicLoadRelaxed( d->minimumSeverity ) ) );
+}
+
+/*!
+  Returns whether a message of severity \a severity would currently
+  make it to the log device, ie. whether it passes both this KDLog's
+  and the log device's minimumSeverity.
+
+  \sa minimumSeverity, KDLogDevice::isSeverityEnabled()
+*/
+bool KDLog::isSeverityEnabled( Severity severity ) const {
+    return severity_passes( severity, kdtools::atomicLoadRelaxed( d->minimumSeverity ) )
+        && d->logDevice && d->logDevice->isSeverityEnabled( severity );
+}
+
+/*!
+  \def KDLOG_INFO( log, fmt, ... )
+  \relates KDLog
+
+  Calls \a log.logInfo( \a fmt, ... ), but only if
+  \a log.isSeverityEnabled( KDLog::Info ). Unlike with a plain call
+  to KDLog::logInfo(), the arguments are not evaluated at all if the
+  message would be discarded:
+
+  \code
+  KDLOG_DEBUG( log, "state: %s", qPrintable( expensiveDump() ) );
+  \endcode
+*/
+
+/*!
+  \def KDLOG_DEBUG( log, fmt, ... )
+  \relates KDLog
+
+  Like KDLOG_INFO(), but logs with severity KDLog::Debug.
+*/
+
+/*!
+  \def KDLOG_WARNING( log, fmt, ... )
+  \relates KDLog
+
+  Like KDLOG_INFO(), but logs with severity KDLog::Warning.
+*/
+
+/*!
+  \def KDLOG_ERROR( log, fmt, ... )
+  \relates KDLog
+
+  Like KDLOG_INFO(), but logs with severity KDLog::Error.
 */
 
 /*!
@@ -193,15 +307,13 @@ KDLog::~KDLog() {
   \param fmt A printf-style format string.
  */
 void KDLog::logInfo( const char * fmt, ... ) {
-    if ( !d->logDevice )
+    if ( !isSeverityEnabled( Info ) )
         return;
 
     va_list ap;
     va_start( ap, fmt );
-    const QString str = QString().vsprintf( fmt, ap );
+    d->logDevice->logv( Info, fmt, ap );
     va_end( ap );
-
-    d->logDevice->log( Info, str );
 }
 
 /*!
@@ -209,15 +321,13 @@ void KDLog::logInfo( const char * fmt, ... ) {
   \param fmt A printf-style format string.
  */
 void KDLog::logDebug( const char * fmt, ... ) {
-    if ( !d->logDevice )
+    if ( !isSeverityEnabled( Debug ) )
         return;
 
     va_list ap;
     va_start( ap, fmt );
-    const QString str = QString().vsprintf( fmt, ap );
+    d->logDevice->logv( Debug, fmt, ap );
     va_end( ap );
-
-    d->logDevice->log( Debug, str );
 }
 
 /*!
@@ -225,15 +335,13 @@ void KDLog::logDebug( const char * fmt, ... ) {
   \param fmt A printf-style format string.
  */
 void KDLog::logWarning( const char * fmt, ... ) {
-    if ( !d->logDevice )
+    if ( !isSeverityEnabled( Warning ) )
         return;
 
     va_list ap;
     va_start( ap, fmt );
-    const QString str = QString().vsprintf( fmt, ap );
+    d->logDevice->logv( Warning, fmt, ap );
     va_end( ap );
-
-    d->logDevice->log( Warning, str );
 }
 
 /*!
@@ -241,15 +349,13 @@ void KDLog::logWarning( const char * fmt, ... ) {
   \param fmt A printf-style format string.
  */
 void KDLog::logError( const char * fmt, ... ) {
-    if ( !d->logDevice )
+    if ( !isSeverityEnabled( Error ) )
         return;
 
     va_list ap;
     va_start( ap, fmt );
-    const QString str = QString().vsprintf( fmt, ap );
-    va_end(ap);
-
-    d->logDevice->log( Error, str );
+    d->logDevice->logv( Error, fmt, ap );
+    va_end( ap );
 }
 
 //
@@ -258,12 +364,59 @@ void KDLog::logError( const char * fmt, ... ) {
 
 #define d d_func()
 
-KDLogDevice::KDLogDevice() : _d( 0 ) { init( false ); }
+KDLogDevice::KDLogDevice() : _d( new Private ) { init( false ); }
 
-KDLogDevice::~KDLogDevice() {}
+KDLogDevice::~KDLogDevice() { delete _d; }
 
 void KDLogDevice::init( bool ) {}
 
+/*!
+  \property KDLog::Severity KDLogDevice::minimumSeverity
+
+  Specifies the least urgent severity this device wants to see. The
+  default is KDLog::Info, i.e. everything.
+
+  The threshold is checked by KDLog, and by devices that forward to
+  other devices (KDCompositeLogDevice, KDAsyncLogDevice,
+  KDThreadLocalLogDevice), before they
+  call log(); it lets you send e.g. only warnings and errors to the
+  system log while a file receives everything. This property can be
+  changed while other threads are logging.
+
+  Get this property's value using %minimumSeverity() and set it using
+  %setMinimumSeverity().
+
+  \sa KDLog::minimumSeverity
+*/
+void KDLogDevice::setMinimumSeverity( KDLog::Severity severity ) {
+    kdtools::atomicStoreRelaxed( d->minimumSeverity, severity_level( severity ) );
+}
+
+KDLog::Severity KDLogDevice::minimumSeverity() const {
+    return KDLog::Severity( QFlag( kdtools::atomicLoadRelaxed( d->minimumSeverity ) ) );
+}
+
+/*!
+  Returns whether \a severity passes this device's minimumSeverity.
+
+  \sa KDLog::Severity
+*/
+bool KDLogDevice::isSeverityEnabled( KDLog::Severity severity ) const {
+    return severity_passes( severity, kdtools::atomicLoadRelaxed( d->minimumSeverity ) );
+}
+
+/*!
+  Log the printf-style format string \a fmt, with its arguments in \a
+  args, with severity \a severity. This is what KDLog calls.
+
+  The default implementation formats the message and passes it on to
+  log(). Reimplement this function if your device can make use of the
+  unformatted message, like KDBinaryLogDevice does.
+*/
+void KDLogDevice::logv( KDLog::Severity severity, const char * fmt, va_list args ) {
+    log( severity, QString().vsprintf( fmt, args ) );
+}
+
 //
 // KDEncodingLogDevice
 //
@@ -355,15 +508,6 @@ void KDEncodingLogDevice::log( KDLog::Severity severity, const QString & msg ) {
   \brief A KDLogDevice that writes its output to stderr
 */
 
-/*!
-  The constructor. Constructs a KDStderrLogDevice object.
-*/
-KDStderrLogDevice::KDStderrLogDevice() : KDEncodingLogDevice() {}
-KDStderrLogDevice::KDStderrLogDevice( const QTextCodec * codec ) : KDEncodingLogDevice( codec ) {}
-KDStderrLogDevice::~KDStderrLogDevice() {}
-
-void KDStderrLogDevice::init( bool ) {}
-
 static const char * severity_to_string( KDLog::Severity severity ) {
     switch( severity ) {
     case KDLog::Info:
@@ -378,10 +522,178 @@ static const char * severity_to_string( KDLog::Severity severity ) {
     return "";
 }
 
+//
+// KDLogWriteBuffer
+//
+
+KDLogWriteBuffer::KDLogWriteBuffer()
+    : capacity( 0 ),
+      interval( -1 ),
+      flushSeverity( KDLog::Error ),
+      entries(),
+      bytes( 0 ),
+      age()
+{
+}
+
+bool KDLogWriteBuffer::append( KDLog::Severity severity, const char * prefix, const QByteArray & msg ) {
+    if ( entries.isEmpty() )
+        age.start();
+    entries.push_back( KDLogBufferedEntry( prefix, msg ) );
+    bytes += qstrlen( prefix ) + msg.size() + 1;
+    return bytes >= capacity
+        || severity_level( severity ) >= severity_level( flushSeverity )
+        || ( interval >= 0 && age.elapsed() >= interval );
+}
+
+bool KDLogWriteBuffer::writeTo( int fd ) {
+    if ( entries.isEmpty() )
+        return true;
+    const bool ok = kdlog_write_entries( fd, entries.constData(), entries.size() );
+    entries.clear();
+    bytes = 0;
+    return ok;
+}
+
+QByteArray KDLogWriteBuffer::takeAll() {
+    QByteArray result;
+    result.reserve( bytes );
+    Q_FOREACH( const KDLogBufferedEntry & e, entries ) {
+        result += e.prefix;
+        result += e.message;
+        result += '\n';
+    }
+    entries.clear();
+    bytes = 0;
+    return result;
+}
+
+/*!
+  \page kdlog-write-buffering Write Buffering in KDStderrLogDevice and KDFileLogDevice
+
+  By default, KDStderrLogDevice and KDFileLogDevice write each entry
+  as it is logged. For bursts of many entries, that's many write()
+  calls. Setting a non-zero bufferSize() makes them collect entries
+  instead, and write them out together: KDStderrLogDevice with a
+  single writev() per batch where available, KDFileLogDevice as one
+  QFile::write(). The batch is written when
+
+  \li the collected entries reach bufferSize() bytes,
+  \li an entry at least as urgent as flushSeverity() (by default
+      KDLog::Error) is logged,
+  \li an entry is logged and the oldest buffered entry is older than
+      flushInterval() milliseconds (by default, there is no age limit),
+  \li flush() is called, or the device is destroyed.
+
+  As the devices have no timer of their own, a flushInterval() is
+  only acted upon when the next entry is logged; call flush() from a
+  timer if entries must not linger while the application is quiet.
+*/
+
+//
+// KDStderrLogDevice
+//
+
+class KDStderrLogDevice::Private : public KDEncodingLogDevice::Private {
+    friend class ::KDStderrLogDevice;
+public:
+    explicit Private( const QTextCodec * c )
+        : KDEncodingLogDevice::Private( c ), buffer() {}
+
+private:
+    KDLogWriteBuffer buffer;
+};
+
+/*!
+  The constructor. Constructs a KDStderrLogDevice object.
+*/
+KDStderrLogDevice::KDStderrLogDevice()
+    : KDEncodingLogDevice( new Private( QTextCodec::codecForLocale() ), false )
+{
+    init( false );
+}
+
+KDStderrLogDevice::KDStderrLogDevice( const QTextCodec * codec )
+    : KDEncodingLogDevice( new Private( codec ), false )
+{
+    init( false );
+}
+
+/*!
+  Destructor. Writes out buffered entries.
+*/
+KDStderrLogDevice::~KDStderrLogDevice() {
+    flush();
+}
+
+void KDStderrLogDevice::init( bool ) {}
+
+/*!
+  Sets the number of bytes to collect before writing them out in one
+  go to \a size. The default is 0, which writes each entry
+  immediately.
+
+  \sa \ref kdlog-write-buffering
+*/
+void KDStderrLogDevice::setBufferSize( int size ) {
+    if ( size <= 0 )
+        flush();
+    d->buffer.capacity = qMax( size, 0 );
+}
+
+int KDStderrLogDevice::bufferSize() const {
+    return d->buffer.capacity;
+}
+
+/*!
+  Sets the age, in milliseconds, after which buffered entries are
+  written out to \a msecs. A negative value (the default) disables
+  the age limit.
+
+  \sa \ref kdlog-write-buffering
+*/
+void KDStderrLogDevice::setFlushInterval( int msecs ) {
+    d->buffer.interval = msecs;
+}
+
+int KDStderrLogDevice::flushInterval() const {
+    return d->buffer.interval;
+}
+
+/*!
+  Sets the severity from which on entries, and all buffered entries
+  before them, are written out immediately to \a severity. The
+  default is KDLog::Error.
+
+  \sa \ref kdlog-write-buffering
+*/
+void KDStderrLogDevice::setFlushSeverity( KDLog::Severity severity ) {
+    d->buffer.flushSeverity = severity;
+}
+
+KDLog::Severity KDStderrLogDevice::flushSeverity() const {
+    return d->buffer.flushSeverity;
+}
+
+/*!
+  Writes out all buffered entries. Returns \c false if that failed.
+
+  \sa \ref kdlog-write-buffering
+*/
+bool KDStderrLogDevice::flush() {
+    fflush( stderr );
+    return d->buffer.writeTo( 2 );
+}
+
 /*!
   Reimplemented from \ref KDLogDevice
 */
 void KDStderrLogDevice::doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) {
+    if ( d->buffer.isEnabled() ) {
+        if ( d->buffer.append( severity, severity_to_string( severity ), msg ) )
+            flush();
+        return;
+    }
     fprintf( stderr, "%s%s\n", severity_to_string( severity ), msg.data() ? msg.data() : "" );
 }
 
@@ -441,125 +753,1588 @@ void KDCompositeLogDevice::addLogDevice( KDLogDevice * dev ) {
 */
 void KDCompositeLogDevice::log( KDLog::Severity severity, const QString & msg ) {
     Q_FOREACH( KDLogDevice * dev, d->logDevices )
-        dev->log( severity, msg );
+        if ( dev->isSeverityEnabled( severity ) )
+            dev->log( severity, msg );
 }
 
-
 //
-// KDFileLogDevice
+// KDAsyncLogDevice
 //
 
+namespace {
+
+    struct LogRecord {
+        LogRecord() : severity( KDLog::Info ), message() {}
+        KDLog::Severity severity;
+        QString message;
+    };
+
+    // Bounded multi-producer/multi-consumer queue after Dmitry
+    // Vyukov. Each cell carries a sequence number that tells
+    // producers and consumers whether it is theirs to fill or to
+    // empty, so neither side ever takes a lock. Positions only ever
+    // grow (modulo 2^32), and the position of a record doubles as the
+    // ticket KDAsyncLogDevice::flush() waits for.
+    class LogRecordQueue {
+        Q_DISABLE_COPY( LogRecordQueue )
+        struct Cell {
+            QAtomicInt sequence;
+            LogRecord record;
+        };
+    public:
+        explicit LogRecordQueue( int capacity )
+            : mask( roundUpToPowerOfTwo( capacity ) - 1 ),
+              cells( new Cell[mask+1] ),
+              enqueuePos( 0 ),
+              dequeuePos( 0 )
+        {
+            for ( int i = 0 ; i <= mask ; ++i )
+                kdtools::atomicStoreRelaxed( cells[i].sequence, i );
+        }
+        ~LogRecordQueue() { delete[] cells; }
+
+        int capacity() const { return mask + 1; }
+
+        int enqueuePosition() const { return kdtools::atomicLoadAcquire( enqueuePos ); }
+        int dequeuePosition() const { return kdtools::atomicLoadAcquire( dequeuePos ); }
+
+        bool tryPush( KDLog::Severity severity, const QString & message ) {
+            Cell * cell;
+            int pos = kdtools::atomicLoadRelaxed( enqueuePos );
+            for ( ;; ) {
+                cell = &cells[pos & mask];
+                const int dif = kdtools::wrappingDifference( kdtools::atomicLoadAcquire( cell->sequence ), pos );
+                if ( dif == 0 ) {
+                    if ( enqueuePos.testAndSetRelaxed( pos, kdtools::wrappingAdd( pos, 1 ) ) )
+                        break;
+                    pos = kdtools::atomicLoadRelaxed( enqueuePos );
+                } else if ( dif < 0 ) {
+                    return false; // full
+                } else {
+                    pos = kdtools::atomicLoadRelaxed( enqueuePos );
+                }
+            }
+            cell->record.severity = severity;
+            cell->record.message = message;
+            kdtools::atomicStoreRelease( cell->sequence, kdtools::wrappingAdd( pos, 1 ) );
+            return true;
+        }
+
+        bool tryPop( LogRecord & record ) {
+            Cell * cell;
+            int pos = kdtools::atomicLoadRelaxed( dequeuePos );
+            for ( ;; ) {
+                cell = &cells[pos & mask];
+                const int dif = kdtools::wrappingDifference( kdtools::atomicLoadAcquire( cell->sequence ), kdtools::wrappingAdd( pos, 1 ) );
+                if ( dif == 0 ) {
+                    if ( dequeuePos.testAndSetRelaxed( pos, kdtools::wrappingAdd( pos, 1 ) ) )
+                        break;
+                    pos = kdtools::atomicLoadRelaxed( dequeuePos );
+                } else if ( dif < 0 ) {
+                    return false; // empty
+                } else {
+                    pos = kdtools::atomicLoadRelaxed( dequeuePos );
+                }
+            }
+            record.severity = cell->record.severity;
+            record.message.swap( cell->record.message );
+            cell->record.message.clear(); // don't keep the payload alive in the ring
+            kdtools::atomicStoreRelease( cell->sequence, kdtools::wrappingAdd( pos, mask + 1 ) );
+            return true;
+        }
+
+        bool isEmpty() const {
+            const int pos = kdtools::atomicLoadRelaxed( dequeuePos );
+            const Cell & cell = cells[pos & mask];
+            return kdtools::wrappingDifference( kdtools::atomicLoadAcquire( cell.sequence ), kdtools::wrappingAdd( pos, 1 ) ) < 0;
+        }
+
+    private:
+        static int roundUpToPowerOfTwo( int n ) {
+            int result = 2;
+            while ( result < n && result < ( 1 << 30 ) )
+                result <<= 1;
+            return result;
+        }
+
+    private:
+        const int mask;
+        Cell * const cells;
+        QAtomicInt enqueuePos;
+        QAtomicInt dequeuePos;
+    };
+
+} // anon namespace
 
 /*!
-  \class KDFileLogDevice
+  \class KDAsyncLogDevice
   \ingroup kdlog
-  \brief A KDLogDevice that outputs to a file.
+  \brief A KDLogDevice that hands log entries off to a background thread.
+  \since_c 2.3
+
+  KDAsyncLogDevice decouples the threads that log from the (possibly
+  slow) log device that writes the entries. log() only pushes the
+  already formatted message into a bounded, lock-free queue and
+  returns; a dedicated writer thread drains the queue into the
+  targetDevice(), in the order the entries were queued.
+
+  Unlike the other log devices, KDAsyncLogDevice may be used from any
+  number of threads at the same time. The target device is only ever
+  called from the writer thread, so it need not be thread-safe
+  itself.
+
+  \code
+  KDCompositeLogDevice * devices = new KDCompositeLogDevice;
+  devices->addLogDevice( new KDFileLogDevice( QLatin1String( "app.log" ) ) );
+  devices->addLogDevice( new KDStderrLogDevice );
+  KDAsyncLogDevice * async = new KDAsyncLogDevice( devices );
+  KDLog log( async );
+  \endcode
+
+  When the queue is full, the overflowPolicy() decides whether the
+  logging thread waits for room (Block, the default), or whether an
+  entry is discarded (DropOldest, DropNewest). Use flush() to wait
+  until everything logged so far has reached the target device.
 */
 
-class KDFileLogDevice::Private : public KDEncodingLogDevice::Private {
-    friend class ::KDFileLogDevice;
+/*!
+  \enum KDAsyncLogDevice::OverflowPolicy
+
+  Specifies what log() does when the queue is full.
+
+  \var KDAsyncLogDevice::Block
+  Wait until the writer thread has made room in the queue. Entries
+  logged by the writer thread itself, i.e. by the target device
+  logging into this device, are handled as with DropOldest instead,
+  as waiting would deadlock.
+
+  \var KDAsyncLogDevice::DropOldest
+  Discard the oldest queued entry to make room for the new one.
+
+  \var KDAsyncLogDevice::DropNewest
+  Discard the new entry.
+*/
+
+class KDAsyncLogDevice::Private : public KDLogDevice::Private {
+    friend class ::KDAsyncLogDevice;
 public:
-    explicit Private( const QString & filename, QIODevice::OpenMode mode, const QTextCodec * c )
-        : KDEncodingLogDevice::Private( c ), file( filename )
+    Private( KDLogDevice * t, int capacity, OverflowPolicy p )
+        : KDLogDevice::Private(),
+          target( t ),
+          policy( p ),
+          queue( capacity ),
+          writerFloor( 0 ),
+          writerBusy( 0 ),
+          dropped( 0 ),
+          waiters( 0 ),
+          writerSleeping( 0 ),
+          stopRequested( 0 ),
+          mutex(),
+          dataAvailable(),
+          progress(),
+          writer( this )
     {
-        mode &= QIODevice::Append|QIODevice::Truncate|QIODevice::Text;
-        mode |= QIODevice::WriteOnly;
+    }
 
-        if ( !file.open( mode ) )
-            fprintf( stderr, "KDFileLogDevice: Unable to open logfile %s: %s\n",
-                     qPrintable( file.fileName() ), qPrintable( file.errorString() ) );
+private:
+    class Writer : public QThread {
+    public:
+        explicit Writer( Private * p ) : QThread(), priv( p ) {}
+    protected:
+        void run() KDAB_OVERRIDE { priv->drain(); }
+    private:
+        Private * const priv;
+    };
+
+    enum {
+        BatchSize = 256,
+        IdleTimeout = 250,  // ms; only a safety net, the writer is woken explicitly
+        WaitSlice = 10      // ms; ditto for blocked producers and flush()
+    };
+
+    void wakeWriter() {
+        if ( !writerSleeping.fetchAndAddOrdered( 0 ) )
+            return;
+        QMutexLocker locker( &mutex );
+        dataAvailable.wakeOne();
     }
 
-public:
-    QFile file;
+    // All records before ticket have been popped, and the writer isn't
+    // still writing any of them. Records popped by pushDroppingOldest()
+    // are done when popped; the writer's are done when its batch is,
+    // and all of them are at or behind writerFloor.
+    bool isCompleted( int ticket ) const {
+        if ( kdtools::wrappingDifference( queue.dequeuePosition(), ticket ) < 0 )
+            return false;
+        kdtools::atomicFence();
+        if ( !kdtools::atomicLoadAcquire( writerBusy ) )
+            return true;
+        return kdtools::wrappingDifference( kdtools::atomicLoadAcquire( writerFloor ), ticket ) >= 0;
+    }
+
+    void notifyProgress() {
+        if ( !kdtools::atomicLoadAcquire( waiters ) )
+            return;
+        QMutexLocker locker( &mutex );
+        progress.wakeAll();
+    }
+
+    void drain() {
+        LogRecord record;
+        for ( ;; ) {
+            writerFloor.fetchAndStoreOrdered( queue.dequeuePosition() );
+            writerBusy.fetchAndStoreOrdered( 1 );
+            int n = 0;
+            while ( n < BatchSize && queue.tryPop( record ) ) {
+                if ( target )
+                    target->log( record.severity, record.message );
+                record.message.clear();
+                ++n;
+            }
+            writerBusy.fetchAndStoreOrdered( 0 );
+            if ( n ) {
+                notifyProgress();
+                continue;
+            }
+
+            QMutexLocker locker( &mutex );
+            writerSleeping.fetchAndStoreOrdered( 1 );
+            if ( queue.isEmpty() ) {
+                if ( kdtools::atomicLoadAcquire( stopRequested ) ) {
+                    writerSleeping.fetchAndStoreOrdered( 0 );
+                    return;
+                }
+                dataAvailable.wait( &mutex, IdleTimeout );
+            }
+            writerSleeping.fetchAndStoreOrdered( 0 );
+        }
+    }
+
+    void pushBlocking( KDLog::Severity severity, const QString & msg ) {
+        QMutexLocker locker( &mutex );
+        waiters.ref();
+        while ( !queue.tryPush( severity, msg ) )
+            progress.wait( &mutex, WaitSlice );
+        waiters.deref();
+    }
+
+    void pushDroppingOldest( KDLog::Severity severity, const QString & msg ) {
+        LogRecord victim;
+        while ( !queue.tryPush( severity, msg ) )
+            if ( queue.tryPop( victim ) ) {
+                dropped.ref();
+                notifyProgress();
+            }
+    }
+
+private:
+    KDLogDevice * target;
+    QAtomicInt policy;
+    LogRecordQueue queue;
+    QAtomicInt writerFloor; // dequeue position before the writer's current batch
+    QAtomicInt writerBusy;
+    QAtomicInt dropped;
+    QAtomicInt waiters;
+    QAtomicInt writerSleeping;
+    QAtomicInt stopRequested;
+    QMutex mutex;
+    QWaitCondition dataAvailable;
+    QWaitCondition progress;
+    Writer writer;
 };
 
 /*!
-  Constructor.
-  \param filename The name of the file that the log is written to
-  \param deleteFile If true, the file is deleted before writing the
-  first logentry. The default is to append to the file if it already
-  exists.
- */
-KDFileLogDevice::KDFileLogDevice( const QString& fileName, QIODevice::OpenMode mode )
-    : KDEncodingLogDevice( new Private( fileName, mode, QTextCodec::codecForLocale() ), false )
-{
-    init( false );
-}
+  Constructor. Creates a KDAsyncLogDevice that forwards to \a target
+  and starts its writer thread.
 
-KDFileLogDevice::KDFileLogDevice( const QString & fileName, const QTextCodec * codec, QIODevice::OpenMode mode )
-    : KDEncodingLogDevice( new Private( fileName, mode, codec ), false )
+  \a capacity is the number of entries the queue can hold; it is
+  rounded up to the next power of two. \a policy is the initial
+  overflowPolicy().
+
+  \note The KDLogDevice must be allocated on the heap, as
+  KDAsyncLogDevice takes ownership of it.
+*/
+KDAsyncLogDevice::KDAsyncLogDevice( KDLogDevice * target, int capacity, OverflowPolicy policy )
+    : KDLogDevice( new Private( target, capacity, policy ), false )
 {
     init( false );
 }
 
-void KDFileLogDevice::init( bool ) {}
+void KDAsyncLogDevice::init( bool ) {
+    d->writer.start();
+}
 
 /*!
-  Destructor. Closes the associated file.
+  Destructor. Writes all entries that are still queued to the target
+  device, stops the writer thread and deletes the target device.
 */
-KDFileLogDevice::~KDFileLogDevice() {}
+KDAsyncLogDevice::~KDAsyncLogDevice() {
+    {
+        QMutexLocker locker( &d->mutex );
+        kdtools::atomicStoreRelease( d->stopRequested, 1 );
+        d->dataAvailable.wakeAll();
+    }
+    d->writer.wait();
+    delete d->target; d->target = 0;
+}
 
 /*!
-  Reimplemented from \ref KDLogDevice
- */
-void KDFileLogDevice::doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) {
-    if( !d->file.isOpen() )
-        return;
-
-    const char * const severityString = severity_to_string( severity );
-    // ### error-handle write's...
-    d->file.write( severityString, qstrlen( severityString ) );
-    d->file.write( msg );
-    d->file.write( "\n", 1 );
+  Returns the device the writer thread writes to.
+*/
+KDLogDevice * KDAsyncLogDevice::targetDevice() const {
+    return d->target;
 }
 
 /*!
-  \class KDSignalLogDevice
-  \ingroup kdlog
-  \brief A KDLogDevice that emits signals when a log entry is written to it
+  Returns the number of entries the queue can hold.
 */
+int KDAsyncLogDevice::capacity() const {
+    return d->queue.capacity();
+}
 
 /*!
-  The constructor. Constructs a KDSignalLogDevice object.
+  Sets the overflow policy to \a policy. This function is thread-safe.
+
+  \sa overflowPolicy()
 */
-KDSignalLogDevice::KDSignalLogDevice() : QObject( 0 ) {}
+void KDAsyncLogDevice::setOverflowPolicy( OverflowPolicy policy ) {
+    kdtools::atomicStoreRelease( d->policy, policy );
+}
 
 /*!
-  Destructor
-*/
-KDSignalLogDevice::~KDSignalLogDevice() {}
+  Returns the current overflow policy. The default is Block.
 
-void KDSignalLogDevice::init( bool ) {}
+  \sa setOverflowPolicy()
+*/
+KDAsyncLogDevice::OverflowPolicy KDAsyncLogDevice::overflowPolicy() const {
+    return static_cast<OverflowPolicy>( kdtools::atomicLoadAcquire( d->policy ) );
+}
 
 /*!
-  Reimplemented from \ref KDLogDevice
- */
-void KDSignalLogDevice::log( KDLog::Severity severity, const QString & msg ) {
-    switch ( severity ) {
-    case KDLog::Info:
-        emit info( msg );
-        break;
-    case KDLog::Debug:
-        emit debug( msg );
-        break;
-    case KDLog::Warning:
-        emit warning( msg );
-        break;
-    case KDLog::Error:
-        emit error( msg );
-        break;
-    }
+  Returns the number of entries discarded so far because the queue
+  was full.
+*/
+int KDAsyncLogDevice::droppedCount() const {
+    return kdtools::atomicLoadAcquire( d->dropped );
 }
 
-
 /*!
-  \fn void KDSignalLogDevice::info( const QString & msg )
+  Waits until all entries queued before the call have been handed to
+  the target device (or were discarded, see overflowPolicy()), but at
+  most \a msecs milliseconds; a negative value waits forever.
 
-  This signal is emitted when a log message at severity Info is sent
-  to this device.
+  Returns \c true if all entries were processed, \c false on timeout,
+  and when called from the writer thread itself, which would
+  deadlock.
 */
-
+bool KDAsyncLogDevice::flush( int msecs ) {
+    if ( QThread::currentThread() == &d->writer )
+        return false;
+
+    const int ticket = d->queue.enqueuePosition();
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutexLocker locker( &d->mutex );
+    d->waiters.ref();
+    while ( !d->isCompleted( ticket ) && ( msecs < 0 || timer.elapsed() < msecs ) )
+        d->progress.wait( &d->mutex, Private::WaitSlice );
+    d->waiters.deref();
+    return d->isCompleted( ticket );
+}
+
+/*!
+  Reimplemented from \ref KDLogDevice. Queues \a msg for the writer
+  thread. This function is thread-safe.
+*/
+void KDAsyncLogDevice::log( KDLog::Severity severity, const QString & msg ) {
+    if ( d->target && !d->target->isSeverityEnabled( severity ) )
+        return;
+    if ( !d->queue.tryPush( severity, msg ) )
+        switch ( overflowPolicy() ) {
+        case Block:
+            // the target logging back into us would wait for itself:
+            if ( QThread::currentThread() == &d->writer ) {
+                d->pushDroppingOldest( severity, msg );
+                break;
+            }
+            d->pushBlocking( severity, msg );
+            break;
+        case DropOldest:
+            d->pushDroppingOldest( severity, msg );
+            break;
+        case DropNewest:
+            d->dropped.ref();
+            return;
+        }
+    d->wakeWriter();
+}
+
+
+//
+// KDThreadLocalLogDevice
+//
+
+namespace {
+
+    struct StagedRecord {
+        StagedRecord() : severity( KDLog::Info ), timestamp( 0 ), sequence( 0 ), origin( 0 ), message() {}
+        KDLog::Severity severity;
+        qint64 timestamp;
+        int sequence;
+        int origin; // set by the writer: index of the buffer in its snapshot
+        QString message;
+    };
+
+    // Single-producer/single-consumer ring owned by one logging
+    // thread. Records carry the thread's sequence number, which
+    // counts dropped records, too. Only that thread writes tail and the counters, only the
+    // writer thread writes head and bytesWritten, so producers never
+    // contend with each other, and only share cache lines with the
+    // writer.
+    class ThreadBuffer {
+        Q_DISABLE_COPY( ThreadBuffer )
+    public:
+        // capacity must be a power of two
+        ThreadBuffer( int id_, int capacity )
+            : id( id_ ),
+              threadId( QThread::currentThreadId() ),
+              mask( capacity - 1 ),
+              records( new StagedRecord[mask+1] ),
+              head( 0 ),
+              tail( 0 ),
+              produced( 0 ),
+              dropped( 0 ),
+              finished( 0 ),
+              orphaned( 0 ),
+              bytesWritten( 0 ),
+              refs( 2 ) // the device's and the thread's
+        {
+        }
+        ~ThreadBuffer() { delete[] records; }
+
+        static void release( ThreadBuffer * buffer ) {
+            if ( !buffer->refs.deref() )
+                delete buffer;
+        }
+
+        int capacity() const { return mask + 1; }
+
+        // producer side:
+
+        bool tryPush( KDLog::Severity severity, qint64 timestamp, const QString & msg ) {
+            const int t = kdtools::atomicLoadRelaxed( tail );
+            if ( kdtools::wrappingDifference( t, kdtools::atomicLoadAcquire( head ) ) > mask )
+                return false;
+            StagedRecord & r = records[t & mask];
+            r.severity = severity;
+            r.timestamp = timestamp;
+            r.sequence = kdtools::atomicLoadRelaxed( produced );
+            r.message = msg;
+            // full barrier: pairs with the writer announcing that it
+            // goes to sleep, see KDThreadLocalLogDevice::Private::drain()
+            tail.fetchAndStoreOrdered( kdtools::wrappingAdd( t, 1 ) );
+            kdtools::atomicStoreRelaxed( produced, kdtools::wrappingAdd( r.sequence, 1 ) );
+            return true;
+        }
+
+        void countDropped() {
+            kdtools::atomicStoreRelaxed( dropped, kdtools::wrappingAdd( kdtools::atomicLoadRelaxed( dropped ), 1 ) );
+        }
+
+        // consumer side:
+
+        int take( QVector<StagedRecord> & out, int origin, int max ) {
+            const int h = kdtools::atomicLoadRelaxed( head );
+            const int n = qMin( kdtools::wrappingDifference( kdtools::atomicLoadAcquire( tail ), h ), max );
+            for ( int i = 0 ; i < n ; ++i ) {
+                StagedRecord & r = records[kdtools::wrappingAdd( h, i ) & mask];
+                out.push_back( r );
+                out.back().origin = origin;
+                out.back().message.swap( r.message );
+                r.message.clear();
+            }
+            if ( n )
+                kdtools::atomicStoreRelease( head, kdtools::wrappingAdd( h, n ) );
+            return n;
+        }
+
+        int consumedPosition() const { return kdtools::atomicLoadAcquire( head ); }
+        int producedPosition() const { return kdtools::atomicLoadAcquire( tail ); }
+
+        bool isEmpty() const { return consumedPosition() == producedPosition(); }
+
+        static int roundUpToPowerOfTwo( int n ) {
+            int result = 2;
+            while ( result < n && result < ( 1 << 30 ) )
+                result <<= 1;
+            return result;
+        }
+
+    public:
+        const int id;
+        const Qt::HANDLE threadId;
+    private:
+        const int mask;
+        StagedRecord * const records;
+        QAtomicInt head;
+        QAtomicInt tail;
+    public:
+        QAtomicInt produced;
+        QAtomicInt dropped;
+        QAtomicInt finished; // the thread has exited
+        QAtomicInt orphaned; // the device has been destroyed
+        qint64 bytesWritten; // guarded by KDThreadLocalLogDevice::Private::mutex
+    private:
+        QAtomicInt refs;
+    };
+
+    // The buffers of one thread, by device id. This is a single
+    // process-wide QThreadStorage rather than one per device: Qt
+    // reuses the slot of a destroyed QThreadStorage without clearing
+    // the other threads' data in it, so a new device would find the
+    // buffers of an old one. Device ids are never reused.
+    //
+    // Sits in QThreadStorage, so it is deleted when its thread exits.
+    // A buffer is shared between the thread and the device, and
+    // deleted by whichever lets go of it last.
+    class ThreadBuffers {
+        Q_DISABLE_COPY( ThreadBuffers )
+    public:
+        ThreadBuffers() : buffers() {}
+        ~ThreadBuffers() {
+            Q_FOREACH( ThreadBuffer * buffer, buffers ) {
+                kdtools::atomicStoreRelease( buffer->finished, 1 );
+                ThreadBuffer::release( buffer );
+            }
+        }
+
+        ThreadBuffer * find( int device ) const {
+            return buffers.value( device, 0 );
+        }
+
+        void insert( int device, ThreadBuffer * buffer ) {
+            pruneOrphans();
+            buffers.insert( device, buffer );
+        }
+
+        void remove( int device ) {
+            if ( ThreadBuffer * buffer = buffers.take( device ) )
+                ThreadBuffer::release( buffer );
+        }
+
+    private:
+        // Buffers of destroyed devices linger until the thread exits
+        // or starts logging to another device.
+        void pruneOrphans() {
+            for ( QHash<int,ThreadBuffer*>::iterator it = buffers.begin() ; it != buffers.end() ; )
+                if ( kdtools::atomicLoadAcquire( ( *it )->orphaned ) ) {
+                    ThreadBuffer::release( *it );
+                    it = buffers.erase( it );
+                } else {
+                    ++it;
+                }
+        }
+
+    private:
+        QHash<int,ThreadBuffer*> buffers;
+    };
+
+    Q_GLOBAL_STATIC( QThreadStorage<ThreadBuffers*>, threadBuffers )
+
+    static QBasicAtomicInt nextThreadLocalLogDeviceId = Q_BASIC_ATOMIC_INITIALIZER( 0 );
+
+    struct StagedRecordOrder {
+        bool operator()( const StagedRecord & lhs, const StagedRecord & rhs ) const {
+            if ( lhs.timestamp != rhs.timestamp )
+                return lhs.timestamp < rhs.timestamp;
+            if ( lhs.origin != rhs.origin )
+                return lhs.origin < rhs.origin;
+            return kdtools::wrappingDifference( lhs.sequence, rhs.sequence ) < 0;
+        }
+    };
+
+} // anon namespace
+
+/*!
+  \class KDThreadLocalLogDevice
+  \ingroup kdlog
+  \brief A KDLogDevice that stages log entries in per-thread buffers.
+  \since_c 2.3
+
+  Like KDAsyncLogDevice, KDThreadLocalLogDevice may be used from any
+  number of threads at the same time, and hands entries to its
+  targetDevice() from a single background writer thread. The
+  difference is where entries wait: KDAsyncLogDevice has one queue
+  that all logging threads push into, while KDThreadLocalLogDevice
+  gives every logging thread a ring buffer of its own. Logging threads
+  thus never touch the same memory, which lets throughput grow with
+  the number of threads when many of them log heavily.
+
+  Each entry is stamped with a monotonic timestamp and a per-thread
+  sequence number. The writer collects what is staged in all buffers
+  and passes it on ordered by timestamp. Entries from one thread
+  always arrive in the order they were logged; entries from different
+  threads are ordered by timestamp within each batch the writer
+  collects, but a thread that is preempted between taking the
+  timestamp and publishing the entry may see it written after
+  entries with later timestamps. Use KDAsyncLogDevice if a strict
+  total order matters more than scalability.
+
+  threadStatistics() reports how many entries each thread produced,
+  how many had to be discarded because its buffer was full (see
+  overflowPolicy()), and how many bytes of message text were written
+  on its behalf. The buffer of a thread that has finished is released
+  once it has been drained; its statistics are then added to a
+  summary entry.
+*/
+
+/*!
+  \enum KDThreadLocalLogDevice::OverflowPolicy
+
+  Specifies what log() does when the calling thread's buffer is full.
+
+  \var KDThreadLocalLogDevice::Block
+  Wait until the writer thread has made room in the buffer.
+
+  \var KDThreadLocalLogDevice::DropNewest
+  Discard the new entry.
+*/
+
+/*!
+  \struct KDThreadLocalLogDevice::ThreadStatistics
+  \brief Counters for one logging thread.
+
+  \a threadId is the QThread::currentThreadId() of the thread, or 0
+  for the summary of all threads that have finished, which has \a
+  finished set. \a produced counts the entries the thread logged,
+  including the \a dropped ones. \a bytesWritten is the size of the
+  message text (as UTF-16) handed to the target device.
+*/
+
+class KDThreadLocalLogDevice::Private : public KDLogDevice::Private {
+    friend class ::KDThreadLocalLogDevice;
+public:
+    Private( KDLogDevice * t, int capacity, OverflowPolicy p )
+        : KDLogDevice::Private(),
+          target( t ),
+          capacityPerThread( ThreadBuffer::roundUpToPowerOfTwo( capacity ) ),
+          policy( p ),
+          clock(),
+          id( nextThreadLocalLogDeviceId.fetchAndAddRelaxed( 1 ) ),
+          buffers(),
+          nextId( 0 ),
+          finishedStatistics(),
+          waiters( 0 ),
+          writerSleeping( 0 ),
+          stopRequested( 0 ),
+          mutex(),
+          dataAvailable(),
+          progress(),
+          writer( this )
+    {
+        finishedStatistics.finished = true;
+        clock.start();
+    }
+
+    ~Private() {
+        Q_FOREACH( ThreadBuffer * buffer, buffers ) {
+            kdtools::atomicStoreRelease( buffer->orphaned, 1 );
+            ThreadBuffer::release( buffer );
+        }
+    }
+
+private:
+    class Writer : public QThread {
+    public:
+        explicit Writer( Private * p ) : QThread(), priv( p ) {}
+    protected:
+        void run() KDAB_OVERRIDE { priv->drain(); }
+    private:
+        Private * const priv;
+    };
+
+    enum {
+        BatchSizePerThread = 256,
+        IdleTimeout = 250,  // ms; only a safety net, the writer is woken explicitly
+        WaitSlice = 10      // ms; ditto for blocked producers and flush()
+    };
+
+    ThreadBuffer * localBuffer() {
+        QThreadStorage<ThreadBuffers*> * const storage = threadBuffers();
+        ThreadBuffers * local = storage->localData();
+        if ( !local ) {
+            local = new ThreadBuffers;
+            storage->setLocalData( local );
+        } else if ( ThreadBuffer * buffer = local->find( id ) ) {
+            return buffer;
+        }
+        QMutexLocker locker( &mutex );
+        ThreadBuffer * const buffer = new ThreadBuffer( nextId++, capacityPerThread );
+        buffers.push_back( buffer );
+        local->insert( id, buffer );
+        return buffer;
+    }
+
+    void wakeWriter() {
+        if ( !kdtools::atomicLoadAcquire( writerSleeping ) )
+            return;
+        QMutexLocker locker( &mutex );
+        dataAvailable.wakeOne();
+    }
+
+    bool allEmpty() const {
+        Q_FOREACH( const ThreadBuffer * buffer, buffers )
+            if ( !buffer->isEmpty() )
+                return false;
+        return true;
+    }
+
+    static ThreadStatistics statistics( const ThreadBuffer * buffer ) {
+        ThreadStatistics s;
+        s.threadId = buffer->threadId;
+        s.produced = kdtools::atomicLoadAcquire( buffer->produced );
+        s.dropped = kdtools::atomicLoadAcquire( buffer->dropped );
+        s.bytesWritten = buffer->bytesWritten;
+        s.finished = kdtools::atomicLoadAcquire( buffer->finished );
+        return s;
+    }
+
+    // called with mutex locked
+    void releaseFinishedBuffers() {
+        for ( int i = buffers.size() - 1 ; i >= 0 ; --i ) {
+            ThreadBuffer * const buffer = buffers[i];
+            if ( !kdtools::atomicLoadAcquire( buffer->finished ) || !buffer->isEmpty() )
+                continue;
+            const ThreadStatistics s = statistics( buffer );
+            finishedStatistics.produced += s.produced;
+            finishedStatistics.dropped += s.dropped;
+            finishedStatistics.bytesWritten += s.bytesWritten;
+            buffers.removeAt( i );
+            ThreadBuffer::release( buffer );
+        }
+    }
+
+    void drain() {
+        QVector<StagedRecord> batch;
+        QList<ThreadBuffer*> snapshot;
+        QVector<qint64> bytes;
+        for ( ;; ) {
+            {
+                QMutexLocker locker( &mutex );
+                snapshot = buffers;
+            }
+
+            batch.clear();
+            for ( int i = 0 ; i < snapshot.size() ; ++i )
+                snapshot[i]->take( batch, i, BatchSizePerThread );
+
+            if ( !batch.isEmpty() ) {
+                // timestamps never decrease within one thread, so this
+                // keeps each thread's records in the order they were logged:
+                std::sort( batch.begin(), batch.end(), StagedRecordOrder() );
+                bytes.fill( 0, snapshot.size() );
+                for ( QVector<StagedRecord>::iterator it = batch.begin(), end = batch.end() ; it != end ; ++it ) {
+                    if ( target )
+                        target->log( it->severity, it->message );
+                    bytes[it->origin] += it->message.size() * sizeof( QChar );
+                    it->message.clear();
+                }
+
+                QMutexLocker locker( &mutex );
+                for ( int i = 0 ; i < snapshot.size() ; ++i )
+                    snapshot[i]->bytesWritten += bytes[i];
+                releaseFinishedBuffers();
+                if ( kdtools::atomicLoadAcquire( waiters ) )
+                    progress.wakeAll();
+                continue;
+            }
+
+            QMutexLocker locker( &mutex );
+            releaseFinishedBuffers();
+            // full barrier: pairs with the one in ThreadBuffer::tryPush()
+            writerSleeping.fetchAndStoreOrdered( 1 );
+            if ( allEmpty() ) {
+                if ( kdtools::atomicLoadAcquire( stopRequested ) ) {
+                    writerSleeping.fetchAndStoreOrdered( 0 );
+                    return;
+                }
+                dataAvailable.wait( &mutex, IdleTimeout );
+            }
+            writerSleeping.fetchAndStoreOrdered( 0 );
+        }
+    }
+
+    void pushBlocking( ThreadBuffer * buffer, KDLog::Severity severity, qint64 timestamp, const QString & msg ) {
+        QMutexLocker locker( &mutex );
+        waiters.ref();
+        while ( !buffer->tryPush( severity, timestamp, msg ) )
+            progress.wait( &mutex, WaitSlice );
+        waiters.deref();
+    }
+
+    // called with mutex locked
+    bool isConsumed( int id, int position ) const {
+        Q_FOREACH( const ThreadBuffer * buffer, buffers )
+            if ( buffer->id == id )
+                return kdtools::wrappingDifference( buffer->consumedPosition(), position ) >= 0;
+        return true; // released, so it was drained
+    }
+
+private:
+    KDLogDevice * target;
+    const int capacityPerThread;
+    QAtomicInt policy;
+    QElapsedTimer clock;
+    const int id;
+    QList<ThreadBuffer*> buffers;          // guarded by mutex
+    int nextId;                            // ditto
+    ThreadStatistics finishedStatistics;   // ditto
+    QAtomicInt waiters;
+    QAtomicInt writerSleeping;
+    QAtomicInt stopRequested;
+    mutable QMutex mutex;
+    QWaitCondition dataAvailable;
+    QWaitCondition progress;
+    Writer writer;
+};
+
+/*!
+  Constructor. Creates a KDThreadLocalLogDevice that forwards to \a
+  target and starts its writer thread.
+
+  \a capacityPerThread is the number of entries each logging thread's
+  buffer can hold; it is rounded up to the next power of two. \a
+  policy is the initial overflowPolicy().
+
+  \note The KDLogDevice must be allocated on the heap, as
+  KDThreadLocalLogDevice takes ownership of it.
+*/
+KDThreadLocalLogDevice::KDThreadLocalLogDevice( KDLogDevice * target, int capacityPerThread, OverflowPolicy policy )
+    : KDLogDevice( new Private( target, capacityPerThread, policy ), false )
+{
+    init( false );
+}
+
+void KDThreadLocalLogDevice::init( bool ) {
+    d->writer.start();
+}
+
+/*!
+  Destructor. Writes all entries that are still staged to the target
+  device, stops the writer thread and deletes the target device.
+
+  No other thread may still be logging to this device.
+*/
+KDThreadLocalLogDevice::~KDThreadLocalLogDevice() {
+    {
+        QMutexLocker locker( &d->mutex );
+        kdtools::atomicStoreRelease( d->stopRequested, 1 );
+        d->dataAvailable.wakeAll();
+    }
+    d->writer.wait();
+    if ( QThreadStorage<ThreadBuffers*> * const storage = threadBuffers() )
+        if ( ThreadBuffers * const local = storage->localData() )
+            local->remove( d->id );
+    delete d->target; d->target = 0;
+}
+
+/*!
+  Returns the device the writer thread writes to.
+*/
+KDLogDevice * KDThreadLocalLogDevice::targetDevice() const {
+    return d->target;
+}
+
+/*!
+  Returns the number of entries each thread's buffer can hold.
+*/
+int KDThreadLocalLogDevice::capacityPerThread() const {
+    return d->capacityPerThread;
+}
+
+/*!
+  Sets the overflow policy to \a policy. This function is thread-safe.
+
+  \sa overflowPolicy()
+*/
+void KDThreadLocalLogDevice::setOverflowPolicy( OverflowPolicy policy ) {
+    kdtools::atomicStoreRelease( d->policy, policy );
+}
+
+/*!
+  Returns the current overflow policy. The default is Block.
+
+  \sa setOverflowPolicy()
+*/
+KDThreadLocalLogDevice::OverflowPolicy KDThreadLocalLogDevice::overflowPolicy() const {
+    return static_cast<OverflowPolicy>( kdtools::atomicLoadAcquire( d->policy ) );
+}
+
+/*!
+  Returns the counters of each thread that has logged to this device
+  and whose buffer is still around, followed by one entry summing up
+  all threads that have finished. This function is thread-safe.
+
+  The counters are updated without synchronisation between them, so
+  while threads are logging, the values are a close, but not
+  necessarily consistent, snapshot.
+*/
+QList<KDThreadLocalLogDevice::ThreadStatistics> KDThreadLocalLogDevice::threadStatistics() const {
+    QList<ThreadStatistics> result;
+    QMutexLocker locker( &d->mutex );
+    Q_FOREACH( const ThreadBuffer * buffer, d->buffers )
+        result.push_back( Private::statistics( buffer ) );
+    result.push_back( d->finishedStatistics );
+    return result;
+}
+
+/*!
+  Waits until all entries staged by any thread before the call have
+  been handed to the target device, but at most \a msecs
+  milliseconds; a negative value waits forever.
+
+  Returns \c true if all entries were processed, \c false on timeout,
+  and when called from the writer thread itself, which would
+  deadlock.
+*/
+bool KDThreadLocalLogDevice::flush( int msecs ) {
+    if ( QThread::currentThread() == &d->writer )
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutexLocker locker( &d->mutex );
+    QVector< QPair<int,int> > tickets;
+    Q_FOREACH( const ThreadBuffer * buffer, d->buffers )
+        tickets.push_back( qMakePair( buffer->id, buffer->producedPosition() ) );
+
+    d->waiters.ref();
+    for ( int i = 0 ; i < tickets.size() ; ) {
+        if ( d->isConsumed( tickets[i].first, tickets[i].second ) )
+            ++i;
+        else if ( msecs < 0 || timer.elapsed() < msecs )
+            d->progress.wait( &d->mutex, Private::WaitSlice );
+        else
+            break;
+    }
+    d->waiters.deref();
+
+    for ( int i = 0 ; i < tickets.size() ; ++i )
+        if ( !d->isConsumed( tickets[i].first, tickets[i].second ) )
+            return false;
+    return true;
+}
+
+/*!
+  Reimplemented from \ref KDLogDevice. Stages \a msg in the calling
+  thread's buffer. This function is thread-safe.
+*/
+void KDThreadLocalLogDevice::log( KDLog::Severity severity, const QString & msg ) {
+    if ( d->target && !d->target->isSeverityEnabled( severity ) )
+        return;
+    ThreadBuffer * const buffer = d->localBuffer();
+    const qint64 timestamp = d->clock.nsecsElapsed();
+    if ( !buffer->tryPush( severity, timestamp, msg ) ) {
+        if ( overflowPolicy() == DropNewest ) {
+            buffer->countDropped();
+            kdtools::atomicStoreRelaxed( buffer->produced, kdtools::wrappingAdd( kdtools::atomicLoadRelaxed( buffer->produced ), 1 ) );
+            return;
+        }
+        d->wakeWriter();
+        d->pushBlocking( buffer, severity, timestamp, msg );
+    }
+    d->wakeWriter();
+}
+
+//
+// KDFileLogDevice
+//
+
+
+/*!
+  \class KDFileLogDevice
+  \ingroup kdlog
+  \brief A KDLogDevice that outputs to a file.
+*/
+
+class KDFileLogDevice::Private : public KDEncodingLogDevice::Private {
+    friend class ::KDFileLogDevice;
+public:
+    explicit Private( const QString & filename, QIODevice::OpenMode mode, const QTextCodec * c )
+        : KDEncodingLogDevice::Private( c ), file( filename ), buffer()
+    {
+        mode &= QIODevice::Append|QIODevice::Truncate|QIODevice::Text;
+        mode |= QIODevice::WriteOnly;
+
+        if ( !file.open( mode ) )
+            fprintf( stderr, "KDFileLogDevice: Unable to open logfile %s: %s\n",
+                     qPrintable( file.fileName() ), qPrintable( file.errorString() ) );
+    }
+
+public:
+    QFile file;
+    KDLogWriteBuffer buffer;
+};
+
+/*!
+  Constructor.
+  \param filename The name of the file that the log is written to
+  \param deleteFile If true, the file is deleted before writing the
+  first logentry. The default is to append to the file if it already
+  exists.
+ */
+KDFileLogDevice::KDFileLogDevice( const QString& fileName, QIODevice::OpenMode mode )
+    : KDEncodingLogDevice( new Private( fileName, mode, QTextCodec::codecForLocale() ), false )
+{
+    init( false );
+}
+
+KDFileLogDevice::KDFileLogDevice( const QString & fileName, const QTextCodec * codec, QIODevice::OpenMode mode )
+    : KDEncodingLogDevice( new Private( fileName, mode, codec ), false )
+{
+    init( false );
+}
+
+void KDFileLogDevice::init( bool ) {}
+
+/*!
+  Destructor. Writes out buffered entries and closes the associated
+  file.
+*/
+KDFileLogDevice::~KDFileLogDevice() {
+    flush();
+}
+
+/*!
+  Sets the number of bytes to collect before writing them out in one
+  go to \a size. The default is 0, which hands each entry to the file
+  immediately.
+
+  \sa \ref kdlog-write-buffering
+*/
+void KDFileLogDevice::setBufferSize( int size ) {
+    if ( size <= 0 )
+        flush();
+    d->buffer.capacity = qMax( size, 0 );
+}
+
+int KDFileLogDevice::bufferSize() const {
+    return d->buffer.capacity;
+}
+
+/*!
+  Sets the age, in milliseconds, after which buffered entries are
+  written out to \a msecs. A negative value (the default) disables
+  the age limit.
+
+  \sa \ref kdlog-write-buffering
+*/
+void KDFileLogDevice::setFlushInterval( int msecs ) {
+    d->buffer.interval = msecs;
+}
+
+int KDFileLogDevice::flushInterval() const {
+    return d->buffer.interval;
+}
+
+/*!
+  Sets the severity from which on entries, and all buffered entries
+  before them, are written out immediately to \a severity. The
+  default is KDLog::Error.
+
+  \sa \ref kdlog-write-buffering
+*/
+void KDFileLogDevice::setFlushSeverity( KDLog::Severity severity ) {
+    d->buffer.flushSeverity = severity;
+}
+
+KDLog::Severity KDFileLogDevice::flushSeverity() const {
+    return d->buffer.flushSeverity;
+}
+
+/*!
+  Writes out all buffered entries. Returns \c false if that failed.
+
+  \sa \ref kdlog-write-buffering
+*/
+bool KDFileLogDevice::flush() {
+    if ( !d->file.isOpen() )
+        return false;
+    // all writes go through QFile, so its buffer, position and
+    // QIODevice::Text handling stay consistent with the file:
+    const QByteArray data = d->buffer.takeAll();
+    return d->file.write( data ) == data.size() && d->file.flush();
+}
+
+/*!
+  Reimplemented from \ref KDLogDevice
+ */
+void KDFileLogDevice::doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) {
+    if( !d->file.isOpen() )
+        return;
+
+    if ( d->buffer.isEnabled() ) {
+        if ( d->buffer.append( severity, severity_to_string( severity ), msg ) )
+            flush();
+        return;
+    }
+
+    const char * const severityString = severity_to_string( severity );
+    // ### error-handle write's...
+    d->file.write( severityString, qstrlen( severityString ) );
+    d->file.write( msg );
+    d->file.write( "\n", 1 );
+}
+
+//
+// KDRotatingFileLogDevice
+//
+
+namespace {
+
+    class Crc32 {
+    public:
+        Crc32() {
+            for ( quint32 i = 0 ; i < 256 ; ++i ) {
+                quint32 c = i;
+                for ( int k = 0 ; k < 8 ; ++k )
+                    c = ( c & 1 ) ? 0xEDB88320U ^ ( c >> 1 ) : c >> 1 ;
+                table[i] = c;
+            }
+        }
+
+        quint32 operator()( const QByteArray & data ) const {
+            quint32 crc = 0xFFFFFFFFU;
+            const uchar * const p = reinterpret_cast<const uchar*>( data.constData() );
+            for ( int i = 0, end = data.size() ; i < end ; ++i )
+                crc = table[( crc ^ p[i] ) & 0xFF] ^ ( crc >> 8 );
+            return crc ^ 0xFFFFFFFFU;
+        }
+
+    private:
+        quint32 table[256];
+    };
+
+    // qCompress() returns a zlib stream behind a 4-byte length
+    // prefix. Without the prefix, the 2-byte zlib header and the
+    // 4-byte Adler-32 trailer, that's raw deflate data, which only
+    // needs a gzip header and trailer to be a complete gzip member.
+    bool writeGzipMember( QIODevice & file, const QByteArray & data, const Crc32 & crc32 ) {
+        const QByteArray z = qCompress( data );
+        if ( z.size() < 4 + 2 + 4 )
+            return false;
+
+        static const char header[10] = { '\x1f', '\x8b', 8 /*deflate*/, 0, 0, 0, 0, 0, 0, '\xff' /*unknown OS*/ };
+        uchar trailer[8];
+        qToLittleEndian<quint32>( crc32( data ), trailer );
+        qToLittleEndian<quint32>( data.size(), trailer + 4 );
+
+        return file.write( header, sizeof header ) == int( sizeof header )
+            && file.write( z.constData() + 6, z.size() - 10 ) == z.size() - 10
+            && file.write( reinterpret_cast<const char*>( trailer ), sizeof trailer ) == int( sizeof trailer );
+    }
+
+    enum { GzipChunkSize = 1024 * 1024 };
+
+    // gzip and zcat decompress consecutive members as one stream, so
+    // compressing chunk by chunk keeps memory use bounded regardless
+    // of the size of the generation, at a small cost in ratio.
+    bool writeGzipFile( const QString & filename, QIODevice & in ) {
+        const Crc32 crc32;
+        KDSaveFile file( filename );
+        if ( !file.open( QIODevice::WriteOnly ) )
+            return false;
+        do {
+            const QByteArray chunk = in.read( GzipChunkSize );
+            if ( chunk.isEmpty() && !in.atEnd() )
+                return false;
+            if ( !writeGzipMember( file, chunk, crc32 ) )
+                return false;
+        } while ( !in.atEnd() );
+        return file.commit( KDSaveFile::OverwriteExistingFile );
+    }
+
+    // Returns the first rotation boundary after \a now, or an invalid
+    // QDateTime for NoRotationInterval.
+    QDateTime nextRotationBoundary( const QDateTime & now, KDRotatingFileLogDevice::RotationInterval interval ) {
+        const QTime midnight( 0, 0 );
+        switch ( interval ) {
+        case KDRotatingFileLogDevice::NoRotationInterval:
+            break;
+        case KDRotatingFileLogDevice::Hourly:
+            return QDateTime( now.date(), QTime( now.time().hour(), 0 ) ).addSecs( 60 * 60 );
+        case KDRotatingFileLogDevice::Daily:
+            return QDateTime( now.date().addDays( 1 ), midnight );
+        case KDRotatingFileLogDevice::Weekly:
+            return QDateTime( now.date().addDays( 8 - now.date().dayOfWeek() ), midnight );
+        }
+        return QDateTime();
+    }
+
+    QString generationName( const QString & filename, int generation, bool compressed ) {
+        QString result = filename + QLatin1Char( '.' ) + QString::number( generation );
+        if ( compressed )
+            result += QLatin1String( ".gz" );
+        return result;
+    }
+
+    // Shifts the closed generations up by one, and turns the file
+    // that was just rotated out into generation 1. Runs in the
+    // device's background thread, so neither the (possibly slow)
+    // compression nor the renames block the logging thread.
+    class RotationJob : public QRunnable {
+    public:
+        RotationJob( const QString & fn, const QString & p, int g, bool c )
+            : QRunnable(), filename( fn ), pending( p ), generations( g ), compress( c ) {}
+
+        void run() KDAB_OVERRIDE {
+            if ( generations <= 0 ) {
+                QFile::remove( pending );
+                return;
+            }
+
+            for ( int i = generations ; i >= 1 ; --i )
+                for ( int c = 0 ; c < 2 ; ++c ) {
+                    const QString name = generationName( filename, i, c );
+                    if ( !QFile::exists( name ) )
+                        continue;
+                    if ( i == generations ) {
+                        QFile::remove( name );
+                    } else {
+                        const QString next = generationName( filename, i + 1, c );
+                        QFile::remove( next );
+                        QFile::rename( name, next );
+                    }
+                }
+
+            if ( compress ) {
+                QFile in( pending );
+                if ( in.open( QIODevice::ReadOnly ) && writeGzipFile( generationName( filename, 1, true ), in ) ) {
+                    in.remove();
+                    return;
+                }
+                // fall back to keeping it uncompressed
+            }
+            QFile::rename( pending, generationName( filename, 1, false ) );
+        }
+
+    private:
+        const QString filename;
+        const QString pending;
+        const int generations;
+        const bool compress;
+    };
+
+} // anon namespace
+
+/*!
+  \class KDRotatingFileLogDevice
+  \ingroup kdlog
+  \brief A KDLogDevice that outputs to a file which is rotated when it gets too large or too old.
+  \since_c 2.3
+
+  KDRotatingFileLogDevice writes to a file just like KDFileLogDevice,
+  but it starts a fresh file when the current one exceeds
+  maximumFileSize(), or when a rotationInterval() boundary (the full
+  hour, midnight, Monday midnight) is crossed. Since the device
+  rotates the file itself, no log lines are lost, as can happen with
+  external rotation using \c copytruncate.
+
+  The closed files are kept as generations \c filename.1 (the newest)
+  up to \c filename.N, where N is maximumGenerations(). If
+  isCompressionEnabled(), they are gzip-compressed (\c filename.1.gz,
+  ...). Renaming the generations and compressing is done in a
+  background thread, so the logging thread only ever pays for closing
+  and reopening the file. Compression works on one megabyte at a
+  time, each chunk becoming a gzip member of its own, which gzip and
+  zcat decompress as one stream.
+
+  If the current file cannot be renamed for rotation, logging
+  continues into it, and the next attempt is made after another
+  maximumFileSize() bytes, or at the next rotationInterval() boundary.
+
+  Like KDFileLogDevice, this class is not thread-safe; wrap it in a
+  KDAsyncLogDevice to log from several threads.
+*/
+
+/*!
+  \enum KDRotatingFileLogDevice::RotationInterval
+
+  Specifies at which wall-clock boundaries the file is rotated, in
+  addition to rotation by size.
+
+  \var KDRotatingFileLogDevice::NoRotationInterval
+  Only rotate by size.
+
+  \var KDRotatingFileLogDevice::Hourly
+  Rotate at every full hour.
+
+  \var KDRotatingFileLogDevice::Daily
+  Rotate at midnight.
+
+  \var KDRotatingFileLogDevice::Weekly
+  Rotate at midnight between Sunday and Monday.
+*/
+
+class KDRotatingFileLogDevice::Private : public KDEncodingLogDevice::Private {
+    friend class ::KDRotatingFileLogDevice;
+public:
+    Private( const QString & filename, const QTextCodec * c )
+        : KDEncodingLogDevice::Private( c ),
+          file( filename ),
+          size( 0 ),
+          maximumSize( 10 * 1024 * 1024 ),
+          interval( NoRotationInterval ),
+          msecsToBoundary( -1 ),
+          sinceOpen(),
+          generations( 5 ),
+          compress( true ),
+          rotations( 0 ),
+          pool()
+    {
+        // one thread, so that rotations are processed strictly in order:
+        pool.setMaxThreadCount( 1 );
+        open();
+    }
+
+private:
+    void open() {
+        sinceOpen.start();
+        updateBoundary();
+        if ( !file.open( QIODevice::WriteOnly|QIODevice::Append ) ) {
+            fprintf( stderr, "KDRotatingFileLogDevice: Unable to open logfile %s: %s\n",
+                     qPrintable( file.fileName() ), qPrintable( file.errorString() ) );
+            return;
+        }
+        size = file.size();
+    }
+
+    void updateBoundary() {
+        const QDateTime now = QDateTime::currentDateTime();
+        const QDateTime next = nextRotationBoundary( now, interval );
+        msecsToBoundary = next.isValid() ? sinceOpen.elapsed() + now.msecsTo( next ) : -1 ;
+    }
+
+    bool needsRotation() const {
+        return ( maximumSize > 0 && size >= maximumSize )
+            || ( msecsToBoundary >= 0 && sinceOpen.elapsed() >= msecsToBoundary );
+    }
+
+private:
+    QFile file;
+    qint64 size;
+    qint64 maximumSize;
+    RotationInterval interval;
+    qint64 msecsToBoundary;
+    QElapsedTimer sinceOpen;
+    int generations;
+    bool compress;
+    unsigned int rotations;
+    QThreadPool pool;
+};
+
+/*!
+  Constructor. Opens \a filename for appending, using
+  QTextCodec::codecForLocale() to encode messages.
+
+  By default, the file is rotated when it exceeds 10MiB, and 5
+  compressed generations are kept.
+*/
+KDRotatingFileLogDevice::KDRotatingFileLogDevice( const QString & filename )
+    : KDEncodingLogDevice( new Private( filename, QTextCodec::codecForLocale() ), false )
+{
+    init( false );
+}
+
+/*!
+  \overload
+
+  Uses \a codec to encode messages.
+*/
+KDRotatingFileLogDevice::KDRotatingFileLogDevice( const QString & filename, const QTextCodec * codec )
+    : KDEncodingLogDevice( new Private( filename, codec ), false )
+{
+    init( false );
+}
+
+void KDRotatingFileLogDevice::init( bool ) {}
+
+/*!
+  Destructor. Closes the file and waits for pending rotations to
+  finish.
+*/
+KDRotatingFileLogDevice::~KDRotatingFileLogDevice() {
+    d->file.close();
+    d->pool.waitForDone();
+}
+
+/*!
+  Sets the size, in bytes, after which the file is rotated, to \a
+  size. Zero or a negative value disables rotation by size.
+*/
+void KDRotatingFileLogDevice::setMaximumFileSize( qint64 size ) {
+    d->maximumSize = size;
+}
+
+/*!
+  Returns the size after which the file is rotated.
+*/
+qint64 KDRotatingFileLogDevice::maximumFileSize() const {
+    return d->maximumSize;
+}
+
+/*!
+  Sets the wall-clock interval at which the file is rotated to \a
+  interval. The default is NoRotationInterval.
+*/
+void KDRotatingFileLogDevice::setRotationInterval( RotationInterval interval ) {
+    d->interval = interval;
+    d->updateBoundary();
+}
+
+/*!
+  Returns the wall-clock interval at which the file is rotated.
+*/
+KDRotatingFileLogDevice::RotationInterval KDRotatingFileLogDevice::rotationInterval() const {
+    return d->interval;
+}
+
+/*!
+  Sets the number of closed generations to keep to \a
+  generations. Zero discards the old file on each rotation.
+*/
+void KDRotatingFileLogDevice::setMaximumGenerations( int generations ) {
+    d->generations = qMax( generations, 0 );
+}
+
+/*!
+  Returns the number of closed generations that are kept.
+*/
+int KDRotatingFileLogDevice::maximumGenerations() const {
+    return d->generations;
+}
+
+/*!
+  Sets whether closed generations are gzip-compressed to \a on.
+*/
+void KDRotatingFileLogDevice::setCompressionEnabled( bool on ) {
+    d->compress = on;
+}
+
+/*!
+  Returns whether closed generations are gzip-compressed.
+*/
+bool KDRotatingFileLogDevice::isCompressionEnabled() const {
+    return d->compress;
+}
+
+/*!
+  Rotates the file now. This is done automatically according to
+  maximumFileSize() and rotationInterval().
+
+  The current file is closed, renamed to a temporary name, and
+  replaced by an empty one; shifting the generations and compressing
+  happens in the background.
+
+  \sa waitForPendingRotations()
+*/
+void KDRotatingFileLogDevice::rotate() {
+    const QString filename = d->file.fileName();
+    d->file.close();
+
+    const QString pending = filename + QString::fromLatin1( ".rotating-%1-%2" )
+        .arg( QDateTime::currentDateTime().toString( QLatin1String( "yyyyMMddhhmmsszzz" ) ) )
+        .arg( d->rotations++ );
+    QFile current( filename );
+    if ( current.rename( pending ) ) {
+        d->pool.start( new RotationJob( filename, pending, d->generations, d->compress ) );
+        d->open();
+        return;
+    }
+
+    fprintf( stderr, "KDRotatingFileLogDevice: Unable to rotate logfile %s: %s\n",
+             qPrintable( filename ), qPrintable( current.errorString() ) );
+    d->open();
+    // don't retry on every message; open() restarted the interval,
+    // this restarts the size count:
+    d->size = 0;
+}
+
+/*!
+  Waits until the background thread has finished all rotations, but
+  at most \a msecs milliseconds; a negative value waits forever.
+  Returns \c true if no rotations are pending anymore.
+*/
+bool KDRotatingFileLogDevice::waitForPendingRotations( int msecs ) {
+    return d->pool.waitForDone( msecs );
+}
+
+/*!
+  Reimplemented from \ref KDEncodingLogDevice
+ */
+void KDRotatingFileLogDevice::doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) {
+    if ( d->needsRotation() )
+        rotate();
+    if ( !d->file.isOpen() )
+        return;
+
+    const char * const severityString = severity_to_string( severity );
+    const qint64 length = qstrlen( severityString );
+    // ### error-handle write's...
+    d->file.write( severityString, length );
+    d->file.write( msg );
+    d->file.write( "\n", 1 );
+    d->size += length + msg.size() + 1;
+}
+
+/*!
+  \class KDSignalLogDevice
+  \ingroup kdlog
+  \brief A KDLogDevice that emits signals when a log entry is written to it
+*/
+
+/*!
+  The constructor. Constructs a KDSignalLogDevice object.
+*/
+KDSignalLogDevice::KDSignalLogDevice() : QObject( 0 ) {}
+
+/*!
+  Destructor
+*/
+KDSignalLogDevice::~KDSignalLogDevice() {}
+
+void KDSignalLogDevice::init( bool ) {}
+
+/*!
+  Reimplemented from \ref KDLogDevice
+ */
+void KDSignalLogDevice::log( KDLog::Severity severity, const QString & msg ) {
+    switch ( severity ) {
+    case KDLog::Info:
+        emit info( msg );
+        break;
+    case KDLog::Debug:
+        emit debug( msg );
+        break;
+    case KDLog::Warning:
+        emit warning( msg );
+        break;
+    case KDLog::Error:
+        emit error( msg );
+        break;
+    }
+}
+
+
+/*!
+  \fn void KDSignalLogDevice::info( const QString & msg )
+
+  This signal is emitted when a log message at severity Info is sent
+  to this device.
+*/
+
 
 /*!
   \fn void KDSignalLogDevice::debug( const QString & msg )
@@ -611,10 +2386,78 @@ void KDSignalLogDevice::log( KDLog::Severity severity, const QString & msg ) {
   UNIX. On windows this parameter currently does nothing.
 */
 
+/*!
+  \enum KDSystemLogDevice::SubmissionMode
+
+  How messages reach the system logger on UNIX.
+
+  \var KDSystemLogDevice::SyslogCall
+  Every message is passed to syslog(), which sends it right away and
+  blocks while the logger is busy. This is the default.
+
+  \var KDSystemLogDevice::DirectDatagram
+  The device speaks the syslog datagram protocol (RFC 3164) to the
+  logger's socket (usually \c /dev/log) itself. Messages are sent
+  without blocking, up to batchSize() at a time, using a single
+  sendmmsg() call where available. When the logger cannot take more
+  right now, messages are kept and sent along with the next one
+  (messages of severity KDLog::Error, or on flush()); if more than
+  1024 pile up, the oldest are discarded (see droppedCount()). If the
+  socket cannot be used at all, the device falls back to syslog(),
+  and tries the socket again at most once a second.
+
+  On Windows, the mode is remembered, but has no effect.
+*/
+
 /*!
   \fn KDSystemLogDevice::~KDSystemLogDevice()
 
-  Closes the connection to the system log.
+  Closes the connection to the system log. In DirectDatagram mode,
+  waits up to 100ms for pending messages to be sent, and passes the
+  rest to syslog().
+*/
+
+/*!
+  \fn void KDSystemLogDevice::setSubmissionMode( SubmissionMode mode )
+
+  Sets the submission mode to \a mode. Switching to SyslogCall
+  passes any pending messages to syslog().
+*/
+
+/*!
+  \fn KDSystemLogDevice::SubmissionMode KDSystemLogDevice::submissionMode() const
+
+  Returns the submission mode. The default is SyslogCall.
+*/
+
+/*!
+  \fn void KDSystemLogDevice::setBatchSize( int messages )
+
+  In DirectDatagram mode, collects \a messages messages (at most 64)
+  before sending them together. Messages of severity KDLog::Error are
+  always sent immediately, along with those collected before them.
+  The default is 1.
+*/
+
+/*!
+  \fn int KDSystemLogDevice::batchSize() const
+
+  Returns the number of messages sent together in DirectDatagram mode.
+*/
+
+/*!
+  \fn int KDSystemLogDevice::droppedCount() const
+
+  Returns the number of messages discarded in DirectDatagram mode
+  because the logger could not keep up.
+*/
+
+/*!
+  \fn bool KDSystemLogDevice::flush( int msecs )
+
+  In DirectDatagram mode, sends the pending messages, waiting at most
+  \a msecs milliseconds for the logger to accept them. Returns \c true
+  if nothing is left pending.
 */
 
 /*!
@@ -625,4 +2468,606 @@ void KDSignalLogDevice::log( KDLog::Severity severity, const QString & msg ) {
 
 #undef d
 
+#ifdef KDTOOLSCORE_UNITTESTS
+
+#include <KDUnitTest/Test>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QList>
+#include <QSemaphore>
+#include <QStringList>
+#include <QUuid>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+namespace {
+    class RecordingLogDevice : public KDLogDevice {
+    public:
+        void log( KDLog::Severity severity, const QString & msg ) KDAB_OVERRIDE {
+            severities.push_back( severity & KDLog::LevelMask );
+            messages.push_back( msg );
+        }
+
+        QList<int> severities;
+        QStringList messages;
+    };
+}
+
+namespace {
+    class LoggingThread : public QThread {
+    public:
+        LoggingThread( KDLog * l, int i, int n ) : QThread(), log( l ), index( i ), count( n ) {}
+    protected:
+        void run() KDAB_OVERRIDE {
+            for ( int i = 0 ; i < count ; ++i )
+                log->logInfo( "%d %d", index, i );
+        }
+    private:
+        KDLog * const log;
+        const int index;
+        const int count;
+    };
+}
+
+namespace {
+    // Logs one entry whenever asked to, and keeps running in between,
+    // so it outlives the log devices it logs to.
+    class LongLivedLoggingThread : public QThread {
+    public:
+        LongLivedLoggingThread() : QThread(), log( 0 ), index( 0 ), request( 0 ), done( 0 ) {}
+
+        void logTo( KDLog * l, int i ) {
+            log = l;
+            index = i;
+            request.release();
+            done.acquire();
+        }
+
+        void stop() {
+            log = 0;
+            request.release();
+            wait();
+        }
+
+    protected:
+        void run() KDAB_OVERRIDE {
+            for ( ;; ) {
+                request.acquire();
+                if ( !log )
+                    return;
+                log->logInfo( "thread %d", index );
+                done.release();
+            }
+        }
+
+    private:
+        KDLog * log;
+        int index;
+        QSemaphore request;
+        QSemaphore done;
+    };
+}
+
+namespace {
+    // Holds the writer thread of a KDAsyncLogDevice inside log()
+    // until the test opens the gate, so that the test controls what
+    // is still queued. Messages go to a list owned by the test, as
+    // the device itself is deleted along with the KDAsyncLogDevice.
+    class GatedLogDevice : public KDLogDevice {
+    public:
+        explicit GatedLogDevice( QStringList * sink )
+            : KDLogDevice(), entered( 0 ), messages( sink ), isOpen( false ), mutex(), opened() {}
+
+        void log( KDLog::Severity, const QString & msg ) KDAB_OVERRIDE {
+            entered.release();
+            QMutexLocker locker( &mutex );
+            while ( !isOpen )
+                opened.wait( &mutex );
+            messages->push_back( msg );
+        }
+
+        void open() {
+            QMutexLocker locker( &mutex );
+            isOpen = true;
+            opened.wakeAll();
+        }
+
+        QStringList received() const {
+            QMutexLocker locker( &mutex );
+            return *messages;
+        }
+
+        QSemaphore entered;
+
+    private:
+        QStringList * const messages;
+        bool isOpen;
+        mutable QMutex mutex;
+        QWaitCondition opened;
+    };
+
+    // Logs "first" and waits until the writer thread is stuck in the
+    // gate with it, leaving an empty queue behind.
+    static void occupyWriter( KDLog & log, GatedLogDevice * gate ) {
+        log.logInfo( "first" );
+        gate->entered.acquire();
+    }
+
+    class FlushThread : public QThread {
+    public:
+        FlushThread( KDAsyncLogDevice * d, int m ) : QThread(), result( true ), dev( d ), msecs( m ) {}
+        void run() KDAB_OVERRIDE { result = dev->flush( msecs ); }
+        bool result;
+    private:
+        KDAsyncLogDevice * const dev;
+        const int msecs;
+    };
+
+    // Logs every message it gets back into the device it's set to,
+    // the way a target that logs its own errors would.
+    class EchoLogDevice : public KDLogDevice {
+    public:
+        explicit EchoLogDevice( QStringList * sink ) : KDLogDevice(), echoTo( 0 ), messages( sink ) {}
+        void log( KDLog::Severity severity, const QString & msg ) KDAB_OVERRIDE {
+            messages->push_back( msg );
+            if ( echoTo && !msg.startsWith( QLatin1String( "echo" ) ) )
+                for ( int i = 0 ; i < 8 ; ++i )
+                    echoTo->log( severity, QString::fromLatin1( "echo %1" ).arg( i ) );
+        }
+        KDLogDevice * echoTo;
+    private:
+        QStringList * const messages;
+    };
+}
+
+static int argumentEvaluations = 0;
+
+static int countedArgument() {
+    ++argumentEvaluations;
+    return 42;
+}
+
+KDAB_UNITTEST_SIMPLE( KDLog, "kdtools/core" ) {
+
+    {
+        RecordingLogDevice * dev = new RecordingLogDevice;
+        KDLog log( dev );
+        assertEqual( int( log.minimumSeverity() ), int( KDLog::Info ) );
+        assertTrue( log.isSeverityEnabled( KDLog::Info ) );
+
+        log.logInfo( "info %d", 1 );
+        log.logDebug( "debug %d", 2 );
+        assertEqual( dev->messages.size(), 2 );
+        assertTrue( dev->messages.back() == QLatin1String( "debug 2" ) );
+
+        log.setMinimumSeverity( KDLog::Warning );
+        assertFalse( log.isSeverityEnabled( KDLog::Debug ) );
+        assertTrue( log.isSeverityEnabled( KDLog::Error ) );
+        log.logInfo( "info %d", 3 );
+        log.logDebug( "debug %d", 4 );
+        log.logWarning( "warning %d", 5 );
+        assertEqual( dev->messages.size(), 3 );
+        assertEqual( dev->severities.back(), int( KDLog::Warning ) );
+
+        argumentEvaluations = 0;
+        KDLOG_DEBUG( log, "debug %d", countedArgument() );
+        assertEqual( argumentEvaluations, 0 );
+        KDLOG_ERROR( log, "error %d", countedArgument() );
+        assertEqual( argumentEvaluations, 1 );
+        assertTrue( dev->messages.back() == QLatin1String( "error 42" ) );
+
+        log.setMinimumSeverity( KDLog::Info );
+        dev->setMinimumSeverity( KDLog::Error );
+        assertFalse( log.isSeverityEnabled( KDLog::Warning ) );
+        log.logWarning( "warning %d", 6 );
+        assertEqual( dev->messages.size(), 4 );
+
+        // levels are ordered Info < Debug < Warning < Error:
+        dev->setMinimumSeverity( KDLog::Info );
+        log.setMinimumSeverity( KDLog::Debug );
+        assertFalse( log.isSeverityEnabled( KDLog::Info ) );
+        assertTrue( log.isSeverityEnabled( KDLog::Debug ) );
+        log.logInfo( "info %d", 7 );
+        log.logDebug( "debug %d", 8 );
+        assertEqual( dev->messages.size(), 5 );
+        assertTrue( dev->messages.back() == QLatin1String( "debug 8" ) );
+
+        // flag-only severities have no level, and always pass:
+        log.setMinimumSeverity( KDLog::Error );
+        dev->setMinimumSeverity( KDLog::Error );
+        assertTrue( log.isSeverityEnabled( KDLog::Popup ) );
+        assertTrue( log.isSeverityEnabled( KDLog::User ) );
+        assertTrue( log.isSeverityEnabled( KDLog::Popup|KDLog::User ) );
+        assertFalse( log.isSeverityEnabled( KDLog::Popup|KDLog::Warning ) );
+        assertTrue( log.isSeverityEnabled( KDLog::Popup|KDLog::Error ) );
+    }
+
+    {
+        RecordingLogDevice * quiet = new RecordingLogDevice;
+        RecordingLogDevice * chatty = new RecordingLogDevice;
+        quiet->setMinimumSeverity( KDLog::Error );
+        KDCompositeLogDevice * composite = new KDCompositeLogDevice;
+        composite->addLogDevice( quiet );
+        composite->addLogDevice( chatty );
+        KDLog log( composite );
+        log.logWarning( "warning" );
+        log.logError( "error" );
+        assertEqual( quiet->messages.size(), 1 );
+        assertEqual( chatty->messages.size(), 2 );
+        composite->log( KDLog::Popup, QLatin1String( "popup" ) );
+        assertEqual( quiet->messages.size(), 2 );
+        assertEqual( chatty->messages.size(), 3 );
+    }
+
+    {
+        const QString filename = QString::fromLatin1( "kdfilelogdevice-test%1" ).arg( QUuid::createUuid().toString() );
+        KDFileLogDevice * dev = new KDFileLogDevice( filename, QIODevice::Truncate );
+        dev->setBufferSize( 4096 );
+        assertEqual( dev->bufferSize(), 4096 );
+        KDLog log( dev );
+        log.logInfo( "one" );
+        log.logDebug( "two" );
+        assertEqual( QFileInfo( filename ).size(), qint64( 0 ) );
+        log.logError( "three" );
+        const QByteArray expected = "Info: one\nDebug: two\nError: three\n";
+        assertEqual( QFileInfo( filename ).size(), qint64( expected.size() ) );
+        log.logWarning( "four" );
+        assertTrue( dev->flush() );
+        QFile file( filename );
+        assertTrue( file.open( QIODevice::ReadOnly ) );
+        assertTrue( file.readAll() == expected + "Warning: four\n" );
+        file.close();
+        assertTrue( QFile::remove( filename ) );
+    }
+
+#ifdef Q_OS_UNIX
+    // same for stderr, captured in a file (assert only after restoring fd 2):
+    {
+        const QString filename = QString::fromLatin1( "kdstderrlogdevice-test%1" ).arg( QUuid::createUuid().toString() );
+        QFile capture( filename );
+        assertTrue( capture.open( QIODevice::ReadWrite|QIODevice::Truncate ) );
+        fflush( stderr );
+        const int saved = ::dup( 2 );
+        assertGreaterOrEqual( saved, 0 );
+        const bool redirected = ::dup2( capture.handle(), 2 ) >= 0;
+        qint64 bufferedSize = -1, flushedSize = -1;
+        bool flushed = false;
+        {
+            KDStderrLogDevice * dev = new KDStderrLogDevice;
+            dev->setBufferSize( 4096 );
+            KDLog log( dev );
+            log.logInfo( "one" );
+            log.logDebug( "two" );
+            bufferedSize = capture.size();
+            log.logError( "three" );
+            flushedSize = capture.size();
+            log.logWarning( "four" );
+            flushed = dev->flush();
+        }
+        fflush( stderr );
+        ::dup2( saved, 2 );
+        ::close( saved );
+
+        assertTrue( redirected );
+        assertEqual( bufferedSize, qint64( 0 ) );
+        const QByteArray expected = "Info: one\nDebug: two\nError: three\n";
+        assertEqual( flushedSize, qint64( expected.size() ) );
+        assertTrue( flushed );
+        assertTrue( capture.seek( 0 ) );
+        assertTrue( capture.readAll() == expected + "Warning: four\n" );
+        capture.close();
+        assertTrue( QFile::remove( filename ) );
+    }
+#endif
+
+    {
+        const int Threads = 4;
+        const int PerThread = 1000;
+        RecordingLogDevice * dev = new RecordingLogDevice;
+        KDThreadLocalLogDevice * tl = new KDThreadLocalLogDevice( dev, 16 );
+        assertEqual( tl->capacityPerThread(), 16 );
+        KDLog log( tl );
+        QList<LoggingThread*> threads;
+        for ( int i = 0 ; i < Threads ; ++i )
+            threads.push_back( new LoggingThread( &log, i, PerThread ) );
+        Q_FOREACH( LoggingThread * t, threads )
+            t->start();
+        Q_FOREACH( LoggingThread * t, threads )
+            t->wait();
+        assertTrue( tl->flush() );
+        qDeleteAll( threads );
+
+        assertEqual( dev->messages.size(), Threads * PerThread );
+        QVector<int> next( Threads, 0 );
+        Q_FOREACH( const QString & msg, dev->messages ) {
+            const QStringList parts = msg.split( QLatin1Char( ' ' ) );
+            const int thread = parts.at( 0 ).toInt();
+            assertEqual( parts.at( 1 ).toInt(), next[thread]++ );
+        }
+
+        int produced = 0, dropped = 0;
+        Q_FOREACH( const KDThreadLocalLogDevice::ThreadStatistics & s, tl->threadStatistics() ) {
+            produced += s.produced;
+            dropped += s.dropped;
+        }
+        assertEqual( produced, Threads * PerThread );
+        assertEqual( dropped, 0 );
+    }
+
+    // a thread that logged to a device that is gone by now must get
+    // a fresh buffer from the next device
+    {
+        LongLivedLoggingThread thread;
+        thread.start();
+        for ( int round = 0 ; round < 2 ; ++round ) {
+            RecordingLogDevice * dev = new RecordingLogDevice;
+            KDThreadLocalLogDevice * tl = new KDThreadLocalLogDevice( dev );
+            KDLog log( tl );
+            thread.logTo( &log, round );
+            log.logInfo( "main %d", round );
+            assertTrue( tl->flush() );
+            assertEqual( dev->messages.size(), 2 );
+            assertTrue( dev->messages.contains( QString::fromLatin1( "thread %1" ).arg( round ) ) );
+            assertEqual( tl->threadStatistics().size(), 3 ); // two threads, and the finished ones
+        }
+        thread.stop();
+    }
+}
+
+KDAB_UNITTEST_SIMPLE( KDAsyncLogDevice, "kdtools/core" ) {
+
+    {
+        const int Threads = 4;
+        const int PerThread = 1000;
+        RecordingLogDevice * dev = new RecordingLogDevice;
+        KDAsyncLogDevice * async = new KDAsyncLogDevice( dev, 64 );
+        assertEqual( async->capacity(), 64 );
+        KDLog log( async );
+        QList<LoggingThread*> threads;
+        for ( int i = 0 ; i < Threads ; ++i )
+            threads.push_back( new LoggingThread( &log, i, PerThread ) );
+        Q_FOREACH( LoggingThread * t, threads )
+            t->start();
+        Q_FOREACH( LoggingThread * t, threads )
+            t->wait();
+        assertTrue( async->flush() );
+        qDeleteAll( threads );
+
+        assertEqual( async->droppedCount(), 0 );
+        assertEqual( dev->messages.size(), Threads * PerThread );
+        QVector<int> next( Threads, 0 );
+        Q_FOREACH( const QString & msg, dev->messages ) {
+            const QStringList parts = msg.split( QLatin1Char( ' ' ) );
+            const int thread = parts.at( 0 ).toInt();
+            assertEqual( parts.at( 1 ).toInt(), next[thread]++ );
+        }
+    }
+
+    // overflow policies: with the writer held in the gate, ten
+    // entries meet a queue of four
+    {
+        QStringList sink;
+        GatedLogDevice * gate = new GatedLogDevice( &sink );
+        KDAsyncLogDevice * async = new KDAsyncLogDevice( gate, 4, KDAsyncLogDevice::DropNewest );
+        KDLog log( async );
+        occupyWriter( log, gate );
+        for ( int i = 0 ; i < 10 ; ++i )
+            log.logInfo( "%d", i );
+        assertEqual( async->droppedCount(), 6 );
+        gate->open();
+        assertTrue( async->flush() );
+        assertTrue( gate->received().join( QLatin1String( "," ) ) == QLatin1String( "first,0,1,2,3" ) );
+    }
+
+    {
+        QStringList sink;
+        GatedLogDevice * gate = new GatedLogDevice( &sink );
+        KDAsyncLogDevice * async = new KDAsyncLogDevice( gate, 4, KDAsyncLogDevice::DropOldest );
+        KDLog log( async );
+        occupyWriter( log, gate );
+        for ( int i = 0 ; i < 10 ; ++i )
+            log.logInfo( "%d", i );
+        assertEqual( async->droppedCount(), 6 );
+        gate->open();
+        assertTrue( async->flush() );
+        assertTrue( gate->received().join( QLatin1String( "," ) ) == QLatin1String( "first,6,7,8,9" ) );
+    }
+
+    {
+        QStringList sink;
+        GatedLogDevice * gate = new GatedLogDevice( &sink );
+        KDAsyncLogDevice * async = new KDAsyncLogDevice( gate, 4, KDAsyncLogDevice::Block );
+        KDLog log( async );
+        occupyWriter( log, gate );
+        LoggingThread producer( &log, 0, 10 );
+        producer.start();
+        assertFalse( producer.wait( 100 ) ); // stuck on the full queue
+        gate->open();
+        assertTrue( producer.wait() );
+        assertTrue( async->flush() );
+        assertEqual( async->droppedCount(), 0 );
+        QStringList expected( QLatin1String( "first" ) );
+        for ( int i = 0 ; i < 10 ; ++i )
+            expected.push_back( QString::fromLatin1( "0 %1" ).arg( i ) );
+        assertTrue( gate->received() == expected );
+    }
+
+    // flush() returns only once its ticket has reached the target
+    {
+        QStringList sink;
+        GatedLogDevice * gate = new GatedLogDevice( &sink );
+        KDAsyncLogDevice * async = new KDAsyncLogDevice( gate );
+        KDLog log( async );
+        occupyWriter( log, gate );
+        log.logInfo( "second" );
+        assertFalse( async->flush( 50 ) );
+        assertTrue( gate->received().isEmpty() );
+        gate->open();
+        assertTrue( async->flush() );
+        assertTrue( gate->received().join( QLatin1String( "," ) ) == QLatin1String( "first,second" ) );
+    }
+
+    // ...even if later entries were dropped meanwhile
+    {
+        QStringList sink;
+        GatedLogDevice * gate = new GatedLogDevice( &sink );
+        KDAsyncLogDevice * async = new KDAsyncLogDevice( gate, 4, KDAsyncLogDevice::DropOldest );
+        KDLog log( async );
+        occupyWriter( log, gate );
+        FlushThread flusher( async, 300 );
+        flusher.start();
+        QThread::yieldCurrentThread();
+        for ( int i = 0 ; i < 20 ; ++i )
+            log.logInfo( "%d", i );
+        assertTrue( flusher.wait() );
+        assertFalse( flusher.result ); // "first" is still in the gate
+        gate->open();
+        assertTrue( async->flush() );
+    }
+
+    // a target logging back into a full queue from the writer thread
+    // must not wait for itself
+    {
+        QStringList sink;
+        EchoLogDevice * echo = new EchoLogDevice( &sink );
+        KDAsyncLogDevice * async = new KDAsyncLogDevice( echo, 4, KDAsyncLogDevice::Block );
+        echo->echoTo = async;
+        KDLog log( async );
+        log.logInfo( "one" );
+        assertTrue( async->flush( 10000 ) );
+        assertTrue( sink.front() == QLatin1String( "one" ) );
+        assertGreater( async->droppedCount(), 0 );
+    }
+
+    // destruction delivers what is still queued
+    {
+        QStringList sink;
+        GatedLogDevice * gate = new GatedLogDevice( &sink );
+        KDLog * log = new KDLog( new KDAsyncLogDevice( gate, 64 ) );
+        occupyWriter( *log, gate );
+        for ( int i = 0 ; i < 50 ; ++i )
+            log->logInfo( "%d", i );
+        gate->open();
+        delete log;
+        assertEqual( sink.size(), 51 );
+        assertTrue( sink.back() == QLatin1String( "49" ) );
+    }
+}
+
+namespace {
+    static QStringList filesStartingWith( const QString & prefix ) {
+        return QDir().entryList( QStringList( prefix + QLatin1Char( '*' ) ), QDir::Files, QDir::Name );
+    }
+
+    static void removeFilesStartingWith( const QString & prefix ) {
+        Q_FOREACH( const QString & file, filesStartingWith( prefix ) )
+            QFile::remove( file );
+    }
+
+    static QByteArray readFile( const QString & filename ) {
+        QFile file( filename );
+        return file.open( QIODevice::ReadOnly ) ? file.readAll() : QByteArray() ;
+    }
+
+    static QByteArray paddedEntries( int from, int to ) {
+        QByteArray result;
+        for ( int i = from ; i <= to ; ++i )
+            result += "Info: " + QByteArray::number( i ).rightJustified( 2, '0' ) + ' ' + QByteArray( 60, '.' ) + '\n';
+        return result;
+    }
+
+    static quint32 adler32( const QByteArray & data ) {
+        quint32 a = 1, b = 0;
+        for ( int i = 0 ; i < data.size() ; ++i ) {
+            a = ( a + static_cast<uchar>( data[i] ) ) % 65521;
+            b = ( b + a ) % 65521;
+        }
+        return b << 16 | a;
+    }
+
+    // Rewraps the deflate data of a single-member gzip file the way
+    // qUncompress() expects it, which needs the length and Adler-32
+    // checksum of the content the test expects to get back.
+    static QByteArray gzipToQCompress( const QByteArray & gz, const QByteArray & expected ) {
+        QByteArray z( 4, '\0' );
+        qToBigEndian<quint32>( expected.size(), reinterpret_cast<uchar*>( z.data() ) );
+        z += "\x78\x9c";
+        z += gz.mid( 10, gz.size() - 10 - 8 );
+        z.resize( z.size() + 4 );
+        qToBigEndian<quint32>( adler32( expected ), reinterpret_cast<uchar*>( z.data() + z.size() - 4 ) );
+        return z;
+    }
+}
+
+KDAB_UNITTEST_SIMPLE( KDRotatingFileLogDevice, "kdtools/core" ) {
+
+    // by size: a 100-byte limit holds two 70-byte entries, so ten
+    // entries make four rotations, of which two generations are kept
+    {
+        const QString base = QString::fromLatin1( "kdrotatingfilelogdevice-test%1" ).arg( QUuid::createUuid().toString() );
+        KDRotatingFileLogDevice * dev = new KDRotatingFileLogDevice( base );
+        dev->setMaximumFileSize( 100 );
+        dev->setMaximumGenerations( 2 );
+        dev->setCompressionEnabled( false );
+        {
+            KDLog log( dev );
+            for ( int i = 0 ; i < 10 ; ++i )
+                log.logInfo( "%02d %s", i, QByteArray( 60, '.' ).constData() );
+            assertTrue( dev->waitForPendingRotations() );
+            assertTrue( filesStartingWith( base + QLatin1String( ".rotating" ) ).isEmpty() );
+        }
+        assertTrue( filesStartingWith( base ) == QStringList() << base << base + QLatin1String( ".1" ) << base + QLatin1String( ".2" ) );
+        assertTrue( readFile( base ) == paddedEntries( 8, 9 ) );
+        assertTrue( readFile( base + QLatin1String( ".1" ) ) == paddedEntries( 6, 7 ) );
+        assertTrue( readFile( base + QLatin1String( ".2" ) ) == paddedEntries( 4, 5 ) );
+        removeFilesStartingWith( base );
+    }
+
+    // compressed generations are gzip files
+    {
+        const QString base = QString::fromLatin1( "kdrotatingfilelogdevice-test%1" ).arg( QUuid::createUuid().toString() );
+        const QString generation = base + QLatin1String( ".1.gz" );
+        KDRotatingFileLogDevice * dev = new KDRotatingFileLogDevice( base );
+        assertTrue( dev->isCompressionEnabled() );
+        {
+            KDLog log( dev );
+            log.logInfo( "one" );
+            log.logWarning( "two" );
+            dev->rotate();
+            log.logInfo( "three" );
+            assertTrue( dev->waitForPendingRotations() );
+            assertTrue( QFile::exists( generation ) );
+        }
+        assertTrue( filesStartingWith( base ) == QStringList() << base << generation );
+        assertTrue( readFile( base ) == "Info: three\n" );
+
+        const QByteArray expected = "Info: one\nWarning: two\n";
+        const QByteArray gz = readFile( generation );
+        assertGreater( gz.size(), 10 + 8 );
+        assertTrue( gz.startsWith( "\x1f\x8b\x08" ) );
+        const uchar * const trailer = reinterpret_cast<const uchar*>( gz.constData() + gz.size() - 8 );
+        assertEqual( qFromLittleEndian<quint32>( trailer ), Crc32()( expected ) );
+        assertEqual( qFromLittleEndian<quint32>( trailer + 4 ), quint32( expected.size() ) );
+        assertTrue( qUncompress( gzipToQCompress( gz, expected ) ) == expected );
+        removeFilesStartingWith( base );
+    }
+
+    // by interval
+    {
+        const QDateTime wednesday( QDate( 2014, 1, 15 ), QTime( 10, 15, 30 ) );
+        const QDateTime monday( QDate( 2014, 1, 20 ), QTime( 0, 0 ) );
+        assertFalse( nextRotationBoundary( wednesday, KDRotatingFileLogDevice::NoRotationInterval ).isValid() );
+        assertTrue( nextRotationBoundary( wednesday, KDRotatingFileLogDevice::Hourly ) == QDateTime( QDate( 2014, 1, 15 ), QTime( 11, 0 ) ) );
+        assertTrue( nextRotationBoundary( wednesday, KDRotatingFileLogDevice::Daily ) == QDateTime( QDate( 2014, 1, 16 ), QTime( 0, 0 ) ) );
+        assertTrue( nextRotationBoundary( wednesday, KDRotatingFileLogDevice::Weekly ) == monday );
+        assertTrue( nextRotationBoundary( monday, KDRotatingFileLogDevice::Daily ) == QDateTime( QDate( 2014, 1, 21 ), QTime( 0, 0 ) ) );
+        assertTrue( nextRotationBoundary( monday, KDRotatingFileLogDevice::Weekly ) == monday.addDays( 7 ) );
+    }
+}
+
+#endif // KDTOOLSCORE_UNITTESTS
+
 #include "moc_kdlog.cpp"
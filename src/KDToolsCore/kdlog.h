@@ -28,6 +28,10 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QIODevice>
+#include <QtCore/QDateTime>
+#include <QtCore/QList>
+
+#include <cstdarg>
 
 QT_BEGIN_NAMESPACE
 class QString;
@@ -40,6 +44,7 @@ class KDLogDevice;
 class KDTOOLSCORE_EXPORT KDLog {
     Q_DISABLE_COPY( KDLog )
     DOXYGEN_PROPERTY( bool qDebugMessagesRedirected READ qDebugMessagesRedirected WRITE setQDebugMessagesRedirected )
+    DOXYGEN_PROPERTY( Severity minimumSeverity READ minimumSeverity WRITE setMinimumSeverity )
 public:
     explicit KDLog( KDLogDevice * logDev );
     ~KDLog();
@@ -58,6 +63,11 @@ public:
     void setQDebugMessagesRedirected( bool on );
     bool qDebugMessagesRedirected() const;
 
+    void setMinimumSeverity( Severity severity );
+    Severity minimumSeverity() const;
+
+    bool isSeverityEnabled( Severity severity ) const;
+
     void logInfo( const char* fmt, ... )
 #if defined(Q_CC_GNU) && !defined(__INSURE__)
     __attribute__ ((format (printf, 2, 3)))
@@ -86,13 +96,29 @@ private:
 
 Q_DECLARE_OPERATORS_FOR_FLAGS( KDLog::Severity )
 
+#define KDLOG_INFO( log, ... ) \
+    do { if ( ( log ).isSeverityEnabled( KDLog::Info ) ) ( log ).logInfo( __VA_ARGS__ ); } while ( false )
+#define KDLOG_DEBUG( log, ... ) \
+    do { if ( ( log ).isSeverityEnabled( KDLog::Debug ) ) ( log ).logDebug( __VA_ARGS__ ); } while ( false )
+#define KDLOG_WARNING( log, ... ) \
+    do { if ( ( log ).isSeverityEnabled( KDLog::Warning ) ) ( log ).logWarning( __VA_ARGS__ ); } while ( false )
+#define KDLOG_ERROR( log, ... ) \
+    do { if ( ( log ).isSeverityEnabled( KDLog::Error ) ) ( log ).logError( __VA_ARGS__ ); } while ( false )
+
 class KDTOOLSCORE_EXPORT KDLogDevice {
     Q_DISABLE_COPY( KDLogDevice )
+    DOXYGEN_PROPERTY( KDLog::Severity minimumSeverity READ minimumSeverity WRITE setMinimumSeverity )
 public:
     KDLogDevice();
     virtual ~KDLogDevice();
 
+    void setMinimumSeverity( KDLog::Severity severity );
+    KDLog::Severity minimumSeverity() const;
+
+    bool isSeverityEnabled( KDLog::Severity severity ) const;
+
     virtual void log( KDLog::Severity severity, const QString & msg ) = 0;
+    virtual void logv( KDLog::Severity severity, const char * fmt, va_list args );
 
 private:
     KDTOOLS_DECLARE_PRIVATE_BASE( KDLogDevice );
@@ -122,6 +148,17 @@ public:
     explicit KDStderrLogDevice( const QTextCodec * codec );
     ~KDStderrLogDevice();
 
+    void setBufferSize( int size );
+    int bufferSize() const;
+
+    void setFlushInterval( int msecs );
+    int flushInterval() const;
+
+    void setFlushSeverity( KDLog::Severity severity );
+    KDLog::Severity flushSeverity() const;
+
+    bool flush();
+
 private:
     void doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) KDAB_OVERRIDE;
 private:
@@ -134,13 +171,54 @@ public:
     explicit KDFileLogDevice( const QString & filename, const QTextCodec * codec, QIODevice::OpenMode mode=QIODevice::Append );
     ~KDFileLogDevice();
 
+    void setBufferSize( int size );
+    int bufferSize() const;
+
+    void setFlushInterval( int msecs );
+    int flushInterval() const;
+
+    void setFlushSeverity( KDLog::Severity severity );
+    KDLog::Severity flushSeverity() const;
+
+    bool flush();
+
 private:
-    void doLogEncoded( KDLog::Severity severity, const QByteArray & msg );
+    void doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) KDAB_OVERRIDE;
 
 private:
     KDTOOLS_DECLARE_PRIVATE_DERIVED( KDFileLogDevice, KDEncodingLogDevice );
 };
 
+class KDTOOLSCORE_EXPORT KDRotatingFileLogDevice : public KDEncodingLogDevice {
+public:
+    enum RotationInterval { NoRotationInterval, Hourly, Daily, Weekly };
+
+    explicit KDRotatingFileLogDevice( const QString & filename );
+    explicit KDRotatingFileLogDevice( const QString & filename, const QTextCodec * codec );
+    ~KDRotatingFileLogDevice();
+
+    void setMaximumFileSize( qint64 size );
+    qint64 maximumFileSize() const;
+
+    void setRotationInterval( RotationInterval interval );
+    RotationInterval rotationInterval() const;
+
+    void setMaximumGenerations( int generations );
+    int maximumGenerations() const;
+
+    void setCompressionEnabled( bool on );
+    bool isCompressionEnabled() const;
+
+    void rotate();
+    bool waitForPendingRotations( int msecs=-1 );
+
+private:
+    void doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) KDAB_OVERRIDE;
+
+private:
+    KDTOOLS_DECLARE_PRIVATE_DERIVED( KDRotatingFileLogDevice, KDEncodingLogDevice );
+};
+
 class KDTOOLSCORE_EXPORT KDSignalLogDevice : public QObject, public KDLogDevice {
     Q_OBJECT
 public:
@@ -162,11 +240,22 @@ private:
 class KDTOOLSCORE_EXPORT KDSystemLogDevice : public KDEncodingLogDevice {
 public:
     enum Facility { User, Daemon, Auth };
+    enum SubmissionMode { SyslogCall, DirectDatagram };
 
     explicit KDSystemLogDevice( Facility facility );
     explicit KDSystemLogDevice( Facility facility, const QTextCodec * codec );
     ~KDSystemLogDevice();
 
+    void setSubmissionMode( SubmissionMode mode );
+    SubmissionMode submissionMode() const;
+
+    void setBatchSize( int messages );
+    int batchSize() const;
+
+    int droppedCount() const;
+
+    bool flush( int msecs=0 );
+
 private:
     void doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) KDAB_OVERRIDE;
 private:
@@ -188,4 +277,142 @@ private:
     KDTOOLS_DECLARE_PRIVATE_DERIVED( KDCompositeLogDevice, KDLogDevice );
 };
 
+class KDTOOLSCORE_EXPORT KDBinaryLogDevice : public KDLogDevice {
+public:
+    explicit KDBinaryLogDevice( const QString & filename, QIODevice::OpenMode mode=QIODevice::Append );
+    ~KDBinaryLogDevice();
+
+    bool flush();
+
+    void log( KDLog::Severity severity, const QString & msg ) KDAB_OVERRIDE;
+    void logv( KDLog::Severity severity, const char * fmt, va_list args ) KDAB_OVERRIDE;
+
+private:
+    KDTOOLS_DECLARE_PRIVATE_DERIVED( KDBinaryLogDevice, KDLogDevice );
+};
+
+class KDTOOLSCORE_EXPORT KDBinaryLogReader {
+    Q_DISABLE_COPY( KDBinaryLogReader )
+public:
+    struct Record {
+        Record() : severity( KDLog::Info ), timestamp( 0 ), threadId( 0 ) {}
+
+        KDLog::Severity severity;
+        qint64 timestamp;
+        QDateTime time;
+        quint64 threadId;
+        QString message;
+    };
+
+    explicit KDBinaryLogReader( const QString & filename );
+    ~KDBinaryLogReader();
+
+    bool isOpen() const;
+    QString errorString() const;
+
+    bool readNext( Record * record );
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+class KDTOOLSCORE_EXPORT KDMmapRingLogDevice : public KDLogDevice {
+public:
+    explicit KDMmapRingLogDevice( const QString & filename, qint64 size=4*1024*1024 );
+    ~KDMmapRingLogDevice();
+
+    bool isOpen() const;
+    QString errorString() const;
+
+    qint64 size() const;
+
+    void log( KDLog::Severity severity, const QString & msg ) KDAB_OVERRIDE;
+
+private:
+    KDTOOLS_DECLARE_PRIVATE_DERIVED( KDMmapRingLogDevice, KDLogDevice );
+};
+
+class KDTOOLSCORE_EXPORT KDMmapRingLogReader {
+    Q_DISABLE_COPY( KDMmapRingLogReader )
+public:
+    struct Record {
+        Record() : severity( KDLog::Info ), sequence( 0 ), usecsSinceEpoch( 0 ), threadId( 0 ) {}
+
+        KDLog::Severity severity;
+        quint64 sequence;
+        qint64 usecsSinceEpoch;
+        QDateTime time;
+        quint64 threadId;
+        QString message;
+    };
+
+    explicit KDMmapRingLogReader( const QString & filename );
+    ~KDMmapRingLogReader();
+
+    bool isOpen() const;
+    QString errorString() const;
+
+    bool readNext( Record * record );
+
+private:
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+class KDTOOLSCORE_EXPORT KDAsyncLogDevice : public KDLogDevice {
+public:
+    enum OverflowPolicy { Block, DropOldest, DropNewest };
+
+    explicit KDAsyncLogDevice( KDLogDevice * target, int capacity=4096, OverflowPolicy policy=Block );
+    ~KDAsyncLogDevice();
+
+    KDLogDevice * targetDevice() const;
+    int capacity() const;
+
+    void setOverflowPolicy( OverflowPolicy policy );
+    OverflowPolicy overflowPolicy() const;
+
+    int droppedCount() const;
+
+    bool flush( int msecs=-1 );
+
+    void log( KDLog::Severity severity, const QString & msg ) KDAB_OVERRIDE;
+
+private:
+    KDTOOLS_DECLARE_PRIVATE_DERIVED( KDAsyncLogDevice, KDLogDevice );
+};
+
+class KDTOOLSCORE_EXPORT KDThreadLocalLogDevice : public KDLogDevice {
+public:
+    enum OverflowPolicy { Block, DropNewest };
+
+    struct ThreadStatistics {
+        ThreadStatistics() : threadId( 0 ), produced( 0 ), dropped( 0 ), bytesWritten( 0 ), finished( false ) {}
+        Qt::HANDLE threadId;
+        int produced;
+        int dropped;
+        qint64 bytesWritten;
+        bool finished;
+    };
+
+    explicit KDThreadLocalLogDevice( KDLogDevice * target, int capacityPerThread=1024, OverflowPolicy policy=Block );
+    ~KDThreadLocalLogDevice();
+
+    KDLogDevice * targetDevice() const;
+    int capacityPerThread() const;
+
+    void setOverflowPolicy( OverflowPolicy policy );
+    OverflowPolicy overflowPolicy() const;
+
+    QList<ThreadStatistics> threadStatistics() const;
+
+    bool flush( int msecs=-1 );
+
+    void log( KDLog::Severity severity, const QString & msg ) KDAB_OVERRIDE;
+
+private:
+    KDTOOLS_DECLARE_PRIVATE_DERIVED( KDThreadLocalLogDevice, KDLogDevice );
+};
+
 #endif /* __KDTOOLSCORE_KDLOG_H__ */
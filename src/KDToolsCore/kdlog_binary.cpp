@@ -0,0 +1,780 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+#include "kdlog.h"
+#include "kdlog_p.h"
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstdio>
+#include <cstring>
+
+/*
+  File format (all integers little-endian):
+
+    'H' magic[6]="KDBLOG" u8 version i64 startMSecsSinceEpoch
+        Starts a session. Format ids are only valid within a session.
+    'F' u32 id u32 length char[length]
+        Defines format string number id.
+    'R' u32 formatId u16 severity i64 nsecsSinceSessionStart u64 threadId
+        u32 length byte[length]
+        A log entry. The bytes are the tagged arguments, see ArgumentTag.
+*/
+
+static const char binaryLogMagic[6] = { 'K', 'D', 'B', 'L', 'O', 'G' };
+static const quint8 binaryLogVersion = 1;
+
+enum RecordType {
+    SessionRecord = 'H',
+    FormatRecord = 'F',
+    EntryRecord = 'R'
+};
+
+enum ArgumentTag {
+    SignedTag = 'i',     // i64
+    UnsignedTag = 'u',   // u64
+    DoubleTag = 'd',     // IEEE 754 bits as u64
+    StringTag = 's',     // u32 length, UTF-8 bytes
+    PointerTag = 'p'     // u64
+};
+
+namespace {
+
+    // One printf conversion specification, as far as we need to
+    // understand it to pick the argument off the va_list and render
+    // it again later.
+    struct FormatSpec {
+        FormatSpec() : widthFromArgument( false ), precisionFromArgument( false ), conversion( 0 ) {}
+
+        QByteArray flags;
+        QByteArray width;
+        QByteArray precision;      // including the '.'
+        bool widthFromArgument;
+        bool precisionFromArgument;
+        QByteArray length;
+        char conversion;
+
+        bool isSigned() const { return conversion == 'd' || conversion == 'i'; }
+        bool isUnsigned() const { return conversion && std::strchr( "ouxXc", conversion ); }
+        bool isFloatingPoint() const { return conversion && std::strchr( "eEfFgGaA", conversion ); }
+        bool isString() const { return conversion == 's'; }
+        bool isPointer() const { return conversion == 'p'; }
+        bool isCount() const { return conversion == 'n'; }
+
+        // Qt's vsprintf() takes %lc and %ls as UTF-16, not wchar_t, so
+        // they are left to it
+        bool isWide() const { return ( conversion == 'c' || conversion == 's' ) && length == "l"; }
+
+        bool isSupported() const {
+            return !isWide() && ( isSigned() || isUnsigned() || isFloatingPoint() || isString() || isPointer() || isCount() );
+        }
+    };
+
+    // Parses the conversion specification starting after the '%' at
+    // \a p. Returns a pointer past the conversion character, or 0 if
+    // the specification is malformed.
+    const char * parseFormatSpec( const char * p, FormatSpec & spec ) {
+        spec = FormatSpec();
+        while ( *p && std::strchr( "-+ #0'", *p ) )
+            spec.flags += *p++;
+        if ( *p == '*' ) {
+            spec.widthFromArgument = true;
+            ++p;
+        } else {
+            while ( *p >= '0' && *p <= '9' )
+                spec.width += *p++;
+        }
+        if ( *p == '.' ) {
+            spec.precision += *p++;
+            if ( *p == '*' ) {
+                spec.precisionFromArgument = true;
+                ++p;
+            } else {
+                while ( *p >= '0' && *p <= '9' )
+                    spec.precision += *p++;
+            }
+        }
+        while ( *p && std::strchr( "hlLqjzt", *p ) )
+            spec.length += *p++;
+        if ( !*p )
+            return 0;
+        spec.conversion = *p++;
+        return spec.isSupported() ? p : 0 ;
+    }
+
+    // Returns whether every conversion in \a fmt can be encoded in
+    // binary form. If not, the entry is formatted and stored as text.
+    bool isEncodable( const char * fmt ) {
+        FormatSpec spec;
+        for ( const char * p = fmt ; *p ; ) {
+            if ( *p++ != '%' )
+                continue;
+            if ( *p == '%' ) {
+                ++p;
+                continue;
+            }
+            if ( !( p = parseFormatSpec( p, spec ) ) )
+                return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    void put( QByteArray & buffer, T value ) {
+        uchar bytes[sizeof value];
+        qToLittleEndian( value, bytes );
+        buffer.append( reinterpret_cast<const char*>( bytes ), sizeof value );
+    }
+
+    void putString( QByteArray & buffer, const QByteArray & str ) {
+        buffer += char( StringTag );
+        put<quint32>( buffer, str.size() );
+        buffer += str;
+    }
+
+    void encodeArguments( QByteArray & buffer, const char * fmt, va_list args ) {
+        FormatSpec spec;
+        for ( const char * p = fmt ; *p ; ) {
+            if ( *p++ != '%' )
+                continue;
+            if ( *p == '%' ) {
+                ++p;
+                continue;
+            }
+            p = parseFormatSpec( p, spec ); // isEncodable() has checked it
+            if ( spec.widthFromArgument ) {
+                buffer += char( SignedTag );
+                put<qint64>( buffer, va_arg( args, int ) );
+            }
+            if ( spec.precisionFromArgument ) {
+                buffer += char( SignedTag );
+                put<qint64>( buffer, va_arg( args, int ) );
+            }
+            if ( spec.isSigned() ) {
+                qint64 value;
+                if ( spec.length == "l" )
+                    value = va_arg( args, long );
+                else if ( spec.length == "ll" || spec.length == "q" || spec.length == "j" )
+                    value = va_arg( args, qint64 );
+                else if ( spec.length == "z" || spec.length == "t" )
+                    value = va_arg( args, qptrdiff );
+                else
+                    value = va_arg( args, int ); // also covers h and hh, which are promoted
+                buffer += char( SignedTag );
+                put<qint64>( buffer, value );
+            } else if ( spec.isUnsigned() ) {
+                quint64 value;
+                if ( spec.length == "l" )
+                    value = va_arg( args, unsigned long );
+                else if ( spec.length == "ll" || spec.length == "q" || spec.length == "j" )
+                    value = va_arg( args, quint64 );
+                else if ( spec.length == "z" || spec.length == "t" )
+                    value = va_arg( args, quintptr );
+                else
+                    value = va_arg( args, unsigned int );
+                buffer += char( UnsignedTag );
+                put<quint64>( buffer, value );
+            } else if ( spec.isFloatingPoint() ) {
+                const double value = spec.length == "L" ? static_cast<double>( va_arg( args, long double ) ) : va_arg( args, double );
+                quint64 bits;
+                std::memcpy( &bits, &value, sizeof bits );
+                buffer += char( DoubleTag );
+                put<quint64>( buffer, bits );
+            } else if ( spec.isString() ) {
+                const char * const str = va_arg( args, const char * );
+                putString( buffer, str ? QByteArray( str ) : QByteArray( "(null)" ) );
+            } else if ( spec.isPointer() ) {
+                buffer += char( PointerTag );
+                put<quint64>( buffer, reinterpret_cast<quintptr>( va_arg( args, void * ) ) );
+            } else if ( spec.isCount() ) {
+                (void)va_arg( args, void * ); // %n writes, and we don't
+            }
+        }
+    }
+
+} // anon namespace
+
+/*!
+  \class KDBinaryLogDevice
+  \ingroup kdlog
+  \brief A KDLogDevice that writes a compact binary log.
+  \since_c 2.3
+
+  Instead of formatting each message into text, KDBinaryLogDevice
+  stores the printf-style format string once per session, and for
+  each entry only a reference to it, the raw arguments, the severity,
+  a monotonic timestamp (in nanoseconds since the device was created)
+  and the id of the logging thread. This avoids the cost of
+  formatting and encoding on the logging path, and makes the log a
+  lot smaller.
+
+  Use KDBinaryLogReader, or the \c kdlogdecoder tool built on it, to
+  turn the log back into text.
+
+  The binary encoding is only available when the device is used
+  directly by KDLog. Behind a KDCompositeLogDevice or a
+  KDAsyncLogDevice, it receives already formatted messages, which it
+  stores as a single string argument. The same happens for format
+  strings that use conversions it does not understand.
+
+  KDBinaryLogDevice is thread-safe. Entries are buffered and written
+  to the file in blocks, when an entry with severity KDLog::Error is
+  logged, when flush() is called, and when the device is destroyed.
+*/
+
+class KDBinaryLogDevice::Private : public KDLogDevice::Private {
+    friend class ::KDBinaryLogDevice;
+public:
+    Private( const QString & filename, QIODevice::OpenMode mode )
+        : KDLogDevice::Private(),
+          file( filename ),
+          formatsByAddress(),
+          formatsByContent(),
+          encodable(),
+          buffer(),
+          timer(),
+          mutex()
+    {
+        mode &= QIODevice::Append|QIODevice::Truncate;
+        mode |= QIODevice::WriteOnly;
+
+        if ( !file.open( mode ) ) {
+            fprintf( stderr, "KDBinaryLogDevice: Unable to open logfile %s: %s\n",
+                     qPrintable( file.fileName() ), qPrintable( file.errorString() ) );
+            return;
+        }
+
+        timer.start();
+        buffer += char( SessionRecord );
+        buffer.append( binaryLogMagic, sizeof binaryLogMagic );
+        buffer += char( binaryLogVersion );
+        put<qint64>( buffer, QDateTime::currentDateTime().toMSecsSinceEpoch() );
+    }
+
+    ~Private() {
+        writeBuffer();
+    }
+
+private:
+    enum {
+        BufferSize = 64 * 1024,
+        // format strings built at runtime each have an address of their own:
+        MaxFormatAddresses = 4096
+    };
+
+    quint32 intern( const char * fmt ) {
+        const QHash<const char*,quint32>::const_iterator it = formatsByAddress.constFind( fmt );
+        if ( it != formatsByAddress.constEnd() && qstrcmp( formats[*it], fmt ) == 0 )
+            return *it;
+
+        const QByteArray content( fmt );
+        quint32 id;
+        const QHash<QByteArray,quint32>::const_iterator cit = formatsByContent.constFind( content );
+        if ( cit != formatsByContent.constEnd() ) {
+            id = *cit;
+        } else {
+            id = formats.size();
+            formats.push_back( content );
+            encodable.push_back( isEncodable( fmt ) );
+            formatsByContent.insert( content, id );
+
+            buffer += char( FormatRecord );
+            put<quint32>( buffer, id );
+            put<quint32>( buffer, content.size() );
+            buffer += content;
+        }
+        if ( formatsByAddress.size() >= MaxFormatAddresses )
+            formatsByAddress.clear();
+        formatsByAddress.insert( fmt, id );
+        return id;
+    }
+
+    // Appends the record header and returns the offset of the
+    // argument length field, to be patched by finishEntry().
+    int beginEntry( quint32 id, KDLog::Severity severity ) {
+        buffer += char( EntryRecord );
+        put<quint32>( buffer, id );
+        put<quint16>( buffer, static_cast<int>( severity ) );
+        put<qint64>( buffer, timer.nsecsElapsed() );
+        put<quint64>( buffer, reinterpret_cast<quintptr>( QThread::currentThreadId() ) );
+        const int lengthOffset = buffer.size();
+        put<quint32>( buffer, 0 );
+        return lengthOffset;
+    }
+
+    void finishEntry( int lengthOffset, KDLog::Severity severity ) {
+        const int argumentsOffset = lengthOffset + sizeof( quint32 );
+        qToLittleEndian<quint32>( buffer.size() - argumentsOffset, reinterpret_cast<uchar*>( buffer.data() + lengthOffset ) );
+        if ( buffer.size() >= BufferSize || ( severity & KDLog::LevelMask ) >= KDLog::Error )
+            writeBuffer();
+    }
+
+    void logText( KDLog::Severity severity, const QString & msg ) {
+        static const char textFormat[] = "%s";
+        const int lengthOffset = beginEntry( intern( textFormat ), severity );
+        putString( buffer, msg.toUtf8() );
+        finishEntry( lengthOffset, severity );
+    }
+
+    bool writeBuffer() {
+        if ( buffer.isEmpty() || !file.isOpen() )
+            return true;
+        const bool ok = file.write( buffer ) == buffer.size() && file.flush();
+        buffer.clear();
+        return ok;
+    }
+
+private:
+    QFile file;
+    QHash<const char*,quint32> formatsByAddress;
+    QHash<QByteArray,quint32> formatsByContent;
+    QVector<QByteArray> formats;
+    QVector<bool> encodable;
+    QByteArray buffer;
+    QElapsedTimer timer;
+    QMutex mutex;
+};
+
+#define d d_func()
+
+/*!
+  Constructor. Opens \a filename for writing and starts a new session
+  in it. Only the QIODevice::Append and QIODevice::Truncate flags of
+  \a mode are respected; by default, the session is appended to an
+  existing log.
+*/
+KDBinaryLogDevice::KDBinaryLogDevice( const QString & filename, QIODevice::OpenMode mode )
+    : KDLogDevice( new Private( filename, mode ), false )
+{
+    init( false );
+}
+
+/*!
+  Destructor. Writes out the buffered entries and closes the file.
+*/
+KDBinaryLogDevice::~KDBinaryLogDevice() {}
+
+void KDBinaryLogDevice::init( bool ) {}
+
+/*!
+  Writes all buffered entries to the file. Returns \c false if that
+  failed.
+*/
+bool KDBinaryLogDevice::flush() {
+    const QMutexLocker locker( &d->mutex );
+    return d->writeBuffer();
+}
+
+/*!
+  Reimplemented from \ref KDLogDevice. Stores \a msg as an entry with
+  format \c "%s".
+*/
+void KDBinaryLogDevice::log( KDLog::Severity severity, const QString & msg ) {
+    const QMutexLocker locker( &d->mutex );
+    if ( d->file.isOpen() )
+        d->logText( severity, msg );
+}
+
+/*!
+  Reimplemented from \ref KDLogDevice. Stores a reference to \a fmt
+  and the arguments in \a args, without formatting them.
+*/
+void KDBinaryLogDevice::logv( KDLog::Severity severity, const char * fmt, va_list args ) {
+    if ( !fmt )
+        return;
+    const QMutexLocker locker( &d->mutex );
+    if ( !d->file.isOpen() )
+        return;
+    const quint32 id = d->intern( fmt );
+    if ( !d->encodable[id] ) {
+        d->logText( severity, QString().vsprintf( fmt, args ) );
+        return;
+    }
+    const int lengthOffset = d->beginEntry( id, severity );
+    encodeArguments( d->buffer, fmt, args );
+    d->finishEntry( lengthOffset, severity );
+}
+
+#undef d
+
+//
+// KDBinaryLogReader
+//
+
+/*!
+  \class KDBinaryLogReader
+  \ingroup kdlog
+  \brief Reads the logs written by KDBinaryLogDevice.
+  \since_c 2.3
+
+  \code
+  KDBinaryLogReader reader( QLatin1String( "app.kdblog" ) );
+  KDBinaryLogReader::Record record;
+  while ( reader.readNext( &record ) )
+      printf( "%s\n", qPrintable( record.message ) );
+  if ( !reader.errorString().isEmpty() )
+      ...
+  \endcode
+*/
+
+/*!
+  \class KDBinaryLogReader::Record
+  \brief One log entry, as returned by KDBinaryLogReader::readNext().
+
+  \a timestamp is the number of nanoseconds since the writing
+  KDBinaryLogDevice was created, \a time the corresponding wall-clock
+  time. \a threadId identifies the logging thread, as returned by
+  QThread::currentThreadId(). \a message is the formatted message.
+*/
+
+class KDBinaryLogReader::Private {
+    friend class ::KDBinaryLogReader;
+public:
+    explicit Private( const QString & filename )
+        : file( filename ), stream(), formats(), start(), error()
+    {
+        if ( !file.open( QIODevice::ReadOnly ) ) {
+            error = file.errorString();
+            return;
+        }
+        stream.setDevice( &file );
+        stream.setByteOrder( QDataStream::LittleEndian );
+    }
+
+private:
+    // whether the file has \a length more bytes, checked before allocating them
+    bool hasBytes( quint32 length ) const {
+        return stream.status() == QDataStream::Ok && length <= quint64( file.size() - file.pos() );
+    }
+
+    bool fail( const char * what ) {
+        error = QString::fromLatin1( "%1: corrupt log at offset %2 (%3)" )
+            .arg( file.fileName() ).arg( file.pos() ).arg( QLatin1String( what ) );
+        return false;
+    }
+
+    QString render( const QByteArray & fmt, const QByteArray & arguments ) const;
+
+private:
+    QFile file;
+    QDataStream stream;
+    QHash<quint32,QByteArray> formats;
+    QDateTime start;
+    QString error;
+};
+
+namespace {
+
+    class ArgumentReader {
+    public:
+        explicit ArgumentReader( const QByteArray & ba )
+            : p( reinterpret_cast<const uchar*>( ba.constData() ) ), end( p + ba.size() ) {}
+
+        bool read( char expected, quint64 & value ) {
+            if ( end - p < 9 || *p != expected )
+                return false;
+            value = qFromLittleEndian<quint64>( p + 1 );
+            p += 9;
+            return true;
+        }
+
+        bool readString( QByteArray & str ) {
+            if ( end - p < 5 || *p != StringTag )
+                return false;
+            const quint32 len = qFromLittleEndian<quint32>( p + 1 );
+            if ( quint32( end - p - 5 ) < len )
+                return false;
+            str = QByteArray( reinterpret_cast<const char*>( p + 5 ), len );
+            p += 5 + len;
+            return true;
+        }
+
+    private:
+        const uchar * p;
+        const uchar * const end;
+    };
+
+    QByteArray formatOne( const char * spec, ... ) {
+        va_list args;
+        va_start( args, spec );
+        QByteArray result( 256, '\0' );
+        int n = qvsnprintf( result.data(), result.size(), spec, args );
+        va_end( args );
+        if ( n >= result.size() ) {
+            result.resize( n + 1 );
+            va_start( args, spec );
+            n = qvsnprintf( result.data(), result.size(), spec, args );
+            va_end( args );
+        }
+        result.resize( qMax( n, 0 ) );
+        return result;
+    }
+
+}
+
+QString KDBinaryLogReader::Private::render( const QByteArray & fmt, const QByteArray & arguments ) const {
+    ArgumentReader reader( arguments );
+    QByteArray result;
+    FormatSpec spec;
+    for ( const char * p = fmt.constData() ; *p ; ) {
+        if ( *p != '%' ) {
+            result += *p++;
+            continue;
+        }
+        if ( *++p == '%' ) {
+            result += *p++;
+            continue;
+        }
+        if ( !( p = parseFormatSpec( p, spec ) ) )
+            break;
+
+        quint64 value;
+        QByteArray s = '%' + spec.flags;
+        if ( spec.widthFromArgument ) {
+            if ( !reader.read( SignedTag, value ) )
+                break;
+            s += QByteArray::number( static_cast<qint64>( value ) );
+        } else {
+            s += spec.width;
+        }
+        if ( spec.precisionFromArgument ) {
+            if ( !reader.read( SignedTag, value ) )
+                break;
+            s += '.' + QByteArray::number( static_cast<qint64>( value ) );
+        } else {
+            s += spec.precision;
+        }
+
+        if ( spec.isSigned() ) {
+            if ( !reader.read( SignedTag, value ) )
+                break;
+            result += formatOne( ( s + "ll" + spec.conversion ).constData(), static_cast<qint64>( value ) );
+        } else if ( spec.isUnsigned() ) {
+            if ( !reader.read( UnsignedTag, value ) )
+                break;
+            if ( spec.conversion == 'c' )
+                result += formatOne( ( s + 'c' ).constData(), static_cast<int>( value ) );
+            else
+                result += formatOne( ( s + "ll" + spec.conversion ).constData(), value );
+        } else if ( spec.isFloatingPoint() ) {
+            if ( !reader.read( DoubleTag, value ) )
+                break;
+            double dbl;
+            std::memcpy( &dbl, &value, sizeof dbl );
+            result += formatOne( ( s + spec.conversion ).constData(), dbl );
+        } else if ( spec.isString() ) {
+            QByteArray str;
+            if ( !reader.readString( str ) )
+                break;
+            result += formatOne( ( s + 's' ).constData(), str.constData() );
+        } else if ( spec.isPointer() ) {
+            if ( !reader.read( PointerTag, value ) )
+                break;
+            result += "0x" + QByteArray::number( value, 16 );
+        }
+    }
+    return QString::fromUtf8( result.constData(), result.size() );
+}
+
+/*!
+  Constructor. Opens \a filename for reading.
+*/
+KDBinaryLogReader::KDBinaryLogReader( const QString & filename )
+    : d( new Private( filename ) )
+{
+}
+
+/*!
+  Destructor.
+*/
+KDBinaryLogReader::~KDBinaryLogReader() {}
+
+/*!
+  Returns whether the file could be opened.
+*/
+bool KDBinaryLogReader::isOpen() const {
+    return d->file.isOpen();
+}
+
+/*!
+  Returns a description of the last error, or an empty string if
+  there was none.
+*/
+QString KDBinaryLogReader::errorString() const {
+    return d->error;
+}
+
+/*!
+  Reads the next entry into \a record. Returns \c false at the end of
+  the file, or if the file is corrupt; in that case, errorString()
+  describes the problem.
+*/
+bool KDBinaryLogReader::readNext( Record * record ) {
+    if ( !record || !d->file.isOpen() || !d->error.isEmpty() )
+        return false;
+
+    while ( !d->stream.atEnd() ) {
+        quint8 type;
+        d->stream >> type;
+        switch ( type ) {
+        case SessionRecord: {
+            char magic[sizeof binaryLogMagic];
+            quint8 version;
+            qint64 msecs;
+            if ( d->stream.readRawData( magic, sizeof magic ) != int( sizeof magic )
+                 || std::memcmp( magic, binaryLogMagic, sizeof magic ) != 0 )
+                return d->fail( "bad magic" );
+            d->stream >> version >> msecs;
+            if ( version != binaryLogVersion )
+                return d->fail( "unsupported version" );
+            d->formats.clear();
+            d->start = QDateTime::fromMSecsSinceEpoch( msecs );
+            break;
+        }
+        case FormatRecord: {
+            quint32 id, length;
+            d->stream >> id >> length;
+            if ( !d->hasBytes( length ) )
+                return d->fail( "truncated format" );
+            QByteArray fmt( length, Qt::Uninitialized );
+            if ( d->stream.readRawData( fmt.data(), length ) != static_cast<int>( length ) )
+                return d->fail( "truncated format" );
+            d->formats.insert( id, fmt );
+            break;
+        }
+        case EntryRecord: {
+            quint32 id, length;
+            quint16 severity;
+            qint64 nsecs;
+            quint64 thread;
+            d->stream >> id >> severity >> nsecs >> thread >> length;
+            if ( !d->hasBytes( length ) )
+                return d->fail( "truncated entry" );
+            QByteArray arguments( length, Qt::Uninitialized );
+            if ( d->stream.readRawData( arguments.data(), length ) != static_cast<int>( length ) )
+                return d->fail( "truncated entry" );
+            const QHash<quint32,QByteArray>::const_iterator it = d->formats.constFind( id );
+            if ( it == d->formats.constEnd() )
+                return d->fail( "unknown format id" );
+            record->severity = KDLog::Severity( QFlag( severity ) );
+            record->timestamp = nsecs;
+            record->time = d->start.addMSecs( nsecs / 1000000 );
+            record->threadId = thread;
+            record->message = d->render( *it, arguments );
+            return true;
+        }
+        default:
+            return d->fail( "unknown record type" );
+        }
+        if ( d->stream.status() != QDataStream::Ok )
+            return d->fail( "truncated record" );
+    }
+    return false;
+}
+
+#ifdef KDTOOLSCORE_UNITTESTS
+
+#include <KDUnitTest/Test>
+
+#include <QUuid>
+
+KDAB_UNITTEST_SIMPLE( KDBinaryLogDevice, "kdtools/core" ) {
+    const QString filename = QString::fromLatin1( "kdbinarylogdevice-test%1" ).arg( QUuid::createUuid().toString() );
+
+    {
+        KDLog log( new KDBinaryLogDevice( filename, QIODevice::Truncate ) );
+        log.logInfo( "plain" );
+        log.logDebug( "%d|%5u|%-4x|%lld", -1, 42u, 255u, Q_INT64_C(1) << 40 );
+        log.logWarning( "%.2f|%*d|%.3s|%c|%%", 3.14159, 4, 7, "abcdef", 'z' );
+        log.logError( "%s", static_cast<const char *>( 0 ) );
+        log.logInfo( "%ls", QString::fromUtf8( "wide \xc3\xa4" ).utf16() ); // UTF-16, as in Qt
+    }
+    {
+        // a second session, appended, and text passed in pre-formatted
+        KDBinaryLogDevice dev( filename );
+        dev.log( KDLog::Info, QString::fromUtf8( "pre-formatted \xc3\xa4" ) );
+    }
+
+    KDBinaryLogReader reader( filename );
+    assertTrue( reader.isOpen() );
+    KDBinaryLogReader::Record r;
+
+    assertTrue( reader.readNext( &r ) );
+    assertEqual( int( r.severity ), int( KDLog::Info ) );
+    assertTrue( r.message == QLatin1String( "plain" ) );
+
+    assertTrue( reader.readNext( &r ) );
+    assertEqual( int( r.severity ), int( KDLog::Debug ) );
+    assertTrue( r.message == QLatin1String( "-1|   42|ff  |1099511627776" ) );
+
+    qint64 previous = r.timestamp;
+    assertTrue( reader.readNext( &r ) );
+    assertGreaterOrEqual( r.timestamp, previous );
+    assertTrue( r.message == QLatin1String( "3.14|   7|abc|z|%" ) );
+
+    assertTrue( reader.readNext( &r ) );
+    assertEqual( int( r.severity ), int( KDLog::Error ) );
+    assertTrue( r.message == QLatin1String( "(null)" ) );
+
+    assertTrue( reader.readNext( &r ) );
+    assertTrue( r.message == QString::fromUtf8( "wide \xc3\xa4" ) );
+
+    assertTrue( reader.readNext( &r ) );
+    assertTrue( r.message == QString::fromUtf8( "pre-formatted \xc3\xa4" ) );
+
+    assertFalse( reader.readNext( &r ) );
+    assertTrue( reader.errorString().isEmpty() );
+
+    assertTrue( QFile::remove( filename ) );
+
+    // a length field beyond the end of the file is corrupt, and not allocated
+    {
+        QByteArray data( "H" );
+        data.append( binaryLogMagic, sizeof binaryLogMagic );
+        data += char( binaryLogVersion );
+        put<qint64>( data, 0 );
+        data += char( FormatRecord );
+        put<quint32>( data, 0 );
+        put<quint32>( data, 0xfffffff0u );
+        data += "%s";
+        QFile file( filename );
+        assertTrue( file.open( QIODevice::WriteOnly ) );
+        assertEqual( file.write( data ), qint64( data.size() ) );
+    }
+    {
+        KDBinaryLogReader corrupt( filename );
+        assertFalse( corrupt.readNext( &r ) );
+        assertFalse( corrupt.errorString().isEmpty() );
+    }
+    assertTrue( QFile::remove( filename ) );
+}
+
+#endif // KDTOOLSCORE_UNITTESTS
@@ -0,0 +1,545 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+
+#include "kdlog.h"
+#include "kdlog_p.h"
+
+#include "kdatomic.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+#include <QtEndian>
+
+#include <cstdio>
+#include <cstring>
+
+/*
+  File format (all integers little-endian):
+
+    Header, HeaderSize bytes:
+      char[8] magic="KDMMRING" u32 version u32 headerSize u64 capacity
+      u64 head u64 tail u64 nextSequence, padded with zeros
+
+    Ring, capacity bytes (a multiple of 8). head and tail are absolute
+    byte positions that only ever grow; a position p lives at offset
+    p % capacity of the ring. The records between head and tail are
+    valid; everything else is free or being overwritten.
+
+    Record, RecordHeaderSize bytes plus the payload, padded to 8 bytes:
+      u32 RecordMagic u32 length u64 sequence i64 usecsSinceEpoch
+      u64 threadId u32 severity u32 reserved byte[length] (UTF-8)
+
+    Wrap marker:
+      u32 WrapMagic
+        The rest of the ring up to its end is unused, the next record
+        starts at offset 0.
+
+  The writer moves head past the records it is about to overwrite
+  before touching them, and moves tail past a new record only after
+  writing it, so the header always describes complete records, even
+  if the process dies in the middle of log().
+*/
+
+static const char mmapRingMagic[8] = { 'K', 'D', 'M', 'M', 'R', 'I', 'N', 'G' };
+static const quint32 mmapRingVersion = 1;
+
+enum {
+    HeaderSize = 64,
+    RecordHeaderSize = 40,
+    MinimumSize = HeaderSize + 4096
+};
+
+enum HeaderOffset {
+    MagicOffset = 0,
+    VersionOffset = 8,
+    HeaderSizeOffset = 12,
+    CapacityOffset = 16,
+    HeadOffset = 24,
+    TailOffset = 32,
+    NextSequenceOffset = 40
+};
+
+static const quint32 RecordMagic = 0x5252444bU; // "KDRR"
+static const quint32 WrapMagic   = 0x5757444bU; // "KDWW"
+
+static inline quint64 align8( quint64 n ) {
+    return ( n + 7 ) & ~Q_UINT64_C(7);
+}
+
+static inline quint32 get32( const uchar * p ) { return qFromLittleEndian<quint32>( p ); }
+static inline quint64 get64( const uchar * p ) { return qFromLittleEndian<quint64>( p ); }
+static inline void put32( uchar * p, quint32 v ) { qToLittleEndian<quint32>( v, p ); }
+static inline void put64( uchar * p, quint64 v ) { qToLittleEndian<quint64>( v, p ); }
+
+// Returns the position of the record after the one at \a pos.
+static quint64 nextRecordPosition( const uchar * ring, quint64 capacity, quint64 pos ) {
+    const quint64 offset = pos % capacity;
+    if ( capacity - offset < RecordHeaderSize || get32( ring + offset ) != RecordMagic )
+        return pos + ( capacity - offset ); // wrap marker
+    return pos + RecordHeaderSize + align8( get32( ring + offset + 4 ) );
+}
+
+//
+// KDMmapRingLogDevice
+//
+
+/*!
+  \class KDMmapRingLogDevice
+  \ingroup kdlog
+  \brief A KDLogDevice that keeps the most recent entries in a memory-mapped file.
+  \since_c 2.3
+
+  KDMmapRingLogDevice is a flight recorder: it maps a file of fixed
+  size() into memory and uses it as a circular buffer, overwriting the
+  oldest entries once it is full. Logging an entry is a copy into the
+  mapping, without any system call, yet as the operating system owns
+  the pages, the entries survive if the process crashes. (They do not
+  necessarily survive if the whole system goes down.)
+
+  Use KDMmapRingLogReader, or the \c kdmmaplogextract tool built on it,
+  to get the entries back in the order they were logged. That works
+  while the device is still writing, too, but the reader then only
+  sees a snapshot, which may be torn at the oldest entries.
+
+  \code
+  KDCompositeLogDevice * devices = new KDCompositeLogDevice;
+  devices->addLogDevice( new KDFileLogDevice( QLatin1String( "app.log" ) ) );
+  devices->addLogDevice( new KDMmapRingLogDevice( QLatin1String( "app.flightrec" ), 16*1024*1024 ) );
+  KDLog log( devices );
+  \endcode
+
+  If the file exists and was written with the same size, new entries
+  are appended to the ones already in it; otherwise, it is
+  reinitialised. Messages are stored as UTF-8; a message longer than
+  a quarter of the ring is truncated.
+
+  KDMmapRingLogDevice is thread-safe.
+*/
+
+class KDMmapRingLogDevice::Private : public KDLogDevice::Private {
+    friend class ::KDMmapRingLogDevice;
+public:
+    Private( const QString & filename, qint64 size )
+        : KDLogDevice::Private(),
+          file( filename ),
+          map( 0 ),
+          ring( 0 ),
+          capacity( 0 ),
+          head( 0 ),
+          tail( 0 ),
+          nextSequence( 0 ),
+          error(),
+          mutex()
+    {
+        size = HeaderSize + ( qMax<qint64>( size, MinimumSize ) - HeaderSize ) / 8 * 8;
+
+        if ( !file.open( QIODevice::ReadWrite ) ) {
+            fail();
+            return;
+        }
+        const bool reuse = file.size() == size;
+        if ( ( !reuse && !file.resize( size ) ) || !( map = file.map( 0, size ) ) ) {
+            fail();
+            return;
+        }
+
+        ring = map + HeaderSize;
+        capacity = size - HeaderSize;
+
+        if ( reuse && isValid() ) {
+            head = get64( map + HeadOffset );
+            tail = get64( map + TailOffset );
+            nextSequence = get64( map + NextSequenceOffset );
+            return;
+        }
+
+        std::memset( map, 0, HeaderSize );
+        std::memcpy( map + MagicOffset, mmapRingMagic, sizeof mmapRingMagic );
+        put32( map + VersionOffset, mmapRingVersion );
+        put32( map + HeaderSizeOffset, HeaderSize );
+        put64( map + CapacityOffset, capacity );
+        put64( map + HeadOffset, 0 );
+        put64( map + TailOffset, 0 );
+        put64( map + NextSequenceOffset, 0 );
+    }
+
+    ~Private() {
+        if ( map )
+            file.unmap( map );
+    }
+
+private:
+    void fail() {
+        error = file.errorString();
+        fprintf( stderr, "KDMmapRingLogDevice: Unable to map logfile %s: %s\n",
+                 qPrintable( file.fileName() ), qPrintable( error ) );
+        if ( map )
+            file.unmap( map );
+        map = ring = 0;
+        file.close();
+    }
+
+    bool isValid() const {
+        const quint64 h = get64( map + HeadOffset );
+        const quint64 t = get64( map + TailOffset );
+        return std::memcmp( map + MagicOffset, mmapRingMagic, sizeof mmapRingMagic ) == 0
+            && get32( map + VersionOffset ) == mmapRingVersion
+            && get32( map + HeaderSizeOffset ) == HeaderSize
+            && get64( map + CapacityOffset ) == capacity
+            && h <= t && t - h <= capacity && h % 8 == 0 && t % 8 == 0;
+    }
+
+    // Moves head forward until [head, end) fits into the ring.
+    void makeRoom( quint64 end ) {
+        if ( end - head <= capacity )
+            return;
+        while ( head < tail && end - head > capacity )
+            head = nextRecordPosition( ring, capacity, head );
+        if ( head > tail ) // only if the file was damaged
+            head = tail;
+        put64( map + HeadOffset, head );
+    }
+
+    void append( KDLog::Severity severity, const QByteArray & utf8 ) {
+        quint32 length = qMin<quint64>( utf8.size(), capacity / 4 - RecordHeaderSize );
+        if ( length < quint32( utf8.size() ) ) // don't cut a UTF-8 sequence in half
+            while ( length > 0 && ( utf8[length] & 0xC0 ) == 0x80 )
+                --length;
+        const quint64 needed = RecordHeaderSize + align8( length );
+
+        quint64 pos = tail;
+        quint64 offset = pos % capacity;
+        if ( capacity - offset < needed ) {
+            makeRoom( pos + ( capacity - offset ) + needed );
+            put32( ring + offset, WrapMagic );
+            pos += capacity - offset;
+            offset = 0;
+        } else {
+            makeRoom( pos + needed );
+        }
+
+        uchar * const p = ring + offset;
+        put32( p, RecordMagic );
+        put32( p + 4, length );
+        put64( p + 8, nextSequence );
+        put64( p + 16, kdlog_current_usecs_since_epoch() );
+        put64( p + 24, reinterpret_cast<quintptr>( QThread::currentThreadId() ) );
+        put32( p + 32, severity );
+        put32( p + 36, 0 );
+        std::memcpy( p + RecordHeaderSize, utf8.constData(), length );
+
+        tail = pos + needed;
+        ++nextSequence;
+        // a reader in another process must not see the new tail
+        // before the record it covers:
+        kdtools::atomicFence();
+        put64( map + NextSequenceOffset, nextSequence );
+        put64( map + TailOffset, tail );
+    }
+
+private:
+    QFile file;
+    uchar * map;
+    uchar * ring;
+    quint64 capacity;
+    quint64 head;
+    quint64 tail;
+    quint64 nextSequence;
+    QString error;
+    QMutex mutex;
+};
+
+#define d d_func()
+
+/*!
+  Constructor. Maps \a filename, creating or resizing it to \a size
+  bytes if needed. \a size includes a small header and is rounded to
+  a usable value; there is a lower limit of a few kilobytes.
+*/
+KDMmapRingLogDevice::KDMmapRingLogDevice( const QString & filename, qint64 size )
+    : KDLogDevice( new Private( filename, size ), false )
+{
+    init( false );
+}
+
+void KDMmapRingLogDevice::init( bool ) {}
+
+/*!
+  Destructor. Unmaps the file; the operating system writes it back.
+*/
+KDMmapRingLogDevice::~KDMmapRingLogDevice() {}
+
+/*!
+  Returns whether the file could be mapped.
+*/
+bool KDMmapRingLogDevice::isOpen() const {
+    return d->map != 0;
+}
+
+/*!
+  Returns a description of the error that occurred while mapping the
+  file, or an empty string if there was none.
+*/
+QString KDMmapRingLogDevice::errorString() const {
+    return d->error;
+}
+
+/*!
+  Returns the size of the file, header included, or 0 if it could not
+  be mapped.
+*/
+qint64 KDMmapRingLogDevice::size() const {
+    return d->map ? HeaderSize + d->capacity : 0;
+}
+
+/*!
+  Reimplemented from \ref KDLogDevice. This function is thread-safe.
+*/
+void KDMmapRingLogDevice::log( KDLog::Severity severity, const QString & msg ) {
+    const QByteArray utf8 = msg.toUtf8();
+    const QMutexLocker locker( &d->mutex );
+    if ( d->map )
+        d->append( severity, utf8 );
+}
+
+#undef d
+
+//
+// KDMmapRingLogReader
+//
+
+/*!
+  \class KDMmapRingLogReader
+  \ingroup kdlog
+  \brief Reads the entries a KDMmapRingLogDevice left in its file.
+  \since_c 2.3
+
+  The reader takes a copy of the file when it is constructed, and
+  returns the entries it contains, oldest first.
+
+  \code
+  KDMmapRingLogReader reader( QLatin1String( "app.flightrec" ) );
+  KDMmapRingLogReader::Record record;
+  while ( reader.readNext( &record ) )
+      printf( "%s\n", qPrintable( record.message ) );
+  if ( !reader.errorString().isEmpty() )
+      ...
+  \endcode
+*/
+
+/*!
+  \struct KDMmapRingLogReader::Record
+  \brief One log entry, as returned by KDMmapRingLogReader::readNext().
+
+  \a sequence numbers the entries written to the file, starting at 0;
+  gaps tell that older entries were overwritten. \a usecsSinceEpoch
+  is the wall-clock time the entry was logged at, in microseconds
+  since 1970-01-01T00:00:00 UTC, with the resolution of the system
+  clock (on Windows, that of GetSystemTimeAsFileTime()). \a time is
+  the same, truncated to the milliseconds QDateTime can hold. \a threadId identifies the logging thread,
+  as returned by QThread::currentThreadId().
+*/
+
+class KDMmapRingLogReader::Private {
+    friend class ::KDMmapRingLogReader;
+public:
+    explicit Private( const QString & filename )
+        : data(), capacity( 0 ), pos( 0 ), tail( 0 ), open( false ), error()
+    {
+        QFile file( filename );
+        if ( !file.open( QIODevice::ReadOnly ) ) {
+            error = file.errorString();
+            return;
+        }
+        data = file.readAll();
+        open = true;
+
+        const uchar * const map = reinterpret_cast<const uchar*>( data.constData() );
+        if ( data.size() < HeaderSize
+             || std::memcmp( map + MagicOffset, mmapRingMagic, sizeof mmapRingMagic ) != 0 ) {
+            fail( "bad magic" );
+            return;
+        }
+        if ( get32( map + VersionOffset ) != mmapRingVersion ) {
+            fail( "unsupported version" );
+            return;
+        }
+        capacity = get64( map + CapacityOffset );
+        pos = get64( map + HeadOffset );
+        tail = get64( map + TailOffset );
+        if ( get32( map + HeaderSizeOffset ) != HeaderSize
+             || capacity == 0 || capacity % 8 != 0
+             || quint64( data.size() ) != HeaderSize + capacity
+             || pos > tail || tail - pos > capacity || pos % 8 != 0 )
+            fail( "bad header" );
+    }
+
+private:
+    bool fail( const char * what ) {
+        error = QString::fromLatin1( "corrupt flight recording at position %1 (%2)" )
+            .arg( pos ).arg( QLatin1String( what ) );
+        return false;
+    }
+
+    const uchar * ring() const {
+        return reinterpret_cast<const uchar*>( data.constData() ) + HeaderSize;
+    }
+
+private:
+    QByteArray data;
+    quint64 capacity;
+    quint64 pos;
+    quint64 tail;
+    bool open;
+    QString error;
+};
+
+/*!
+  Constructor. Reads \a filename.
+*/
+KDMmapRingLogReader::KDMmapRingLogReader( const QString & filename )
+    : d( new Private( filename ) )
+{
+}
+
+/*!
+  Destructor.
+*/
+KDMmapRingLogReader::~KDMmapRingLogReader() {}
+
+/*!
+  Returns whether the file could be opened.
+*/
+bool KDMmapRingLogReader::isOpen() const {
+    return d->open;
+}
+
+/*!
+  Returns a description of the last error, or an empty string if
+  there was none.
+*/
+QString KDMmapRingLogReader::errorString() const {
+    return d->error;
+}
+
+/*!
+  Reads the next entry into \a record. Returns \c false after the
+  newest entry, or if the file is corrupt; in that case, errorString()
+  describes the problem.
+*/
+bool KDMmapRingLogReader::readNext( Record * record ) {
+    if ( !record || !d->open || !d->error.isEmpty() )
+        return false;
+
+    while ( d->pos < d->tail ) {
+        const quint64 offset = d->pos % d->capacity;
+        const uchar * const p = d->ring() + offset;
+        if ( d->capacity - offset < RecordHeaderSize || get32( p ) == WrapMagic ) {
+            d->pos += d->capacity - offset;
+            continue;
+        }
+        if ( get32( p ) != RecordMagic )
+            return d->fail( "bad record magic" );
+        const quint32 length = get32( p + 4 );
+        const quint64 next = d->pos + RecordHeaderSize + align8( length );
+        if ( length > d->capacity - offset - RecordHeaderSize || next > d->tail )
+            return d->fail( "bad record length" );
+
+        record->severity = KDLog::Severity( QFlag( get32( p + 32 ) ) );
+        record->sequence = get64( p + 8 );
+        record->usecsSinceEpoch = get64( p + 16 );
+        record->time = QDateTime::fromMSecsSinceEpoch( record->usecsSinceEpoch / 1000 );
+        record->threadId = get64( p + 24 );
+        record->message = QString::fromUtf8( reinterpret_cast<const char*>( p + RecordHeaderSize ), length );
+        d->pos = next;
+        return true;
+    }
+    return false;
+}
+
+#ifdef KDTOOLSCORE_UNITTESTS
+
+#include <KDUnitTest/Test>
+
+#include <QUuid>
+
+KDAB_UNITTEST_SIMPLE( KDMmapRingLogDevice, "kdtools/core" ) {
+    const QString filename = QString::fromLatin1( "kdmmapringlogdevice-test%1" ).arg( QUuid::createUuid().toString() );
+    const int Entries = 1000;
+
+    {
+        KDMmapRingLogDevice dev( filename, 0 );
+        assertTrue( dev.isOpen() );
+        assertEqual( dev.size(), qint64( MinimumSize ) );
+        const qint64 before = QDateTime::currentDateTime().toMSecsSinceEpoch() * 1000;
+        dev.log( KDLog::Warning, QString::fromUtf8( "first \xc3\xa4" ) );
+        const qint64 after = ( QDateTime::currentDateTime().toMSecsSinceEpoch() + 1 ) * 1000;
+        {
+            KDMmapRingLogReader reader( filename );
+            KDMmapRingLogReader::Record r;
+            assertTrue( reader.readNext( &r ) );
+            assertEqual( int( r.severity ), int( KDLog::Warning ) );
+            assertGreaterOrEqual( r.usecsSinceEpoch, before );
+            assertLess( r.usecsSinceEpoch, after );
+            assertEqual( r.time.toMSecsSinceEpoch(), r.usecsSinceEpoch / 1000 );
+            assertTrue( r.message == QString::fromUtf8( "first \xc3\xa4" ) );
+            assertFalse( reader.readNext( &r ) );
+        }
+        for ( int i = 1 ; i < Entries ; ++i )
+            dev.log( KDLog::Info, QString::fromLatin1( "entry %1" ).arg( i ) );
+    }
+    {
+        // reopened with the same size, appends
+        KDMmapRingLogDevice dev( filename, MinimumSize );
+        dev.log( KDLog::Error, QLatin1String( "last" ) );
+        dev.log( KDLog::Info, QString( MinimumSize, QLatin1Char( 'x' ) ) );
+    }
+
+    KDMmapRingLogReader reader( filename );
+    assertTrue( reader.isOpen() );
+    KDMmapRingLogReader::Record r;
+    quint64 previous = 0;
+    int count = 0;
+    while ( reader.readNext( &r ) ) {
+        if ( count++ )
+            assertEqual( r.sequence, previous + 1 );
+        previous = r.sequence;
+        if ( r.sequence > 0 && r.sequence < Entries )
+            assertTrue( r.message == QString::fromLatin1( "entry %1" ).arg( r.sequence ) );
+        else if ( r.sequence == Entries )
+            assertTrue( r.message == QLatin1String( "last" ) );
+    }
+    assertTrue( reader.errorString().isEmpty() );
+    assertTrue( count > 1 );
+    assertTrue( count < Entries );
+    assertEqual( previous, quint64( Entries + 1 ) );
+    assertEqual( r.message.size(), ( MinimumSize - HeaderSize ) / 4 - RecordHeaderSize );
+
+    assertTrue( QFile::remove( filename ) );
+}
+
+#endif // KDTOOLSCORE_UNITTESTS
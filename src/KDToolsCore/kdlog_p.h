@@ -25,7 +25,60 @@
 
 #include "kdlog.h"
 
-class KDLogDevice::Private {};
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QVector>
+
+class KDLogDevice::Private {
+    friend class ::KDLogDevice;
+public:
+    Private() : minimumSeverity( KDLog::Info ) {}
+    virtual ~Private() {}
+private:
+    QAtomicInt minimumSeverity;
+};
+
+struct KDLogBufferedEntry {
+    KDLogBufferedEntry() : prefix( "" ), message() {}
+    KDLogBufferedEntry( const char * p, const QByteArray & m ) : prefix( p ), message( m ) {}
+
+    const char * prefix;
+    QByteArray message;
+};
+
+// Writes "<prefix><message>\n" for each entry to \a fd, with as few
+// syscalls as the platform allows. Implemented in kdlog_{unix,win}.cpp.
+bool kdlog_write_entries( int fd, const KDLogBufferedEntry * entries, int count );
+
+// Returns the wall-clock time in microseconds since the epoch (UTC),
+// without QDateTime's time zone handling. Implemented in
+// kdlog_{unix,win}.cpp.
+qint64 kdlog_current_usecs_since_epoch();
+
+class KDLogWriteBuffer {
+public:
+    KDLogWriteBuffer();
+
+    bool isEnabled() const { return capacity > 0; }
+    bool isEmpty() const { return entries.isEmpty(); }
+
+    // Returns whether the buffer should be flushed now.
+    bool append( KDLog::Severity severity, const char * prefix, const QByteArray & msg );
+
+    bool writeTo( int fd );
+    QByteArray takeAll();
+
+public:
+    int capacity;
+    int interval;
+    KDLog::Severity flushSeverity;
+
+private:
+    QVector<KDLogBufferedEntry> entries;
+    int bytes;
+    QElapsedTimer age;
+};
 
 class KDEncodingLogDevice::Private : public KDLogDevice::Private {
     friend class ::KDEncodingLogDevice;
@@ -25,16 +25,34 @@
 
 #include <QCoreApplication>
 #include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
 #include <QStringList>
 #include <QTextCodec>
+#include <QVarLengthArray>
 
 #include <syslog.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <ctime>
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
 
+#if defined(Q_OS_LINUX) && defined(_GNU_SOURCE) && defined(__GLIBC__) \
+    && ( __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 14 ) )
+# define KDLOG_HAVE_SENDMMSG
+#endif
+
 static QByteArray findSyslogIdentification() {
     // ### check QCoreApplication::applicationName() etc
     return QCoreApplication::arguments().at( 0 ).toLocal8Bit();
@@ -55,6 +73,231 @@ static inline char * mystrdup( const char * str ) {
     return strdup( str );
 }
 
+static int severityToSyslogPriority( KDLog::Severity severity ) {
+    switch( severity & KDLog::LevelMask ) {
+    case 0:              // flags only (Popup, User)
+    case KDLog::Info:    return LOG_INFO;
+    case KDLog::Debug:   return LOG_DEBUG;
+    case KDLog::Warning: return LOG_WARNING;
+    case KDLog::Error:   return LOG_ERR;
+    }
+    assert( !"KDSystemLogDevice::log: unknown Severity value encountered" );
+    return LOG_DEBUG;
+}
+
+#ifdef _PATH_LOG
+static const char syslogSocketPath[] = _PATH_LOG;
+#else
+static const char syslogSocketPath[] = "/dev/log";
+#endif
+
+static void callSyslog( int priority, const QByteArray & message ) {
+    syslog( priority, "%s", message.constData() );
+}
+
+namespace {
+    struct PendingDatagram {
+        PendingDatagram() : priority( LOG_DEBUG ), datagram(), message() {}
+        PendingDatagram( int p, const QByteArray & dg, const QByteArray & msg )
+            : priority( p ), datagram( dg ), message( msg ) {}
+        int priority;
+        QByteArray datagram; // RFC 3164 formatted
+        QByteArray message;  // as passed to doLogEncoded(), for falling back to syslog()
+    };
+
+    // The DirectDatagram mode of KDSystemLogDevice: formats messages
+    // the way syslog() does, given the same openlog() arguments, and
+    // sends them to the logger's socket without blocking.
+    class SyslogDatagramSender {
+        Q_DISABLE_COPY( SyslogDatagramSender )
+    public:
+        enum {
+            MaxPending = 1024,
+            MaxBatch = 64,
+            MaxDatagramSize = 8192,
+            RetryInterval = 1000 // msecs between connection attempts after a failed one
+        };
+
+        typedef void (*FallbackFunction)( int priority, const QByteArray & message );
+
+        // \a ident must outlive the sender. Messages that cannot be
+        // sent are passed to \a fallback (by default, syslog()).
+        SyslogDatagramSender( const char * path, const char * ident, int options, int facility,
+                              FallbackFunction fallback=callSyslog )
+            : socketPath( path ),
+              tag( ident ),
+              logOptions( options ),
+              logFacility( facility ),
+              fallbackFunction( fallback ),
+              retryInterval( RetryInterval ),
+              socket( -1 ),
+              pending(),
+              dropped( 0 ),
+              lastFailure()
+        {
+        }
+        ~SyslogDatagramSender() {
+            disconnectSocket();
+        }
+
+        int socketDescriptor() const { return socket; }
+        bool isEmpty() const { return pending.isEmpty(); }
+        int size() const { return pending.size(); }
+        int droppedCount() const { return dropped; }
+        void setRetryInterval( int msecs ) { retryInterval = msecs; }
+
+        // "<PRI>Mmm dd hh:mm:ss TAG[PID]: MSG", with the PID only if
+        // LOG_PID was passed to openlog().
+        QByteArray formatDatagram( int priority, const QByteArray & msg, time_t now ) const {
+            static const char months[12][4] = {
+                "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+            };
+            struct tm tm;
+            ::localtime_r( &now, &tm );
+            char header[64];
+            const int n = std::snprintf( header, sizeof header, "<%d>%s %2d %02d:%02d:%02d ",
+                                         logFacility | priority,
+                                         months[tm.tm_mon], tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec );
+            QByteArray result;
+            result.reserve( n + qstrlen( tag ) + msg.size() + 16 );
+            result.append( header, n );
+            result += tag;
+            if ( logOptions & LOG_PID ) {
+                result += '[';
+                result += QByteArray::number( static_cast<int>( ::getpid() ) );
+                result += ']';
+            }
+            result += ": ";
+            result += msg;
+            if ( result.size() > MaxDatagramSize )
+                result.truncate( MaxDatagramSize );
+            return result;
+        }
+
+        // Queues \a msg, discarding the oldest pending message if
+        // there are too many already.
+        void append( int priority, const QByteArray & msg ) {
+            if ( pending.size() >= MaxPending ) {
+                pending.removeFirst();
+                ++dropped;
+            }
+            pending.push_back( PendingDatagram( priority, formatDatagram( priority, msg, ::time( 0 ) ), msg ) );
+        }
+
+        void submit() {
+            // after a failure, don't try to connect for every message:
+            if ( socket < 0 && lastFailure.isValid() && lastFailure.elapsed() < retryInterval ) {
+                fallBack();
+                return;
+            }
+            if ( !connectSocket() || !sendPending() ) {
+                // the logger may have been restarted, so reconnect once:
+                disconnectSocket();
+                if ( !connectSocket() || !sendPending() ) {
+                    fallBack();
+                    lastFailure.start();
+                    return;
+                }
+            }
+            lastFailure.invalidate();
+        }
+
+        // Hands everything pending to syslog(), which blocks, but which
+        // knows how to reach the logger when we don't.
+        void fallBack() {
+            Q_FOREACH( const PendingDatagram & dg, pending )
+                fallbackFunction( dg.priority, dg.message );
+            pending.clear();
+            disconnectSocket();
+        }
+
+    private:
+        bool connectSocket() {
+            if ( socket >= 0 )
+                return true;
+            const int fd = ::socket( AF_UNIX, SOCK_DGRAM, 0 );
+            if ( fd < 0 )
+                return false;
+            ::fcntl( fd, F_SETFD, FD_CLOEXEC );
+            ::fcntl( fd, F_SETFL, ::fcntl( fd, F_GETFL ) | O_NONBLOCK );
+            sockaddr_un addr;
+            std::memset( &addr, 0, sizeof addr );
+            addr.sun_family = AF_UNIX;
+            std::strncpy( addr.sun_path, socketPath.constData(), sizeof addr.sun_path - 1 );
+            if ( ::connect( fd, reinterpret_cast<sockaddr*>( &addr ), sizeof addr ) != 0 ) {
+                ::close( fd );
+                return false;
+            }
+            socket = fd;
+            return true;
+        }
+
+        void disconnectSocket() {
+            if ( socket < 0 )
+                return;
+            ::close( socket );
+            socket = -1;
+        }
+
+        // Sends as many pending datagrams as the socket takes without
+        // blocking. Returns false if the socket is unusable.
+        bool sendPending() {
+            while ( !pending.isEmpty() ) {
+                const int n = qMin<int>( pending.size(), MaxBatch );
+                int sent = 0;
+#ifdef KDLOG_HAVE_SENDMMSG
+                mmsghdr msgs[MaxBatch];
+                iovec iov[MaxBatch];
+                std::memset( msgs, 0, n * sizeof *msgs );
+                for ( int i = 0 ; i < n ; ++i ) {
+                    iov[i].iov_base = const_cast<char*>( pending[i].datagram.constData() );
+                    iov[i].iov_len = pending[i].datagram.size();
+                    msgs[i].msg_hdr.msg_iov = &iov[i];
+                    msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+                do
+                    sent = ::sendmmsg( socket, msgs, n, MSG_DONTWAIT | MSG_NOSIGNAL );
+                while ( sent < 0 && errno == EINTR );
+#else
+                for ( ; sent < n ; ++sent ) {
+                    ssize_t rc;
+                    do
+                        rc = ::send( socket, pending[sent].datagram.constData(), pending[sent].datagram.size(), MSG_DONTWAIT );
+                    while ( rc < 0 && errno == EINTR );
+                    if ( rc < 0 )
+                        break;
+                }
+                if ( sent == 0 )
+                    sent = -1;
+#endif
+                if ( sent < 0 ) {
+                    if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS )
+                        return true; // try again with the next message
+                    return false;
+                }
+                pending.erase( pending.begin(), pending.begin() + sent );
+            }
+            return true;
+        }
+
+    private:
+        const QByteArray socketPath;
+        const char * const tag;
+        const int logOptions;
+        const int logFacility;
+        const FallbackFunction fallbackFunction;
+        int retryInterval;
+        int socket;
+        QList<PendingDatagram> pending;
+        int dropped;
+        QElapsedTimer lastFailure; // invalid unless the last submit() failed
+    };
+}
+
+// passed to openlog(); the DirectDatagram mode follows suit
+static const int syslogOptions = 0;
+
 class KDSystemLogDevice::Private : public KDEncodingLogDevice::Private {
     friend class ::KDSystemLogDevice;
 public:
@@ -64,14 +307,21 @@ public:
           // according to the openlog() docs, the identification string
           // better stay constant throughout the lifefile of the
           // connection, so therefore we take our own copy:
-          internal( mystrdup( findSyslogIdentification().constData() ) )
+          internal( mystrdup( findSyslogIdentification().constData() ) ),
+          mode( SyslogCall ),
+          batchSize( 1 ),
+          sender( syslogSocketPath, internal, syslogOptions, toSyslogFacility( facility ) )
     {
         assert( internal || !"Check why findSyslogIdentification() fails to return something" );
-        openlog( internal, 0, toSyslogFacility( facility ) );
+        openlog( internal, syslogOptions, toSyslogFacility( facility ) );
     }
+
 private:
     Facility facility;
     char * internal;
+    SubmissionMode mode;
+    int batchSize;
+    SyslogDatagramSender sender;
 };
 
 KDSystemLogDevice::KDSystemLogDevice( Facility facility )
@@ -81,6 +331,8 @@ KDSystemLogDevice::KDSystemLogDevice( Facility facility )
 }
 
 KDSystemLogDevice::~KDSystemLogDevice() {
+    flush( 100 );
+    d_func()->sender.fallBack();
     closelog();
     using namespace std;
     if ( d_func()->internal )
@@ -89,18 +341,299 @@ KDSystemLogDevice::~KDSystemLogDevice() {
 
 void KDSystemLogDevice::init( bool ) {}
 
-static int severityToSyslogPriority( KDLog::Severity severity ) {
-    switch( severity & KDLog::LevelMask ) {
-    case KDLog::Info:    return LOG_INFO;
-    case KDLog::Debug:   return LOG_DEBUG;
-    case KDLog::Warning: return LOG_WARNING;
-    case KDLog::Error:   return LOG_ERR;
+#define d d_func()
+
+void KDSystemLogDevice::setSubmissionMode( SubmissionMode mode ) {
+    if ( mode == d->mode )
+        return;
+    if ( mode == SyslogCall )
+        d->sender.fallBack();
+    d->mode = mode;
+}
+
+KDSystemLogDevice::SubmissionMode KDSystemLogDevice::submissionMode() const {
+    return d->mode;
+}
+
+void KDSystemLogDevice::setBatchSize( int messages ) {
+    d->batchSize = qBound( 1, messages, static_cast<int>( SyslogDatagramSender::MaxBatch ) );
+    if ( d->sender.size() >= d->batchSize )
+        d->sender.submit();
+}
+
+int KDSystemLogDevice::batchSize() const {
+    return d->batchSize;
+}
+
+int KDSystemLogDevice::droppedCount() const {
+    return d->sender.droppedCount();
+}
+
+bool KDSystemLogDevice::flush( int msecs ) {
+    if ( d->sender.isEmpty() )
+        return true;
+    d->sender.submit();
+    if ( msecs > 0 && !d->sender.isEmpty() && d->sender.socketDescriptor() >= 0 ) {
+        pollfd pfd;
+        pfd.fd = d->sender.socketDescriptor();
+        pfd.events = POLLOUT;
+        QElapsedTimer timer;
+        timer.start();
+        for ( qint64 left = msecs ; !d->sender.isEmpty() && left > 0 ; left = msecs - timer.elapsed() ) {
+            if ( ::poll( &pfd, 1, static_cast<int>( left ) ) < 0 && errno != EINTR )
+                break;
+            d->sender.submit();
+        }
     }
-    assert( !"KDSystemLogDevice::log: unknown Severity value encountered" );
-    return LOG_DEBUG;
+    return d->sender.isEmpty();
 }
 
 void KDSystemLogDevice::doLogEncoded( KDLog::Severity severity, const QByteArray & msg ) {
-    syslog( severityToSyslogPriority( severity ), "%s", msg.data() ? msg.data() : "" );
+    const int priority = severityToSyslogPriority( severity );
+    const QByteArray message = msg.data() ? msg : QByteArray( "" );
+    if ( d->mode == SyslogCall ) {
+        syslog( priority, "%s", message.constData() );
+        return;
+    }
+
+    d->sender.append( priority, message );
+    if ( d->sender.size() >= d->batchSize || priority <= LOG_ERR )
+        d->sender.submit();
+}
+
+#undef d
+
+#ifndef IOV_MAX
+# define IOV_MAX 16
+#endif
+
+static bool write_fully( int fd, iovec * iov, int count ) {
+    while ( count > 0 ) {
+        const ssize_t written = ::writev( fd, iov, count );
+        if ( written < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            return false;
+        }
+        // skip what was written, and adjust a partially written iovec:
+        size_t left = written;
+        while ( count > 0 && left >= iov->iov_len ) {
+            left -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if ( count > 0 ) {
+            iov->iov_base = static_cast<char*>( iov->iov_base ) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+qint64 kdlog_current_usecs_since_epoch() {
+#if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0
+    timespec ts;
+    if ( clock_gettime( CLOCK_REALTIME, &ts ) == 0 )
+        return qint64( ts.tv_sec ) * 1000000 + ts.tv_nsec / 1000;
+#endif
+    timeval tv;
+    gettimeofday( &tv, 0 );
+    return qint64( tv.tv_sec ) * 1000000 + tv.tv_usec;
+}
+
+bool kdlog_write_entries( int fd, const KDLogBufferedEntry * entries, int count ) {
+    static char newline[] = "\n";
+    static const int EntriesPerCall = qMax( IOV_MAX / 3, 1 );
+    QVarLengthArray<iovec, 3 * 64> iov;
+    bool ok = true;
+    for ( int i = 0 ; i < count ; i += EntriesPerCall ) {
+        const int n = qMin( count - i, EntriesPerCall );
+        iov.resize( 3 * n );
+        for ( int j = 0 ; j < n ; ++j ) {
+            const KDLogBufferedEntry & e = entries[i+j];
+            iov[3*j].iov_base   = const_cast<char*>( e.prefix );
+            iov[3*j].iov_len    = std::strlen( e.prefix );
+            iov[3*j+1].iov_base = const_cast<char*>( e.message.constData() );
+            iov[3*j+1].iov_len  = e.message.size();
+            iov[3*j+2].iov_base = newline;
+            iov[3*j+2].iov_len  = 1;
+        }
+        if ( !write_fully( fd, iov.data(), iov.size() ) )
+            ok = false;
+    }
+    return ok;
+}
+
+#ifdef KDTOOLSCORE_UNITTESTS
+
+#include <KDUnitTest/Test>
+
+#include <QDir>
+#include <QFile>
+#include <QUuid>
+
+namespace {
+    // Stands in for the logger's socket.
+    class DatagramReceiver {
+    public:
+        explicit DatagramReceiver( const QByteArray & p )
+            : path( p ), fd( ::socket( AF_UNIX, SOCK_DGRAM, 0 ) )
+        {
+            sockaddr_un addr;
+            std::memset( &addr, 0, sizeof addr );
+            addr.sun_family = AF_UNIX;
+            std::strncpy( addr.sun_path, path.constData(), sizeof addr.sun_path - 1 );
+            if ( fd >= 0 && ::bind( fd, reinterpret_cast<sockaddr*>( &addr ), sizeof addr ) != 0 ) {
+                ::close( fd );
+                fd = -1;
+            }
+        }
+        ~DatagramReceiver() { close(); }
+
+        bool isValid() const { return fd >= 0; }
+
+        void close() {
+            if ( fd < 0 )
+                return;
+            ::close( fd );
+            ::unlink( path.constData() );
+            fd = -1;
+        }
+
+        // Returns the datagrams that have arrived so far.
+        QList<QByteArray> receive() {
+            QList<QByteArray> result;
+            char buffer[SyslogDatagramSender::MaxDatagramSize + 1];
+            for ( ;; ) {
+                const ssize_t n = ::recv( fd, buffer, sizeof buffer, MSG_DONTWAIT );
+                if ( n >= 0 )
+                    result.push_back( QByteArray( buffer, n ) );
+                else if ( errno != EINTR )
+                    return result;
+            }
+        }
+
+    private:
+        const QByteArray path;
+        int fd;
+    };
+
+    static QByteArray testSocketPath() {
+        return QFile::encodeName( QDir::tempPath() + QLatin1String( "/kdsyslog-test" ) + QUuid::createUuid().toString() );
+    }
+
+    // Stands in for syslog(), so the test doesn't write to the system log.
+    static QList<QByteArray> fallbackMessages;
+
+    static void recordFallback( int, const QByteArray & message ) {
+        fallbackMessages.push_back( message );
+    }
+}
+
+KDAB_UNITTEST_SIMPLE( KDSystemLogDevice, "kdtools/core" ) {
+
+    // the datagram format follows the openlog() options
+    {
+        struct tm tm;
+        std::memset( &tm, 0, sizeof tm );
+        tm.tm_year = 114;
+        tm.tm_mday = 5;
+        tm.tm_hour = 3;
+        tm.tm_min = 4;
+        tm.tm_sec = 5;
+        tm.tm_isdst = -1;
+        const time_t when = ::mktime( &tm );
+
+        const SyslogDatagramSender plain( "/nonexistent", "kdtest", 0, LOG_USER );
+        assertTrue( plain.formatDatagram( LOG_WARNING, "hello", when ) == "<12>Jan  5 03:04:05 kdtest: hello" );
+        const SyslogDatagramSender withPid( "/nonexistent", "kdtest", LOG_PID, LOG_DAEMON );
+        assertTrue( withPid.formatDatagram( LOG_ERR, "hello", when )
+                    == "<27>Jan  5 03:04:05 kdtest[" + QByteArray::number( static_cast<int>( ::getpid() ) ) + "]: hello" );
+        assertEqual( plain.formatDatagram( LOG_INFO, QByteArray( 10000, 'x' ), when ).size(), int( SyslogDatagramSender::MaxDatagramSize ) );
+    }
+
+    // with nobody reading, the receiver's queue fills up, then the
+    // pending list, and then the oldest pending messages are dropped
+    {
+        const QByteArray path = testSocketPath();
+        DatagramReceiver receiver( path );
+        assertTrue( receiver.isValid() );
+        SyslogDatagramSender sender( path.constData(), "kdtest", 0, LOG_USER );
+        const int Total = 4 * SyslogDatagramSender::MaxPending;
+        for ( int i = 0 ; i < Total ; ++i ) {
+            sender.append( LOG_INFO, QByteArray::number( i ) );
+            sender.submit();
+        }
+        assertEqual( sender.size(), int( SyslogDatagramSender::MaxPending ) );
+        assertGreater( sender.droppedCount(), 0 );
+
+        QList<QByteArray> received;
+        for ( int round = 0 ; !sender.isEmpty() && round < 1000 ; ++round ) {
+            received += receiver.receive();
+            sender.submit();
+        }
+        received += receiver.receive();
+        assertTrue( sender.isEmpty() );
+        assertEqual( received.size() + sender.droppedCount(), Total );
+        int previous = -1;
+        Q_FOREACH( const QByteArray & datagram, received ) {
+            const int i = datagram.mid( datagram.lastIndexOf( ' ' ) + 1 ).toInt();
+            assertGreater( i, previous );
+            previous = i;
+        }
+        assertEqual( previous, Total - 1 );
+    }
+
+    // without a logger socket, messages go to the fallback (syslog())
+    // instead, and the socket is only retried after the retry interval
+    {
+        fallbackMessages.clear();
+        const QByteArray path = testSocketPath();
+        SyslogDatagramSender sender( path.constData(), "kdtest", 0, LOG_USER, recordFallback );
+        sender.setRetryInterval( 200 );
+        sender.append( LOG_DEBUG, "one" );
+        sender.submit();
+        assertTrue( sender.isEmpty() );
+        assertEqual( sender.socketDescriptor(), -1 );
+        assertEqual( sender.droppedCount(), 0 );
+        assertEqual( fallbackMessages.size(), 1 );
+        assertTrue( fallbackMessages.back() == "one" );
+
+        DatagramReceiver receiver( path );
+        assertTrue( receiver.isValid() );
+        sender.append( LOG_DEBUG, "two" );
+        sender.submit();
+        assertEqual( sender.socketDescriptor(), -1 );
+        assertEqual( fallbackMessages.size(), 2 );
+        assertEqual( receiver.receive().size(), 0 );
+
+        ::usleep( 300 * 1000 );
+        sender.append( LOG_DEBUG, "three" );
+        sender.submit();
+        assertTrue( sender.socketDescriptor() >= 0 );
+        assertEqual( fallbackMessages.size(), 2 );
+        assertEqual( receiver.receive().size(), 1 );
+    }
+
+    // ... and when the logger goes away and cannot be reconnected to
+    {
+        fallbackMessages.clear();
+        const QByteArray path = testSocketPath();
+        DatagramReceiver receiver( path );
+        assertTrue( receiver.isValid() );
+        SyslogDatagramSender sender( path.constData(), "kdtest", 0, LOG_USER, recordFallback );
+        sender.append( LOG_DEBUG, "one" );
+        sender.submit();
+        assertEqual( receiver.receive().size(), 1 );
+        assertTrue( sender.socketDescriptor() >= 0 );
+        receiver.close();
+        sender.append( LOG_DEBUG, "two" );
+        sender.submit();
+        assertTrue( sender.isEmpty() );
+        assertEqual( sender.socketDescriptor(), -1 );
+        assertEqual( fallbackMessages.size(), 1 );
+        assertTrue( fallbackMessages.back() == "two" );
+    }
 }
 
+#endif // KDTOOLSCORE_UNITTESTS
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <io.h>
 #include <windows.h>
 #include <winbase.h>
 
@@ -40,7 +41,9 @@ public:
     explicit  Private( Facility facility_ )
         : KDEncodingLogDevice::Private( QTextCodec::codecForLocale() ),
           facility( facility_ ),
-          internal( RegisterEventSource( 0, TEXT("Application") ) )
+          internal( RegisterEventSource( 0, TEXT("Application") ) ),
+          mode( SyslogCall ),
+          batchSize( 1 )
     {
         if ( !internal )
             fprintf( stderr, "Error in RegisterEventSourceA(): %u\n", static_cast< unsigned int >( GetLastError() ) );
@@ -48,6 +51,8 @@ public:
 private:
     Facility facility;
     HANDLE internal;
+    SubmissionMode mode;  // only remembered, the event log has no datagram protocol
+    int batchSize;        // ditto
 };
 
 KDSystemLogDevice::KDSystemLogDevice( Facility facility )
@@ -64,8 +69,33 @@ KDSystemLogDevice::~KDSystemLogDevice() {
 
 void KDSystemLogDevice::init( bool ) {}
 
+void KDSystemLogDevice::setSubmissionMode( SubmissionMode mode ) {
+    d->mode = mode;
+}
+
+KDSystemLogDevice::SubmissionMode KDSystemLogDevice::submissionMode() const {
+    return d->mode;
+}
+
+void KDSystemLogDevice::setBatchSize( int messages ) {
+    d->batchSize = qMax( 1, messages );
+}
+
+int KDSystemLogDevice::batchSize() const {
+    return d->batchSize;
+}
+
+int KDSystemLogDevice::droppedCount() const {
+    return 0;
+}
+
+bool KDSystemLogDevice::flush( int ) {
+    return true;
+}
+
 static int severityToEventLogType( KDLog::Severity severity ) {
     switch ( severity & KDLog::LevelMask ) {
+    case 0: // flags only (Popup, User)
     case KDLog::Info:
     case KDLog::Debug: // No debug option
         return EVENTLOG_INFORMATION_TYPE;
@@ -109,4 +139,31 @@ void KDSystemLogDevice::doLogEncoded( KDLog::Severity severity, const QByteArray
              err, lpMsgBuf, msg.constData() );
 }
 
+qint64 kdlog_current_usecs_since_epoch() {
+    FILETIME ft;
+    GetSystemTimeAsFileTime( &ft );
+    const qint64 ticks = ( qint64( ft.dwHighDateTime ) << 32 ) | ft.dwLowDateTime; // 100ns since 1601
+    return ( ticks - Q_INT64_C(116444736000000000) ) / 10;
+}
+
+bool kdlog_write_entries( int fd, const KDLogBufferedEntry * entries, int count ) {
+    // no writev() here, so concatenate instead:
+    QByteArray data;
+    for ( int i = 0 ; i < count ; ++i ) {
+        data += entries[i].prefix;
+        data += entries[i].message;
+        data += '\n';
+    }
+    const char * p = data.constData();
+    int left = data.size();
+    while ( left > 0 ) {
+        const int written = _write( fd, p, left );
+        if ( written <= 0 )
+            return false;
+        p += written;
+        left -= written;
+    }
+    return true;
+}
+
 #undef d
@@ -26,19 +26,45 @@
 #include <QtCore/QDateTime>
 #include <QtCore/QDir>
 #include <QtCore/QPointer>
+#include <QtCore/QSet>
 #include <QtCore/QTemporaryFile>
+#include <QtCore/QUrl>
 
 #ifdef Q_OS_WIN
 #include <io.h>
 #include <windows.h>
+#else
+#include <unistd.h>
 #endif
+#include <cerrno>
+#include <climits>
+#include <cstring>
 #include <memory>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 
+// Linux >= 3.11 can create files without a name, which only get one
+// (with linkat()) when they are committed:
+#if defined(Q_OS_LINUX) && defined(O_TMPFILE)
+#define KDSAVEFILE_HAVE_O_TMPFILE
+#endif
+
+#if defined(KDSAVEFILE_HAVE_O_TMPFILE) && defined(KDTOOLSCORE_UNITTESTS)
+// lets the unit test exercise the fallback to named temporary files
+static bool anonymousFilesDisabled = false;
+#endif
+
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
 #include <KDToolsCore/kdmetamethoditerator.h>
 
+// writes of at least this size bypass QFile's write buffer
+static const qint64 DIRECTWRITETHRESHOLD = 64 * 1024;
+
 #ifdef Q_OS_WIN
 #define DEFAULTBACKUPEXTENSION ".bak"
 #else
@@ -104,6 +130,36 @@ static QFile* createFile( const QString& path, QIODevice::OpenMode m, QFile::Per
     return file.release();
 }
 
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+/*!
+ Converts \a p to a Unix file mode.
+ \internal
+ */
+static mode_t toFileMode( QFile::Permissions p )
+{
+    mode_t mode = 0;
+    if ( p & ( QFile::ReadOwner | QFile::ReadUser ) )
+        mode |= S_IRUSR;
+    if ( p & ( QFile::WriteOwner | QFile::WriteUser ) )
+        mode |= S_IWUSR;
+    if ( p & ( QFile::ExeOwner | QFile::ExeUser ) )
+        mode |= S_IXUSR;
+    if ( p & QFile::ReadGroup )
+        mode |= S_IRGRP;
+    if ( p & QFile::WriteGroup )
+        mode |= S_IWGRP;
+    if ( p & QFile::ExeGroup )
+        mode |= S_IXGRP;
+    if ( p & QFile::ReadOther )
+        mode |= S_IROTH;
+    if ( p & QFile::WriteOther )
+        mode |= S_IWOTH;
+    if ( p & QFile::ExeOther )
+        mode |= S_IXOTH;
+    return mode;
+}
+#endif
+
 /*!
  Generates a temporary file name template based on target name \a path
  \internal
@@ -123,6 +179,163 @@ static QString generateTempFileName( const QString& path, bool tmpPath )
     return tmp.arg( dir, file );
 }
 
+/*!
+ Writes the data of the open file \a fd to the storage device. On Linux,
+ metadata not needed to read the data back (e.g. modification times) is
+ not written. On Mac OS X, plain fsync() leaves the data in the drive's
+ cache, so F_FULLFSYNC is used where the file system supports it.
+ \internal
+ */
+static bool syncFileData( int fd )
+{
+#if defined(Q_OS_WIN)
+    return ::_commit( fd ) == 0;
+#else
+    int rc;
+# if defined(Q_OS_LINUX)
+    do {
+        rc = ::fdatasync( fd );
+    } while ( rc == -1 && errno == EINTR );
+# elif defined(Q_OS_MAC)
+    rc = ::fcntl( fd, F_FULLFSYNC );
+    if ( rc == -1 )
+        do {
+            rc = ::fsync( fd );
+        } while ( rc == -1 && errno == EINTR );
+# else
+    do {
+        rc = ::fsync( fd );
+    } while ( rc == -1 && errno == EINTR );
+# endif
+    return rc == 0;
+#endif
+}
+
+/*!
+ Writes the entries of directory \a dir to the storage device, so that a
+ rename into it survives a power loss. Windows has no equivalent (and
+ needs none for NTFS), so this always succeeds there.
+ \internal
+ */
+static bool syncDirectory( const QString& dir )
+{
+#ifdef Q_OS_WIN
+    Q_UNUSED( dir );
+    return true;
+#else
+    int fd;
+    do {
+        fd = ::open( QFile::encodeName( dir ).constData(), O_RDONLY );
+    } while ( fd == -1 && errno == EINTR );
+    if ( fd == -1 )
+        return false;
+    int rc;
+    do {
+        rc = ::fsync( fd );
+    } while ( rc == -1 && errno == EINTR );
+    // some file systems don't support fsync on directories:
+    const bool ok = rc == 0 || errno == EINVAL;
+    ::close( fd );
+    return ok;
+#endif
+}
+
+/*!
+ Writes the data of the file \a path to the storage device. The file is opened read-only, which
+ is all fsync() needs on most systems, so this works for target files without write permission;
+ only where fsync() rejects a read-only descriptor is it retried on a writable one.
+ \internal
+ */
+static bool syncFile( const QString& path )
+{
+#ifdef Q_OS_WIN
+    const QString native = QDir::toNativeSeparators( path );
+    const HANDLE h = ::CreateFileW( (wchar_t*)native.utf16(), GENERIC_WRITE,
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                    0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0 );
+    if ( h == INVALID_HANDLE_VALUE )
+        return false;
+    const bool ok = ::FlushFileBuffers( h );
+    ::CloseHandle( h );
+    return ok;
+#else
+    QFile file( path );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+    if ( syncFileData( file.handle() ) )
+        return true;
+    if ( errno != EBADF )
+        return false;
+    file.close();
+    return file.open( QIODevice::ReadWrite ) && syncFileData( file.handle() );
+#endif
+}
+
+/*!
+ Creates \a to as a copy-on-write clone of \a from, which takes constant time
+ on file systems that support it (Btrfs, XFS, ...). Mode and times are copied.
+ Returns false if this is not supported.
+ \internal
+ */
+static bool reflinkFile( const QString& from, const QString& to )
+{
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    const int src = ::open( QFile::encodeName( from ).constData(), O_RDONLY | O_CLOEXEC );
+    if ( src == -1 )
+        return false;
+    struct stat st;
+    if ( ::fstat( src, &st ) != 0 ) {
+        ::close( src );
+        return false;
+    }
+    const QByteArray toName = QFile::encodeName( to );
+    const int dst = ::open( toName.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777 );
+    if ( dst == -1 ) {
+        ::close( src );
+        return false;
+    }
+    const struct timespec times[2] = { st.st_atim, st.st_mtim };
+    const bool ok = ::ioctl( dst, FICLONE, src ) == 0
+                    && ::fchmod( dst, st.st_mode & 07777 ) == 0 // open() applied the umask
+                    && ::futimens( dst, times ) == 0;
+    ::close( dst );
+    ::close( src );
+    if ( !ok )
+        ::unlink( toName.constData() );
+    return ok;
+#else
+    Q_UNUSED( from );
+    Q_UNUSED( to );
+    return false;
+#endif
+}
+
+/*!
+ Creates \a to as another name for \a from.
+ \internal
+ */
+static bool hardLinkFile( const QString& from, const QString& to )
+{
+#ifdef Q_OS_WIN
+    const QString nativeFrom = QDir::toNativeSeparators( from );
+    const QString nativeTo = QDir::toNativeSeparators( to );
+    return ::CreateHardLinkW( (wchar_t*)nativeTo.utf16(), (wchar_t*)nativeFrom.utf16(), 0 );
+#else
+    return ::link( QFile::encodeName( from ).constData(), QFile::encodeName( to ).constData() ) == 0;
+#endif
+}
+
+/*!
+ Writes the data of the open file \a file to the storage device.
+ \internal
+ */
+static bool syncFile( QFile* file )
+{
+    // QFile on Windows may use a native handle and have no file descriptor:
+    const int fd = file->handle();
+    return fd != -1 ? syncFileData( fd ) : syncFile( file->fileName() );
+}
+
 /*!
   \class KDSaveFile KDSaveFile
   \ingroup core
@@ -166,8 +379,82 @@ static QString generateTempFileName( const QString& path, bool tmpPath )
   a device node on Unix. To avoid that, KDSaveFile writes all content into a temporary file first and
   renames this file to the actual file name when committing. If the file was already existing, it gets
   backuped, if requested.
+
+  \subsection durability Durability
+
+  By default, commit() leaves it to the operating system when the new contents reach the disk. After a
+  power loss, the file may then turn out empty or still have its old contents, even though commit()
+  succeeded. Use setSyncPolicy() to make commit() wait until the data, or the data and the rename, are
+  on the storage device:
+
+  \code
+  KDSaveFile file( QLatin1String( "settings.conf" ) );
+  file.setSyncPolicy( KDSaveFile::SyncDataAndDirectory );
+  \endcode
+
+  This costs one or two round trips to the storage device per commit, from well below a millisecond on
+  SSDs to tens of milliseconds on rotating disks; the kdsavefilebenchmark program in tests/ measures
+  it for a given directory.
 */
 
+/*!
+ \enum KDSaveFile::SyncPolicy
+ This enum is used with setSyncPolicy() to describe what commit() writes to the storage device
+ before it returns. \since_c 2.3
+ */
+
+/*!
+ \var KDSaveFile::NoSync
+ Nothing; the operating system writes the file whenever it sees fit. This is the default.
+ */
+
+/*!
+ \var KDSaveFile::SyncData
+ The contents of the file are on the storage device before it is renamed to the target file name, so
+ the target never ends up with partial contents. The rename itself may still be lost on power failure,
+ leaving the old file in place.
+ */
+
+/*!
+ \var KDSaveFile::SyncDataAndDirectory
+ Like SyncData, and additionally the directory containing the target file is written after the rename,
+ so that the new file is in place once commit() returns.
+
+ If writing the directory (or a target copied from another file system) fails, the new contents are
+ already in place, so commit() still succeeds; it prints a warning and sets errorString() instead.
+ */
+
+/*!
+ \enum KDSaveFile::BackupStrategy
+ This enum is used with setBackupStrategy() to describe how commit() creates the backup of an existing
+ file, and reported by usedBackupStrategy(). The link-based strategies leave the existing file in place
+ until the new one replaces it, so on Unix there is no moment in which the target file does not exist.
+ \since_c 2.3
+ */
+
+/*!
+ \var KDSaveFile::NoBackup
+ No backup was made. Only returned by usedBackupStrategy().
+ */
+
+/*!
+ \var KDSaveFile::RenameBackup
+ The existing file is renamed to the backup name. This is the default.
+ */
+
+/*!
+ \var KDSaveFile::HardLinkBackup
+ The backup name is created as a hard link to the existing file. This takes constant time, but requires
+ a file system with hard links.
+ */
+
+/*!
+ \var KDSaveFile::ReflinkBackup
+ The backup is created as a copy-on-write clone (FICLONE) of the existing file, a separate file that
+ shares its data blocks with the original. This takes constant time, but is only supported on Linux,
+ by file systems like Btrfs and XFS.
+ */
+
 /*!
  \enum KDSaveFile::CommitMode
  This enum is used with commit() to describe what KDSaveFile should do with an existing file with the
@@ -195,7 +482,13 @@ public:
           backupExtension( QLatin1String( DEFAULTBACKUPEXTENSION ) ),
           permissions( QFile::ReadUser | QFile::WriteUser ),
           filename( fname ),
-          error( QFile::NoError )
+          error( QFile::NoError ),
+          syncPolicy( NoSync ),
+          backupStrategy( RenameBackup ),
+          usedBackupStrategy( NoBackup ),
+          anonymousFd( -1 ),
+          anonymousPermissions( 0 ),
+          linkedName()
     {
         //TODO respect umask instead of hardcoded default permissions
     }
@@ -217,12 +510,149 @@ public:
     {
         if( !tmpFile )
             return true;
+        if( anonymousFd != -1 )
+        {
+            // vanishes on close, unless commit() gave it a name already
+            const QString name = linkedName;
+            closeTempFile();
+            return name.isEmpty() || QFile::remove( name );
+        }
         const QString name = tmpFile->fileName();
         delete tmpFile;
         //force a real close by deleting the object, before deleting the actual file. Needed on Windows
         return QFile::remove( name );
     }
 
+    /*!
+     Closes the temporary file, without deleting it.
+     \internal
+     */
+    void closeTempFile()
+    {
+        delete tmpFile;
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+        if( anonymousFd != -1 )
+        {
+            ::close( anonymousFd ); // QFile does not own it
+            anonymousFd = -1;
+            linkedName.clear();
+        }
+#endif
+    }
+
+    /*!
+     Sets the permissions of the temporary file to \a p.
+     \internal
+     */
+    bool setTemporaryPermissions( QFile::Permissions p )
+    {
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+        if( anonymousFd != -1 )
+        {
+            if( ::fchmod( anonymousFd, toFileMode( p ) ) != 0 )
+                return false;
+            anonymousPermissions = p;
+            return true;
+        }
+#endif
+        return tmpFile && tmpFile->setPermissions( p );
+    }
+
+    /*!
+     Returns the name of the temporary file, giving it one first if it has none yet.
+     Returns an empty string if that fails.
+     \internal
+     */
+    QString visibleTemporaryFileName()
+    {
+        if( !tmpFile )
+            return QString();
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+        if( anonymousFd != -1 )
+        {
+            if( linkedName.isEmpty() )
+                linkedName = linkAnonymousFileToTempName();
+            return linkedName;
+        }
+#endif
+        return tmpFile->fileName();
+    }
+
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+    /*!
+     Opens an unnamed temporary file in the target directory in \a mode.
+     Returns false if the kernel or file system doesn't support it.
+     \internal
+     */
+    bool openAnonymousFile( QIODevice::OpenMode mode )
+    {
+#ifdef KDTOOLSCORE_UNITTESTS
+        if( anonymousFilesDisabled )
+            return false;
+#endif
+        // linkat() needs /proc to name the file later
+        if( ::access( "/proc/self/fd", X_OK ) != 0 )
+            return false;
+        const QByteArray dir = QFile::encodeName( QFileInfo( filename ).absolutePath() );
+        const int flags = O_TMPFILE | O_CLOEXEC | ( ( mode & QIODevice::ReadOnly ) ? O_RDWR : O_WRONLY );
+        int fd;
+        do {
+            fd = ::open( dir.constData(), flags, S_IRUSR | S_IWUSR );
+        } while( fd == -1 && errno == EINTR );
+        if( fd == -1 )
+            return false; // EISDIR, EOPNOTSUPP, ...: fall back to a named temporary file
+
+        std::auto_ptr<QFile> file( new QFile );
+        if( !file->open( fd, mode ) )
+        {
+            ::close( fd );
+            return false;
+        }
+        tmpFile = file.release();
+        anonymousFd = fd;
+        error = QFile::NoError;
+        if( !setTemporaryPermissions( permissions ) )
+        {
+            closeTempFile();
+            return false;
+        }
+        return true;
+    }
+
+    /*!
+     Gives the unnamed temporary file the name \a path, which must not exist.
+     \internal
+     */
+    bool linkAnonymousFile( const QString& path )
+    {
+        char procPath[32];
+        qsnprintf( procPath, sizeof procPath, "/proc/self/fd/%d", anonymousFd );
+        return ::linkat( AT_FDCWD, procPath, AT_FDCWD, QFile::encodeName( path ).constData(), AT_SYMLINK_FOLLOW ) == 0;
+    }
+
+    /*!
+     Gives the unnamed temporary file a new, unique temporary name next to the target.
+     \internal
+     */
+    QString linkAnonymousFileToTempName()
+    {
+        static const char characters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890";
+        QString name = generateTempFileName( filename, false );
+        const int placeholder = name.lastIndexOf( QLatin1String( "XXXXXX" ) );
+        // linkat() fails on collisions, so there's no need to look first
+        for( int attempt = 0 ; attempt < 100 ; ++attempt )
+        {
+            for( int i = 0 ; i < 6 ; ++i )
+                name[placeholder + i] = QLatin1Char( characters[qrand() % ( sizeof characters - 1 )] );
+            if( linkAnonymousFile( name ) )
+                return name;
+            if( errno != EEXIST )
+                break;
+        }
+        return QString();
+    }
+#endif
+
     /*!
      (Re)-creates the temporary file and opens it in \a mode.
      \internal
@@ -231,10 +661,15 @@ public:
     {
         deleteTempFile();
         bool ok = false;
-        // first try, create it in the target directory
-        tmpFile = createFile( generateTempFileName( filename, false ), mode, permissions, ok, error );
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+        // first try, an unnamed file in the target directory: nothing is left over after a crash
+        ok = openAnonymousFile( mode );
+#endif
+        // second try, create it in the target directory
+        if( tmpFile == 0 )
+            tmpFile = createFile( generateTempFileName( filename, false ), mode, permissions, ok, error );
 
-        // second try, create it in the temp directory
+        // third try, create it in the temp directory
         if( tmpFile == 0 )
             tmpFile = createFile( generateTempFileName( filename, true ), mode, permissions, ok, error );
 
@@ -269,6 +704,59 @@ public:
         return bf + QString::number( count );
     }
 
+    /*!
+     Creates \a backup of the target file without moving it, using backupStrategy or,
+     if that is not supported, the next simpler one. Returns the strategy used, or
+     RenameBackup if the target file has to be renamed after all.
+     \internal
+     */
+    BackupStrategy linkBackup( const QString& backup ) const
+    {
+        if( backupStrategy >= ReflinkBackup && reflinkFile( filename, backup ) )
+            return ReflinkBackup;
+        if( backupStrategy >= HardLinkBackup && hardLinkFile( filename, backup ) )
+            return HardLinkBackup;
+        return RenameBackup;
+    }
+
+#ifndef Q_OS_WIN
+    /*!
+     Writes \a size bytes of \a data at the current position straight to the temporary
+     file's descriptor, bypassing QFile's write buffer, which would only add a copy for
+     large blocks.
+     \internal
+     */
+    qint64 writeDirect( const char* data, qint64 size )
+    {
+        if( !tmpFile->flush() )
+        {
+            propagateErrors();
+            return -1;
+        }
+        const int fd = tmpFile->handle();
+        const qint64 start = tmpFile->pos();
+        qint64 written = 0;
+        while( written < size )
+        {
+            const ssize_t n = ::pwrite( fd, data + written, static_cast<size_t>( qMin<qint64>( size - written, INT_MAX ) ), start + written );
+            if( n == -1 && errno == EINTR )
+                continue;
+            if( n == 0 )
+                errno = ENOSPC; // no progress, and no error reported: treat it as a full device
+            if( n <= 0 )
+                break;
+            written += n;
+        }
+        if( written == 0 )
+        {
+            q->setErrorString( QString::fromLocal8Bit( strerror( errno ) ) );
+            return -1;
+        }
+        tmpFile->seek( start + written ); // QFile keeps its own position
+        return written;
+    }
+#endif
+
     /*!
      Propagates the error string form the internal temporary file to this instance, if any.
      \internal
@@ -285,6 +773,12 @@ public:
     QString filename;
     QPointer<QFile> tmpFile;
     QFile::FileError error;
+    SyncPolicy syncPolicy;
+    BackupStrategy backupStrategy;
+    BackupStrategy usedBackupStrategy;
+    int anonymousFd;                        // -1 unless tmpFile has no name (O_TMPFILE)
+    QFile::Permissions anonymousPermissions;
+    QString linkedName;                     // the name given to the unnamed tmpFile, if any
 };
 
 /*!
@@ -370,8 +864,8 @@ bool KDSaveFile::open( OpenMode mode )
     if( opened )
         setOpenMode( mode );
 
-    if( f.exists() )
-        d->tmpFile->setPermissions( f.permissions() );
+    if( opened && f.exists() )
+        d->setTemporaryPermissions( f.permissions() );
 
     //if target file already exists, apply permissions of existing file to temp file
     return opened;
@@ -469,42 +963,118 @@ bool KDSaveFile::commit( KDSaveFile::CommitMode mode )
     if( !d->tmpFile )
         return false;
 
-    const QString tmpfname = d->tmpFile->fileName();
+    QString tmpfname = d->tmpFile->fileName();
     flush();
-    delete d->tmpFile;
+    if( d->syncPolicy != NoSync && !syncFile( d->tmpFile ) )
+    {
+        // don't replace the existing file with one that may be empty after a crash
+        setErrorString( tr("Could not write %1 to disk: %2").arg( d->filename, QString::fromLocal8Bit( strerror( errno ) ) ) );
+        return false;
+    }
+
+    // whether the new contents are at the target name already
+    bool inPlace = false;
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+    if( d->anonymousFd != -1 )
+    {
+        // an unnamed file just gets the target name, if it's free:
+        if( d->linkedName.isEmpty() && !QFile::exists( d->filename ) )
+            inPlace = d->linkAnonymousFile( d->filename );
+        if( !inPlace )
+        {
+            tmpfname = d->visibleTemporaryFileName();
+            if( tmpfname.isEmpty() )
+            {
+                setErrorString( tr("Could not create %1: %2").arg( d->filename, QString::fromLocal8Bit( strerror( errno ) ) ) );
+                return false;
+            }
+            // rename() replaces the existing file atomically, so no backup is needed to overwrite it:
+            if( mode == OverwriteExistingFile )
+                inPlace = ::rename( QFile::encodeName( tmpfname ).constData(), QFile::encodeName( d->filename ).constData() ) == 0;
+        }
+    }
+#endif
+    d->closeTempFile();
 
-    // first step: backup the existing file (if any)
-    QFile orig( d->filename );
     QString backup;
-    if( orig.exists() )
+    d->usedBackupStrategy = NoBackup;
+    if( !inPlace )
     {
-        backup = d->generateBackupName();
-        if( !orig.rename( backup ) )
+        // first step: backup the existing file (if any)
+        QFile orig( d->filename );
+        if( orig.exists() )
+        {
+            backup = d->generateBackupName();
+            // links and clones leave the existing file in place:
+            if( mode == BackupExistingFile )
+                d->usedBackupStrategy = d->linkBackup( backup );
+            if( d->usedBackupStrategy == NoBackup || d->usedBackupStrategy == RenameBackup )
+            {
+                if( orig.rename( backup ) )
+                {
+                    if( mode == BackupExistingFile )
+                        d->usedBackupStrategy = RenameBackup;
+                }
+                else
+                {
+                    d->usedBackupStrategy = NoBackup;
+                    setErrorString( tr("Could not backup existing file %1: %2").arg( d->filename, orig.errorString() ) );
+                    if ( mode != OverwriteExistingFile )
+                        return false;
+                }
+                orig.setFileName( d->filename );
+                if( orig.exists() && !orig.remove() )
+                {
+                    setErrorString( tr( "Could not remove existing file %1: %2" ).arg( d->filename, orig.errorString() ) );
+                    return false;
+                }
+            }
+        }
+
+        // second step: rename the temp file to the target file name
+        bool renamed = false;
+        if( d->usedBackupStrategy == HardLinkBackup || d->usedBackupStrategy == ReflinkBackup )
         {
-            setErrorString( tr("Could not backup existing file %1: %2").arg( d->filename, orig.errorString() ) );
-            if ( mode != OverwriteExistingFile )
+#ifndef Q_OS_WIN
+            // the target still exists; rename() replaces it atomically
+            renamed = ::rename( QFile::encodeName( tmpfname ).constData(), QFile::encodeName( d->filename ).constData() ) == 0;
+#endif
+            if( !renamed && !orig.remove() )
+            {
+                setErrorString( tr( "Could not remove existing file %1: %2" ).arg( d->filename, orig.errorString() ) );
                 return false;
+            }
         }
-        orig.setFileName( d->filename );
-        if( orig.exists() && !orig.remove() )
+        QFile target( tmpfname );
+        if( !renamed && !target.rename( d->filename ) )
         {
-            setErrorString( tr( "Could not remove existing file %1: %2" ).arg( d->filename, orig.errorString() ) );
+            setErrorString( target.errorString() );
             return false;
         }
+
+#ifdef Q_OS_WIN
+        makeFileHidden( d->filename, false );
+#endif
     }
 
-    // second step: rename the temp file to the target file name
-    QFile target( tmpfname );
-    if( !target.rename( d->filename ) )
+    if( d->syncPolicy != NoSync )
     {
-        setErrorString( target.errorString() );
-        return false;
+        // a temp file created in QDir::tempPath() was copied, not renamed, so
+        // the copy has to be synced itself:
+        const QString targetDir = QFileInfo( d->filename ).absolutePath();
+        bool synced = true;
+        if( !inPlace && QFileInfo( tmpfname ).absolutePath() != targetDir && !syncFile( d->filename ) )
+            synced = false;
+        else if( d->syncPolicy == SyncDataAndDirectory && !syncDirectory( targetDir ) )
+            synced = false;
+        // the new contents are in place already, so this is only a warning:
+        if( !synced )
+        {
+            setErrorString( tr("Could not write %1 to disk: %2").arg( d->filename, QString::fromLocal8Bit( strerror( errno ) ) ) );
+            qWarning() << "KDSaveFile::commit:" << errorString();
+        }
     }
 
-#ifdef Q_OS_WIN
-    makeFileHidden( d->filename, false );
-#endif
-
     // third step, if the existing file is to be overwritten: remove the backup we created in first step
     if( mode == OverwriteExistingFile )
     {
@@ -519,6 +1089,61 @@ bool KDSaveFile::commit( KDSaveFile::CommitMode mode )
     return true;
 }
 
+/*!
+ Returns how commit( BackupExistingFile ) tries to back up the existing file.
+ \since_c 2.3
+ \sa setBackupStrategy(), usedBackupStrategy()
+ */
+KDSaveFile::BackupStrategy KDSaveFile::backupStrategy() const
+{
+    return d->backupStrategy;
+}
+
+/*!
+ Sets how commit( BackupExistingFile ) tries to back up the existing file to \a strategy.
+ If \a strategy is not supported by the operating system or file system, the next simpler
+ one is used: ReflinkBackup falls back to HardLinkBackup, which falls back to RenameBackup.
+ The default is RenameBackup; NoBackup is treated like RenameBackup.
+ \since_c 2.3
+ \sa backupStrategy(), usedBackupStrategy()
+ */
+void KDSaveFile::setBackupStrategy( BackupStrategy strategy )
+{
+    d->backupStrategy = strategy == NoBackup ? RenameBackup : strategy;
+}
+
+/*!
+ Returns how the last commit() backed up the existing file, or NoBackup if it didn't,
+ e.g. because there was no such file or OverwriteExistingFile was used.
+ \since_c 2.3
+ \sa setBackupStrategy()
+ */
+KDSaveFile::BackupStrategy KDSaveFile::usedBackupStrategy() const
+{
+    return d->usedBackupStrategy;
+}
+
+/*!
+ Returns what commit() writes to the storage device before it returns.
+ \since_c 2.3
+ \sa setSyncPolicy(), SyncPolicy
+ */
+KDSaveFile::SyncPolicy KDSaveFile::syncPolicy() const
+{
+    return d->syncPolicy;
+}
+
+/*!
+ Sets what commit() writes to the storage device before it returns to \a policy.
+ The default is NoSync.
+ \since_c 2.3
+ \sa syncPolicy(), SyncPolicy
+ */
+void KDSaveFile::setSyncPolicy( SyncPolicy policy )
+{
+    d->syncPolicy = policy;
+}
+
 /*!
  Returns the name set by setFileName() or passed to the KDSaveFile constructor.
  */
@@ -581,6 +1206,12 @@ qint64 KDSaveFile::writeData( const char* data, qint64 maxSize )
         setErrorString( tr( "Could not write to file: Temporary file does not exist." ) );
         return -1;
     }
+#ifndef Q_OS_WIN
+    // pwrite() takes an off_t, which may be 32 bits wide
+    if( maxSize >= DIRECTWRITETHRESHOLD && d->tmpFile->handle() != -1
+        && ( sizeof( off_t ) >= sizeof( qint64 ) || d->tmpFile->pos() + maxSize <= INT_MAX ) )
+        return d->writeDirect( data, maxSize );
+#endif
     const qint64 ret = d->tmpFile->write( data, maxSize );
     d->propagateErrors();
     return ret;
@@ -602,6 +1233,41 @@ bool KDSaveFile::resize( qint64 sz )
     return d->tmpFile ? d->tmpFile->resize( sz ) : false;
 }
 
+/*!
+ Allocates disk space for \a sz bytes of file contents, without changing size().
+ Call this after open() when the final size is known, to avoid fragmentation
+ of large files and to get an error about missing disk space before writing.
+ Returns true if the space could be allocated; false if not, or if the platform
+ or file system does not support it. Writing works in either case.
+ \since_c 2.3
+ */
+bool KDSaveFile::reserve( qint64 sz )
+{
+    const int fd = handle();
+    if( fd == -1 || sz <= 0 )
+        return false;
+    int rc = -1;
+#if defined(Q_OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE)
+    // posix_fallocate() would extend the file, and commit() would keep the extra zeros
+    do {
+        rc = ::fallocate( fd, FALLOC_FL_KEEP_SIZE, 0, sz );
+    } while( rc == -1 && errno == EINTR );
+#elif defined(Q_OS_MAC)
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, sz, 0 };
+    rc = ::fcntl( fd, F_PREALLOCATE, &store );
+    if( rc == -1 )
+    {
+        store.fst_flags = F_ALLOCATEALL;
+        rc = ::fcntl( fd, F_PREALLOCATE, &store );
+    }
+#else
+    errno = ENOSYS;
+#endif
+    if( rc != 0 )
+        setErrorString( tr( "Could not reserve %1 bytes: %2" ).arg( sz ).arg( QString::fromLocal8Bit( strerror( errno ) ) ) );
+    return rc == 0;
+}
+
 /*!
  Returns the file handle of the file.
  */
@@ -616,6 +1282,8 @@ int KDSaveFile::handle() const
  */
 QFile::Permissions KDSaveFile::permissions() const
 {
+    if( d->anonymousFd != -1 )
+        return d->anonymousPermissions;
     return d->tmpFile ? d->tmpFile->permissions() : d->permissions;
 }
 
@@ -626,7 +1294,7 @@ bool KDSaveFile::setPermissions( QFile::Permissions p )
 {
     d->permissions = p;
     if ( d->tmpFile )
-        return d->tmpFile->setPermissions( p );
+        return d->setTemporaryPermissions( p );
     return false;
 }
 
@@ -648,6 +1316,456 @@ QString KDSaveFile::backupExtension() const
     return d->backupExtension;
 }
 
+namespace {
+
+    struct JournalEntry {
+        QString target;
+        QString temp;
+        QString backup; // empty if there was no file to back up
+        QByteArray identity; // of temp, see fileIdentity()
+    };
+
+    struct Journal {
+        Journal() : removeBackups( false ), entries() {}
+        bool removeBackups;
+        QList<JournalEntry> entries;
+    };
+
+} // anon namespace
+
+static const char journalMagic[] = "KDSaveFileGroup journal 1\n";
+
+/*!
+ Returns what identifies the file \a path after it has been renamed: its size, and on Unix, if
+ \a withInode, its device and inode numbers, which a rename within the file system keeps. Returns
+ an empty QByteArray if the file does not exist.
+ \internal
+ */
+static QByteArray fileIdentity( const QString& path, bool withInode = true )
+{
+#ifdef Q_OS_WIN
+    Q_UNUSED( withInode );
+    const QFileInfo info( path );
+    return info.exists() ? QByteArray::number( info.size() ) : QByteArray();
+#else
+    struct stat st;
+    if ( ::stat( QFile::encodeName( path ).constData(), &st ) != 0 )
+        return QByteArray();
+    QByteArray result = QByteArray::number( static_cast<qint64>( st.st_size ) );
+    if ( withInode )
+        result += ':' + QByteArray::number( static_cast<quint64>( st.st_dev ) )
+            + ':' + QByteArray::number( static_cast<quint64>( st.st_ino ) );
+    return result;
+#endif
+}
+
+/*!
+ Returns whether \a file and \a dir are on the same file system, so that renaming \a file into \a dir
+ does not copy it.
+ \internal
+ */
+static bool isSameFileSystem( const QString& file, const QString& dir )
+{
+#ifdef Q_OS_WIN
+    return QFileInfo( file ).absolutePath().left( 2 ).compare( QFileInfo( dir ).absoluteFilePath().left( 2 ), Qt::CaseInsensitive ) == 0;
+#else
+    struct stat fst, dst;
+    return ::stat( QFile::encodeName( file ).constData(), &fst ) == 0
+        && ::stat( QFile::encodeName( dir ).constData(), &dst ) == 0
+        && fst.st_dev == dst.st_dev;
+#endif
+}
+
+static QByteArray encodeJournalName( const QString& name )
+{
+    return QUrl::toPercentEncoding( name );
+}
+
+static QString decodeJournalName( const QByteArray& name )
+{
+    return QUrl::fromPercentEncoding( name );
+}
+
+/*!
+ Serializes \a journal. The last line holds a checksum over all others, so
+ that a journal that was only partially written is recognized as such.
+ \internal
+ */
+static QByteArray serializeJournal( const Journal& journal )
+{
+    QByteArray data( journalMagic );
+    data += journal.removeBackups ? "overwrite\n" : "backup\n";
+    Q_FOREACH( const JournalEntry& e, journal.entries )
+        data += encodeJournalName( e.target ) + '\t' + encodeJournalName( e.temp ) + '\t' + encodeJournalName( e.backup ) + '\t' + e.identity + '\n';
+    data += "end " + QByteArray::number( qChecksum( data.constData(), data.size() ) ) + '\n';
+    return data;
+}
+
+/*!
+ Parses \a data into \a journal. Returns whether \a data was a complete journal;
+ if it was not, \a journal contains the entries that could be read.
+ \internal
+ */
+static bool parseJournal( const QByteArray& data, Journal* journal )
+{
+    if ( !data.startsWith( journalMagic ) )
+        return false;
+    const QList<QByteArray> lines = data.split( '\n' );
+    journal->removeBackups = lines.size() > 1 && lines[1] == "overwrite";
+    int i = 2;
+    for ( ; i < lines.size() ; ++i ) {
+        const QList<QByteArray> fields = lines[i].split( '\t' );
+        if ( fields.size() != 4 )
+            break;
+        JournalEntry e;
+        e.target = decodeJournalName( fields[0] );
+        e.temp = decodeJournalName( fields[1] );
+        e.backup = decodeJournalName( fields[2] );
+        e.identity = fields[3];
+        journal->entries.push_back( e );
+    }
+    // complete: the entries are followed by the end line and the final newline
+    if ( i != lines.size() - 2 || !lines.last().isEmpty() )
+        return false;
+    const QByteArray end = lines[lines.size() - 2];
+    const int bodySize = data.size() - end.size() - 1;
+    bool ok = false;
+    const uint checksum = end.startsWith( "end " ) ? end.mid( 4 ).toUInt( &ok ) : 0;
+    return ok && checksum == qChecksum( data.constData(), bodySize );
+}
+
+/*!
+ Writes \a journal to \a fileName and makes sure it is on the storage device.
+ \internal
+ */
+static bool writeJournal( const QString& fileName, const Journal& journal, QString* errorString )
+{
+    QFile file( fileName );
+    const QByteArray data = serializeJournal( journal );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate )
+         || file.write( data ) != data.size() || !file.flush() ) {
+        *errorString = file.errorString();
+        file.remove();
+        return false;
+    }
+    if ( !syncFile( &file ) || !syncDirectory( QFileInfo( fileName ).absolutePath() ) ) {
+        *errorString = QString::fromLocal8Bit( strerror( errno ) );
+        file.close();
+        file.remove();
+        return false;
+    }
+    return true;
+}
+
+/*!
+ Moves all files of \a journal into place. Entries that have been moved
+ already are skipped, so this can be repeated after an interruption.
+ \internal
+ */
+static bool applyJournal( const Journal& journal, QString* errorString )
+{
+    bool ok = true;
+    QSet<QString> dirs;
+    Q_FOREACH( const JournalEntry& e, journal.entries ) {
+        const QString targetDir = QFileInfo( e.target ).absolutePath();
+        dirs.insert( targetDir );
+        if ( !QFile::exists( e.temp ) ) {
+            // done before the interruption, unless the temporary file got lost
+            if ( fileIdentity( e.target, e.identity.contains( ':' ) ) == e.identity )
+                continue;
+            *errorString = KDSaveFileGroup::tr( "Temporary file %1 for %2 is missing" ).arg( e.temp, e.target );
+            ok = false;
+            continue;
+        }
+        if ( QFile::exists( e.target ) ) {
+            QFile orig( e.target );
+            // The backup name was free, and without one the target didn't exist, when the journal
+            // was written. So if the backup exists, or there is none, the old file is safe already,
+            // and the target is what an interrupted copy of the temporary file from another file
+            // system left behind:
+            if ( e.backup.isEmpty() || QFile::exists( e.backup ) ) {
+                if ( !orig.remove() ) {
+                    *errorString = KDSaveFileGroup::tr( "Could not remove existing file %1: %2" ).arg( e.target, orig.errorString() );
+                    ok = false;
+                    continue;
+                }
+            // the old file; keep it as backup, so the group can still be rolled back by hand
+            } else if ( !orig.rename( e.backup ) && !( journal.removeBackups && orig.remove() ) ) {
+                *errorString = KDSaveFileGroup::tr( "Could not backup existing file %1: %2" ).arg( e.target, orig.errorString() );
+                ok = false;
+                continue;
+            }
+        }
+        QFile temp( e.temp );
+        if ( !temp.rename( e.target ) ) {
+            *errorString = temp.errorString();
+            ok = false;
+            continue;
+        }
+#ifdef Q_OS_WIN
+        makeFileHidden( e.target, false );
+#endif
+        // copied from another file system, not renamed:
+        if ( QFileInfo( e.temp ).absolutePath() != targetDir && !syncFile( e.target ) ) {
+            *errorString = KDSaveFileGroup::tr( "Could not write %1 to disk: %2" ).arg( e.target, QString::fromLocal8Bit( strerror( errno ) ) );
+            ok = false;
+        }
+    }
+    if ( !ok )
+        return false;
+
+    Q_FOREACH( const QString& dir, dirs )
+        if ( !syncDirectory( dir ) ) {
+            *errorString = KDSaveFileGroup::tr( "Could not write %1 to disk: %2" ).arg( dir, QString::fromLocal8Bit( strerror( errno ) ) );
+            return false;
+        }
+
+    if ( journal.removeBackups )
+        Q_FOREACH( const JournalEntry& e, journal.entries )
+            if ( !e.backup.isEmpty() && QFile::exists( e.backup ) && !QFile::remove( e.backup ) )
+                qWarning() << "Could not remove the backup: " << e.backup;
+    return true;
+}
+
+/*!
+  \class KDSaveFileGroup KDSaveFileGroup
+  \ingroup core
+  \brief Commits several KDSaveFiles together
+  \since_c 2.3
+
+  KDSaveFileGroup commits several KDSaveFile instances such that, even after a crash or power loss in
+  the middle of the commit, either all or none of the target files end up with their new contents.
+
+  \code
+  KDSaveFileGroup group( configDir.absoluteFilePath( QLatin1String( ".save-journal" ) ) );
+  KDSaveFileGroup::recover( group.journalFileName() ); // at start-up; finishes an interrupted commit
+
+  KDSaveFile settings( configDir.absoluteFilePath( QLatin1String( "settings.conf" ) ) );
+  KDSaveFile packages( configDir.absoluteFilePath( QLatin1String( "packages.xml" ) ) );
+  settings.open( QIODevice::WriteOnly );
+  packages.open( QIODevice::WriteOnly );
+  ... // write both
+  group.addFile( &settings );
+  group.addFile( &packages );
+  if ( !group.commit() )
+      qWarning() << group.errorString();
+  \endcode
+
+  commit() first writes the contents of all temporary files, and the directory entries naming them, to
+  the storage device, in one pass. Then it writes a small journal, listing which temporary file goes
+  where, and syncs it; from then on, the commit is decided. Then it moves the files into place, syncs each affected directory once and
+  removes the journal.
+
+  If the process dies before the journal is complete, recover() removes the temporary files it lists,
+  and all target files keep their old contents. If it dies later, recover() moves the remaining files
+  into place. A temporary file listed in a complete journal that is neither there nor already in place
+  (on Unix, identified by its inode; on Windows, and across file systems, only by its size) makes
+  recover() fail, rather than leave that target old while the others are new. commit() calls recover() itself before it starts.
+
+  This is all-or-nothing and durable, like committing each file with KDSaveFile::SyncDataAndDirectory,
+  but the storage device is waited for about twice per group plus once per directory, instead of
+  twice per file. The files' own syncPolicy() is not used.
+*/
+
+/*!
+ \internal
+ */
+class KDSaveFileGroup::Private
+{
+public:
+    explicit Private( const QString& journal )
+        : journalFileName( makeAbsolute( journal ) ),
+          files(),
+          errorString()
+    {
+    }
+
+    QString journalFileName;
+    QList< QPointer<KDSaveFile> > files;
+    QString errorString;
+};
+
+/*!
+ Creates a group using \a journalFileName for its journal. The journal only exists while
+ commit() runs, or if a commit was interrupted. It has to be on the same file system as
+ the files, or recovery may not be possible after a power loss.
+ */
+KDSaveFileGroup::KDSaveFileGroup( const QString& journalFileName )
+    : d( new Private( journalFileName ) )
+{
+}
+
+/*!
+ Destroys the group. The files are not affected.
+ */
+KDSaveFileGroup::~KDSaveFileGroup()
+{
+}
+
+/*!
+ Returns the name of the journal file.
+ */
+QString KDSaveFileGroup::journalFileName() const
+{
+    return d->journalFileName;
+}
+
+/*!
+ Adds \a file to the group. The group does not take ownership. \a file must be open
+ when commit() is called.
+ */
+void KDSaveFileGroup::addFile( KDSaveFile* file )
+{
+    if ( file && !files().contains( file ) )
+        d->files.push_back( file );
+}
+
+/*!
+ Removes \a file from the group.
+ */
+void KDSaveFileGroup::removeFile( KDSaveFile* file )
+{
+    d->files.removeAll( file );
+}
+
+/*!
+ Returns the files in the group; files that have been deleted are left out.
+ */
+QList<KDSaveFile*> KDSaveFileGroup::files() const
+{
+    QList<KDSaveFile*> result;
+    Q_FOREACH( const QPointer<KDSaveFile>& f, d->files )
+        if ( f )
+            result.push_back( f );
+    return result;
+}
+
+/*!
+ Returns a description of the last error that occurred in commit().
+ */
+QString KDSaveFileGroup::errorString() const
+{
+    return d->errorString;
+}
+
+/*!
+ Commits all files of the group, using \a mode for existing target files. Returns true on success,
+ otherwise false.
+
+ If writing the files to the storage device fails, nothing is changed and the files stay open, so
+ that commit() can be retried. If moving them into place fails, the journal is kept, and recover()
+ finishes the commit. On success, all files are closed and the group is empty.
+ */
+bool KDSaveFileGroup::commit( KDSaveFile::CommitMode mode )
+{
+    d->errorString.clear();
+    if ( !recover( d->journalFileName, &d->errorString ) )
+        return false;
+
+    const QList<KDSaveFile*> files = this->files();
+    Journal journal;
+    journal.removeBackups = mode == KDSaveFile::OverwriteExistingFile;
+    QSet<QString> targets;
+    QSet<QString> tempDirs;
+
+    // first step: all contents to disk, before anything is decided
+    Q_FOREACH( KDSaveFile* f, files ) {
+        QFile* const tmp = f->d->tmpFile;
+        if ( !tmp ) {
+            d->errorString = tr( "File %1 is not open." ).arg( f->fileName() );
+            return false;
+        }
+        if ( targets.contains( f->fileName() ) ) {
+            d->errorString = tr( "File %1 is part of the group more than once." ).arg( f->fileName() );
+            return false;
+        }
+        targets.insert( f->fileName() );
+        if ( !tmp->flush() || !syncFile( tmp ) ) {
+            d->errorString = tr( "Could not write %1 to disk: %2" ).arg( f->fileName(), QString::fromLocal8Bit( strerror( errno ) ) );
+            return false;
+        }
+        JournalEntry e;
+        e.target = f->fileName();
+        // the journal needs names, so unnamed temporary files get one now
+        e.temp = f->d->visibleTemporaryFileName();
+        if ( e.temp.isEmpty() ) {
+            d->errorString = tr( "Could not create %1: %2" ).arg( f->fileName(), QString::fromLocal8Bit( strerror( errno ) ) );
+            return false;
+        }
+        if ( QFile::exists( e.target ) )
+            e.backup = f->d->generateBackupName();
+        // the inode number only survives a rename, not a copy to another file system:
+        e.identity = fileIdentity( e.temp, isSameFileSystem( e.temp, QFileInfo( e.target ).absolutePath() ) );
+        journal.entries.push_back( e );
+        tempDirs.insert( QFileInfo( e.temp ).absolutePath() );
+    }
+
+    // the journal must not name temporary files that a power loss can still make disappear
+    Q_FOREACH( const QString& dir, tempDirs )
+        if ( !syncDirectory( dir ) ) {
+            d->errorString = tr( "Could not write %1 to disk: %2" ).arg( dir, QString::fromLocal8Bit( strerror( errno ) ) );
+            return false;
+        }
+
+    // second step: the journal; once it is on disk, the commit happens
+    QString error;
+    if ( !writeJournal( d->journalFileName, journal, &error ) ) {
+        d->errorString = tr( "Could not write journal %1: %2" ).arg( d->journalFileName, error );
+        return false;
+    }
+
+    // third step: move everything into place
+    Q_FOREACH( KDSaveFile* f, files )
+        f->d->closeTempFile(); // without removing it. Needed on Windows
+    if ( !applyJournal( journal, &d->errorString ) )
+        return false;
+    // a journal left over after this point is harmless, all its entries are done
+    QFile::remove( d->journalFileName );
+
+    Q_FOREACH( KDSaveFile* f, files )
+        f->close();
+    d->files.clear();
+    return true;
+}
+
+/*!
+ Finishes a commit of a KDSaveFileGroup that was interrupted, e.g. by a crash, using the journal
+ \a journalFileName. Call this when your program starts, before reading any of the files. Returns true
+ if there was nothing to do or the commit could be finished or rolled back; otherwise false, with the
+ reason in \a errorString, if given.
+ */
+bool KDSaveFileGroup::recover( const QString& journalFileName, QString* errorString )
+{
+    QString dummy;
+    QString& error = errorString ? *errorString : dummy;
+
+    QFile file( journalFileName );
+    if ( !file.exists() )
+        return true;
+    if ( !file.open( QIODevice::ReadOnly ) ) {
+        error = tr( "Could not read journal %1: %2" ).arg( journalFileName, file.errorString() );
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    file.close();
+
+    Journal journal;
+    if ( parseJournal( data, &journal ) ) {
+        // decided: roll forward
+        if ( !applyJournal( journal, &error ) )
+            return false;
+    } else {
+        // interrupted before it was decided: roll back. No target has been touched yet.
+        Q_FOREACH( const JournalEntry& e, journal.entries )
+            QFile::remove( e.temp );
+    }
+    if ( !file.remove() ) {
+        error = tr( "Could not remove journal %1: %2" ).arg( journalFileName, file.errorString() );
+        return false;
+    }
+    return true;
+}
+
 #ifdef KDTOOLSCORE_UNITTESTS
 
 #include <KDUnitTest/Test>
@@ -682,6 +1800,44 @@ static QByteArray blockingRead( QIODevice& dev, qint64 count )
     return data;
 }
 
+static QByteArray readFile( const QString& name )
+{
+    QFile f( name );
+    return f.open( QIODevice::ReadOnly ) ? f.readAll() : QByteArray();
+}
+
+static bool writeFile( const QString& name, const QByteArray& data )
+{
+    QFile f( name );
+    return f.open( QIODevice::WriteOnly | QIODevice::Truncate ) && f.write( data ) == data.size();
+}
+
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+/*!
+ Returns the named temporary files next to \a filename.
+ */
+static QStringList temporaryFilesOf( const QString& filename )
+{
+    const QFileInfo fi( filename );
+    const QString pattern = QFileInfo( generateTempFileName( filename, false ) ).fileName().replace( QLatin1String( "XXXXXX" ), QLatin1String( "*" ) );
+    return fi.absoluteDir().entryList( QStringList( pattern ), QDir::Files | QDir::Hidden | QDir::System );
+}
+
+/*!
+ Returns whether unnamed files can be created next to \a filename.
+ */
+static bool supportsAnonymousFiles( const QString& filename )
+{
+    if( ::access( "/proc/self/fd", X_OK ) != 0 )
+        return false;
+    const int fd = ::open( QFile::encodeName( QFileInfo( filename ).absolutePath() ).constData(), O_TMPFILE | O_WRONLY, S_IRUSR | S_IWUSR );
+    if( fd == -1 )
+        return false;
+    ::close( fd );
+    return true;
+}
+#endif
+
 static std::ostream& operator<<( std::ostream& stream, const QByteArray& ba )
 {
     stream << "QByteArray( " << ba.data() << " )";
@@ -760,6 +1916,152 @@ KDAB_UNITTEST_SIMPLE( KDSaveFile, "kdtools/core" ) {
 
         assertTrue( QFile::remove( testfile1 ) );
     }
+    {
+        const QString testfile1 = filename;
+        const QByteArray testData("lalalala");
+        KDSaveFile sf( testfile1 );
+        assertEqual( sf.syncPolicy(), KDSaveFile::NoSync );
+        sf.setSyncPolicy( KDSaveFile::SyncData );
+        assertEqual( sf.syncPolicy(), KDSaveFile::SyncData );
+        assertTrue( sf.open( QIODevice::WriteOnly ) );
+        assertEqual( blockingWrite( sf, testData ), testData.size() );
+        assertTrue( sf.commit( KDSaveFile::OverwriteExistingFile ) );
+        assertEqual( QFile( testfile1 ).size(), testData.size() );
+
+        sf.setSyncPolicy( KDSaveFile::SyncDataAndDirectory );
+        assertTrue( sf.open( QIODevice::WriteOnly ) );
+        assertEqual( blockingWrite( sf, testData + testData ), 2 * testData.size() );
+        assertTrue( sf.commit( KDSaveFile::OverwriteExistingFile ) );
+        QFile f( testfile1 );
+        assertTrue( f.open( QIODevice::ReadOnly ) );
+        assertEqual( blockingRead( f, 2 * testData.size() ), testData + testData );
+        f.close();
+        assertTrue( f.remove() );
+    }
+    {
+        // large writes take the direct path, small ones go through QFile's buffer
+        const QString testfile1 = filename;
+        const QByteArray head( "head" );
+        const QByteArray large( 256 * 1024, 'x' );
+        const QByteArray tail( "tail" );
+        KDSaveFile sf( testfile1 );
+        assertFalse( sf.reserve( 1024 * 1024 ) ); // not open
+        assertTrue( sf.open( QIODevice::ReadWrite ) );
+        sf.reserve( 1024 * 1024 ); // may be unsupported, but must not change the size
+        assertEqual( sf.size(), 0 );
+        assertEqual( blockingWrite( sf, head ), head.size() );
+        assertEqual( blockingWrite( sf, large ), large.size() );
+        assertEqual( blockingWrite( sf, tail ), tail.size() );
+        assertEqual( sf.pos(), head.size() + large.size() + tail.size() );
+        assertEqual( sf.size(), head.size() + large.size() + tail.size() );
+        assertTrue( sf.seek( 0 ) );
+        assertEqual( blockingRead( sf, head.size() ), head );
+        assertTrue( sf.seek( head.size() + large.size() ) );
+        assertEqual( blockingRead( sf, tail.size() ), tail );
+        assertTrue( sf.commit( KDSaveFile::OverwriteExistingFile ) );
+        QFile f( testfile1 );
+        assertTrue( f.open( QIODevice::ReadOnly ) );
+        assertTrue( f.readAll() == head + large + tail );
+        f.close();
+        assertTrue( f.remove() );
+    }
+    {
+        const QString testfile1 = filename;
+        const QByteArray oldData( "old" );
+        const QByteArray newData( "new" );
+        const KDSaveFile::BackupStrategy strategies[] = { KDSaveFile::RenameBackup, KDSaveFile::HardLinkBackup, KDSaveFile::ReflinkBackup };
+        for ( int i = 0 ; i < 3 ; ++i ) {
+            KDSaveFile sf( testfile1 );
+            assertEqual( sf.backupStrategy(), KDSaveFile::RenameBackup );
+            assertEqual( sf.usedBackupStrategy(), KDSaveFile::NoBackup );
+            sf.setBackupStrategy( strategies[i] );
+            sf.setBackupExtension( QLatin1String( ".bak" ) );
+            assertTrue( sf.open( QIODevice::WriteOnly ) );
+            assertEqual( blockingWrite( sf, oldData ), oldData.size() );
+            assertTrue( sf.commit() );
+            assertEqual( sf.usedBackupStrategy(), KDSaveFile::NoBackup ); // nothing to back up
+
+            assertTrue( sf.open( QIODevice::WriteOnly ) );
+            assertEqual( blockingWrite( sf, newData ), newData.size() );
+            assertTrue( sf.commit() );
+            // falls back to simpler strategies where unsupported:
+            assertTrue( sf.usedBackupStrategy() != KDSaveFile::NoBackup );
+            assertTrue( sf.usedBackupStrategy() <= strategies[i] );
+
+            QFile backup( testfile1 + sf.backupExtension() );
+            assertTrue( backup.open( QIODevice::ReadOnly ) );
+            assertEqual( backup.readAll(), oldData );
+            backup.close();
+            assertTrue( backup.remove() );
+            QFile f( testfile1 );
+            assertTrue( f.open( QIODevice::ReadOnly ) );
+            assertEqual( f.readAll(), newData );
+            f.close();
+            assertTrue( f.remove() );
+        }
+    }
+    {
+        const QString testfile1 = filename;
+        const QFile::Permissions permissions = QFile::ReadOwner | QFile::WriteOwner | QFile::ReadUser | QFile::WriteUser | QFile::ReadGroup;
+        KDSaveFile sf( testfile1 );
+        assertTrue( sf.open( QIODevice::ReadWrite ) );
+        assertTrue( sf.setPermissions( permissions ) );
+        assertEqual( sf.permissions(), permissions );
+        assertEqual( blockingWrite( sf, QByteArray( "lalalala" ) ), 8 );
+        assertTrue( sf.resize( 4 ) );
+        assertTrue( sf.commit() );
+#ifndef Q_OS_WIN // no group permissions there
+        assertEqual( QFile::permissions( testfile1 ), permissions );
+#endif
+        QFile f( testfile1 );
+        assertTrue( f.open( QIODevice::ReadOnly ) );
+        assertEqual( f.readAll(), QByteArray( "lala" ) );
+        f.close();
+        assertTrue( f.remove() );
+    }
+#ifdef KDSAVEFILE_HAVE_O_TMPFILE
+    if( supportsAnonymousFiles( filename ) )
+    {
+        // the temporary file has no name while it is open...
+        const QByteArray testData( "lalalala" );
+        {
+            KDSaveFile sf( filename );
+            assertTrue( sf.open( QIODevice::WriteOnly ) );
+            assertEqual( blockingWrite( sf, testData ), testData.size() );
+            assertTrue( sf.flush() );
+            assertTrue( temporaryFilesOf( filename ).isEmpty() );
+            assertFalse( QFile::exists( filename ) );
+            sf.close();
+            // ...and none afterwards, without commit()
+            assertTrue( temporaryFilesOf( filename ).isEmpty() );
+            assertFalse( QFile::exists( filename ) );
+        }
+        assertTrue( temporaryFilesOf( filename ).isEmpty() );
+    }
+    {
+        // without O_TMPFILE, a named temporary file is used instead
+        anonymousFilesDisabled = true;
+        const QByteArray testData( "lalalala" );
+        {
+            KDSaveFile sf( filename );
+            assertTrue( sf.open( QIODevice::WriteOnly ) );
+            assertEqual( blockingWrite( sf, testData ), testData.size() );
+            assertEqual( temporaryFilesOf( filename ).size(), 1 );
+            assertTrue( sf.commit() );
+            assertTrue( temporaryFilesOf( filename ).isEmpty() );
+            assertEqual( readFile( filename ), testData );
+
+            KDSaveFile sf2( filename );
+            assertTrue( sf2.open( QIODevice::WriteOnly ) );
+            assertEqual( temporaryFilesOf( filename ).size(), 1 );
+            sf2.close();
+            assertTrue( temporaryFilesOf( filename ).isEmpty() );
+            assertEqual( readFile( filename ), testData );
+        }
+        anonymousFilesDisabled = false;
+        assertTrue( QFile::remove( filename ) );
+    }
+#endif
     {
         const QString testfile1 = filename;
         KDSaveFile sf( testfile1 );
@@ -797,4 +2099,122 @@ KDAB_UNITTEST_SIMPLE( KDSaveFile, "kdtools/core" ) {
     }
 }
 
+KDAB_UNITTEST_SIMPLE( KDSaveFileGroup, "kdtools/core" ) {
+    const QString base = QString::fromLatin1( "kdsavefilegroup-test%1" ).arg( QUuid::createUuid().toString() );
+    const QString first = base + QLatin1String( "-first" );
+    const QString second = base + QLatin1String( "-second" );
+    const QString journal = base + QLatin1String( "-journal" );
+    const QByteArray oldData( "old" );
+    const QByteArray newData( "new" );
+
+    assertTrue( writeFile( first, oldData ) );
+    {
+        KDSaveFileGroup group( journal );
+        KDSaveFile f1( first ), f2( second );
+        assertTrue( f1.open( QIODevice::WriteOnly ) );
+        assertTrue( f2.open( QIODevice::WriteOnly ) );
+        assertEqual( blockingWrite( f1, newData ), newData.size() );
+        assertEqual( blockingWrite( f2, newData ), newData.size() );
+        group.addFile( &f1 );
+        group.addFile( &f2 );
+        group.addFile( &f1 );
+        assertEqual( group.files().size(), 2 );
+        assertTrue( group.commit( KDSaveFile::OverwriteExistingFile ) );
+        assertTrue( group.files().isEmpty() );
+        assertFalse( f1.isOpen() );
+        assertEqual( readFile( first ), newData );
+        assertEqual( readFile( second ), newData );
+        assertFalse( QFile::exists( journal ) );
+        assertFalse( QFile::exists( first + f1.backupExtension() ) );
+    }
+    {
+        // one file not open: nothing changes
+        KDSaveFileGroup group( journal );
+        KDSaveFile f1( first ), f2( second );
+        assertTrue( f1.open( QIODevice::WriteOnly ) );
+        assertEqual( blockingWrite( f1, oldData ), oldData.size() );
+        group.addFile( &f1 );
+        group.addFile( &f2 );
+        assertFalse( group.commit() );
+        assertFalse( group.errorString().isEmpty() );
+        assertTrue( f1.isOpen() );
+        assertEqual( readFile( first ), newData );
+        assertFalse( QFile::exists( journal ) );
+    }
+    {
+        // interrupted after the journal was written: rolled forward
+        Journal j;
+        j.removeBackups = true;
+        JournalEntry e1, e2;
+        e1.target = first;
+        e1.temp = base + QLatin1String( "-tmp1" );
+        e1.backup = first + QLatin1String( ".bak" );
+        e2.target = second;
+        e2.temp = base + QLatin1String( "-tmp2" );
+        e2.backup = second + QLatin1String( ".bak" );
+        assertTrue( writeFile( e1.temp, oldData ) );
+        assertTrue( writeFile( e2.temp, oldData ) );
+        e1.identity = fileIdentity( e1.temp );
+        e2.identity = fileIdentity( e2.temp );
+        j.entries << e1 << e2;
+        QString error;
+        assertTrue( writeJournal( journal, j, &error ) );
+        // the first file was moved into place before the interruption:
+        assertTrue( QFile::rename( first, e1.backup ) );
+        assertTrue( QFile::rename( e1.temp, first ) );
+
+        assertTrue( KDSaveFileGroup::recover( journal, &error ) );
+        assertEqual( readFile( first ), oldData );
+        assertEqual( readFile( second ), oldData );
+        assertFalse( QFile::exists( journal ) );
+        assertFalse( QFile::exists( e2.temp ) );
+        assertFalse( QFile::exists( e1.backup ) );
+        assertFalse( QFile::exists( e2.backup ) );
+
+        // interrupted while writing the journal: rolled back
+        assertTrue( writeFile( e1.temp, newData ) );
+        QByteArray partial = serializeJournal( j );
+        partial.chop( 3 );
+        assertTrue( writeFile( journal, partial ) );
+        assertTrue( KDSaveFileGroup::recover( journal, &error ) );
+        assertEqual( readFile( first ), oldData );
+        assertFalse( QFile::exists( e1.temp ) );
+        assertFalse( QFile::exists( journal ) );
+
+        assertTrue( KDSaveFileGroup::recover( journal, &error ) ); // nothing to do
+
+        // in backup mode, interrupted while copying the temporary file from another file system:
+        // the old file is in the backup already, and the target only partially written
+        j.removeBackups = false;
+        assertTrue( writeFile( e1.temp, newData ) );
+        e1.identity = fileIdentity( e1.temp );
+        j.entries.clear();
+        j.entries << e1;
+        assertTrue( writeJournal( journal, j, &error ) );
+        assertTrue( QFile::rename( first, e1.backup ) );
+        assertTrue( writeFile( first, newData.left( newData.size() / 2 ) ) );
+        assertTrue( KDSaveFileGroup::recover( journal, &error ) );
+        assertEqual( readFile( first ), newData );
+        assertEqual( readFile( e1.backup ), oldData );
+        assertFalse( QFile::exists( e1.temp ) );
+        assertFalse( QFile::exists( journal ) );
+        assertTrue( QFile::remove( e1.backup ) );
+
+        // a complete journal whose temporary file vanished: an error, not a no-op
+        assertTrue( writeFile( e2.temp, newData ) );
+        e2.identity = fileIdentity( e2.temp );
+        j.entries.clear();
+        j.entries << e2;
+        assertTrue( writeJournal( journal, j, &error ) );
+        assertTrue( QFile::remove( e2.temp ) );
+        assertFalse( KDSaveFileGroup::recover( journal, &error ) );
+        assertFalse( error.isEmpty() );
+        assertEqual( readFile( second ), oldData );
+        assertTrue( QFile::exists( journal ) );
+        assertTrue( QFile::remove( journal ) );
+    }
+    assertTrue( QFile::remove( first ) );
+    assertTrue( QFile::remove( second ) );
+}
+
 #endif // KDTOOLSCORE_UNITTESTS
@@ -25,7 +25,9 @@
 
 #include <KDToolsCore/pimpl_ptr.h>
 
+#include <QtCore/QCoreApplication>
 #include <QtCore/QFile>
+#include <QtCore/QList>
 
 class KDTOOLSCORE_EXPORT KDSaveFile : public QIODevice
 {
@@ -42,6 +44,26 @@ public:
 
     bool commit( CommitMode=BackupExistingFile );
 
+    enum SyncPolicy {
+        NoSync=0,
+        SyncData=1,
+        SyncDataAndDirectory=2
+    };
+
+    SyncPolicy syncPolicy() const;
+    void setSyncPolicy( SyncPolicy policy );
+
+    enum BackupStrategy {
+        NoBackup=0,
+        RenameBackup=1,
+        HardLinkBackup=2,
+        ReflinkBackup=3
+    };
+
+    BackupStrategy backupStrategy() const;
+    void setBackupStrategy( BackupStrategy strategy );
+    BackupStrategy usedBackupStrategy() const;
+
     QFile::FileError error() const;
     void unsetError();
 
@@ -56,6 +78,7 @@ public:
 
     bool flush();
     bool resize( qint64 sz );
+    bool reserve( qint64 sz );
     int handle() const;
 
     qint64 bytesAvailable() const;
@@ -74,6 +97,31 @@ protected:
     qint64 readLineData( char* data, qint64 maxSize );
     qint64 writeData( const char* data, qint64 maxSize );
 
+private:
+    friend class KDSaveFileGroup;
+    class Private;
+    kdtools::pimpl_ptr<Private> d;
+};
+
+class KDTOOLSCORE_EXPORT KDSaveFileGroup
+{
+    Q_DECLARE_TR_FUNCTIONS( KDSaveFileGroup )
+    Q_DISABLE_COPY( KDSaveFileGroup )
+public:
+    explicit KDSaveFileGroup( const QString& journalFileName );
+    ~KDSaveFileGroup();
+
+    QString journalFileName() const;
+
+    void addFile( KDSaveFile* file );
+    void removeFile( KDSaveFile* file );
+    QList<KDSaveFile*> files() const;
+
+    bool commit( KDSaveFile::CommitMode mode=KDSaveFile::BackupExistingFile );
+    QString errorString() const;
+
+    static bool recover( const QString& journalFileName, QString* errorString=0 );
+
 private:
     class Private;
     kdtools::pimpl_ptr<Private> d;
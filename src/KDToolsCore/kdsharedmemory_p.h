@@ -0,0 +1,43 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+#ifndef __KDTOOLS_CORE_KDSHAREDMEMORY_P_H__
+#define __KDTOOLS_CORE_KDSHAREDMEMORY_P_H__
+
+#include <QtCore/QAtomicInt>
+
+// Blocking on a word in shared memory, across processes. On Linux,
+// this is a futex; elsewhere, the wait just sleeps briefly, so callers
+// must re-check their condition in a loop anyway.
+
+namespace kdtools {
+
+    // Blocks while word == expected, for at most msecs (-1: forever).
+    // May return early, spuriously.
+    void sharedMemoryWait( QBasicAtomicInt & word, int expected, int msecs );
+
+    // Wakes all threads blocked in sharedMemoryWait() on word.
+    void sharedMemoryWakeAll( QBasicAtomicInt & word );
+
+}
+
+#endif /* __KDTOOLS_CORE_KDSHAREDMEMORY_P_H__ */
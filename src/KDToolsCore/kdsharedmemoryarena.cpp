@@ -0,0 +1,512 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+#include "kdsharedmemoryarena.h"
+
+#if QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN )
+
+#ifndef QT_NO_SHAREDMEMORY
+
+#include "kdsharedmemorylocker.h"
+
+#include <QSharedMemory>
+
+using namespace kdtools;
+
+namespace {
+
+    // Block k spans MinBlockSize << k bytes, its header included, so a
+    // free block can be split into two blocks of the next smaller size
+    // class. Freed blocks go onto their size class's free list; they
+    // are not coalesced.
+    enum { MinBlockSize = 32, BlockHeaderSize = 16, NumSizeClasses = 26 };
+
+    static const quint32 ArenaMagic = 0x4b445341; // "KDSA"
+    static const quint32 AllocatedTag = 0x616c6c63;
+    static const quint32 FreeTag = 0x66726565;
+
+    // behind KDSharedMemoryFutexLocker's header; all offsets are from
+    // the start of the segment, 0 being null:
+    struct ArenaHeader {
+        quint32 magic;
+        quint32 size;
+        quint32 top; // where never allocated memory starts
+        quint32 root;
+        quint32 allocated; // bytes in allocated blocks, headers included
+        quint32 freeLists[NumSizeClasses];
+    };
+
+    struct BlockHeader {
+        quint32 sizeClass;
+        quint32 tag;
+        quint32 next; // in the free list
+        quint32 reserved;
+    };
+
+    typedef char BlockHeaderFits[ sizeof( BlockHeader ) <= BlockHeaderSize ? 1 : -1 ];
+
+    static inline quint32 blockSize( int sizeClass ) {
+        return quint32( MinBlockSize ) << sizeClass;
+    }
+
+    // the smallest size class whose blocks hold size bytes, or -1:
+    static int sizeClassFor( std::size_t size ) {
+        for ( int k = 0 ; k < NumSizeClasses ; ++k )
+            if ( size <= blockSize( k ) - BlockHeaderSize )
+                return k;
+        return -1;
+    }
+
+    static inline quint32 firstBlockOffset() {
+        const quint32 end = KDSharedMemoryFutexLocker::HeaderSize + sizeof( ArenaHeader );
+        return ( end + MinBlockSize - 1 ) & ~quint32( MinBlockSize - 1 );
+    }
+
+    // Gives access to the arena while locking the segment:
+    class ArenaLocker {
+    public:
+        explicit ArenaLocker( QSharedMemory * mem )
+            : locker( mem ),
+              header( 0 ),
+              base( 0 )
+        {
+            if ( !locker.data() || mem->size() < static_cast<int>( firstBlockOffset() ) )
+                return;
+            if ( locker.ownerDied() )
+                qWarning( "KDSharedMemoryArena: a process died while allocating, the arena may be corrupt" );
+            header = static_cast<ArenaHeader*>( locker.data() );
+            base = static_cast<char*>( mem->data() );
+        }
+
+        bool isValid() const { return header && header->magic == ArenaMagic; }
+
+        BlockHeader * block( quint32 offset ) const {
+            return reinterpret_cast<BlockHeader*>( base + offset );
+        }
+
+        KDSharedMemoryFutexLocker locker;
+        ArenaHeader * header;
+        char * base;
+    };
+
+} // anon namespace
+
+/*!
+  \class KDSharedMemoryArena
+  \ingroup core
+  \brief Allocation of variable-sized objects in a Qt shared memory segment
+  \since_c 2.3
+
+  KDLockedSharedMemoryArray and KDSharedMemoryRingBuffer share
+  fixed-size values. KDSharedMemoryArena instead manages a QSharedMemory
+  segment as a heap, so that variable-length records, such as strings
+  and arrays, can be shared between processes directly, instead of
+  being serialized.
+
+  Allocations are served from power-of-two size classes, each with a
+  free list; a request is rounded up to the next size class. Blocks
+  are split, but freed blocks are not coalesced, so the arena suits
+  workloads with recurring allocation sizes best. All operations lock
+  the segment with a KDSharedMemoryFutexLocker.
+
+  The segment is mapped at different addresses in different processes,
+  so pointers into it must not be stored in it. Store
+  KDSharedMemoryOffsetPtr instead, which is relative to its own
+  address, or pass offsets, obtained with offsetOf() and resolved with
+  fromOffset(). One allocation can be published as root(), for other
+  processes to find the shared data:
+
+  \code
+  struct Record {
+      quint32 length;
+      KDSharedMemoryOffsetPtr<char> text;
+      KDSharedMemoryOffsetPtr<Record> next;
+  };
+
+  KDSharedMemoryArena arena( mem );
+  arena.initialize(); // once, by the creator of the segment
+  Record * const r = static_cast<Record*>( arena.allocate( sizeof( Record ) ) );
+  r->length = text.size();
+  r->text = arena.allocateArray<char>( text.size() );
+  std::memcpy( r->text.get(), text.constData(), text.size() );
+  r->next = 0;
+  arena.setRoot( r );
+  \endcode
+
+  \note The objects in the arena must not contain plain pointers or
+  virtual functions. The arena hands out raw memory; it's up to the
+  users to synchronize access to the objects themselves.
+
+  \sa KDSharedMemoryOffsetPtr, KDSharedMemoryFutexLocker
+*/
+
+/*!
+  Constructor. Constructs a KDSharedMemoryArena on the data segment of
+  \a m, which must be initialized before use, by this or another
+  KDSharedMemoryArena.
+*/
+KDSharedMemoryArena::KDSharedMemoryArena( QSharedMemory * m )
+    : mem( m )
+{
+
+}
+
+/*!
+  Constructor.
+  \overload
+*/
+KDSharedMemoryArena::KDSharedMemoryArena( QSharedMemory & m )
+    : mem( &m )
+{
+
+}
+
+/*!
+  Destructor. Leaves the arena in the segment untouched.
+*/
+KDSharedMemoryArena::~KDSharedMemoryArena() {}
+
+/*!
+  Sets up an empty arena spanning the whole segment. Returns \c false if
+  the segment is not attached or too small.
+
+  Call this once, from the process that created the segment, before
+  anyone else uses it.
+*/
+bool KDSharedMemoryArena::initialize() {
+    ArenaLocker a( mem );
+    if ( !a.header )
+        return false;
+    ArenaHeader * const h = a.header;
+    h->size = static_cast<quint32>( mem->size() );
+    h->top = firstBlockOffset();
+    h->root = 0;
+    h->allocated = 0;
+    for ( int k = 0 ; k < NumSizeClasses ; ++k )
+        h->freeLists[k] = 0;
+    h->magic = ArenaMagic;
+    return true;
+}
+
+/*!
+  Returns whether the segment holds an initialized arena.
+*/
+bool KDSharedMemoryArena::isValid() const {
+    return ArenaLocker( mem ).isValid();
+}
+
+/*!
+  \fn T * KDSharedMemoryArena::allocateArray( std::size_t count )
+
+  Allocates an array of \a count values of type \a T, uninitialized.
+  Returns 0 if the arena is exhausted, or if \a count values would
+  not fit into a std::size_t.
+*/
+
+/*!
+  Allocates \a size bytes in the segment and returns a pointer to them,
+  or 0 if the arena is exhausted (or not valid). The memory is aligned
+  to 16 bytes, and not initialized.
+
+  \sa deallocate()
+*/
+void * KDSharedMemoryArena::allocate( std::size_t size ) {
+    ArenaLocker a( mem );
+    const int k = sizeClassFor( size );
+    if ( !a.isValid() || k < 0 )
+        return 0;
+    ArenaHeader * const h = a.header;
+
+    quint32 offset = 0;
+    if ( h->freeLists[k] ) {
+        offset = h->freeLists[k];
+        h->freeLists[k] = a.block( offset )->next;
+    } else if ( h->top <= h->size && h->size - h->top >= blockSize( k ) ) {
+        offset = h->top;
+        h->top += blockSize( k );
+    } else {
+        // split the smallest larger free block, keeping the upper halves:
+        int j = k + 1;
+        while ( j < NumSizeClasses && !h->freeLists[j] )
+            ++j;
+        if ( j == NumSizeClasses )
+            return 0;
+        offset = h->freeLists[j];
+        h->freeLists[j] = a.block( offset )->next;
+        while ( j > k ) {
+            --j;
+            const quint32 upper = offset + blockSize( j );
+            BlockHeader * const b = a.block( upper );
+            b->sizeClass = j;
+            b->tag = FreeTag;
+            b->next = h->freeLists[j];
+            h->freeLists[j] = upper;
+        }
+    }
+
+    BlockHeader * const b = a.block( offset );
+    b->sizeClass = k;
+    b->tag = AllocatedTag;
+    b->next = 0;
+    h->allocated += blockSize( k );
+    return a.base + offset + BlockHeaderSize;
+}
+
+/*!
+  Frees the memory at \a p, which must have been returned by allocate()
+  on this segment (by any process). Does nothing if \a p is 0. Other
+  pointers, and ones freed already, are reported with qWarning(), and
+  assert in debug builds.
+*/
+void KDSharedMemoryArena::deallocate( void * p ) {
+    if ( !p )
+        return;
+    ArenaLocker a( mem );
+    if ( !a.isValid() )
+        return;
+    ArenaHeader * const h = a.header;
+    const quint32 pos = offsetOf( p );
+    const quint32 offset = pos - BlockHeaderSize;
+    // in debug builds, stop right at pointers allocate() didn't return, and at double frees:
+    assert( pos >= firstBlockOffset() + BlockHeaderSize && ( offset - firstBlockOffset() ) % MinBlockSize == 0 );
+    assert( offset < h->top && a.block( offset )->tag == AllocatedTag );
+    if ( pos < firstBlockOffset() + BlockHeaderSize || offset >= h->top || a.block( offset )->tag != AllocatedTag ) {
+        qWarning( "KDSharedMemoryArena::deallocate: %p was not allocated in this arena, or was freed already", p );
+        return;
+    }
+    BlockHeader * const b = a.block( offset );
+    b->tag = FreeTag;
+    b->next = h->freeLists[b->sizeClass];
+    h->freeLists[b->sizeClass] = offset;
+    h->allocated -= blockSize( b->sizeClass );
+}
+
+/*!
+  Returns the offset of \a p from the start of the segment, which is
+  the same in all processes, or 0 if \a p is 0 or not in the segment.
+
+  \sa fromOffset()
+*/
+quint32 KDSharedMemoryArena::offsetOf( const void * p ) const {
+    const char * const base = mem ? static_cast<const char*>( mem->constData() ) : 0 ;
+    const char * const c = static_cast<const char*>( p );
+    if ( !base || c <= base || c >= base + mem->size() )
+        return 0;
+    return static_cast<quint32>( c - base );
+}
+
+/*!
+  Returns a pointer to \a offset bytes into the segment in this
+  process, or 0 if \a offset is 0 or out of range.
+
+  \sa offsetOf()
+*/
+void * KDSharedMemoryArena::fromOffset( quint32 offset ) const {
+    if ( !offset || !mem || !mem->data() || offset >= static_cast<quint32>( mem->size() ) )
+        return 0;
+    return static_cast<char*>( mem->data() ) + offset;
+}
+
+/*!
+  Returns the allocation published with setRoot(), or 0.
+*/
+void * KDSharedMemoryArena::root() const {
+    quint32 offset = 0;
+    {
+        const ArenaLocker a( mem );
+        if ( a.isValid() )
+            offset = a.header->root;
+    }
+    return fromOffset( offset );
+}
+
+/*!
+  Publishes \a p as the root of the arena, the well-known starting point
+  for other processes to find the shared data.
+*/
+void KDSharedMemoryArena::setRoot( void * p ) {
+    const quint32 offset = offsetOf( p );
+    ArenaLocker a( mem );
+    if ( a.isValid() )
+        a.header->root = offset;
+}
+
+/*!
+  Returns the number of bytes in allocated blocks, including the
+  overhead of the size classes.
+*/
+std::size_t KDSharedMemoryArena::bytesAllocated() const {
+    const ArenaLocker a( mem );
+    return a.isValid() ? a.header->allocated : 0 ;
+}
+
+/*!
+  \class KDSharedMemoryOffsetPtr
+  \ingroup core smartptr
+  \brief A pointer that stays valid in shared memory mapped at different addresses
+  \since_c 2.3
+
+  KDSharedMemoryOffsetPtr stores the distance of the object it points
+  to from its own address, instead of an address. When it lives in the
+  same shared memory segment as that object, it points to the right
+  place in every process, wherever the segment is mapped. This is how
+  objects in a KDSharedMemoryArena refer to each other.
+
+  Copying a KDSharedMemoryOffsetPtr copies the pointer, not the
+  offset.
+
+  \sa KDSharedMemoryArena
+*/
+
+/*!
+  \fn KDSharedMemoryOffsetPtr::KDSharedMemoryOffsetPtr()
+  Constructs a null pointer.
+*/
+
+/*!
+  \fn KDSharedMemoryOffsetPtr::KDSharedMemoryOffsetPtr( T * p )
+  Constructs a pointer to \a p.
+*/
+
+/*!
+  \fn T * KDSharedMemoryOffsetPtr::get() const
+  Returns the pointer, as valid in this process.
+*/
+
+#ifdef KDTOOLSCORE_UNITTESTS
+
+#include <KDUnitTest/Test>
+
+#include <QByteArray>
+#include <QUuid>
+
+#include <cstring>
+
+namespace {
+
+    struct Record {
+        quint32 length;
+        KDSharedMemoryOffsetPtr<char> text;
+        KDSharedMemoryOffsetPtr<Record> next;
+    };
+
+    static Record * addRecord( KDSharedMemoryArena & arena, Record * next, const QByteArray & text ) {
+        Record * const r = static_cast<Record*>( arena.allocate( sizeof( Record ) ) );
+        if ( !r )
+            return 0;
+        r->length = text.size();
+        r->text = arena.allocateArray<char>( text.size() );
+        std::memcpy( r->text.get(), text.constData(), text.size() );
+        r->next = next;
+        return r;
+    }
+
+}
+
+KDAB_UNITTEST_SIMPLE( KDSharedMemoryArena, "kdtools/core" ) {
+
+    const QString key = QUuid::createUuid().toString();
+    QSharedMemory mem( key );
+    const bool created = mem.create( 64 * 1024 );
+    assertTrue( created );
+    if ( !created )
+        return; // don't execute tests if shm coulnd't be created
+
+    KDSharedMemoryArena arena( mem );
+    assertFalse( arena );
+    assertEqual( arena.allocate( 1 ), static_cast<void*>( 0 ) );
+    assertTrue( arena.initialize() );
+    assertTrue( arena );
+    assertEqual( arena.bytesAllocated(), std::size_t( 0 ) );
+
+    {
+        void * const p1 = arena.allocate( 1 );
+        void * const p2 = arena.allocate( 100 );
+        assertTrue( p1 != 0 );
+        assertTrue( p2 != 0 );
+        assertEqual( reinterpret_cast<quintptr>( p1 ) % 16, quintptr( 0 ) );
+        assertEqual( reinterpret_cast<quintptr>( p2 ) % 16, quintptr( 0 ) );
+        assertEqual( arena.fromOffset( arena.offsetOf( p2 ) ), p2 );
+        assertEqual( arena.offsetOf( 0 ), 0u );
+        assertGreater( arena.bytesAllocated(), std::size_t( 100 ) );
+
+        // freed blocks are reused for the same size class:
+        arena.deallocate( p2 );
+        assertEqual( arena.allocate( 90 ), p2 );
+        arena.deallocate( p2 );
+        arena.deallocate( p1 );
+        assertEqual( arena.bytesAllocated(), std::size_t( 0 ) );
+        assertNull( arena.allocateArray<quint64>( static_cast<std::size_t>( -1 ) / 8 + 3 ) ); // count * 8 wraps around to 16
+    }
+
+    {
+        // exhaustion:
+        assertEqual( arena.allocate( 64 * 1024 ), static_cast<void*>( 0 ) );
+        QList<void*> blocks;
+        while ( void * const p = arena.allocate( 1000 ) )
+            blocks.push_back( p );
+        assertGreater( blocks.size(), 20 );
+        QList<void*> smallBlocks;
+        while ( void * const p = arena.allocate( 1 ) )
+            smallBlocks.push_back( p );
+
+        // once nothing is left, larger free blocks are split for smaller ones:
+        void * const large = blocks.takeLast();
+        arena.deallocate( large );
+        assertEqual( arena.allocate( 1 ), large );
+        smallBlocks.push_back( large );
+
+        Q_FOREACH( void * p, blocks )
+            arena.deallocate( p );
+        Q_FOREACH( void * p, smallBlocks )
+            arena.deallocate( p );
+        assertEqual( arena.bytesAllocated(), std::size_t( 0 ) );
+    }
+
+    {
+        // a linked list of strings, read through a second mapping of the
+        // segment, at a different address:
+        Record * list = 0;
+        for ( int i = 0 ; i < 10 ; ++i )
+            list = addRecord( arena, list, QByteArray::number( i ) + " bottles" );
+        arena.setRoot( list );
+
+        QSharedMemory other( key );
+        assertTrue( other.attach() );
+        assertTrue( other.data() != mem.data() );
+        KDSharedMemoryArena otherArena( other );
+        assertTrue( otherArena );
+        int i = 9;
+        for ( const Record * r = static_cast<const Record*>( otherArena.root() ) ; r ; r = r->next.get(), --i ) {
+            assertTrue( QByteArray( r->text.get(), r->length ) == QByteArray::number( i ) + " bottles" );
+            assertEqual( otherArena.offsetOf( r ), arena.offsetOf( list ) );
+            list = list->next.get();
+        }
+        assertEqual( i, -1 );
+    }
+}
+
+#endif // KDTOOLSCORE_UNITTESTS
+
+#endif /* QT_NO_SHAREDMEMORY */
+
+#endif /* QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN ) */
@@ -0,0 +1,115 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+#ifndef __KDTOOLS__CORE__KDSHAREDMEMORYARENA_H__
+#define __KDTOOLS__CORE__KDSHAREDMEMORYARENA_H__
+
+#include <KDToolsCore/kdtoolsglobal.h>
+
+#if QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN )
+#ifndef QT_NO_SHAREDMEMORY
+
+#include <cassert>
+#include <cstddef>
+
+QT_BEGIN_NAMESPACE
+class QSharedMemory;
+QT_END_NAMESPACE
+
+#ifndef DOXYGEN_RUN
+namespace kdtools {
+#endif
+
+class KDTOOLSCORE_EXPORT KDSharedMemoryArena KDAB_FINAL_CLASS {
+    Q_DISABLE_COPY( KDSharedMemoryArena )
+public:
+    explicit KDSharedMemoryArena( QSharedMemory * mem );
+    explicit KDSharedMemoryArena( QSharedMemory & mem );
+    ~KDSharedMemoryArena();
+
+    bool initialize();
+    bool isValid() const;
+
+    void * allocate( std::size_t size );
+    void deallocate( void * p );
+
+    template <typename T>
+    T * allocateArray( std::size_t count ) {
+        if ( count > static_cast<std::size_t>( -1 ) / sizeof( T ) )
+            return 0;
+        return static_cast<T*>( allocate( count * sizeof( T ) ) );
+    }
+
+    quint32 offsetOf( const void * p ) const;
+    void * fromOffset( quint32 offset ) const;
+
+    void * root() const;
+    void setRoot( void * p );
+
+    std::size_t bytesAllocated() const;
+
+    KDAB_IMPLEMENT_SAFE_BOOL_OPERATOR( isValid() )
+
+private:
+    QSharedMemory * const mem;
+};
+
+template <typename T>
+class MAKEINCLUDES_EXPORT KDSharedMemoryOffsetPtr {
+public:
+    KDSharedMemoryOffsetPtr() : offset( Null ) {}
+    KDSharedMemoryOffsetPtr( T * p ) : offset( Null ) { set( p ); }
+    KDSharedMemoryOffsetPtr( const KDSharedMemoryOffsetPtr & other ) : offset( Null ) { set( other.get() ); }
+
+    KDSharedMemoryOffsetPtr & operator=( const KDSharedMemoryOffsetPtr & other ) { set( other.get() ); return *this; }
+    KDSharedMemoryOffsetPtr & operator=( T * p ) { set( p ); return *this; }
+
+    T * get() const {
+        return offset == Null ? 0 : reinterpret_cast<T*>( const_cast<char*>( reinterpret_cast<const char*>( this ) ) + offset );
+    }
+
+    T & operator*() const { assert( get() ); return *get(); }
+    T * operator->() const { return get(); }
+    T & operator[]( std::ptrdiff_t n ) const { assert( get() ); return get()[n]; }
+
+    KDAB_IMPLEMENT_SAFE_BOOL_OPERATOR( get() )
+
+private:
+    // relative to this: 0 would be a pointer to itself, so 1 is null
+    enum { Null = 1 };
+
+    void set( T * p ) {
+        offset = p ? reinterpret_cast<const char*>( p ) - reinterpret_cast<const char*>( this ) : std::ptrdiff_t( Null ) ;
+    }
+
+    std::ptrdiff_t offset;
+};
+
+#ifndef DOXYGEN_RUN
+}
+#endif
+
+#endif /* QT_NO_SHAREDMEMORY */
+
+#endif /* QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN ) */
+
+#endif /* __KDTOOLS__CORE__KDSHAREDMEMORYARENA_H__ */
@@ -26,10 +26,60 @@
 
 #ifndef QT_NO_SHAREDMEMORY
 
+#include "kdsharedmemory_p.h"
+#include "kdatomic.h"
+
 #include <QSharedMemory>
+#include <QThread>
+
+#include <climits>
+
+#ifdef Q_OS_LINUX
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <errno.h>
+# include <pthread.h>
+# include <signal.h>
+# include <time.h>
+# include <unistd.h>
+#endif
 
 using namespace kdtools;
 
+#ifdef Q_OS_LINUX
+
+// not FUTEX_PRIVATE_FLAG: the word is shared with other processes
+void kdtools::sharedMemoryWait( QBasicAtomicInt & word, int expected, int msecs ) {
+    timespec timeout;
+    if ( msecs >= 0 ) {
+        timeout.tv_sec = msecs / 1000;
+        timeout.tv_nsec = ( msecs % 1000 ) * 1000000L;
+    }
+    ::syscall( SYS_futex, reinterpret_cast<int*>( &word ), FUTEX_WAIT, expected,
+               msecs >= 0 ? &timeout : 0, 0, 0 );
+}
+
+void kdtools::sharedMemoryWakeAll( QBasicAtomicInt & word ) {
+    ::syscall( SYS_futex, reinterpret_cast<int*>( &word ), FUTEX_WAKE, INT_MAX, 0, 0, 0 );
+}
+
+#else // Q_OS_LINUX
+
+namespace {
+    struct Sleeper : QThread {
+        using QThread::msleep;
+    };
+}
+
+void kdtools::sharedMemoryWait( QBasicAtomicInt & word, int expected, int msecs ) {
+    if ( msecs != 0 && kdtools::atomicLoadAcquire( word ) == expected )
+        Sleeper::msleep( 1 );
+}
+
+void kdtools::sharedMemoryWakeAll( QBasicAtomicInt & ) {}
+
+#endif // Q_OS_LINUX
+
 /*!
   \class KDSharedMemoryLocker
   \ingroup raii core
@@ -68,6 +118,296 @@ KDSharedMemoryLocker::~KDSharedMemoryLocker() {
         mem->unlock();
 }
 
+/*!
+  \class KDSharedMemoryFutexLocker
+  \ingroup raii core
+  \brief Like KDSharedMemoryLocker, but without a system call when uncontended
+  \since_c 2.3
+
+  KDSharedMemoryLocker uses QSharedMemory::lock(), which is a System V
+  semaphore operation, and so a system call, even if no other process
+  holds the lock. KDSharedMemoryFutexLocker instead uses a lock living
+  in the first HeaderSize bytes of the segment itself: on Linux, a
+  process-shared, robust mutex, i.e. a futex word that is taken with an
+  atomic operation in user space as long as there's no contention.
+
+  The segment's data then starts at data(), HeaderSize bytes into the
+  segment. The creator of the segment must leave these bytes zeroed
+  (as QSharedMemory::create() does); the first locker sets the lock up.
+  If that process dies while doing so, the next locker sets it up
+  again. All users of a segment must agree on using
+  KDSharedMemoryFutexLocker, and, on Linux, run in the same PID
+  namespace.
+
+  If a process dies while holding the lock, the next locker gets it,
+  and ownerDied() returns \c true; the data may then be inconsistent,
+  as the process may have died in the middle of changing it.
+
+  \note Elsewhere than on Linux, this uses QSharedMemory::lock(), like
+  KDSharedMemoryLocker, but still keeps the data behind the header, so
+  that the same code works on all platforms.
+*/
+
+#ifdef Q_OS_LINUX
+
+namespace {
+
+    // otherwise, state is the pid of the process setting the mutex up:
+    enum { Uninitialized = 0, Initialized = -1 };
+
+    // the mutex's futex word comes first:
+    struct FutexLockHeader {
+        pthread_mutex_t mutex;
+        QBasicAtomicInt state;
+    };
+
+    // EPERM means it exists, but belongs to someone else:
+    bool processExists( pid_t pid ) {
+        return ::kill( pid, 0 ) == 0 || errno != ESRCH;
+    }
+
+    typedef char FutexLockHeaderFits[ sizeof( FutexLockHeader ) <= KDSharedMemoryFutexLocker::HeaderSize ? 1 : -1 ];
+
+}
+
+// Returns the mutex in mem's header, setting it up if this is the
+// first use of the segment, or if the process that started to set it
+// up died before finishing; 0 if mem isn't usable:
+static pthread_mutex_t * sharedMutex( QSharedMemory * mem ) {
+    if ( !mem || !mem->data() || mem->size() < KDSharedMemoryFutexLocker::HeaderSize )
+        return 0;
+    FutexLockHeader * const h = static_cast<FutexLockHeader*>( mem->data() );
+    while ( true ) {
+        const int state = kdtools::atomicLoadAcquire( h->state );
+        if ( state == Initialized )
+            return &h->mutex;
+        if ( state != Uninitialized && processExists( state ) ) {
+            QThread::yieldCurrentThread();
+            continue;
+        }
+        if ( h->state.testAndSetAcquire( state, ::getpid() ) ) {
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init( &attr );
+            pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+            pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+            pthread_mutex_init( &h->mutex, &attr );
+            pthread_mutexattr_destroy( &attr );
+            kdtools::atomicStoreRelease( h->state, Initialized );
+            return &h->mutex;
+        }
+    }
+}
+
+static bool lockShared( QSharedMemory * mem, bool * ownerDied ) {
+    pthread_mutex_t * const mutex = sharedMutex( mem );
+    if ( !mutex )
+        return false;
+    const int rc = pthread_mutex_lock( mutex );
+    if ( rc == EOWNERDEAD ) {
+        // we got the lock, but its owner died with it
+        *ownerDied = true;
+        pthread_mutex_consistent( mutex );
+        return true;
+    }
+    return rc == 0;
+}
+
+static void unlockShared( QSharedMemory * mem ) {
+    pthread_mutex_unlock( &static_cast<FutexLockHeader*>( mem->data() )->mutex );
+}
+
+#else // Q_OS_LINUX
+
+static bool lockShared( QSharedMemory * mem, bool * ) {
+    return mem && mem->size() >= KDSharedMemoryFutexLocker::HeaderSize && mem->lock();
+}
+
+static void unlockShared( QSharedMemory * mem ) {
+    mem->unlock();
+}
+
+#endif // Q_OS_LINUX
+
+/*!
+  Constructor. Locks the shared memory segment \a m. If another
+  process holds the lock, this constructor blocks until the lock is
+  released. The memory segment needs to be properly created or
+  attached, and at least HeaderSize bytes large.
+*/
+KDSharedMemoryFutexLocker::KDSharedMemoryFutexLocker( QSharedMemory * m )
+    : mem( m ),
+      locked( false ),
+      previousOwnerDied( false )
+{
+    locked = lockShared( mem, &previousOwnerDied );
+}
+
+/*!
+  Constructor.
+  \overload
+*/
+KDSharedMemoryFutexLocker::KDSharedMemoryFutexLocker( QSharedMemory & m )
+    : mem( &m ),
+      locked( false ),
+      previousOwnerDied( false )
+{
+    locked = lockShared( mem, &previousOwnerDied );
+}
+
+/*!
+  Destructor. Unlocks the shared memory segment associated with this
+  KDSharedMemoryFutexLocker.
+*/
+KDSharedMemoryFutexLocker::~KDSharedMemoryFutexLocker() {
+    if ( locked )
+        unlockShared( mem );
+}
+
+/*!
+  Returns whether the segment was locked successfully. This is \c
+  false if the segment is not attached or smaller than HeaderSize.
+*/
+bool KDSharedMemoryFutexLocker::isLocked() const {
+    return locked;
+}
+
+/*!
+  Returns \c true if the previous owner of the lock died while holding
+  it. The data in the segment may then be inconsistent.
+*/
+bool KDSharedMemoryFutexLocker::ownerDied() const {
+    return previousOwnerDied;
+}
+
+/*!
+  Returns a pointer to the data in the segment, behind the lock's
+  header, or 0 if the segment is not locked.
+*/
+void * KDSharedMemoryFutexLocker::data() const {
+    return locked ? static_cast<char*>( mem->data() ) + HeaderSize : 0 ;
+}
+
+#ifdef KDTOOLSCORE_UNITTESTS
+
+#include <KDUnitTest/Test>
+
+#include <QUuid>
+
+#ifdef Q_OS_LINUX
+# include <sys/wait.h>
+# include <cstring>
+#endif
+
+namespace {
+
+    struct Counters {
+        int a;
+        int b; // always ~a while unlocked
+    };
+
+    enum { Incrementers = 4, Increments = 20000 };
+
+    class IncrementThread : public QThread {
+    public:
+        explicit IncrementThread( const QString & key )
+            : mem( key ), errors( 0 )
+        {
+            mem.attach();
+        }
+
+        void run() {
+            for ( int i = 0 ; i < Increments ; ++i ) {
+                const KDSharedMemoryFutexLocker locker( mem );
+                Counters * const c = static_cast<Counters*>( locker.data() );
+                if ( !c || c->b != ~c->a ) {
+                    ++errors;
+                    continue;
+                }
+                ++c->a;
+                c->b = ~c->a;
+            }
+        }
+
+        QSharedMemory mem;
+        int errors;
+    };
+
+}
+
+KDAB_UNITTEST_SIMPLE( KDSharedMemoryFutexLocker, "kdtools/core" ) {
+
+    const QString key = QUuid::createUuid().toString();
+    QSharedMemory mem( key );
+    const bool created = mem.create( KDSharedMemoryFutexLocker::HeaderSize + sizeof( Counters ) );
+    assertTrue( created );
+    if ( !created )
+        return; // don't execute tests if shm coulnd't be created
+
+    {
+        const KDSharedMemoryFutexLocker locker( mem );
+        assertTrue( locker.isLocked() );
+        assertFalse( locker.ownerDied() );
+        assertEqual( locker.data(), static_cast<void*>( static_cast<char*>( mem.data() ) + KDSharedMemoryFutexLocker::HeaderSize ) );
+        Counters * const c = static_cast<Counters*>( locker.data() );
+        c->a = 0;
+        c->b = ~0;
+    }
+
+    {
+        QSharedMemory detached( key + key );
+        const KDSharedMemoryFutexLocker locker( detached );
+        assertFalse( locker.isLocked() );
+        assertEqual( locker.data(), static_cast<void*>( 0 ) );
+    }
+
+    {
+        QList<IncrementThread*> threads;
+        for ( int i = 0 ; i < Incrementers ; ++i )
+            threads.push_back( new IncrementThread( key ) );
+        Q_FOREACH( IncrementThread * t, threads )
+            t->start();
+        Q_FOREACH( IncrementThread * t, threads ) {
+            assertTrue( t->wait( 60000 ) );
+            assertEqual( t->errors, 0 );
+        }
+        qDeleteAll( threads );
+
+        const KDSharedMemoryFutexLocker locker( mem );
+        const Counters * const c = static_cast<const Counters*>( locker.data() );
+        assertEqual( c->a, Incrementers * Increments );
+        assertEqual( c->b, ~c->a );
+    }
+
+#ifdef Q_OS_LINUX
+    {
+        // a process that died while setting the lock up...
+        const pid_t child = ::fork();
+        if ( child == 0 )
+            ::_exit( 0 );
+        assertGreater( child, 0 );
+        assertEqual( ::waitpid( child, 0, 0 ), child );
+
+        QSharedMemory abandoned( key + key );
+        assertTrue( abandoned.create( KDSharedMemoryFutexLocker::HeaderSize ) );
+        FutexLockHeader * const h = static_cast<FutexLockHeader*>( abandoned.data() );
+        std::memset( &h->mutex, 0xff, sizeof h->mutex );
+        kdtools::atomicStoreRelease( h->state, static_cast<int>( child ) );
+
+        // ...doesn't keep others from locking
+        {
+            const KDSharedMemoryFutexLocker locker( abandoned );
+            assertTrue( locker.isLocked() );
+            assertFalse( locker.ownerDied() );
+        }
+        assertEqual( kdtools::atomicLoadAcquire( h->state ), static_cast<int>( Initialized ) );
+        const KDSharedMemoryFutexLocker locker( abandoned );
+        assertTrue( locker.isLocked() );
+    }
+#endif
+}
+
+#endif // KDTOOLSCORE_UNITTESTS
+
 #endif /* QT_NO_SHAREDMEMORY */
 
 #endif /* QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN ) */
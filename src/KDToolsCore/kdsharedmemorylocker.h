@@ -47,6 +47,27 @@ private:
     QSharedMemory * const mem;
 };
 
+class KDTOOLSCORE_EXPORT KDSharedMemoryFutexLocker KDAB_FINAL_CLASS {
+    Q_DISABLE_COPY( KDSharedMemoryFutexLocker )
+public:
+    // the lock lives in a header of this size at the start of the segment:
+    enum { HeaderSize = 64 };
+
+    explicit KDSharedMemoryFutexLocker( QSharedMemory * mem );
+    explicit KDSharedMemoryFutexLocker( QSharedMemory & mem );
+    ~KDSharedMemoryFutexLocker();
+
+    bool isLocked() const;
+    bool ownerDied() const;
+
+    void * data() const;
+
+private:
+    QSharedMemory * const mem;
+    bool locked;
+    bool previousOwnerDied;
+};
+
 #ifndef DOXYGEN_RUN
 }
 #endif
@@ -0,0 +1,555 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+#include "kdsharedmemoryringbuffer.h"
+
+#if QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN )
+
+#ifndef QT_NO_SHAREDMEMORY
+
+#include "kdsharedmemory_p.h"
+#include "kdatomic.h"
+
+#include <QElapsedTimer>
+#include <QSharedMemory>
+
+#include <climits>
+#include <cstring>
+
+using namespace kdtools;
+
+namespace {
+
+    enum { CacheLineSize = 64, SlotHeaderSize = 8 };
+
+    static const int Magic = 0x4b445242; // "KDRB"
+
+    // The segment starts with this header, followed by the slots. Each
+    // field written at runtime has a cache line of its own, so pushing
+    // and popping processes don't contend for the same line.
+    struct RingHeader {
+        QBasicAtomicInt magic; // set last by initialize()
+        qint32 capacity;       // a power of two
+        qint32 slotSize;
+        char padding0[CacheLineSize - 12];
+        QBasicAtomicInt enqueuePos;
+        char padding1[CacheLineSize - 4];
+        QBasicAtomicInt dequeuePos;
+        char padding2[CacheLineSize - 4];
+        QBasicAtomicInt notEmpty; // bumped after a push while someone waits in pop()
+        QBasicAtomicInt notEmptyWaiters;
+        char padding3[CacheLineSize - 8];
+        QBasicAtomicInt notFull;  // bumped after a pop while someone waits in push()
+        QBasicAtomicInt notFullWaiters;
+        char padding4[CacheLineSize - 8];
+    };
+
+    // A slot is its sequence number (as in Dmitry Vyukov's bounded
+    // MPMC queue), followed by the value at SlotHeaderSize:
+    static inline int slotSize( std::size_t valueSize ) {
+        return static_cast<int>( ( SlotHeaderSize + valueSize + 7 ) & ~std::size_t( 7 ) );
+    }
+
+    static inline char * slotAt( RingHeader * h, int index ) {
+        return reinterpret_cast<char*>( h ) + sizeof( RingHeader ) + index * h->slotSize;
+    }
+
+    static inline QBasicAtomicInt & sequenceOf( char * slot ) {
+        return *reinterpret_cast<QBasicAtomicInt*>( slot );
+    }
+
+    // Returns 0 if the result doesn't fit into an int:
+    static int roundUpToPowerOfTwo( int n ) {
+        int result = 1;
+        while ( result < n ) {
+            if ( result > INT_MAX / 2 )
+                return 0;
+            result *= 2;
+        }
+        return result;
+    }
+
+    // Wakes waiters on counter, if any. The fence orders the preceding
+    // publication of a slot before the check of waiters, matching the
+    // waiters' increment before they re-check the slots.
+    static inline void wakeWaiters( QBasicAtomicInt & counter, const QBasicAtomicInt & waiters ) {
+        kdtools::atomicFence();
+        if ( kdtools::atomicLoadRelaxed( waiters ) > 0 ) {
+            counter.fetchAndAddRelease( 1 );
+            kdtools::sharedMemoryWakeAll( counter );
+        }
+    }
+
+    static inline int remainingTime( const QElapsedTimer & timer, int msecs ) {
+        if ( msecs < 0 )
+            return -1;
+        return static_cast<int>( qMax( qint64( 0 ), msecs - timer.elapsed() ) );
+    }
+
+} // anon namespace
+
+/*!
+  \class KDSharedMemoryRingBuffer
+  \ingroup core
+  \brief A lock-free queue of values in a Qt shared memory segment
+  \since_c 2.3
+
+  KDSharedMemoryRingBuffer passes values of type \c T between
+  processes (or threads) through a QSharedMemory segment, without
+  taking the segment's lock. Any number of processes may push and pop
+  concurrently.
+
+  The segment holds a header, with the enqueue and dequeue positions
+  on cache lines of their own, and an array of capacity() slots. A
+  push or pop claims a slot with one compare-and-swap on its position,
+  copies the value, and then releases the slot by advancing its
+  sequence number; no lock is taken. push() and pop() wait while the
+  buffer is full or empty, respectively; on Linux, they sleep on a
+  futex in the header, which is only woken (with a system call) while
+  someone actually waits.
+
+  The buffer is lock-free, but not wait-free: values are popped in
+  order, so a slot that has been claimed but not released yet holds
+  up everyone behind it. A pop reaching a slot whose push is still
+  copying sees the buffer as empty, and a push reaching a slot whose
+  pop is still copying sees it as full. This only takes as long as the
+  copy, unless the process in between is stopped (e.g. by a debugger
+  or SIGSTOP), which stalls the buffer until it continues, or dies,
+  which stalls it for good.
+
+  One process creates the segment with segmentSize() bytes and calls
+  initialize() on it before the others use it:
+
+  \code
+  QSharedMemory mem( key );
+  mem.create( KDSharedMemoryRingBuffer<Sample>::segmentSize( 4096 ) );
+  KDSharedMemoryRingBuffer<Sample> ring( mem );
+  ring.initialize( 4096 );
+  ...
+  ring.push( sample );
+  \endcode
+
+  and the others attach to it:
+
+  \code
+  QSharedMemory mem( key );
+  mem.attach();
+  KDSharedMemoryRingBuffer<Sample> ring( mem );
+  Sample sample;
+  while ( ring.pop( &sample ) )
+      process( sample );
+  \endcode
+
+  \note \c T must be a simple type that can be copied bytewise (no
+  pointers, no virtual functions), and all processes must use the
+  same \c T.
+
+  \note Elsewhere than on Linux, waiting in push() and pop() polls,
+  sleeping a millisecond between tries.
+
+  \note There is no recovery from a process dying while it pushes or
+  pops: the other processes must detect that (e.g. by a timeout on
+  push() or pop()) and create and initialize a new segment.
+
+  \sa KDSeqlockSharedMemoryPointer, KDLockedSharedMemoryArray
+*/
+
+/*!
+  \fn KDSharedMemoryRingBuffer::KDSharedMemoryRingBuffer( QSharedMemory * mem )
+
+  Constructor. Constructs a KDSharedMemoryRingBuffer on the data
+  segment of \a mem, which must be initialized before use, by this or
+  another KDSharedMemoryRingBuffer.
+*/
+
+/*!
+  \fn KDSharedMemoryRingBuffer::KDSharedMemoryRingBuffer( QSharedMemory & mem )
+  \overload
+*/
+
+/*!
+  \fn int KDSharedMemoryRingBuffer::segmentSize( int capacity )
+
+  Returns the size to create the shared memory segment with for a ring
+  buffer of at least \a capacity values, or 0 if \a capacity is not
+  positive or the segment would be larger than INT_MAX bytes.
+*/
+
+/*!
+  \fn bool KDSharedMemoryRingBuffer::initialize( int capacity )
+
+  Sets up an empty ring buffer of \a capacity values, rounded up to a
+  power of two, in the segment. Returns \c false if the segment is not
+  attached or too small, or if segmentSize() is 0 for \a capacity.
+
+  Call this once, from the process that created the segment, before
+  anyone else uses it.
+*/
+
+/*!
+  \fn int KDSharedMemoryRingBuffer::capacity() const
+
+  Returns the number of values the ring buffer can hold, or 0 if it
+  is not valid.
+*/
+
+/*!
+  \fn int KDSharedMemoryRingBuffer::size() const
+
+  Returns the number of values in the ring buffer. Other processes may
+  change it at any time, so use this for statistics only.
+*/
+
+/*!
+  \fn bool KDSharedMemoryRingBuffer::tryPush( const T & t )
+
+  Appends \a t, unless the ring buffer is full. Returns whether \a t
+  was appended. Never blocks.
+*/
+
+/*!
+  \fn bool KDSharedMemoryRingBuffer::tryPop( T * t )
+
+  Removes the oldest value and copies it into \a t, unless the ring
+  buffer is empty. Returns whether a value was removed. Never blocks.
+*/
+
+/*!
+  \fn bool KDSharedMemoryRingBuffer::push( const T & t, int msecs )
+
+  Appends \a t, waiting up to \a msecs milliseconds (-1, the default:
+  forever) for space. Returns whether \a t was appended.
+*/
+
+/*!
+  \fn bool KDSharedMemoryRingBuffer::pop( T * t, int msecs )
+
+  Removes the oldest value and copies it into \a t, waiting up to \a
+  msecs milliseconds (-1, the default: forever) for one. Returns whether
+  a value was removed.
+*/
+
+KDSharedMemoryRingBufferBase::KDSharedMemoryRingBufferBase( QSharedMemory * m, std::size_t size )
+    : mem( m ),
+      valueSize( size )
+{
+
+}
+
+KDSharedMemoryRingBufferBase::KDSharedMemoryRingBufferBase( QSharedMemory & m, std::size_t size )
+    : mem( &m ),
+      valueSize( size )
+{
+
+}
+
+KDSharedMemoryRingBufferBase::~KDSharedMemoryRingBufferBase() {}
+
+int KDSharedMemoryRingBufferBase::segmentSize( int capacity, std::size_t valueSize ) {
+    const int slots = capacity > 0 ? roundUpToPowerOfTwo( capacity ) : 0;
+    const quint64 slotBytes = ( SlotHeaderSize + quint64( valueSize ) + 7 ) & ~quint64( 7 );
+    if ( slots == 0 || slotBytes > quint64( INT_MAX ) )
+        return 0;
+    // at most 2^30 * 2^31, so this doesn't overflow:
+    const quint64 size = sizeof( RingHeader ) + quint64( slots ) * slotBytes;
+    return size <= quint64( INT_MAX ) ? static_cast<int>( size ) : 0;
+}
+
+bool KDSharedMemoryRingBufferBase::initialize( int capacity ) {
+    const int size = segmentSize( capacity, valueSize );
+    if ( !mem || !mem->data() || size == 0 || mem->size() < size )
+        return false;
+    RingHeader * const h = static_cast<RingHeader*>( mem->data() );
+    kdtools::atomicStoreRelaxed( h->magic, 0 );
+    h->capacity = roundUpToPowerOfTwo( capacity );
+    h->slotSize = slotSize( valueSize );
+    kdtools::atomicStoreRelaxed( h->enqueuePos, 0 );
+    kdtools::atomicStoreRelaxed( h->dequeuePos, 0 );
+    kdtools::atomicStoreRelaxed( h->notEmpty, 0 );
+    kdtools::atomicStoreRelaxed( h->notEmptyWaiters, 0 );
+    kdtools::atomicStoreRelaxed( h->notFull, 0 );
+    kdtools::atomicStoreRelaxed( h->notFullWaiters, 0 );
+    for ( int i = 0 ; i < h->capacity ; ++i )
+        kdtools::atomicStoreRelaxed( sequenceOf( slotAt( h, i ) ), i );
+    kdtools::atomicStoreRelease( h->magic, Magic );
+    return true;
+}
+
+// Returns the header if the segment holds an initialized ring buffer
+// for values of valueSize, 0 otherwise:
+static RingHeader * ringHeader( QSharedMemory * mem, std::size_t valueSize ) {
+    if ( !mem || !mem->data() || mem->size() < static_cast<int>( sizeof( RingHeader ) ) )
+        return 0;
+    RingHeader * const h = static_cast<RingHeader*>( mem->data() );
+    if ( kdtools::atomicLoadAcquire( h->magic ) != Magic || h->slotSize != slotSize( valueSize ) ||
+         mem->size() < static_cast<int>( sizeof( RingHeader ) ) + h->capacity * h->slotSize )
+        return 0;
+    return h;
+}
+
+bool KDSharedMemoryRingBufferBase::isValid() const {
+    return ringHeader( mem, valueSize ) != 0;
+}
+
+int KDSharedMemoryRingBufferBase::capacity() const {
+    const RingHeader * const h = ringHeader( mem, valueSize );
+    return h ? h->capacity : 0 ;
+}
+
+int KDSharedMemoryRingBufferBase::size() const {
+    const RingHeader * const h = ringHeader( mem, valueSize );
+    if ( !h )
+        return 0;
+    const int size = kdtools::wrappingDifference( kdtools::atomicLoadRelaxed( h->enqueuePos ),
+                                                  kdtools::atomicLoadRelaxed( h->dequeuePos ) );
+    return qBound( 0, size, h->capacity );
+}
+
+bool KDSharedMemoryRingBufferBase::tryPush( const void * src ) {
+    RingHeader * const h = ringHeader( mem, valueSize );
+    if ( !h )
+        return false;
+    const int mask = h->capacity - 1;
+    int pos = kdtools::atomicLoadRelaxed( h->enqueuePos );
+    while ( true ) {
+        char * const slot = slotAt( h, pos & mask );
+        const int diff = kdtools::wrappingDifference( kdtools::atomicLoadAcquire( sequenceOf( slot ) ), pos );
+        if ( diff == 0 && h->enqueuePos.testAndSetRelaxed( pos, kdtools::wrappingAdd( pos, 1 ) ) ) {
+            std::memcpy( slot + SlotHeaderSize, src, valueSize );
+            kdtools::atomicStoreRelease( sequenceOf( slot ), kdtools::wrappingAdd( pos, 1 ) );
+            wakeWaiters( h->notEmpty, h->notEmptyWaiters );
+            return true;
+        }
+        if ( diff < 0 )
+            return false; // the slot still holds the value from one round ago: full
+        pos = kdtools::atomicLoadRelaxed( h->enqueuePos );
+    }
+}
+
+bool KDSharedMemoryRingBufferBase::tryPop( void * dest ) {
+    RingHeader * const h = ringHeader( mem, valueSize );
+    if ( !h )
+        return false;
+    const int mask = h->capacity - 1;
+    int pos = kdtools::atomicLoadRelaxed( h->dequeuePos );
+    while ( true ) {
+        char * const slot = slotAt( h, pos & mask );
+        const int diff = kdtools::wrappingDifference( kdtools::atomicLoadAcquire( sequenceOf( slot ) ),
+                                                      kdtools::wrappingAdd( pos, 1 ) );
+        if ( diff == 0 && h->dequeuePos.testAndSetRelaxed( pos, kdtools::wrappingAdd( pos, 1 ) ) ) {
+            std::memcpy( dest, slot + SlotHeaderSize, valueSize );
+            kdtools::atomicStoreRelease( sequenceOf( slot ), kdtools::wrappingAdd( pos, h->capacity ) );
+            wakeWaiters( h->notFull, h->notFullWaiters );
+            return true;
+        }
+        if ( diff < 0 )
+            return false; // nothing pushed into the slot yet: empty
+        pos = kdtools::atomicLoadRelaxed( h->dequeuePos );
+    }
+}
+
+bool KDSharedMemoryRingBufferBase::push( const void * src, int msecs ) {
+    if ( tryPush( src ) )
+        return true;
+    RingHeader * const h = ringHeader( mem, valueSize );
+    if ( !h || msecs == 0 )
+        return false;
+    QElapsedTimer timer;
+    timer.start();
+    while ( true ) {
+        // announce ourselves before re-checking, so a pop either sees
+        // us waiting, or we see the space it made:
+        h->notFullWaiters.fetchAndAddOrdered( 1 );
+        const int seen = kdtools::atomicLoadAcquire( h->notFull );
+        const bool pushed = tryPush( src );
+        const int remaining = remainingTime( timer, msecs );
+        if ( !pushed && remaining != 0 )
+            kdtools::sharedMemoryWait( h->notFull, seen, remaining );
+        h->notFullWaiters.fetchAndAddOrdered( -1 );
+        if ( pushed )
+            return true;
+        if ( remaining == 0 )
+            return false;
+    }
+}
+
+bool KDSharedMemoryRingBufferBase::pop( void * dest, int msecs ) {
+    if ( tryPop( dest ) )
+        return true;
+    RingHeader * const h = ringHeader( mem, valueSize );
+    if ( !h || msecs == 0 )
+        return false;
+    QElapsedTimer timer;
+    timer.start();
+    while ( true ) {
+        h->notEmptyWaiters.fetchAndAddOrdered( 1 );
+        const int seen = kdtools::atomicLoadAcquire( h->notEmpty );
+        const bool popped = tryPop( dest );
+        const int remaining = remainingTime( timer, msecs );
+        if ( !popped && remaining != 0 )
+            kdtools::sharedMemoryWait( h->notEmpty, seen, remaining );
+        h->notEmptyWaiters.fetchAndAddOrdered( -1 );
+        if ( popped )
+            return true;
+        if ( remaining == 0 )
+            return false;
+    }
+}
+
+#ifdef KDTOOLSCORE_UNITTESTS
+
+#include <KDUnitTest/Test>
+
+#include <QThread>
+#include <QUuid>
+
+namespace {
+
+    struct Item {
+        int producer;
+        int n;
+        int check;
+    };
+
+    static Item makeItem( int producer, int n ) {
+        const Item item = { producer, n, ~( producer * 1000003 + n ) };
+        return item;
+    }
+
+    enum { Producers = 2, Consumers = 2, ItemsPerProducer = 20000 };
+
+    class RingThread : public QThread {
+    public:
+        RingThread( const QString & key, int number, bool produce )
+            : mem( key ), producer( produce ), id( number ), received( 0 ), errors( 0 )
+        {
+            mem.attach();
+        }
+
+        void run() {
+            KDSharedMemoryRingBuffer<Item> ring( mem );
+            if ( producer ) {
+                for ( int i = 0 ; i < ItemsPerProducer ; ++i )
+                    if ( !ring.push( makeItem( id, i ) ) )
+                        ++errors;
+                return;
+            }
+            int last[Producers];
+            for ( int p = 0 ; p < Producers ; ++p )
+                last[p] = -1;
+            Item item;
+            while ( ring.pop( &item ) && item.producer >= 0 ) {
+                // each producer's items arrive in order, even with several consumers:
+                if ( item.producer >= Producers || item.check != makeItem( item.producer, item.n ).check || item.n <= last[item.producer] )
+                    ++errors;
+                else
+                    last[item.producer] = item.n;
+                ++received;
+            }
+        }
+
+        QSharedMemory mem;
+        const bool producer;
+        const int id;
+        int received;
+        int errors;
+    };
+
+}
+
+KDAB_UNITTEST_SIMPLE( KDSharedMemoryRingBuffer, "kdtools/core" ) {
+
+    const QString key = QUuid::createUuid().toString();
+    QSharedMemory mem( key );
+    const bool created = mem.create( KDSharedMemoryRingBuffer<Item>::segmentSize( 100 ) );
+    assertTrue( created );
+    if ( !created )
+        return; // don't execute tests if shm coulnd't be created
+
+    KDSharedMemoryRingBuffer<Item> ring( mem );
+    assertFalse( ring );
+    assertFalse( ring.tryPush( makeItem( 0, 0 ) ) );
+
+    assertFalse( ring.initialize( 1000 ) ); // too large for the segment
+    assertFalse( ring.initialize( 0 ) );
+    assertFalse( ring.initialize( INT_MAX ) );
+    assertEqual( KDSharedMemoryRingBuffer<Item>::segmentSize( 0 ), 0 );
+    assertEqual( KDSharedMemoryRingBuffer<Item>::segmentSize( ( 1 << 30 ) + 1 ), 0 ); // no power of two fits
+    assertEqual( KDSharedMemoryRingBuffer<Item>::segmentSize( 1 << 30 ), 0 );         // more than INT_MAX bytes
+    assertEqual( KDSharedMemoryRingBuffer<char>::segmentSize( 1 << 20 ),
+                 KDSharedMemoryRingBuffer<char>::segmentSize( 1 ) + ( ( 1 << 20 ) - 1 ) * 16 );
+    assertTrue( ring.initialize( 100 ) );
+    assertTrue( ring );
+    assertEqual( ring.capacity(), 128 );
+    assertEqual( ring.size(), 0 );
+
+    {
+        Item item;
+        assertFalse( ring.tryPop( &item ) );
+        assertFalse( ring.pop( &item, 10 ) );
+
+        for ( int i = 0 ; i < ring.capacity() ; ++i )
+            assertTrue( ring.tryPush( makeItem( 0, i ) ) );
+        assertEqual( ring.size(), ring.capacity() );
+        assertFalse( ring.tryPush( makeItem( 0, -1 ) ) );
+        assertFalse( ring.push( makeItem( 0, -1 ), 10 ) );
+
+        for ( int i = 0 ; i < ring.capacity() ; ++i ) {
+            assertTrue( ring.tryPop( &item ) );
+            assertEqual( item.n, i );
+            assertEqual( item.check, makeItem( 0, i ).check );
+        }
+        assertEqual( ring.size(), 0 );
+        assertFalse( ring.tryPop( &item ) );
+    }
+
+    {
+        // several producers and consumers, each with its own attachment,
+        // through a buffer much smaller than what passes through it:
+        QList<RingThread*> threads;
+        for ( int i = 0 ; i < Consumers ; ++i )
+            threads.push_back( new RingThread( key, i, false ) );
+        for ( int i = 0 ; i < Producers ; ++i )
+            threads.push_back( new RingThread( key, i, true ) );
+        Q_FOREACH( RingThread * t, threads )
+            t->start();
+        for ( int i = Consumers ; i < threads.size() ; ++i )
+            assertTrue( threads[i]->wait( 60000 ) );
+        for ( int i = 0 ; i < Consumers ; ++i )
+            assertTrue( ring.push( makeItem( -1, 0 ) ) ); // tells one consumer to stop
+
+        int received = 0;
+        Q_FOREACH( RingThread * t, threads ) {
+            assertTrue( t->wait( 60000 ) );
+            assertEqual( t->errors, 0 );
+            received += t->received;
+        }
+        assertEqual( received, Producers * ItemsPerProducer );
+        qDeleteAll( threads );
+    }
+}
+
+#endif // KDTOOLSCORE_UNITTESTS
+
+#endif /* QT_NO_SHAREDMEMORY */
+
+#endif /* QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN ) */
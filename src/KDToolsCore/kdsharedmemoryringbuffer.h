@@ -0,0 +1,100 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+#ifndef __KDTOOLS__CORE__KDSHAREDMEMORYRINGBUFFER_H__
+#define __KDTOOLS__CORE__KDSHAREDMEMORYRINGBUFFER_H__
+
+#include <KDToolsCore/kdtoolsglobal.h>
+
+#if QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN )
+#ifndef QT_NO_SHAREDMEMORY
+
+#include <cassert>
+#include <cstddef>
+
+QT_BEGIN_NAMESPACE
+class QSharedMemory;
+QT_END_NAMESPACE
+
+#ifndef DOXYGEN_RUN
+namespace kdtools {
+#endif
+
+class KDTOOLSCORE_EXPORT KDSharedMemoryRingBufferBase {
+protected:
+    explicit KDSharedMemoryRingBufferBase( QSharedMemory * mem, std::size_t valueSize );
+    explicit KDSharedMemoryRingBufferBase( QSharedMemory & mem, std::size_t valueSize );
+    ~KDSharedMemoryRingBufferBase();
+
+    static int segmentSize( int capacity, std::size_t valueSize );
+
+    bool initialize( int capacity );
+    bool isValid() const;
+    int capacity() const;
+    int size() const;
+
+    bool tryPush( const void * src );
+    bool tryPop( void * dest );
+    bool push( const void * src, int msecs );
+    bool pop( void * dest, int msecs );
+
+    KDAB_IMPLEMENT_SAFE_BOOL_OPERATOR_BASE( isValid() )
+
+private:
+    QSharedMemory * const mem;
+    const std::size_t valueSize;
+};
+
+template <typename T>
+class MAKEINCLUDES_EXPORT KDSharedMemoryRingBuffer KDAB_FINAL_CLASS : KDSharedMemoryRingBufferBase {
+    KDAB_DISABLE_COPY( KDSharedMemoryRingBuffer );
+public:
+    explicit KDSharedMemoryRingBuffer( QSharedMemory * m )
+        : KDSharedMemoryRingBufferBase( m, sizeof( T ) ) {}
+    explicit KDSharedMemoryRingBuffer( QSharedMemory & m )
+        : KDSharedMemoryRingBufferBase( m, sizeof( T ) ) {}
+
+    static int segmentSize( int capacity ) { return KDSharedMemoryRingBufferBase::segmentSize( capacity, sizeof( T ) ); }
+
+    bool initialize( int capacity ) { return KDSharedMemoryRingBufferBase::initialize( capacity ); }
+
+    int capacity() const { return KDSharedMemoryRingBufferBase::capacity(); }
+    int size() const { return KDSharedMemoryRingBufferBase::size(); }
+
+    bool tryPush( const T & t ) { return KDSharedMemoryRingBufferBase::tryPush( &t ); }
+    bool tryPop( T * t ) { assert( t ); return KDSharedMemoryRingBufferBase::tryPop( t ); }
+
+    bool push( const T & t, int msecs = -1 ) { return KDSharedMemoryRingBufferBase::push( &t, msecs ); }
+    bool pop( T * t, int msecs = -1 ) { assert( t ); return KDSharedMemoryRingBufferBase::pop( t, msecs ); }
+
+    KDAB_USING_SAFE_BOOL_OPERATOR( KDSharedMemoryRingBufferBase )
+};
+
+#ifndef DOXYGEN_RUN
+}
+#endif
+
+#endif /* QT_NO_SHAREDMEMORY */
+
+#endif /* QT_VERSION >= 0x040400 || defined( DOXYGEN_RUN ) */
+
+#endif /* __KDTOOLS__CORE__KDSHAREDMEMORYRINGBUFFER_H__ */
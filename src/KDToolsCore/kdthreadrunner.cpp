@@ -21,20 +21,134 @@
 **********************************************************************/
 
 #include "kdthreadrunner.h"
+#include "kdatomic.h"
 
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QReadWriteLock>
+#include <QSet>
 #include <QSemaphore>
+#include <QWaitCondition>
+
+#include <climits>
+
+#ifdef Q_OS_LINUX
+# include <QFile>
+# include <sched.h>
+# include <pthread.h>
+# include <sys/prctl.h>
+# include <cerrno>
+# include <cstring>
+#endif
+
+#ifdef Q_OS_LINUX
+// Parses a kernel cpu list such as "0-3,8,10-11".
+static QList<int> parseCpuList( const QByteArray & list ) {
+    QList<int> result;
+    Q_FOREACH( const QByteArray & range, list.trimmed().split( ',' ) ) {
+        if ( range.isEmpty() )
+            continue;
+        const int dash = range.indexOf( '-' );
+        bool ok1 = true, ok2 = true;
+        const int first = range.left( dash < 0 ? range.size() : dash ).toInt( &ok1 );
+        const int last = dash < 0 ? first : range.mid( dash + 1 ).toInt( &ok2 );
+        if ( !ok1 || !ok2 )
+            return QList<int>();
+        for ( int cpu = first ; cpu <= last ; ++cpu )
+            result.push_back( cpu );
+    }
+    return result;
+}
+
+static QList<int> numaNodeCpus( int node ) {
+    QFile file( QString::fromLatin1( "/sys/devices/system/node/node%1/cpulist" ).arg( node ) );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return QList<int>();
+    return parseCpuList( file.readAll() );
+}
+
+static int toLinuxPolicy( KDThreadRunnerOptions::SchedulerPolicy policy ) {
+    switch ( policy ) {
+    case KDThreadRunnerOptions::InheritPolicy: break;
+    case KDThreadRunnerOptions::Other:         return SCHED_OTHER;
+    case KDThreadRunnerOptions::Fifo:          return SCHED_FIFO;
+    case KDThreadRunnerOptions::RoundRobin:    return SCHED_RR;
+#ifdef SCHED_BATCH
+    case KDThreadRunnerOptions::Batch:         return SCHED_BATCH;
+#endif
+#ifdef SCHED_IDLE
+    case KDThreadRunnerOptions::Idle:          return SCHED_IDLE;
+#endif
+    default:                                   break;
+    }
+    return -1;
+}
+#endif // Q_OS_LINUX
+
+// Applies the options that can only be set from inside the thread.
+static void applyThreadOptions( const KDThreadRunnerOptions & options ) {
+#ifdef Q_OS_LINUX
+    if ( !options.name.isEmpty() )
+        // the kernel truncates to 15 characters
+        ::prctl( PR_SET_NAME, reinterpret_cast<unsigned long>( options.name.constData() ), 0, 0, 0 );
+
+    QList<int> cpus = options.cpus;
+    if ( options.numaNode >= 0 ) {
+        const QList<int> nodeCpus = numaNodeCpus( options.numaNode );
+        if ( nodeCpus.isEmpty() )
+            qWarning( "KDThreadRunner: cannot determine the CPUs of NUMA node %d", options.numaNode );
+        else if ( cpus.isEmpty() )
+            cpus = nodeCpus;
+        else
+            cpus = cpus.toSet().intersect( nodeCpus.toSet() ).toList();
+    }
+    if ( !cpus.isEmpty() ) {
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        Q_FOREACH( const int cpu, cpus )
+            if ( cpu >= 0 && cpu < CPU_SETSIZE )
+                CPU_SET( cpu, &set );
+        if ( const int err = ::pthread_setaffinity_np( ::pthread_self(), sizeof set, &set ) )
+            qWarning( "KDThreadRunner: cannot set CPU affinity: %s", std::strerror( err ) );
+    } else if ( !options.cpus.isEmpty() ) {
+        qWarning( "KDThreadRunner: the requested CPUs are not part of NUMA node %d", options.numaNode );
+    }
+
+    if ( options.schedulerPolicy != KDThreadRunnerOptions::InheritPolicy ) {
+        const int policy = toLinuxPolicy( options.schedulerPolicy );
+        sched_param param;
+        std::memset( &param, 0, sizeof param );
+        param.sched_priority = policy == SCHED_FIFO || policy == SCHED_RR ? options.schedulerPriority : 0;
+        if ( policy < 0 )
+            qWarning( "KDThreadRunner: scheduler policy %d not supported", options.schedulerPolicy );
+        else if ( const int err = ::pthread_setschedparam( ::pthread_self(), policy, &param ) )
+            qWarning( "KDThreadRunner: cannot set scheduler policy: %s", std::strerror( err ) );
+    }
+#else
+    Q_UNUSED( options );
+#endif
+}
 
 class KDThreadRunnerBase::Private
 {
 public:
+    enum State { Stopped, Starting, Started };
+
     Private()
-        : m_impl( 0 )
+        : m_impl( 0 ),
+          m_state( Stopped )
     {
     }
 
-    QObject* m_impl;
-    QSemaphore m_waitStarted;
+    QObject* m_impl;         // guarded by m_stateMutex
+    State m_state;           // ditto
+    mutable QMutex m_stateMutex;
+    QWaitCondition m_stateChanged;
     QMutex m_startThreadMutex;
+    KDThreadRunnerOptions m_options;
 };
 
 KDThreadRunnerBase::KDThreadRunnerBase( QObject * p )
@@ -48,28 +162,99 @@ KDThreadRunnerBase::~KDThreadRunnerBase()
 
 void KDThreadRunnerBase::doStart( Priority prio )
 {
-    start( prio );
-    d->m_waitStarted.acquire(); // wait for T to be created by run()
+    KDThreadRunnerOptions options;
+    options.priority = prio;
+    doStart( options );
+}
+
+void KDThreadRunnerBase::doStart( const KDThreadRunnerOptions & options )
+{
+    doStartAsync( options );
+    waitForStarted(); // wait for T to be created by run()
+}
+
+void KDThreadRunnerBase::doStartAsync( const KDThreadRunnerOptions & options )
+{
+    {
+        QMutexLocker locker( &d->m_stateMutex );
+        if ( d->m_state != Private::Stopped )
+            return;
+        d->m_state = Private::Starting;
+    }
+    // a previous run may be just past setImpl( 0 ), and start() does
+    // nothing while it is still running:
+    wait();
+    d->m_options = options;
+    setStackSize( options.stackSize );
+    start( options.priority );
+}
+
+void KDThreadRunnerBase::applyStartOptions()
+{
+    // options are per start; a plain QThread::start() gets the defaults:
+    const KDThreadRunnerOptions options = d->m_options;
+    d->m_options = KDThreadRunnerOptions();
+    applyThreadOptions( options );
 }
 
 void KDThreadRunnerBase::doExec()
 {
-    // Tell startThread that we have created T
-    d->m_waitStarted.release();
+    // Tell startThread and the futures that we have created T
+    {
+        QMutexLocker locker( &d->m_stateMutex );
+        d->m_state = Private::Started;
+        d->m_stateChanged.wakeAll();
+    }
 
     exec();
 }
 
 void KDThreadRunnerBase::setImpl( QObject * i )
 {
+    QMutexLocker locker( &d->m_stateMutex );
     d->m_impl = i;
+    if ( !i ) {
+        d->m_state = Private::Stopped;
+        d->m_stateChanged.wakeAll();
+    }
 }
 
 QObject* KDThreadRunnerBase::impl() const
 {
+    QMutexLocker locker( &d->m_stateMutex );
     return d->m_impl;
 }
 
+/*!
+  Returns whether T has been constructed and the thread runs its
+  event loop. This function is thread-safe.
+*/
+bool KDThreadRunnerBase::isStarted() const
+{
+    QMutexLocker locker( &d->m_stateMutex );
+    return d->m_state == Private::Started;
+}
+
+/*!
+  Waits until T has been constructed, but at most \a msecs
+  milliseconds; a negative value waits forever. Returns isStarted().
+  Returns immediately if the thread is neither starting nor running.
+  This function is thread-safe.
+*/
+bool KDThreadRunnerBase::waitForStarted( int msecs )
+{
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker( &d->m_stateMutex );
+    while ( d->m_state == Private::Starting ) {
+        const qint64 left = msecs < 0 ? -1 : msecs - timer.elapsed();
+        if ( msecs >= 0 && left <= 0 )
+            break;
+        d->m_stateChanged.wait( &d->m_stateMutex, left < 0 ? ULONG_MAX : static_cast<unsigned long>( left ) );
+    }
+    return d->m_state == Private::Started;
+}
+
 QMutex* KDThreadRunnerBase::internalStartThreadMutex()
 {
     return & d->m_startThreadMutex;
@@ -112,6 +297,38 @@ QMutex* KDThreadRunnerBase::internalStartThreadMutex()
   Constructor. \a parent is passed to the base class constructor.
 */
 
+/*!
+  \struct KDThreadRunnerOptions
+  \ingroup core
+  \brief Where and how a KDThreadRunner's thread runs
+  \since_c 2.3
+
+  Pass to KDThreadRunner::startThread( const KDThreadRunnerOptions & ).
+  \a priority and \a stackSize (in bytes, 0 for the default) are
+  passed to QThread. The other options are applied by the thread
+  itself, before it constructs T, so memory that T's constructor
+  touches first is allocated on the NUMA node the thread runs on.
+  They are currently only supported on Linux, and ignored elsewhere:
+
+  \li \a cpus restricts the thread to the listed CPUs.
+  \li \a numaNode, if not negative, restricts the thread to the CPUs
+  of that NUMA node (intersected with \a cpus, if given).
+  \li \a schedulerPolicy and \a schedulerPriority select the
+  scheduling policy (\c SCHED_OTHER, \c SCHED_FIFO, \c SCHED_RR,
+  \c SCHED_BATCH, \c SCHED_IDLE); the priority only matters for
+  Fifo and RoundRobin. Real-time policies usually need privileges.
+  \li \a name is the thread's name, as shown by \c top or a
+  debugger (at most 15 characters are used).
+
+  Options that cannot be applied result in a warning, but the
+  thread is started nonetheless.
+
+  Options only apply to the start they are passed to: startThread(
+  Priority ) and startThreadAsync( Priority ) use the defaults. Only
+  the stack size, a property of QThread, stays in effect for a plain
+  QThread::start().
+*/
+
 /*!
   \fn KDThreadRunner::startThread( Priority prio )
 
@@ -125,12 +342,691 @@ QMutex* KDThreadRunnerBase::internalStartThreadMutex()
   \sa QThread::start, QThread::Priority
 */
 
+/*!
+  \fn KDThreadRunner::startThread( const KDThreadRunnerOptions & options )
+
+  \overload
+
+  Starts the thread as specified by \a options, see
+  KDThreadRunnerOptions.
+*/
+
+/*!
+  \fn KDThreadRunner::startThreadAsync( Priority prio )
+
+  Like startThread(), but returns as soon as the thread has been
+  started, without waiting for T to be constructed. Use the returned
+  KDThreadRunnerFuture to get at T once it exists. Starting many
+  runners like this lets their T constructors run in parallel:
+
+  \code
+  QList< KDThreadRunnerFuture<Worker> > futures;
+  Q_FOREACH( KDThreadRunner<Worker> * runner, runners )
+      futures.push_back( runner->startThreadAsync() );
+  Q_FOREACH( const KDThreadRunnerFuture<Worker> & future, futures )
+      connectToWorker( future.result() );
+  \endcode
+
+  If the thread is already starting or running, the future refers to
+  that run.
+*/
+
+/*!
+  \fn KDThreadRunner::startThreadAsync( const KDThreadRunnerOptions & options )
+
+  \overload
+
+  Starts the thread as specified by \a options, see
+  KDThreadRunnerOptions.
+*/
+
+/*!
+  \class KDThreadRunnerFuture
+  \ingroup core
+  \brief The T of a KDThreadRunner started with startThreadAsync()
+  \since_c 2.3
+
+  A KDThreadRunnerFuture is a lightweight handle to a KDThreadRunner;
+  copying it is cheap, and it must not outlive the runner. result()
+  waits for T to be constructed, and returns it, or 0 if the thread
+  has already finished again.
+*/
+
+
+//
+// KDThreadRunnerChannel
+//
+
+class KDThreadRunnerChannelBase::Private
+{
+public:
+    // Lives in the runner thread and drains the channel when the
+    // (single, coalesced) drain event arrives there.
+    class Receiver : public QObject {
+    public:
+        explicit Receiver( KDThreadRunnerChannelBase * c )
+            : QObject(), channel( c ) {}
+
+        bool event( QEvent * e ) KDAB_OVERRIDE
+        {
+            if ( e->type() != QEvent::User )
+                return QObject::event( e );
+            drain( channel );
+            return true;
+        }
+
+        KDThreadRunnerChannelBase * const channel;
+    };
+
+    explicit Private( KDThreadRunnerChannelBase * q, KDThreadRunnerBase * r )
+        : runner( r ), receiver( q ), drainScheduled( 0 ),
+          spaceWaiters( 0 ), spaceMutex(), spaceAvailable()
+    {
+        receiver.moveToThread( r );
+    }
+
+    void wakeSpaceWaiters()
+    {
+        // full barrier: pairs with the one in SpaceWaiter's
+        // constructor, so either the producer sees the slots drain()
+        // freed, or we see the producer
+        if ( !spaceWaiters.fetchAndAddOrdered( 0 ) )
+            return;
+        QMutexLocker locker( &spaceMutex );
+        spaceAvailable.wakeAll();
+    }
+
+    KDThreadRunnerBase * const runner;
+    Receiver receiver;
+    QAtomicInt drainScheduled;
+    QAtomicInt spaceWaiters;
+    QMutex spaceMutex;
+    QWaitCondition spaceAvailable;
+
+    static void drain( KDThreadRunnerChannelBase * q );
+};
+
+void KDThreadRunnerChannelBase::Private::drain( KDThreadRunnerChannelBase * q )
+{
+    // Reset before looking at the queue, so a command posted while we
+    // drain schedules the next drain instead of being left behind:
+    q->d->drainScheduled.fetchAndStoreOrdered( 0 );
+    const bool more = q->drain();
+    q->d->wakeSpaceWaiters();
+    if ( more )
+        q->scheduleDrain(); // more than a batch was queued; let other events in
+}
+
+KDThreadRunnerChannelBase::KDThreadRunnerChannelBase( KDThreadRunnerBase * runner )
+    : d( new Private( this, runner ) )
+{
+}
+
+KDThreadRunnerChannelBase::~KDThreadRunnerChannelBase()
+{
+}
+
+QObject * KDThreadRunnerChannelBase::runnerImpl() const
+{
+    return d->runner->impl();
+}
+
+void KDThreadRunnerChannelBase::scheduleDrain()
+{
+    // One event per batch, not per command:
+    if ( d->drainScheduled.testAndSetOrdered( 0, 1 ) )
+        QCoreApplication::postEvent( &d->receiver, new QEvent( QEvent::User ) );
+}
+
+KDThreadRunnerChannelBase::SpaceWaiter::SpaceWaiter( KDThreadRunnerChannelBase * c )
+    : channel( c )
+{
+    channel->d->spaceMutex.lock();
+    channel->d->spaceWaiters.ref(); // full barrier, see Private::wakeSpaceWaiters()
+}
+
+KDThreadRunnerChannelBase::SpaceWaiter::~SpaceWaiter()
+{
+    channel->d->spaceWaiters.deref();
+    channel->d->spaceMutex.unlock();
+}
+
+bool KDThreadRunnerChannelBase::SpaceWaiter::wait( const QElapsedTimer & timer, int msecs )
+{
+    unsigned long timeout = ULONG_MAX;
+    if ( msecs >= 0 ) {
+        const qint64 left = msecs - timer.elapsed();
+        if ( left <= 0 )
+            return false;
+        timeout = static_cast<unsigned long>( left );
+    }
+    channel->d->spaceAvailable.wait( &channel->d->spaceMutex, timeout );
+    return true;
+}
+
+/*!
+  \class KDThreadRunnerChannel
+  \ingroup core
+  \brief A bounded, allocation-free command queue into a KDThreadRunner's T
+  \since_c 2.3
+
+  Queued signal/slot connections to a KDThreadRunner's T allocate an
+  event and copy the arguments for every call. At hundreds of
+  thousands of calls per second, that dominates. A
+  KDThreadRunnerChannel instead copies each \c Command into one of a
+  fixed number of preallocated slots, and the runner's event loop
+  executes all commands queued so far in one go, triggered by a
+  single posted event per batch.
+
+  Any number of threads may post into the same channel. Commands
+  posted from one thread are executed in the order they were
+  posted. \c Command must be default-constructible and assignable;
+  it is either a functor, called as <tt>command( T* )</tt>, or a
+  plain struct passed to a member function of T:
+
+  \code
+  struct Quote { int instrument; double bid, ask; };
+  class Book : public QObject {
+  public:
+      explicit Book( KDThreadRunner<Book> * );
+      void update( const Quote & quote );
+  };
+
+  KDThreadRunner<Book> runner;
+  KDThreadRunnerChannel<Book,Quote> channel( &runner, &Book::update, 4096 );
+  runner.startThread();
+  ...
+  channel.post( quote );
+  \endcode
+
+  Commands are only executed while T exists; commands posted while
+  the thread is not running are kept until it runs again. The
+  channel must not be destroyed while the runner thread is running.
+*/
+
+/*!
+  \fn KDThreadRunnerChannel::KDThreadRunnerChannel( KDThreadRunner<T> * runner, int capacity )
+
+  Constructs a channel to the T of \a runner that calls each \c
+  Command as a functor with T* as argument. \a capacity is rounded
+  up to the next power of two.
+*/
+
+/*!
+  \fn KDThreadRunnerChannel::KDThreadRunnerChannel( KDThreadRunner<T> * runner, Handler handler, int capacity )
+
+  Constructs a channel to the T of \a runner that passes each \c
+  Command to the member function \a handler of T. \a capacity is
+  rounded up to the next power of two.
+*/
+
+/*!
+  \fn int KDThreadRunnerChannel::capacity() const
+
+  Returns the number of commands that can be queued at the same time.
+*/
+
+/*!
+  \fn bool KDThreadRunnerChannel::tryPost( const Command & command )
+
+  Queues \a command for execution in the runner thread. Returns
+  false, without blocking, if the channel is full. This function is
+  thread-safe and does not allocate.
+*/
+
+/*!
+  \fn bool KDThreadRunnerChannel::post( const Command & command, int msecs )
+
+  Like tryPost(), but if the channel is full, sleeps until the runner
+  thread has made space, for at most \a msecs milliseconds; a
+  negative value waits forever. Don't call this from the runner
+  thread itself, as nothing empties the channel while it waits.
+*/
+
+
+//
+// KDThreadRunnerPool
+//
+
+namespace {
+
+    struct PoolInvocation {
+        PoolInvocation() : member(), destroy( false ) {}
+        QByteArray member;
+        QVariant args[5];
+        bool destroy;
+    };
+
+    // One hosted instance, together with the invocations queued for
+    // it. A strand runs on at most one worker at a time, and while it
+    // does not run, its object has no thread affinity ("parked"), so
+    // any worker may adopt it.
+    struct Strand {
+        enum State { Idle, Queued, Running };
+
+        Strand() : object( 0 ), mutex(), pending(), state( Idle ), destroyRequested( false ), created() {}
+
+        QObject * object;  // 0 until created by a worker
+        QMutex mutex;      // guards pending, state and destroyRequested
+        QQueue<PoolInvocation> pending;
+        State state;
+        bool destroyRequested;
+        QSemaphore created;
+    };
+
+} // anon namespace
+
+class KDThreadRunnerPoolBase::Private
+{
+public:
+    class Worker : public QThread
+    {
+    public:
+        Worker( Private * p, int i ) : QThread(), pool( p ), index( i ), mutex(), deque() {}
+
+        void push( Strand * strand ) {
+            QMutexLocker locker( &mutex );
+            deque.push_back( strand );
+        }
+        Strand * popOwn() {
+            QMutexLocker locker( &mutex );
+            return deque.isEmpty() ? 0 : deque.takeFirst();
+        }
+        Strand * steal() {
+            QMutexLocker locker( &mutex );
+            return deque.isEmpty() ? 0 : deque.takeLast();
+        }
+        bool isEmpty() {
+            QMutexLocker locker( &mutex );
+            return deque.isEmpty();
+        }
+
+    protected:
+        void run() KDAB_OVERRIDE { pool->work( this ); }
+
+    private:
+        Private * const pool;
+    public:
+        const int index;
+    private:
+        QMutex mutex;
+        QList<Strand*> deque;
+    };
+
+    Private( KDThreadRunnerPoolBase * q_, int threads )
+        : q( q_ ),
+          workers(),
+          nextWorker( 0 ),
+          strandsLock(),
+          strands(),
+          sleepMutex(),
+          workAvailable(),
+          done(),
+          sleepers( 0 ),
+          outstanding( 0 ),
+          stopRequested( 0 )
+    {
+        if ( threads <= 0 )
+            threads = qMax( 1, QThread::idealThreadCount() );
+        for ( int i = 0 ; i < threads ; ++i )
+            workers.push_back( new Worker( this, i ) );
+        Q_FOREACH( Worker * w, workers )
+            w->start();
+    }
+
+    enum {
+        BatchSize = 16,     // invocations run per adoption of a strand
+        IdleTimeout = 100   // ms; only a safety net, workers are woken explicitly
+    };
+
+    void schedule( Strand * strand, Worker * preferred ) {
+        if ( !preferred )
+            preferred = workers[ ( nextWorker.fetchAndAddRelaxed( 1 ) & 0x7fffffff ) % workers.size() ];
+        preferred->push( strand );
+        if ( !sleepers.fetchAndAddOrdered( 0 ) )
+            return;
+        QMutexLocker locker( &sleepMutex );
+        workAvailable.wakeOne();
+    }
+
+    // Queues an invocation, scheduling the strand if it was idle.
+    // Called with strandsLock held for reading.
+    bool enqueue( Strand * strand, const PoolInvocation & inv ) {
+        {
+            QMutexLocker locker( &strand->mutex );
+            if ( strand->destroyRequested )
+                return false;
+            strand->destroyRequested = inv.destroy;
+            strand->pending.enqueue( inv );
+            outstanding.ref();
+            if ( strand->state != Strand::Idle )
+                return true;
+            strand->state = Strand::Queued;
+        }
+        schedule( strand, 0 );
+        return true;
+    }
+
+    Strand * findWork( Worker * self ) {
+        if ( Strand * s = self->popOwn() )
+            return s;
+        // steal, starting with the next worker, so thieves spread out:
+        for ( int i = 1 ; i < workers.size() ; ++i )
+            if ( Strand * s = workers[( self->index + i ) % workers.size()]->steal() )
+                return s;
+        return 0;
+    }
+
+    bool allEmpty() const {
+        Q_FOREACH( Worker * w, workers )
+            if ( !w->isEmpty() )
+                return false;
+        return true;
+    }
+
+    void finished( int n ) {
+        for ( int i = 0 ; i < n ; ++i )
+            if ( !outstanding.deref() ) {
+                QMutexLocker locker( &sleepMutex );
+                done.wakeAll();
+            }
+    }
+
+    void work( Worker * self ) {
+        for ( ;; ) {
+            if ( Strand * strand = findWork( self ) ) {
+                runStrand( self, strand );
+                continue;
+            }
+
+            QMutexLocker locker( &sleepMutex );
+            sleepers.fetchAndAddOrdered( 1 );
+            if ( allEmpty() ) {
+                if ( stopRequested.fetchAndAddOrdered( 0 ) ) {
+                    sleepers.fetchAndAddOrdered( -1 );
+                    return;
+                }
+                workAvailable.wait( &sleepMutex, IdleTimeout );
+            }
+            sleepers.fetchAndAddOrdered( -1 );
+        }
+    }
+
+    void runStrand( Worker * self, Strand * strand ) {
+        const bool creating = !strand->object;
+        int n = 1; // the creation
+        if ( creating ) {
+            // a new instance: T is constructed here, so that it
+            // starts out with this thread's affinity
+            strand->object = q->createImpl();
+            QWriteLocker locker( &strandsLock );
+            strands.insert( strand->object, strand );
+        } else {
+            QList<PoolInvocation> batch;
+            {
+                QMutexLocker locker( &strand->mutex );
+                strand->state = Strand::Running;
+                while ( batch.size() < BatchSize && !strand->pending.isEmpty() )
+                    batch.push_back( strand->pending.dequeue() );
+            }
+
+            // adopt: allowed, as the parked object has no thread affinity
+            strand->object->moveToThread( self );
+
+            Q_FOREACH( const PoolInvocation & inv, batch ) {
+                if ( inv.destroy ) { // always the last one
+                    {
+                        QWriteLocker locker( &strandsLock );
+                        strands.remove( strand->object );
+                    }
+                    delete strand->object;
+                    delete strand;
+                    finished( batch.size() );
+                    return;
+                }
+                invoke( strand->object, inv );
+            }
+            // deliver what was posted to the instance meanwhile, e.g. by queued connections:
+            QCoreApplication::sendPostedEvents( strand->object, 0 );
+            n = batch.size();
+        }
+
+        // park:
+        strand->object->moveToThread( 0 );
+        bool more;
+        {
+            QMutexLocker locker( &strand->mutex );
+            more = !strand->pending.isEmpty();
+            strand->state = more ? Strand::Queued : Strand::Idle;
+        }
+        if ( creating )
+            strand->created.release();
+        finished( n );
+        if ( more )
+            schedule( strand, self );
+    }
+
+    static void invoke( QObject * object, const PoolInvocation & inv ) {
+        QGenericArgument args[5];
+        for ( int i = 0 ; i < 5 ; ++i )
+            if ( inv.args[i].isValid() )
+                args[i] = QGenericArgument( inv.args[i].typeName(), inv.args[i].constData() );
+        if ( !QMetaObject::invokeMethod( object, inv.member.constData(), Qt::DirectConnection,
+                                         args[0], args[1], args[2], args[3], args[4] ) )
+            qWarning( "KDThreadRunnerPool: cannot invoke %s::%s",
+                      object->metaObject()->className(), inv.member.constData() );
+    }
+
+    Strand * lookup( QObject * object ) const {
+        return strands.value( object, 0 );
+    }
+
+    KDThreadRunnerPoolBase * const q;
+    QList<Worker*> workers;
+    QAtomicInt nextWorker;
+    mutable QReadWriteLock strandsLock;
+    QHash<QObject*,Strand*> strands;
+    QMutex sleepMutex;
+    QWaitCondition workAvailable;
+    QWaitCondition done;
+    QAtomicInt sleepers;
+    QAtomicInt outstanding;    // creations and invocations not yet finished
+    QAtomicInt stopRequested;
+};
+
+KDThreadRunnerPoolBase::KDThreadRunnerPoolBase( int threads, QObject * p )
+    : QObject( p ), d( new Private( this, threads ) )
+{
+}
+
+KDThreadRunnerPoolBase::~KDThreadRunnerPoolBase()
+{
+    QList<QObject*> instances;
+    {
+        QReadLocker locker( &d->strandsLock );
+        instances = d->strands.keys();
+    }
+    Q_FOREACH( QObject * instance, instances )
+        doDestroy( instance );
+    waitForDone();
+
+    {
+        QMutexLocker locker( &d->sleepMutex );
+        d->stopRequested.fetchAndStoreOrdered( 1 );
+        d->workAvailable.wakeAll();
+    }
+    Q_FOREACH( Private::Worker * w, d->workers )
+        w->wait();
+    qDeleteAll( d->workers );
+}
+
+int KDThreadRunnerPoolBase::threadCount() const
+{
+    return d->workers.size();
+}
+
+int KDThreadRunnerPoolBase::instanceCount() const
+{
+    QReadLocker locker( &d->strandsLock );
+    return d->strands.size();
+}
+
+bool KDThreadRunnerPoolBase::waitForDone( int msecs )
+{
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker( &d->sleepMutex );
+    while ( d->outstanding.fetchAndAddOrdered( 0 ) ) {
+        const qint64 left = msecs < 0 ? -1 : msecs - timer.elapsed();
+        if ( msecs >= 0 && left <= 0 )
+            return false;
+        d->done.wait( &d->sleepMutex, left < 0 ? ULONG_MAX : static_cast<unsigned long>( left ) );
+    }
+    return true;
+}
+
+QObject * KDThreadRunnerPoolBase::doCreate()
+{
+    Strand * const strand = new Strand;
+    strand->state = Strand::Queued;
+    d->outstanding.ref();
+    d->schedule( strand, 0 );
+    strand->created.acquire(); // wait for T to be created by a worker
+    return strand->object;
+}
+
+bool KDThreadRunnerPoolBase::doDestroy( QObject * instance )
+{
+    PoolInvocation inv;
+    inv.destroy = true;
+    QReadLocker locker( &d->strandsLock );
+    Strand * const strand = d->lookup( instance );
+    return strand && d->enqueue( strand, inv );
+}
+
+bool KDThreadRunnerPoolBase::doInvoke( QObject * instance, const char * member,
+                                       const QVariant & a0, const QVariant & a1, const QVariant & a2,
+                                       const QVariant & a3, const QVariant & a4 )
+{
+    PoolInvocation inv;
+    inv.member = member;
+    inv.args[0] = a0;
+    inv.args[1] = a1;
+    inv.args[2] = a2;
+    inv.args[3] = a3;
+    inv.args[4] = a4;
+    QReadLocker locker( &d->strandsLock );
+    Strand * const strand = d->lookup( instance );
+    return strand && d->enqueue( strand, inv );
+}
+
+/*!
+  \class KDThreadRunnerPool
+  \ingroup core
+  \brief Hosts many QObject workers on a fixed number of threads
+  \since_c 2.3
+
+  KDThreadRunner<T> gives every T a QThread of its own. With dozens of
+  workers, that means dozens of threads, most of them idle, while the
+  busy ones cannot share their load. KDThreadRunnerPool<T> instead
+  hosts any number of T instances on threadCount() threads, by
+  default one per core.
+
+  Work is handed to an instance with invoke(), which queues a call of
+  one of its slots or Q_INVOKABLE methods, much like
+  QMetaObject::invokeMethod() with Qt::QueuedConnection. The calls
+  queued for one instance are executed in order, one at a time. An
+  instance with queued calls waits in the queue of one pool thread;
+  idle threads steal waiting instances from busy ones, so the load
+  spreads over all threads.
+
+  As with KDThreadRunner, T should be a QObject subclass without a
+  parent. It is constructed in one of the pool threads; its
+  constructor may take a QObject* or a KDThreadRunnerPool<T>*
+  argument, the pool. Whenever one of its methods is called by the
+  pool, or it is constructed or destroyed, T::thread() is the
+  calling thread, which is never the GUI thread. Between calls, the
+  instance has no thread affinity at all, which is how another pool
+  thread can take it over.
+
+  Consequently, T should not use timers, nor call thread()->quit() or
+  deleteLater(). Events posted to it, e.g. by queued signal-slot
+  connections, are delivered the next time the pool runs it; to
+  make it run, use invoke(). Instances are destroyed, in a pool
+  thread, by destroyInstance() or when the pool is destroyed.
+
+  \code
+  KDThreadRunnerPool<Worker> pool;
+  Worker * worker = pool.createInstance();
+  pool.invoke( worker, "process", QString::fromLatin1( "job.txt" ) );
+  \endcode
+*/
+
+/*!
+  \fn KDThreadRunnerPool::KDThreadRunnerPool( int threads, QObject * parent )
+
+  Constructor. Starts \a threads threads; zero or a negative value
+  starts QThread::idealThreadCount() threads. \a parent is passed to
+  the base class constructor.
+*/
+
+/*!
+  \fn T * KDThreadRunnerPool::createInstance()
+
+  Constructs a T in one of the pool threads, waits for that to
+  complete, and returns it. Do not call the instance's methods
+  directly from other threads; use invoke().
+*/
+
+/*!
+  \fn bool KDThreadRunnerPool::destroyInstance( T * instance )
+
+  Queues the destruction of \a instance, after the calls already
+  queued for it. Returns \c false if \a instance is not hosted by this
+  pool, or is already being destroyed.
+*/
+
+/*!
+  \fn bool KDThreadRunnerPool::invoke( T * instance, const char * member, const QVariant & a0, const QVariant & a1, const QVariant & a2, const QVariant & a3, const QVariant & a4 )
+
+  Queues a call of the method \a member (the name only, without
+  parameter list) of \a instance with the arguments \a a0 to \a a4
+  (invalid QVariants are omitted). The types of the arguments must
+  match the method's parameter types exactly. This function is
+  thread-safe, and may be called from the instances themselves.
+
+  Returns \c false if \a instance is not hosted by this pool, or is
+  being destroyed.
+*/
+
+/*!
+  \fn int KDThreadRunnerPoolBase::threadCount() const
+
+  Returns the number of threads in the pool.
+*/
+
+/*!
+  \fn int KDThreadRunnerPoolBase::instanceCount() const
+
+  Returns the number of instances hosted by the pool.
+*/
+
+/*!
+  \fn bool KDThreadRunnerPoolBase::waitForDone( int msecs )
+
+  Waits until all queued calls have been executed, but at most \a
+  msecs milliseconds; a negative value waits forever. Returns \c true
+  if nothing is left to do. Must not be called from the instances.
+*/
+
 
 #ifdef KDTOOLSCORE_UNITTESTS
 
 #include <QCoreApplication>
 #include <QPointer>
 #include <QSemaphore>
+#include <QSharedPointer>
+#include <QWeakPointer>
 #include <KDUnitTest/Test>
 
 QSemaphore slotCalledSemaphore;
@@ -215,6 +1111,89 @@ private:
     int m_slotCalledCount;
 };
 
+static QAtomicInt poolInstancesAlive;
+static QAtomicInt poolCallsExecuted;
+static QAtomicInt poolTestFailures;
+
+class TestPoolImpl : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TestPoolImpl( QObject * pool )
+        : QObject(), // no parent!
+          m_expected( 0 )
+    {
+        if ( !pool || thread() != QThread::currentThread() || thread() == QCoreApplication::instance()->thread() )
+            poolTestFailures.ref();
+        poolInstancesAlive.ref();
+    }
+    ~TestPoolImpl()
+    {
+        if ( thread() != QThread::currentThread() )
+            poolTestFailures.ref();
+        poolInstancesAlive.deref();
+    }
+
+private Q_SLOTS:
+    void work( int sequence, const QString & text )
+    {
+        if ( thread() != QThread::currentThread()
+             || thread() == QCoreApplication::instance()->thread()
+             || sequence != m_expected++ // calls are serialized and in order
+             || text != QLatin1String( "payload" ) )
+            poolTestFailures.ref();
+        poolCallsExecuted.ref();
+    }
+
+private:
+    int m_expected;
+};
+
+static QList<int> optionsTestCpus;
+static QByteArray optionsTestName;
+
+class TestOptionsImpl : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TestOptionsImpl( QObject * )
+        : QObject()
+    {
+        // record what the thread looks like when T is constructed
+#ifdef Q_OS_LINUX
+        optionsTestCpus.clear();
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        if ( ::pthread_getaffinity_np( ::pthread_self(), sizeof set, &set ) == 0 )
+            for ( int cpu = 0 ; cpu < CPU_SETSIZE ; ++cpu )
+                if ( CPU_ISSET( cpu, &set ) )
+                    optionsTestCpus.push_back( cpu );
+        char name[17] = { 0 };
+        ::prctl( PR_GET_NAME, reinterpret_cast<unsigned long>( name ), 0, 0, 0 );
+        optionsTestName = name;
+#endif
+        QMetaObject::invokeMethod( this, "quit", Qt::QueuedConnection );
+    }
+
+private Q_SLOTS:
+    void quit() { thread()->quit(); }
+};
+
+static QSemaphore asyncCtorsEntered;
+static QSemaphore asyncCtorsMayLeave;
+
+class TestAsyncImpl : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TestAsyncImpl( KDThreadRunner<TestAsyncImpl> * )
+        : QObject()
+    {
+        asyncCtorsEntered.release();
+        asyncCtorsMayLeave.acquire();
+    }
+};
+
 #include "kdthreadrunner.moc"
 
 KDAB_UNITTEST_SIMPLE( KDThreadRunner, "kdtools/core" ) {
@@ -293,4 +1272,238 @@ KDAB_UNITTEST_SIMPLE( KDThreadRunner, "kdtools/core" ) {
     }
 }
 
+KDAB_UNITTEST_SIMPLE( KDThreadRunnerOptions, "kdtools/core" ) {
+
+#ifdef Q_OS_LINUX
+    assertTrue( parseCpuList( "0-3,8,10-11\n" ) == QList<int>() << 0 << 1 << 2 << 3 << 8 << 10 << 11 );
+    assertTrue( parseCpuList( "" ).isEmpty() );
+    assertTrue( parseCpuList( "1-x" ).isEmpty() );
+#endif
+
+    // a CPU the test may run on; containers and taskset may exclude CPU 0
+    int cpu = 0;
+#ifdef Q_OS_LINUX
+    cpu_set_t allowed;
+    CPU_ZERO( &allowed );
+    assertEqual( ::sched_getaffinity( 0, sizeof allowed, &allowed ), 0 );
+    while ( cpu < CPU_SETSIZE - 1 && !CPU_ISSET( cpu, &allowed ) )
+        ++cpu;
+#endif
+
+    KDThreadRunnerOptions options;
+    options.cpus << cpu;
+    options.name = "kdtr-options";
+    options.stackSize = 512 * 1024;
+    options.schedulerPolicy = KDThreadRunnerOptions::Other;
+
+    KDThreadRunner<TestOptionsImpl> runner;
+    assertNotNull( runner.startThread( options ) );
+    assertTrue( runner.wait( 10000 ) );
+    assertEqual( runner.stackSize(), 512u * 1024 );
+
+#ifdef Q_OS_LINUX
+    assertTrue( optionsTestCpus == QList<int>() << cpu );
+    assertTrue( optionsTestName == "kdtr-options" );
+#endif
+
+    // the next start does not inherit them
+    assertNotNull( runner.startThread() );
+    assertTrue( runner.wait( 10000 ) );
+    assertEqual( runner.stackSize(), 0u );
+#ifdef Q_OS_LINUX
+    assertTrue( optionsTestName != "kdtr-options" );
+    assertEqual( optionsTestCpus.size(), CPU_COUNT( &allowed ) );
+#endif
+}
+
+KDAB_UNITTEST_SIMPLE( KDThreadRunnerAsync, "kdtools/core" ) {
+
+    const int Runners = 4;
+    const int JOIN_TIMEOUT = 10000; // 10s
+
+    QList< KDThreadRunner<TestAsyncImpl>* > runners;
+    QList< KDThreadRunnerFuture<TestAsyncImpl> > futures;
+    for ( int i = 0 ; i < Runners ; ++i ) {
+        runners.push_back( new KDThreadRunner<TestAsyncImpl> );
+        futures.push_back( runners.back()->startThreadAsync() );
+        assertFalse( futures.back().isNull() );
+    }
+
+    // all constructors run at the same time, none has finished:
+    assertTrue( asyncCtorsEntered.tryAcquire( Runners, JOIN_TIMEOUT ) );
+    Q_FOREACH( const KDThreadRunnerFuture<TestAsyncImpl> & future, futures )
+        assertFalse( future.isReady() );
+    // starting again while starting doesn't start a second thread:
+    assertTrue( runners.front()->startThreadAsync().runner() == runners.front() );
+
+    asyncCtorsMayLeave.release( Runners );
+    Q_FOREACH( const KDThreadRunnerFuture<TestAsyncImpl> & future, futures ) {
+        TestAsyncImpl * impl = future.result();
+        assertNotNull( impl );
+        assertEqual( impl->thread(), static_cast<QThread*>( future.runner() ) );
+        assertTrue( future.isReady() );
+    }
+    assertEqual( asyncCtorsEntered.available(), 0 );
+
+    Q_FOREACH( KDThreadRunner<TestAsyncImpl> * runner, runners ) {
+        runner->quit();
+        assertTrue( runner->wait( JOIN_TIMEOUT ) );
+        assertFalse( runner->isStarted() );
+    }
+    assertNull( futures.front().result() );
+    qDeleteAll( runners );
+}
+
+struct ChannelAdd {
+    ChannelAdd() : producer( 0 ), sequence( 0 ) {}
+    ChannelAdd( int p, int s ) : producer( p ), sequence( s ) {}
+    int producer;
+    int sequence;
+};
+
+class TestChannelImpl : public QObject
+{
+public:
+    explicit TestChannelImpl( KDThreadRunner<TestChannelImpl> * )
+        : QObject(), received( 0 ), outOfOrder( 0 )
+    {
+        next[0] = next[1] = 0;
+    }
+
+    void add( const ChannelAdd & add ) {
+        if ( add.sequence != next[add.producer]++ )
+            ++outOfOrder;
+        if ( ++received == 2 * Expected )
+            done.release();
+    }
+
+    enum { Expected = 100000 };
+    int next[2];
+    int received;
+    int outOfOrder;
+    QSemaphore done;
+};
+
+struct ChannelPing {
+    ChannelPing() : semaphore( 0 ), inRunnerThread( 0 ) {}
+    void operator()( TestChannelImpl * t ) {
+        *inRunnerThread = t->thread() == QThread::currentThread();
+        semaphore->release();
+    }
+    QSemaphore * semaphore;
+    bool * inRunnerThread;
+};
+
+struct ChannelHold {
+    void operator()( TestChannelImpl * ) {}
+    QSharedPointer<int> payload;
+};
+
+class ChannelProducer : public QThread
+{
+public:
+    ChannelProducer( KDThreadRunnerChannel<TestChannelImpl,ChannelAdd> * c, int p )
+        : QThread(), channel( c ), producer( p ), failed( 0 ) {}
+
+    void run() KDAB_OVERRIDE {
+        for ( int i = 0 ; i < TestChannelImpl::Expected ; ++i )
+            if ( !channel->post( ChannelAdd( producer, i ), 10000 ) )
+                ++failed;
+    }
+
+    KDThreadRunnerChannel<TestChannelImpl,ChannelAdd> * const channel;
+    const int producer;
+    int failed;
+};
+
+KDAB_UNITTEST_SIMPLE( KDThreadRunnerChannel, "kdtools/core" ) {
+
+    const int JOIN_TIMEOUT = 10000; // 10s
+
+    KDThreadRunner<TestChannelImpl> runner;
+    KDThreadRunnerChannel<TestChannelImpl,ChannelAdd> adds( &runner, &TestChannelImpl::add, 50 );
+    KDThreadRunnerChannel<TestChannelImpl,ChannelPing> pings( &runner, 1 );
+    KDThreadRunnerChannel<TestChannelImpl,ChannelHold> holds( &runner, 4 );
+    assertEqual( adds.capacity(), 64 );
+    assertEqual( pings.capacity(), 2 );
+
+    // commands posted before the thread runs are kept:
+    QSemaphore pinged;
+    bool inRunnerThread = false;
+    ChannelPing ping;
+    ping.semaphore = &pinged;
+    ping.inRunnerThread = &inRunnerThread;
+    assertTrue( pings.tryPost( ping ) );
+    assertTrue( pings.tryPost( ping ) );
+    assertFalse( pings.tryPost( ping ) ); // full
+    assertFalse( pings.post( ping, 0 ) );
+    QElapsedTimer timer;
+    timer.start();
+    assertFalse( pings.post( ping, 50 ) );
+    assertGreaterOrEqual( timer.elapsed(), qint64( 50 ) );
+
+    TestChannelImpl * const impl = runner.startThread();
+    assertNotNull( impl );
+    assertTrue( pinged.tryAcquire( 2, JOIN_TIMEOUT ) );
+    assertTrue( inRunnerThread );
+
+    ChannelProducer first( &adds, 0 ), second( &adds, 1 );
+    first.start();
+    second.start();
+    assertTrue( first.wait( 6 * JOIN_TIMEOUT ) );
+    assertTrue( second.wait( 6 * JOIN_TIMEOUT ) );
+    assertEqual( first.failed, 0 );
+    assertEqual( second.failed, 0 );
+    assertTrue( impl->done.tryAcquire( 1, JOIN_TIMEOUT ) );
+    assertEqual( impl->outOfOrder, 0 );
+
+    // executed commands don't linger in their slots:
+    {
+        ChannelHold hold;
+        hold.payload = QSharedPointer<int>( new int( 42 ) );
+        const QWeakPointer<int> weak = hold.payload;
+        assertTrue( holds.tryPost( hold ) );
+        hold.payload.clear();
+        for ( timer.restart() ; !weak.isNull() && timer.elapsed() < JOIN_TIMEOUT ; )
+            QThread::yieldCurrentThread();
+        assertTrue( weak.isNull() );
+    }
+
+    runner.quit();
+    assertTrue( runner.wait( JOIN_TIMEOUT ) );
+}
+
+KDAB_UNITTEST_SIMPLE( KDThreadRunnerPool, "kdtools/core" ) {
+
+    const int Instances = 10;
+    const int Calls = 200;
+
+    {
+        KDThreadRunnerPool<TestPoolImpl> pool( 3 );
+        assertEqual( pool.threadCount(), 3 );
+
+        QList<TestPoolImpl*> instances;
+        for ( int i = 0 ; i < Instances ; ++i )
+            instances.push_back( pool.createInstance() );
+        assertEqual( pool.instanceCount(), Instances );
+        assertEqual( kdtools::atomicLoadAcquire( poolInstancesAlive ), Instances );
+
+        for ( int call = 0 ; call < Calls ; ++call )
+            Q_FOREACH( TestPoolImpl * instance, instances )
+                assertTrue( pool.invoke( instance, "work", call, QString::fromLatin1( "payload" ) ) );
+        assertTrue( pool.waitForDone( 10000 ) );
+        assertEqual( kdtools::atomicLoadAcquire( poolCallsExecuted ), Instances * Calls );
+
+        assertTrue( pool.destroyInstance( instances.front() ) );
+        assertTrue( pool.waitForDone( 10000 ) );
+        assertEqual( pool.instanceCount(), Instances - 1 );
+        assertFalse( pool.invoke( instances.front(), "work", 0, QString() ) );
+        assertEqual( kdtools::atomicLoadAcquire( poolInstancesAlive ), Instances - 1 );
+    }
+
+    // the pool destroys the remaining instances in its threads:
+    assertEqual( kdtools::atomicLoadAcquire( poolInstancesAlive ), 0 );
+    assertEqual( kdtools::atomicLoadAcquire( poolTestFailures ), 0 );
+}
+
 #endif // KDTOOLSCORE_UNITTESTS
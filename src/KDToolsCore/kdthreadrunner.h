@@ -24,18 +24,51 @@
 #define __KDTOOLSCORE_KDTHREADRUNNER_H__
 
 #include <QMutexLocker>
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
 #include <QtCore/QThread>
+#include <QtCore/QVariant>
 
 #include <KDToolsCore/pimpl_ptr.h>
+#include <KDToolsCore/kdatomic.h>
+
+struct KDThreadRunnerOptions
+{
+    enum SchedulerPolicy { InheritPolicy, Other, Fifo, RoundRobin, Batch, Idle };
+
+    KDThreadRunnerOptions()
+        : priority( QThread::InheritPriority ),
+          cpus(),
+          numaNode( -1 ),
+          schedulerPolicy( InheritPolicy ),
+          schedulerPriority( 0 ),
+          stackSize( 0 ),
+          name() {}
+
+    QThread::Priority priority;
+    QList<int> cpus;
+    int numaNode;
+    SchedulerPolicy schedulerPolicy;
+    int schedulerPriority;
+    uint stackSize;
+    QByteArray name;
+};
 
 class KDTOOLSCORE_EXPORT KDThreadRunnerBase : public QThread
 {
 public:
     ~KDThreadRunnerBase();
 
+    bool isStarted() const;
+    bool waitForStarted( int msecs = -1 );
+
 protected:
     explicit KDThreadRunnerBase( QObject* parent = 0 );
     void doStart( Priority prio );
+    void doStart( const KDThreadRunnerOptions & options );
+    void doStartAsync( const KDThreadRunnerOptions & options );
+    void applyStartOptions();
     void doExec();
 
     void setImpl( QObject* );
@@ -44,10 +77,39 @@ protected:
     QMutex* internalStartThreadMutex();
 
 private:
+    friend class KDThreadRunnerChannelBase;
     class Private;
     kdtools::pimpl_ptr< Private > d;
 };
 
+template <class T> class KDThreadRunner;
+
+template <class T>
+class MAKEINCLUDES_EXPORT KDThreadRunnerFuture
+{
+public:
+    KDThreadRunnerFuture()
+        : m_runner( 0 ) {}
+    explicit KDThreadRunnerFuture( KDThreadRunner<T> * runner )
+        : m_runner( runner ) {}
+
+    KDThreadRunner<T> * runner() const { return m_runner; }
+
+    bool isNull() const { return !m_runner; }
+    bool isReady() const { return m_runner && m_runner->isStarted(); }
+
+    bool waitForStarted( int msecs = -1 ) const {
+        return m_runner && m_runner->waitForStarted( msecs );
+    }
+
+    T * result() const {
+        return waitForStarted() ? static_cast<T*>( m_runner->impl() ) : 0;
+    }
+
+private:
+    KDThreadRunner<T> * m_runner;
+};
+
 template <class T>
 class MAKEINCLUDES_EXPORT KDThreadRunner
 #ifdef DOXYGEN_RUN
@@ -68,15 +130,246 @@ public:
         return static_cast<T*>( this->impl() );
     }
 
+    T * startThread( const KDThreadRunnerOptions & options ) {
+        QMutexLocker locker( this->internalStartThreadMutex() );
+        if ( !this->impl() ) {
+            this->doStart( options );
+        }
+        return static_cast<T*>( this->impl() );
+    }
+
+    KDThreadRunnerFuture<T> startThreadAsync( Priority prio = InheritPriority ) {
+        KDThreadRunnerOptions options;
+        options.priority = prio;
+        return startThreadAsync( options );
+    }
+
+    KDThreadRunnerFuture<T> startThreadAsync( const KDThreadRunnerOptions & options ) {
+        QMutexLocker locker( this->internalStartThreadMutex() );
+        this->doStartAsync( options );
+        return KDThreadRunnerFuture<T>( this );
+    }
+
 protected:
     void run() KDAB_OVERRIDE // KDAB_FINAL?
     {
+        // before T is constructed, so that its allocations are
+        // first touched on the right CPUs:
+        this->applyStartOptions();
         // impl is created in the thread so that m_impl->thread()==this
         T t(this);
         this->setImpl( &t );
         this->doExec();
         this->setImpl( 0 );
     }
+
+private:
+    friend class KDThreadRunnerFuture<T>;
+};
+
+class KDTOOLSCORE_EXPORT KDThreadRunnerChannelBase
+{
+    Q_DISABLE_COPY( KDThreadRunnerChannelBase )
+public:
+    virtual ~KDThreadRunnerChannelBase();
+
+protected:
+    explicit KDThreadRunnerChannelBase( KDThreadRunnerBase * runner );
+
+    QObject * runnerImpl() const;
+    void scheduleDrain();
+
+    // Lets a producer sleep until drain() has made room, see post().
+    class SpaceWaiter {
+        Q_DISABLE_COPY( SpaceWaiter )
+    public:
+        explicit SpaceWaiter( KDThreadRunnerChannelBase * channel );
+        ~SpaceWaiter();
+        // returns false once msecs (if not negative) have passed since timer was started
+        bool wait( const QElapsedTimer & timer, int msecs );
+    private:
+        KDThreadRunnerChannelBase * const channel;
+    };
+
+private:
+    // called in the runner thread; returns whether commands are left
+    virtual bool drain() = 0;
+
+private:
+    class Private;
+    kdtools::pimpl_ptr< Private > d;
+};
+
+template <class T, class Command>
+class MAKEINCLUDES_EXPORT KDThreadRunnerChannel : public KDThreadRunnerChannelBase
+{
+public:
+    typedef void (T::*Handler)( const Command & );
+
+    explicit KDThreadRunnerChannel( KDThreadRunner<T> * runner, int capacity = 1024 )
+        : KDThreadRunnerChannelBase( runner ),
+          m_handler( 0 ),
+          m_invoke( &invokeFunctor )
+    {
+        init( capacity );
+    }
+
+    KDThreadRunnerChannel( KDThreadRunner<T> * runner, Handler handler, int capacity = 1024 )
+        : KDThreadRunnerChannelBase( runner ),
+          m_handler( handler ),
+          m_invoke( &invokeHandler )
+    {
+        init( capacity );
+    }
+
+    ~KDThreadRunnerChannel() {
+        delete[] m_cells;
+    }
+
+    int capacity() const { return m_mask + 1; }
+
+    bool tryPost( const Command & command ) {
+        int pos = kdtools::atomicLoadRelaxed( m_enqueuePos );
+        for ( ;; ) {
+            Cell & cell = m_cells[pos & m_mask];
+            const int diff = kdtools::wrappingDifference( kdtools::atomicLoadAcquire( cell.sequence ), pos );
+            if ( diff == 0 ) {
+                if ( m_enqueuePos.testAndSetRelaxed( pos, kdtools::wrappingAdd( pos, 1 ) ) ) {
+                    cell.command = command;
+                    kdtools::atomicStoreRelease( cell.sequence, kdtools::wrappingAdd( pos, 1 ) );
+                    this->scheduleDrain();
+                    return true;
+                }
+            } else if ( diff < 0 ) {
+                return false; // full
+            }
+            pos = kdtools::atomicLoadRelaxed( m_enqueuePos );
+        }
+    }
+
+    bool post( const Command & command, int msecs = -1 ) {
+        if ( tryPost( command ) )
+            return true;
+        if ( msecs == 0 )
+            return false;
+        QElapsedTimer timer;
+        timer.start();
+        SpaceWaiter waiter( this );
+        while ( !tryPost( command ) )
+            if ( !waiter.wait( timer, msecs ) )
+                return false;
+        return true;
+    }
+
+private:
+    bool drain() KDAB_OVERRIDE
+    {
+        T * const t = static_cast<T*>( this->runnerImpl() );
+        if ( !t )
+            return false;
+        for ( int i = 0 ; i <= m_mask ; ++i ) {
+            Cell & cell = m_cells[m_dequeuePos & m_mask];
+            const int next = kdtools::wrappingAdd( m_dequeuePos, 1 );
+            if ( kdtools::atomicLoadAcquire( cell.sequence ) != next )
+                return false; // empty
+            m_invoke( t, m_handler, cell.command );
+            cell.command = Command(); // release what the command holds now, not when the slot is reused
+            kdtools::atomicStoreRelease( cell.sequence, kdtools::wrappingAdd( m_dequeuePos, m_mask + 1 ) );
+            m_dequeuePos = next;
+        }
+        return true;
+    }
+
+    void init( int capacity ) {
+        int size = 2;
+        while ( size < capacity && size < ( 1 << 30 ) )
+            size *= 2;
+        m_cells = new Cell[size];
+        for ( int i = 0 ; i < size ; ++i )
+            kdtools::atomicStoreRelaxed( m_cells[i].sequence, i );
+        m_mask = size - 1;
+        m_dequeuePos = 0;
+    }
+
+    static void invokeFunctor( T * t, Handler, Command & command ) {
+        command( t );
+    }
+    static void invokeHandler( T * t, Handler handler, Command & command ) {
+        ( t->*handler )( command );
+    }
+
+private:
+    struct Cell {
+        QAtomicInt sequence;
+        Command command;
+    };
+
+    const Handler m_handler;
+    void (* const m_invoke)( T *, Handler, Command & );
+    Cell * m_cells;
+    int m_mask;
+    QAtomicInt m_enqueuePos; // shared by the producers
+    char m_padding[64];
+    int m_dequeuePos;        // runner thread only
+    char m_tailPadding[64];  // keeps whatever follows off m_dequeuePos' cache line
+};
+
+class KDTOOLSCORE_EXPORT KDThreadRunnerPoolBase : public QObject
+{
+public:
+    ~KDThreadRunnerPoolBase();
+
+    int threadCount() const;
+    int instanceCount() const;
+
+    bool waitForDone( int msecs = -1 );
+
+protected:
+    explicit KDThreadRunnerPoolBase( int threads, QObject * parent = 0 );
+
+    QObject * doCreate();
+    bool doDestroy( QObject * instance );
+    bool doInvoke( QObject * instance, const char * member,
+                   const QVariant & a0, const QVariant & a1, const QVariant & a2,
+                   const QVariant & a3, const QVariant & a4 );
+
+private:
+    virtual QObject * createImpl() = 0;
+
+private:
+    class Private;
+    kdtools::pimpl_ptr< Private > d;
+};
+
+template <class T>
+class MAKEINCLUDES_EXPORT KDThreadRunnerPool : public KDThreadRunnerPoolBase
+{
+public:
+    explicit KDThreadRunnerPool( int threads = -1, QObject * p = 0 )
+        : KDThreadRunnerPoolBase( threads, p ) {}
+
+    T * createInstance() {
+        return static_cast<T*>( this->doCreate() );
+    }
+
+    bool destroyInstance( T * instance ) {
+        return this->doDestroy( instance );
+    }
+
+    bool invoke( T * instance, const char * member,
+                 const QVariant & a0 = QVariant(), const QVariant & a1 = QVariant(),
+                 const QVariant & a2 = QVariant(), const QVariant & a3 = QVariant(),
+                 const QVariant & a4 = QVariant() )
+    {
+        return this->doInvoke( instance, member, a0, a1, a2, a3, a4 );
+    }
+
+private:
+    QObject * createImpl() KDAB_OVERRIDE
+    {
+        // called in a pool thread, so that instance->thread() is that thread
+        return new T( this );
+    }
 };
 
 #endif
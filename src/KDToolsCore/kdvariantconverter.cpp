@@ -24,8 +24,14 @@
 
 #if QT_VERSION >= 0x040200 || defined( DOXYGEN_RUN )
 
+#include "kdatomic.h"
+
 #include <QDateTime>
 #include <QDebug>
+#include <QHash>
+#include <QMutex>
+
+#include <algorithm>
 
 using namespace kdtools;
 
@@ -64,6 +70,40 @@ using namespace kdtools;
   }
   \endcode
 
+  If there's a cheaper way to order values of your type than its operator<, or it has none, specialize
+  kdtools::variant_sort_key for it. Without either, values are ordered by their string conversion,
+  which allocates for each comparison. For example:
+
+  \code
+  namespace kdtools {
+      template<> struct variant_sort_key< MyType > {
+          typedef qint64 key_type;
+          static key_type key( const MyType& t ) { return t.timestamp(); }
+      };
+  }
+  \endcode
+
+  \section Static Registration
+
+  Registering conversions one by one with registerConversion() runs code for every
+  conversion at startup. Applications and plugins registering many of them can instead
+  declare a table per translation unit:
+
+  \code
+  KDAB_VARIANT_CONVERSIONS_BEGIN( myTypes )
+      KDAB_VARIANT_CONVERSION( MyType, String )
+      KDAB_VARIANT_CONVERSION( MyType, Double )
+      KDAB_VARIANT_COMPARISON( MyOtherType )
+  KDAB_VARIANT_CONVERSIONS_END( myTypes )
+  \endcode
+
+  The table consists of function pointers only and is initialized by the compiler
+  and linker; loading the library or plugin merely links it into a list of pending
+  tables, which needs no memory allocation. The pending tables are merged into the
+  dispatch table on the first variant conversion or comparison that needs it.
+  KDAB_VARIANT_COMPARISON() only registers the comparators of a type, without
+  any conversion. Unloading the plugin removes its table again.
+
   \sa registerConversion
 
  */
@@ -115,9 +155,67 @@ using namespace kdtools;
   \endcode
  */
 
-std::map< qvariant_conversion_registrar::converter, converter_function >* qvariant_conversion_registrar::converters = 0;
-std::map< int, comparator_function >* qvariant_conversion_registrar::comparators_equals = 0;
-std::map< int, comparator_function >* qvariant_conversion_registrar::comparators_less_than = 0;
+namespace {
+    // The dispatch table: one row per registered user type, indexed by
+    // type id - QMetaType::User. It only grows; a grown table is
+    // published as a whole, and the old one is retired, but kept
+    // alive, so lookups need neither a lock nor a tree walk. Rows are
+    // replaced the same way, by fully built copies.
+    struct dispatch_table
+    {
+        int size;
+        QAtomicPointer< qvariant_conversion_registrar::dispatch_row >* rows;
+    };
+
+    // Replaced rows and tables, which lookups may still be using. They
+    // are freed at static destruction, when no more lookups happen.
+    struct retired_storage
+    {
+        ~retired_storage()
+        {
+            qDeleteAll( rows );
+            Q_FOREACH( dispatch_table* table, tables )
+            {
+                delete[] table->rows;
+                delete table;
+            }
+        }
+
+        QVector< qvariant_conversion_registrar::dispatch_row* > rows;
+        QVector< dispatch_table* > tables;
+    };
+
+    // Rows changed by registrations, but not published yet: all
+    // registrations of a type up to the next lookup are published as
+    // one row.
+    typedef QHash< int, qvariant_conversion_registrar::dispatch_row > draft_rows;
+}
+
+static QBasicAtomicPointer< dispatch_table > dispatchTable = Q_BASIC_ATOMIC_INITIALIZER( 0 );
+
+Q_GLOBAL_STATIC( QMutex, registrationMutex )
+Q_GLOBAL_STATIC( retired_storage, retiredStorage )
+Q_GLOBAL_STATIC( draft_rows, draftRows )
+
+// tables declared with KDAB_VARIANT_CONVERSIONS_BEGIN/END, not yet merged into dispatchTable:
+static QBasicAtomicPointer< variant_conversion_list > pendingLists = Q_BASIC_ATOMIC_INITIALIZER( 0 );
+// set while there are pending tables or draft rows:
+static QBasicAtomicInt hasPendingLists = Q_BASIC_ATOMIC_INITIALIZER( 0 );
+
+static void mergePendingLists();
+static bool mergePendingListsLocked( const variant_conversion_list* skip = 0 );
+static bool mergePendingListsIntoDraftsLocked( const variant_conversion_list* skip = 0 );
+
+/*!
+ \internal
+ Returns the row of \a userType in the dispatch table, or 0 if there is none.
+ */
+static inline const qvariant_conversion_registrar::dispatch_row* findRow( int userType )
+{
+    if( kdtools::atomicLoadRelaxed( hasPendingLists ) )
+        mergePendingLists();
+    return qvariant_conversion_registrar::row( userType );
+}
 
 const QVariant::Handler* oldHandler = 0;
 
@@ -129,10 +227,6 @@ static QVariant::f_convert oldConvert = 0;
 /*! QVariant's original debugStream function pointer. */
 static QVariant::f_debugStream oldStreamDebug = 0;
 #endif
-/*! QVariant's original construct function pointer. */
-static QVariant::f_construct oldConstruct = 0;
-/*! QVariant's original clear function pointer. */
-static QVariant::f_clear oldClear = 0;
 
 /*!
  \struct comparator_function
@@ -186,6 +280,14 @@ bool comparator_function::operator()( const QVariant::Private* a, const QVariant
     return false;
 }
 
+/*!
+ Returns true, if this and \a other call the same function.
+ */
+bool comparator_function::operator==( const comparator_function& other ) const
+{
+    return function == other.function;
+}
+
 /*!
  Creates a comparator_function using \a function.
  */
@@ -226,6 +328,14 @@ bool converter_function::operator()( const QVariant::Private* d, QVariant::Type
     return false;
 }
 
+/*!
+ Returns true, if this and \a other call the same function.
+ */
+bool converter_function::operator==( const converter_function& other ) const
+{
+    return function == other.function;
+}
+
 /*!
  Creates a new converter_function using \a function.
  */
@@ -252,20 +362,6 @@ static void myStreamDebug( QDebug dbg, const QVariant& v )
 }
 #endif
 
-/*!
- \internal
- Creates a converter with \a id and \a targetType.
-*/
-#if QT_VERSION >= 0x050000
-qvariant_conversion_registrar::converter::converter( int id_, int tt )
-#else
-qvariant_conversion_registrar::converter::converter( int id_, QVariant::Type tt )
-#endif
-    : id( id_ ),
-      targetType( tt )
-{
-}
-
 /*!
  \internal
  Wrapper function for QVariant's old compare function.
@@ -275,14 +371,11 @@ static bool myCompare( const QVariant::Private* a, const QVariant::Private* b )
     if( a->type < QVariant::UserType || b->type < QVariant::UserType || a->type != b->type )
         return oldCompare( a, b );
 
-    if( qvariant_conversion_registrar::comparators_equals == 0 )
-        return oldCompare( a, b );
-
-    comparator_function& compare = (*qvariant_conversion_registrar::comparators_equals)[ a->type ];
-    if( !compare )
+    const qvariant_conversion_registrar::dispatch_row* const row = findRow( a->type );
+    if( row == 0 || !row->equals )
         return oldCompare( a, b );
 
-    return compare( a, b );
+    return row->equals( a, b );
 }
 
 /*!
@@ -298,32 +391,14 @@ static bool myConvert( const QVariant::Private* d, QVariant::Type t, void* resul
     if( d->type < QVariant::UserType )
         return oldConvert( d, t, result, ok );
 
-    if( qvariant_conversion_registrar::converters == 0 )
+    const qvariant_conversion_registrar::dispatch_row* const row = findRow( d->type );
+    if( row == 0 )
         return oldConvert( d, t, result, ok );
-
-    converter_function& convert = (*qvariant_conversion_registrar::converters)[ qvariant_conversion_registrar::converter( d->type, t ) ];
-    if( !convert )
+    const converter_function converter = row->converter( t );
+    if( !converter )
         return oldConvert( d, t, result, ok );
 
-    return convert( d, t, result, ok );
-}
-
-/*!
- \internal
- Wrapper function for QVariant's old construct function.
- */
-static void myConstruct( QVariant::Private* x, const void* copy )
-{
-    oldConstruct( x, copy );
-}
-
-/*!
- \internal
- Wrapper function for QVariant's old clear function.
- */
-static void myClear( QVariant::Private* d )
-{
-    oldClear( d );
+    return converter( d, t, result, ok );
 }
 
 #if QT_VERSION >= 0x050000
@@ -343,9 +418,11 @@ void qvariant_conversion_registrar::registerIt()
 #endif
 
     // this is why we need to derive QVariant...
+    // (construct and clear are Qt's own, so that creating and destroying
+    // variants doesn't pay for an extra indirection)
     static const QVariant::Handler kdab_qt_kernel_variant_handler = {
-        myConstruct,
-        myClear,
+        handler->construct,
+        handler->clear,
         handler->isNull,
 #ifndef QT_NO_DATASTREAM
         handler->load,
@@ -366,23 +443,12 @@ void qvariant_conversion_registrar::registerIt()
         oldHandler = handler;
         oldCompare = handler->compare;
         oldConvert = handler->convert;
-        oldConstruct = handler->construct;
-        oldClear = handler->clear;
 #if !defined(QT_NO_DEBUG_STREAM) && !defined(Q_BROKEN_DEBUG_STREAM)
         oldStreamDebug = handler->debugStream;
 #endif
         handler = &kdab_qt_kernel_variant_handler;
     }
 
-    if( qvariant_conversion_registrar::converters == 0 )
-        qvariant_conversion_registrar::converters = new std::map< qvariant_conversion_registrar::converter, converter_function >;
-
-    if( qvariant_conversion_registrar::comparators_equals == 0 )
-        qvariant_conversion_registrar::comparators_equals = new std::map< int, comparator_function >;
-
-    if( qvariant_conversion_registrar::comparators_less_than == 0 )
-        qvariant_conversion_registrar::comparators_less_than = new std::map< int, comparator_function >;
-
 #if QT_VERSION >= 0x050000
     (*const_cast<QVariant::Handler*>(qcoreVariantHandler())) = kdab_qt_kernel_variant_handler;
 #endif
@@ -390,14 +456,289 @@ void qvariant_conversion_registrar::registerIt()
 
 /*!
  \internal
- To be able to put it into a map.
+ Returns the converter to \a targetType, or a null one if there is none.
+ */
+converter_function qvariant_conversion_registrar::dispatch_row::converter( int targetType ) const
+{
+    if( targetType < MaxTargetType )
+        return targetType >= 0 ? converters[ targetType ] : converter_function();
+
+    // sparse: few user types convert to GUI types, and to few of them
+    for( QVector< overflow_converter >::const_iterator it = overflow.begin(); it != overflow.end(); ++it )
+        if( it->targetType == targetType )
+            return it->converter;
+        else if( it->targetType > targetType )
+            break;
+    return converter_function();
+}
+
+/*!
+ \internal
+ Sets the converter to \a targetType, which must not be negative, to \a converter.
+ */
+void qvariant_conversion_registrar::dispatch_row::setConverter( int targetType, const converter_function& converter )
+{
+    Q_ASSERT( targetType >= 0 );
+    if( targetType < MaxTargetType )
+    {
+        converters[ targetType ] = converter;
+        return;
+    }
+
+    QVector< overflow_converter >::iterator it = overflow.begin();
+    while( it != overflow.end() && it->targetType < targetType )
+        ++it;
+    if( it != overflow.end() && it->targetType == targetType )
+    {
+        it->converter = converter;
+        return;
+    }
+    const overflow_converter entry = { targetType, converter };
+    overflow.insert( it, entry );
+}
+
+/*!
+ \internal
+ Returns the row of \a userType in the dispatch table, or 0 if there is none.
+ */
+const qvariant_conversion_registrar::dispatch_row* qvariant_conversion_registrar::row( int userType )
+{
+    const dispatch_table* const table = kdtools::atomicLoadAcquire( dispatchTable );
+    const int index = userType - QMetaType::User;
+    if( table == 0 || index < 0 || index >= table->size )
+        return 0;
+    return kdtools::atomicLoadAcquire( table->rows[ index ] );
+}
+
+/*!
+ \internal
+ Replaces the row of \a userType, which must be a user type, with a copy of \a row, growing the
+ table if needed. The copy is complete before it is published, so lookups in other threads never
+ see a partially built row. The replaced row and table are retired.
+ Must be called with registrationMutex locked.
+ */
+void qvariant_conversion_registrar::publishRow( int userType, const dispatch_row& row )
+{
+    const int index = userType - QMetaType::User;
+    Q_ASSERT( index >= 0 );
+    retired_storage* const retired = retiredStorage();
+    dispatch_table* table = kdtools::atomicLoadAcquire( dispatchTable );
+    if( table == 0 || index >= table->size )
+    {
+        dispatch_table* const grown = new dispatch_table;
+        grown->size = qMax( 2 * ( table ? table->size : 0 ), index + 16 );
+        grown->rows = new QAtomicPointer< dispatch_row >[ grown->size ];
+        if( table != 0 )
+            std::copy( table->rows, table->rows + table->size, grown->rows );
+        kdtools::atomicStoreRelease( dispatchTable, grown );
+        if( table != 0 && retired != 0 )
+            retired->tables.push_back( table );
+        table = grown;
+    }
+    dispatch_row* const replaced = kdtools::atomicLoadAcquire( table->rows[ index ] );
+    kdtools::atomicStoreRelease( table->rows[ index ], new dispatch_row( row ) );
+    if( replaced != 0 && retired != 0 )
+        retired->rows.push_back( replaced );
+}
+
+/*!
+ \internal
+ Returns a copy of the row of \a userType, or an empty row if there is none, for modification
+ and publishRow().
+ */
+static qvariant_conversion_registrar::dispatch_row copyOfRow( int userType )
+{
+    const qvariant_conversion_registrar::dispatch_row* const row = qvariant_conversion_registrar::row( userType );
+    return row ? *row : qvariant_conversion_registrar::dispatch_row();
+}
+
+/*!
+ \internal
+ Returns the draft of the row of \a userType, which publishDraftsLocked() publishes.
+ Must be called with registrationMutex locked, and not during static destruction.
+ */
+static qvariant_conversion_registrar::dispatch_row& draftRow( int userType )
+{
+    draft_rows* const drafts = draftRows();
+    Q_ASSERT( drafts );
+    draft_rows::iterator it = drafts->find( userType );
+    if( it == drafts->end() )
+        it = drafts->insert( userType, copyOfRow( userType ) );
+    return *it;
+}
+
+/*!
+ \internal
+ Publishes the draft rows, each with one publishRow().
+ Must be called with registrationMutex locked.
+ */
+static void publishDraftsLocked()
+{
+    draft_rows* const drafts = draftRows();
+    if( drafts == 0 || drafts->isEmpty() )
+        return;
+    for( draft_rows::const_iterator it = drafts->constBegin(); it != drafts->constEnd(); ++it )
+        qvariant_conversion_registrar::publishRow( it.key(), it.value() );
+    drafts->clear();
+}
+
+/*!
+ \internal
+ Registers \a converter for conversions of \a metaTypeId to \a targetType, and the
+ comparators \a equals and \a lessThan for \a metaTypeId.
  */
-bool kdtools::operator<( const qvariant_conversion_registrar::converter& lhs, const qvariant_conversion_registrar::converter& rhs )
+void KDVariantConverter::registerFunctions( int metaTypeId, int targetType, const converter_function& converter,
+                                            const comparator_function& equals, const comparator_function& lessThan )
 {
-    if( lhs.id != rhs.id )
-        return lhs.id < rhs.id;
-    else
-        return lhs.targetType < rhs.targetType;
+    const QMutexLocker locker( registrationMutex() );
+    qvariant_conversion_registrar::registerIt();
+    // static tables loaded earlier must not override this later registration:
+    mergePendingListsIntoDraftsLocked();
+
+    if( metaTypeId < QMetaType::User || targetType < 0 )
+    {
+        qWarning( "KDVariantConverter: cannot register a conversion from %s to %s",
+                  QMetaType::typeName( metaTypeId ), QVariant::typeToName( QVariant::Type( targetType ) ) );
+        return;
+    }
+    qvariant_conversion_registrar::dispatch_row& row = draftRow( metaTypeId );
+    row.setConverter( targetType, converter );
+    row.equals = equals;
+    row.less_than = lessThan;
+    // published by the next lookup, together with all registrations up to then
+    kdtools::atomicStoreRelease( hasPendingLists, 1 );
+}
+
+namespace {
+    struct static_converter_function : converter_function
+    {
+        explicit static_converter_function( QVariant::f_convert function ) : converter_function( function ) {}
+    };
+
+    struct static_comparator_function : comparator_function
+    {
+        explicit static_comparator_function( QVariant::f_compare function ) : comparator_function( function ) {}
+    };
+}
+
+/*!
+ \internal
+ Merges the tables declared with KDAB_VARIANT_CONVERSIONS_BEGIN/END since the last
+ call into the draft rows, in the order they were loaded, except for \a skip,
+ which is dropped. Returns whether \a skip was pending.
+ Must be called with registrationMutex locked.
+ */
+static bool mergePendingListsIntoDraftsLocked( const variant_conversion_list* skip )
+{
+    bool skipped = false;
+    variant_conversion_list* reversed = 0;
+    for( variant_conversion_list* list = pendingLists.fetchAndStoreAcquire( 0 ); list != 0; )
+    {
+        variant_conversion_list* const next = list->next;
+        if( list == skip )
+        {
+            skipped = true;
+            list = next;
+            continue;
+        }
+        list->next = reversed;
+        reversed = list;
+        list = next;
+    }
+
+    for( const variant_conversion_list* list = reversed; list != 0; list = list->next )
+    {
+        for( const variant_conversion_entry* e = list->entries; e != list->entries + list->count; ++e )
+        {
+            const int metaTypeId = e->metaTypeId();
+            if( metaTypeId < QMetaType::User )
+            {
+                qWarning( "KDVariantConverter: cannot register a conversion from %s to %s",
+                          QMetaType::typeName( metaTypeId ), QVariant::typeToName( QVariant::Type( e->targetType ) ) );
+                continue;
+            }
+            qvariant_conversion_registrar::dispatch_row& row = draftRow( metaTypeId );
+            if( e->targetType >= 0 && e->convert != 0 )
+                row.setConverter( e->targetType, static_converter_function( e->convert ) );
+            row.equals = static_comparator_function( e->equals );
+            row.less_than = static_comparator_function( e->less_than );
+        }
+    }
+    return skipped;
+}
+
+/*!
+ \internal
+ Merges the pending tables, except for \a skip, and the registrations since the last call
+ into the dispatch table, publishing each changed row once. Returns whether \a skip was pending.
+ Must be called with registrationMutex locked.
+ */
+static bool mergePendingListsLocked( const variant_conversion_list* skip )
+{
+    // reset the flag first: a table pushed while we're merging sets it again
+    kdtools::atomicStoreRelaxed( hasPendingLists, 0 );
+    const bool skipped = mergePendingListsIntoDraftsLocked( skip );
+    publishDraftsLocked();
+    return skipped;
+}
+
+static void mergePendingLists()
+{
+    const QMutexLocker locker( registrationMutex() );
+    mergePendingListsLocked();
+}
+
+/*!
+ \class KDVariantConverter::StaticRegistration
+ \internal
+ Instantiated by KDAB_VARIANT_CONVERSIONS_END: Adds \a list to the tables pending to be merged
+ into the dispatch table, and installs KDVariantConverter's QVariant::Handler.
+ */
+KDVariantConverter::StaticRegistration::StaticRegistration( variant_conversion_list* l )
+    : list( l )
+{
+    variant_conversion_list* head;
+    do {
+        head = kdtools::atomicLoadAcquire( pendingLists );
+        list->next = head;
+    } while( !pendingLists.testAndSetRelease( head, list ) );
+    kdtools::atomicStoreRelease( hasPendingLists, 1 );
+
+    const QMutexLocker locker( registrationMutex() );
+    qvariant_conversion_registrar::registerIt();
+}
+
+/*!
+ Removes the table from the list of pending tables, or, if it has been merged already, its
+ conversions from the dispatch table: the plugin declaring it is being unloaded, and both the
+ table and the functions it points to are about to be unmapped. A conversion or comparator that
+ a later registration replaced is kept.
+ */
+KDVariantConverter::StaticRegistration::~StaticRegistration()
+{
+    const QMutexLocker locker( registrationMutex() );
+    if( draftRows() == 0 )
+        return; // static destruction: there are no more lookups
+
+    // the other pending tables are merged, to keep them in load order
+    if( !mergePendingListsIntoDraftsLocked( list ) )
+    {
+        const draft_rows& drafts = *draftRows();
+        for( const variant_conversion_entry* e = list->entries; e != list->entries + list->count; ++e )
+        {
+            const int metaTypeId = e->metaTypeId();
+            if( qvariant_conversion_registrar::row( metaTypeId ) == 0 && !drafts.contains( metaTypeId ) )
+                continue;
+            qvariant_conversion_registrar::dispatch_row& row = draftRow( metaTypeId );
+            if( e->targetType >= 0 && e->convert != 0 && row.converter( e->targetType ) == static_converter_function( e->convert ) )
+                row.setConverter( e->targetType, converter_function() );
+            if( row.equals == static_comparator_function( e->equals ) )
+                row.equals = comparator_function();
+            if( row.less_than == static_comparator_function( e->less_than ) )
+                row.less_than = comparator_function();
+        }
+    }
+    publishDraftsLocked();
 }
 
 namespace {
@@ -447,14 +788,11 @@ bool operator<( const QVariant& lhs, const QVariant& rhs )
         }
     }
 
-    if( qvariant_conversion_registrar::comparators_less_than == 0 )
-        return lhs.toString() < rhs.toString();
-
-    comparator_function& compare = (*qvariant_conversion_registrar::comparators_less_than)[ lhs.userType() ];
-    if( !compare )
+    const qvariant_conversion_registrar::dispatch_row* const row = findRow( lhs.userType() );
+    if( row == 0 || !row->less_than )
         return lhs.toString() < rhs.toString();
 
-    return compare( &static_cast< QVariantDataPtrAccess& >( const_cast< QVariant& >( lhs ) ).data_ptr(),
+    return row->less_than( &static_cast< QVariantDataPtrAccess& >( const_cast< QVariant& >( lhs ) ).data_ptr(),
                     &static_cast< QVariantDataPtrAccess& >( const_cast< QVariant& >( rhs ) ).data_ptr() );
 }
 
@@ -544,6 +882,69 @@ bool operator<( const MyClass2& lhs, const MyClass2& rhs )
     return lhs.data < rhs.data;
 }
 
+class MyClass3
+{
+public:
+    MyClass3( int dat = 0 )
+        : data( dat )
+    {
+    }
+
+    QString toString() const { return QString::number( data ); }
+    int toInt( bool* ok = 0 ) const { if( ok ) *ok = true; return data; }
+
+    int data;
+};
+
+bool operator==( const MyClass3& lhs, const MyClass3& rhs )
+{
+    return lhs.data == rhs.data;
+}
+
+bool operator<( const MyClass3& lhs, const MyClass3& rhs )
+{
+    return lhs.data > rhs.data; // reversed, so it can't be mistaken for the string fallback
+}
+
+class MyClass4
+{
+public:
+    MyClass4( int dat = 0 )
+        : data( dat )
+    {
+    }
+
+    QString toString() const { return QString::fromLatin1( "MyClass4::toString()" ); }
+
+    int data;
+};
+
+class MyClass5
+{
+public:
+    MyClass5( uint dat = 0 )
+        : data( dat )
+    {
+    }
+
+    QString toString() const { return QString::number( data, 16 ); }
+
+    uint data;
+};
+
+class MyClass6
+{
+public:
+    MyClass6( int dat = 0 )
+        : data( dat )
+    {
+    }
+
+    QString toString() const { return QString::number( data ); }
+
+    int data;
+};
+
 } // namespace _qvariant_converter_uniq_1389392
 using namespace _qvariant_converter_uniq_1389392;
 
@@ -711,9 +1112,46 @@ QT_END_NAMESPACE
 
 Q_DECLARE_METATYPE( _qvariant_converter_uniq_1389392::MyClass )
 Q_DECLARE_METATYPE( _qvariant_converter_uniq_1389392::MyClass2 )
+Q_DECLARE_METATYPE( _qvariant_converter_uniq_1389392::MyClass3 )
+Q_DECLARE_METATYPE( _qvariant_converter_uniq_1389392::MyClass4 )
+Q_DECLARE_METATYPE( _qvariant_converter_uniq_1389392::MyClass5 )
+Q_DECLARE_METATYPE( _qvariant_converter_uniq_1389392::MyClass6 )
+
+namespace kdtools {
+    template<> struct variant_sort_key< MyClass4 > {
+        typedef int key_type;
+        static key_type key( const MyClass4& m ) { return m.data; }
+    };
+
+    // QtCore has neither QColor nor QFont, so these write a uint, and the
+    // test calls the dispatcher with one directly:
+    template< uint XOR > struct gui_type_converter : converter_function {
+        gui_type_converter() : converter_function( convert ) {}
+        static bool convert( const QVariant::Private* d, CONVERTER_TARGET_TYPE, void* result, bool* ok )
+        {
+            *static_cast< uint* >( result ) = valueHelper< MyClass5 >( d )->data ^ XOR;
+            if( ok )
+                *ok = true;
+            return true;
+        }
+    };
+    template<> struct converter< MyClass5, QVariant::Color > : gui_type_converter< 0 > {};
+    template<> struct converter< MyClass5, QVariant::Font > : gui_type_converter< 0xff > {};
+}
+
+KDAB_VARIANT_CONVERSIONS_BEGIN( unittest )
+    KDAB_VARIANT_CONVERSION( MyClass3, String )
+    KDAB_VARIANT_CONVERSION( MyClass3, Int )
+KDAB_VARIANT_CONVERSIONS_END( unittest )
+
+// the table of a plugin, which the test loads and unloads
+static const variant_conversion_entry pluginConversions[] = {
+    KDAB_VARIANT_CONVERSION( MyClass6, String )
+};
 
 KDAB_UNITTEST_SIMPLE( KDVariantConverter, "kdtools/core" ) {
 
+    int retiredRows = retiredStorage()->rows.size();
     KDVariantConverter::registerConversion< MyClass, QVariant::BitArray >();
     KDVariantConverter::registerConversion< MyClass, QVariant::Bool >();
     KDVariantConverter::registerConversion< MyClass, QVariant::ByteArray >();
@@ -746,6 +1184,9 @@ KDAB_UNITTEST_SIMPLE( KDVariantConverter, "kdtools/core" ) {
     {
     MyClass m;
     const QVariant var = qVariantFromValue< MyClass >( m );
+    // the first lookup published each new row once, replacing none
+    assertNotNull( findRow( qMetaTypeId< MyClass >() ) );
+    assertEqual( retiredStorage()->rows.size(), retiredRows );
 
     bool ok1;
     bool ok2;
@@ -826,6 +1267,84 @@ KDAB_UNITTEST_SIMPLE( KDVariantConverter, "kdtools/core" ) {
     assertTrue( var1 < var2 );
     assertFalse( var1 > var2 );
     }
+
+    {
+    // registered by the static table above, without any code in here
+    const QVariant var3a = qVariantFromValue< MyClass3 >( MyClass3( 7 ) );
+    const QVariant var3b = qVariantFromValue< MyClass3 >( MyClass3( 42 ) );
+    const QVariant var3c = qVariantFromValue< MyClass3 >( MyClass3( 7 ) );
+    bool ok = false;
+    assertTrue( var3a.toString() == QString::fromLatin1( "7" ) );
+    assertEqual( var3b.toInt( &ok ), 42 ); assertTrue( ok );
+    assertEqual( var3a, var3c );
+    assertNotEqual( var3a, var3b );
+    assertTrue( var3b < var3a );
+    assertFalse( var3a < var3b );
+    }
+
+    {
+    // no operator<, and toString() is always the same: only the sort key orders them
+    KDVariantConverter::registerConversion< MyClass4 >();
+    const QVariant var4a = qVariantFromValue< MyClass4 >( MyClass4( 1 ) );
+    const QVariant var4b = qVariantFromValue< MyClass4 >( MyClass4( 2 ) );
+    assertTrue( var4a < var4b );
+    assertFalse( var4b < var4a );
+    assertFalse( var4a < var4a );
+    }
+
+    {
+    // conversions to QVariant's GUI types, beyond the directly indexed ones
+    KDVariantConverter::registerConversion< MyClass5, QVariant::Font >();
+    KDVariantConverter::registerConversion< MyClass5, QVariant::Color >();
+    KDVariantConverter::registerConversion< MyClass5 >();
+    QVariant var5 = qVariantFromValue< MyClass5 >( MyClass5( 0x123456 ) );
+    const QVariant::Private* const d5 = &static_cast< QVariantDataPtrAccess& >( var5 ).data_ptr();
+    uint result = 0;
+    bool ok = false;
+    assertTrue( myConvert( d5, QVariant::Color, &result, &ok ) ); assertTrue( ok );
+    assertEqual( result, 0x123456u );
+    ok = false;
+    assertTrue( myConvert( d5, QVariant::Font, &result, &ok ) ); assertTrue( ok );
+    assertEqual( result, 0x1234a9u );
+    assertTrue( var5.toString() == QString::fromLatin1( "123456" ) );
+
+    const qvariant_conversion_registrar::dispatch_row* const row = findRow( qMetaTypeId< MyClass5 >() );
+    assertNotNull( row );
+    assertEqual( row->overflow.size(), 2 );
+    assertTrue( !row->converter( QVariant::Brush ) );
+    assertTrue( !row->converter( QVariant::Bool ) );
+    }
+
+    {
+    // a plugin unloaded before the first lookup...
+    variant_conversion_list plugin = { pluginConversions, 1, 0 };
+    {
+        const KDVariantConverter::StaticRegistration registration( &plugin );
+    }
+    plugin.entries = 0; // ...and unmapped: a merge would crash
+    const QVariant var6 = qVariantFromValue< MyClass6 >( MyClass6( 6 ) );
+    assertTrue( var6.toString().isEmpty() );
+    assertNull( findRow( qMetaTypeId< MyClass6 >() ) );
+
+    // loaded again, used, and unloaded
+    plugin.entries = pluginConversions;
+    {
+        const KDVariantConverter::StaticRegistration registration( &plugin );
+        assertTrue( var6.toString() == QString::fromLatin1( "6" ) );
+        retiredRows = retiredStorage()->rows.size();
+    }
+    assertEqual( retiredStorage()->rows.size(), retiredRows + 1 ); // one row per type, not per entry
+    plugin.entries = 0;
+    assertTrue( var6.toString().isEmpty() );
+    const qvariant_conversion_registrar::dispatch_row* const row6 = findRow( qMetaTypeId< MyClass6 >() );
+    assertNotNull( row6 );
+    assertTrue( !row6->converter( QVariant::String ) );
+    assertTrue( !row6->equals );
+    assertTrue( !row6->less_than );
+
+    // the other tables stay
+    assertTrue( qVariantFromValue< MyClass3 >( MyClass3( 7 ) ).toString() == QString::fromLatin1( "7" ) );
+    }
 }
 
 #endif
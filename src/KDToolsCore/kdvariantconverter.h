@@ -28,7 +28,7 @@
 #if QT_VERSION >= 0x040200 || defined( DOXYGEN_RUN )
 
 #include <QtCore/QVariant>
-#include <map>
+#include <QtCore/QVector>
 
 namespace kdtools {
 
@@ -38,6 +38,7 @@ struct comparator_function
 
     operator bool() const;
     bool operator()( const QVariant::Private* a, const QVariant::Private* b ) const;
+    bool operator==( const comparator_function& other ) const;
 
 protected:
     comparator_function( QVariant::f_compare function );
@@ -56,6 +57,7 @@ struct converter_function
 #else
     bool operator()( const QVariant::Private* d, QVariant::Type t, void* result, bool* ok ) const;
 #endif
+    bool operator==( const converter_function& other ) const;
 
 protected:
     converter_function( QVariant::f_convert function );
@@ -72,29 +74,54 @@ private:
 public:
     static void registerIt();
 
-    struct converter
-    {
-#if QT_VERSION >= 0x050000
-        converter( int id = 0, int targetType = QVariant::String );
+    // conversions to types below this are dispatched by index; all of QVariant's core types fit
+    enum { MaxTargetType = 64 };
 
-        int id;
+    // a conversion to a type >= MaxTargetType, e.g. one of QVariant's GUI types
+    struct overflow_converter
+    {
         int targetType;
-#else
-        converter( int id = 0, QVariant::Type targetType = QVariant::String );
+        converter_function converter;
+    };
 
-        int id;
-        QVariant::Type targetType;
-#endif
+    // everything registered for one user type. A published row is never
+    // modified; registering publishes a modified copy instead.
+    struct dispatch_row
+    {
+        converter_function converters[ MaxTargetType ];
+        QVector< overflow_converter > overflow; // sorted by targetType
+        comparator_function equals;
+        comparator_function less_than;
+
+        converter_function converter( int targetType ) const;
+        void setConverter( int targetType, const converter_function& converter );
     };
 
-    static bool registered;
+    static const dispatch_row* row( int userType );
+    static void publishRow( int userType, const dispatch_row& row );
+};
 
-    static std::map< converter, converter_function >* converters;
-    static std::map< int, comparator_function >* comparators_equals;
-    static std::map< int, comparator_function >* comparators_less_than;
+// One conversion (or just the comparators, if convert is 0) of a
+// user type. These are aggregates of function pointers only, so a
+// table of them is initialized statically, without running any code:
+struct variant_conversion_entry
+{
+    int ( *metaTypeId )();
+    int targetType;
+    QVariant::f_convert convert;
+    QVariant::f_compare equals;
+    QVariant::f_compare less_than;
 };
 
-bool operator<( const qvariant_conversion_registrar::converter& lhs, const qvariant_conversion_registrar::converter& rhs );
+// A translation unit's table of entries. The node is statically
+// initialized, too, and chained into the list of pending tables at
+// load time, which needs no allocation.
+struct variant_conversion_list
+{
+    const variant_conversion_entry* entries;
+    int count;
+    variant_conversion_list* next;
+};
 
 template< typename T >
 const T* valueHelper( const QVariant::Private* d )
@@ -118,6 +145,48 @@ namespace fallback_comparator
     }
 }
 
+// Specialize this for a user type to have QVariants of it ordered by
+// a cheap key, in preference to its operator< (or, lacking that, the
+// comparison of string conversions in fallback_comparator):
+//
+//   namespace kdtools {
+//       template<> struct variant_sort_key< MyType > {
+//           typedef int key_type; // any type with operator<; not a reference
+//           static key_type key( const MyType& t ) { return t.id(); }
+//       };
+//   }
+template< typename T >
+struct variant_sort_key
+{
+};
+
+template< typename T >
+class has_variant_sort_key
+{
+    typedef char yes;
+    typedef char ( &no )[ 2 ];
+    template< typename U > static yes test( typename U::key_type* );
+    template< typename U > static no test( ... );
+public:
+    enum { value = sizeof( test< variant_sort_key< T > >( 0 ) ) == sizeof( yes ) };
+};
+
+template< bool > struct bool_tag {};
+
+template< typename T >
+bool less_than_helper( const T& lhs, const T& rhs, bool_tag< true > )
+{
+    return variant_sort_key< T >::key( lhs ) < variant_sort_key< T >::key( rhs );
+}
+
+template< typename T >
+bool less_than_helper( const T& lhs, const T& rhs, bool_tag< false > )
+{
+    using namespace fallback_comparator;
+
+    return lhs < rhs;
+}
+
 template< typename T >
 bool equals( const QVariant::Private* a, const QVariant::Private* b )
 {
@@ -136,8 +205,6 @@ bool equals( const QVariant::Private* a, const QVariant::Private* b )
 template< typename T >
 bool less_than( const QVariant::Private* a, const QVariant::Private* b )
 {
-    using namespace fallback_comparator;
-
     const T* const A = valueHelper< T >( a );
     const T* const B = valueHelper< T >( b );
     if( A == B )
@@ -145,7 +212,7 @@ bool less_than( const QVariant::Private* a, const QVariant::Private* b )
     else if( A == 0 || B == 0 )
         return A < B;
     else
-        return *A < *B;
+        return less_than_helper< T >( *A, *B, bool_tag< has_variant_sort_key< T >::value >() );
 }
 
 template< typename T >
@@ -171,6 +238,12 @@ struct converter : public converter_function
 {
 };
 
+#if QT_VERSION >= 0x050000
+#define CONVERTER_TARGET_TYPE int
+#else
+#define CONVERTER_TARGET_TYPE QVariant::Type
+#endif
+
 #define CONVERTER_CHECK_INPUT( VARIANT_TYPE )                                                         \
     Q_ASSERT( t == QVariant::VARIANT_TYPE );                                                          \
     Q_UNUSED( t )                                                                                     \
@@ -261,6 +334,11 @@ struct converter< T, QVariant::VARIANT_TYPE > : public converter_function
     converter< T, QVariant::VARIANT_TYPE >()                                                          \
         : converter_function( convertTo##VARIANT_TYPE< T > )                                          \
     {                                                                                                 \
+    }                                                                                                 \
+                                                                                                      \
+    static bool convert( const QVariant::Private* d, CONVERTER_TARGET_TYPE t, void* result, bool* ok )\
+    {                                                                                                 \
+        return convertTo##VARIANT_TYPE< T >( d, t, result, ok );                                      \
     }                                                                                                 \
 };
 
@@ -273,6 +351,11 @@ struct converter< T, QVariant::VARIANT_TYPE > : public converter_function
     converter< T, QVariant::VARIANT_TYPE >()                                                          \
         : converter_function( convertOkTo##VARIANT_TYPE< T > )                                        \
     {                                                                                                 \
+    }                                                                                                 \
+                                                                                                      \
+    static bool convert( const QVariant::Private* d, CONVERTER_TARGET_TYPE t, void* result, bool* ok )\
+    {                                                                                                 \
+        return convertOkTo##VARIANT_TYPE< T >( d, t, result, ok );                                    \
     }                                                                                                 \
 };
 
@@ -332,18 +415,50 @@ protected:
     template< typename TYPE, QVariant::Type VARIANT_TYPE >
     static int registerConversion( const kdtools::converter_function& converter )
     {
-        kdtools::qvariant_conversion_registrar::registerIt();
         const int metaTypeId = QMetaTypeId< TYPE >::qt_metatype_id();
-        (*kdtools::qvariant_conversion_registrar::converters)[ kdtools::qvariant_conversion_registrar::converter( metaTypeId, VARIANT_TYPE ) ] = converter;
-        (*kdtools::qvariant_conversion_registrar::comparators_equals)[ metaTypeId ] = kdtools::comparator_equals< TYPE >();
-        (*kdtools::qvariant_conversion_registrar::comparators_less_than)[ metaTypeId ] = kdtools::comparator_less_than< TYPE >();
+        registerFunctions( metaTypeId, VARIANT_TYPE, converter,
+                           kdtools::comparator_equals< TYPE >(), kdtools::comparator_less_than< TYPE >() );
         return metaTypeId;
     }
 
+public:
+    class KDTOOLSCORE_EXPORT StaticRegistration
+    {
+    public:
+        explicit StaticRegistration( kdtools::variant_conversion_list* list );
+        ~StaticRegistration();
+
+    private:
+        kdtools::variant_conversion_list* const list;
+    };
+
 private:
+    static void registerFunctions( int metaTypeId, int targetType, const kdtools::converter_function& converter,
+                                   const kdtools::comparator_function& equals, const kdtools::comparator_function& lessThan );
+
     KDVariantConverter();
 };
 
+#define KDAB_VARIANT_CONVERSIONS_BEGIN( NAME )                                                        \
+static const kdtools::variant_conversion_entry NAME##_kdab_variant_conversions[] = {
+
+#define KDAB_VARIANT_CONVERSION( TYPE, VARIANT_TYPE )                                                 \
+    { &QMetaTypeId< TYPE >::qt_metatype_id, QVariant::VARIANT_TYPE,                                   \
+      &kdtools::converter< TYPE, QVariant::VARIANT_TYPE >::convert,                                   \
+      &kdtools::equals< TYPE >, &kdtools::less_than< TYPE > },
+
+#define KDAB_VARIANT_COMPARISON( TYPE )                                                               \
+    { &QMetaTypeId< TYPE >::qt_metatype_id, -1, 0, &kdtools::equals< TYPE >, &kdtools::less_than< TYPE > },
+
+#define KDAB_VARIANT_CONVERSIONS_END( NAME )                                                          \
+};                                                                                                    \
+static kdtools::variant_conversion_list NAME##_kdab_variant_conversion_list = {                       \
+    NAME##_kdab_variant_conversions,                                                                  \
+    sizeof NAME##_kdab_variant_conversions / sizeof *NAME##_kdab_variant_conversions,                 \
+    0                                                                                                 \
+};                                                                                                    \
+static const KDVariantConverter::StaticRegistration                                                   \
+    NAME##_kdab_variant_conversion_registration( &NAME##_kdab_variant_conversion_list );
 
 bool operator<( const QVariant& lhs, const QVariant& rhs );
 static inline bool operator>( const QVariant& lhs, const QVariant& rhs ) { return lhs != rhs && !operator<( lhs, rhs ); }
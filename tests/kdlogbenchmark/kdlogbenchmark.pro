@@ -0,0 +1,15 @@
+TEMPLATE    = app
+
+TARGET      = kdlogbenchmark
+
+include(../stage.pri)
+
+# a plain command-line program, not a QTestLib test, and KDToolsCore is all it needs:
+CONFIG      -= qtestlib
+QT          -= gui xml network
+KDTOOLS     -= updater
+KDTOOLS     += core
+
+include(../../features/kdtools.prf)
+
+SOURCES     += main.cpp
@@ -0,0 +1,305 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+#include <KDToolsCore/KDLog>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QSemaphore>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+  Measures the KDLog hot path: for every device, number of producer
+  threads and message size, N messages are logged per thread, and the
+  throughput (messages/second, from the first message until the
+  device has processed the last one) and the latency of the individual
+  KDLog::logInfo() calls are reported.
+
+  Devices that are not thread-safe are called under a mutex when more
+  than one thread logs ("serialized" in the output); that is what an
+  application would have to do, too.
+
+  Run with stderr redirected, e.g. kdlogbenchmark 2>/dev/null, or the
+  stderr device's output mixes with the results.
+*/
+
+namespace {
+
+    class SignalSink : public QObject {
+        Q_OBJECT
+    public:
+        SignalSink() : QObject(), received( 0 ) {}
+        int received;
+    public Q_SLOTS:
+        void receive( const QString & msg ) { received += msg.size() != 0; }
+    };
+
+    struct Benchmark {
+        Benchmark() : log( 0 ), device( 0 ), threadSafe( false ), sink( 0 ) {}
+        ~Benchmark() { delete log; delete sink; }
+
+        KDLog * log;
+        KDLogDevice * device;
+        bool threadSafe;
+        SignalSink * sink;
+    };
+
+    static QString tempFile( const char * name ) {
+        return QDir::temp().absoluteFilePath( QLatin1String( "kdlogbenchmark-" ) + QLatin1String( name ) );
+    }
+
+    static KDSignalLogDevice * createSignalDevice( Benchmark * b ) {
+        KDSignalLogDevice * device = new KDSignalLogDevice;
+        b->sink = new SignalSink;
+        QObject::connect( device, SIGNAL(info(QString)), b->sink, SLOT(receive(QString)), Qt::DirectConnection );
+        return device;
+    }
+
+    // Creates the device named \a name into \a b, returns false for unknown names.
+    static bool createDevice( const QString & name, Benchmark * b ) {
+        b->threadSafe = false;
+        if ( name == QLatin1String( "stderr" ) ) {
+            b->device = new KDStderrLogDevice;
+        } else if ( name == QLatin1String( "stderr-buffered" ) ) {
+            KDStderrLogDevice * device = new KDStderrLogDevice;
+            device->setBufferSize( 64 * 1024 );
+            b->device = device;
+        } else if ( name == QLatin1String( "file" ) ) {
+            b->device = new KDFileLogDevice( tempFile( "file.log" ), QIODevice::Truncate );
+        } else if ( name == QLatin1String( "file-buffered" ) ) {
+            KDFileLogDevice * device = new KDFileLogDevice( tempFile( "file.log" ), QIODevice::Truncate );
+            device->setBufferSize( 64 * 1024 );
+            b->device = device;
+        } else if ( name == QLatin1String( "signal" ) ) {
+            b->device = createSignalDevice( b );
+        } else if ( name == QLatin1String( "composite" ) ) {
+            KDCompositeLogDevice * device = new KDCompositeLogDevice;
+            device->addLogDevice( new KDFileLogDevice( tempFile( "composite.log" ), QIODevice::Truncate ) );
+            device->addLogDevice( createSignalDevice( b ) );
+            b->device = device;
+        } else if ( name == QLatin1String( "system" ) ) {
+            b->device = new KDSystemLogDevice( KDSystemLogDevice::User );
+        } else if ( name == QLatin1String( "system-direct" ) ) {
+            KDSystemLogDevice * device = new KDSystemLogDevice( KDSystemLogDevice::User );
+            device->setSubmissionMode( KDSystemLogDevice::DirectDatagram );
+            device->setBatchSize( 32 );
+            b->device = device;
+        } else if ( name == QLatin1String( "binary" ) ) {
+            b->device = new KDBinaryLogDevice( tempFile( "binary.kdblog" ), QIODevice::Truncate );
+            b->threadSafe = true;
+        } else if ( name == QLatin1String( "mmap" ) ) {
+            b->device = new KDMmapRingLogDevice( tempFile( "mmap.flightrec" ), 16 * 1024 * 1024 );
+            b->threadSafe = true;
+        } else if ( name == QLatin1String( "async" ) ) {
+            b->device = new KDAsyncLogDevice( new KDFileLogDevice( tempFile( "async.log" ), QIODevice::Truncate ) );
+            b->threadSafe = true;
+        } else if ( name == QLatin1String( "threadlocal" ) ) {
+            b->device = new KDThreadLocalLogDevice( new KDFileLogDevice( tempFile( "threadlocal.log" ), QIODevice::Truncate ) );
+            b->threadSafe = true;
+        } else {
+            return false;
+        }
+        b->log = new KDLog( b->device );
+        return true;
+    }
+
+    // Waits until the device has processed everything, where it works in the background.
+    static void drain( KDLogDevice * device ) {
+        if ( KDAsyncLogDevice * async = dynamic_cast<KDAsyncLogDevice*>( device ) )
+            async->flush();
+        else if ( KDThreadLocalLogDevice * tl = dynamic_cast<KDThreadLocalLogDevice*>( device ) )
+            tl->flush();
+        else if ( KDSystemLogDevice * sys = dynamic_cast<KDSystemLogDevice*>( device ) )
+            sys->flush( 1000 );
+    }
+
+    class Producer : public QThread {
+    public:
+        Producer( KDLog * log, QMutex * mutex, const QByteArray & payload, int count, QSemaphore * start )
+            : QThread(), latencies(), m_log( log ), m_mutex( mutex ), m_payload( payload ),
+              m_count( count ), m_start( start )
+        {
+            latencies.reserve( count );
+        }
+
+        QVector<qint64> latencies; // ns
+
+    protected:
+        void run() KDAB_OVERRIDE {
+            const char * const payload = m_payload.constData();
+            QElapsedTimer timer;
+            m_start->acquire();
+            timer.start();
+            for ( int i = 0 ; i < m_count ; ++i ) {
+                const qint64 begin = timer.nsecsElapsed();
+                if ( m_mutex ) {
+                    const QMutexLocker locker( m_mutex );
+                    m_log->logInfo( "%d %s", i, payload );
+                } else {
+                    m_log->logInfo( "%d %s", i, payload );
+                }
+                latencies.push_back( timer.nsecsElapsed() - begin );
+            }
+        }
+
+    private:
+        KDLog * const m_log;
+        QMutex * const m_mutex;
+        const QByteArray m_payload;
+        const int m_count;
+        QSemaphore * const m_start;
+    };
+
+    static qint64 percentile( const QVector<qint64> & sorted, double p ) {
+        if ( sorted.isEmpty() )
+            return 0;
+        const int index = qMin( sorted.size() - 1, static_cast<int>( p * sorted.size() ) );
+        return sorted[index];
+    }
+
+    static bool run( const QString & deviceName, int threads, int size, int messages ) {
+        Benchmark b;
+        if ( !createDevice( deviceName, &b ) )
+            return false;
+
+        QMutex mutex;
+        QSemaphore start;
+        const QByteArray payload( size, 'x' );
+        QList<Producer*> producers;
+        for ( int i = 0 ; i < threads ; ++i )
+            producers.push_back( new Producer( b.log, b.threadSafe || threads == 1 ? 0 : &mutex, payload, messages, &start ) );
+        Q_FOREACH( Producer * p, producers )
+            p->start();
+
+        QElapsedTimer wall;
+        wall.start();
+        start.release( threads );
+        Q_FOREACH( Producer * p, producers )
+            p->wait();
+        drain( b.device );
+        const qint64 elapsed = qMax<qint64>( wall.nsecsElapsed(), 1 );
+
+        QVector<qint64> latencies;
+        latencies.reserve( threads * messages );
+        Q_FOREACH( Producer * p, producers )
+            latencies += p->latencies;
+        qDeleteAll( producers );
+        std::sort( latencies.begin(), latencies.end() );
+
+        const double total = double( threads ) * messages;
+        std::printf( "%-16s %7d %7d %-10s %12.0f %10lld %10lld %10lld\n",
+                     qPrintable( deviceName ), threads, size,
+                     b.threadSafe || threads == 1 ? "direct" : "serialized",
+                     total * 1e9 / elapsed,
+                     percentile( latencies, 0.5 ), percentile( latencies, 0.99 ), percentile( latencies, 0.999 ) );
+        std::fflush( stdout );
+        return true;
+    }
+
+    static void usage( const char * argv0 ) {
+        std::fprintf( stderr,
+                      "Usage: %s [--threads N] [--messages M] [--sizes S,...] [--devices D,...]\n"
+                      "Runs every device with 1, 2, 4, ... N producer threads (default: %d),\n"
+                      "logging M messages each (default: 100000) of S bytes (default: 16,128,1024).\n"
+                      "Devices: stderr stderr-buffered file file-buffered signal composite system\n"
+                      "         system-direct binary mmap async threadlocal\n"
+                      "         (default: all but system and system-direct, which write to the\n"
+                      "         system log and only run when named)\n"
+                      "Latencies are per KDLog::logInfo() call, in ns.\n",
+                      argv0, QThread::idealThreadCount() );
+    }
+
+    static QList<int> toIntList( const QString & s, bool * ok ) {
+        QList<int> result;
+        Q_FOREACH( const QString & item, s.split( QLatin1Char( ',' ), QString::SkipEmptyParts ) ) {
+            const int value = item.toInt( ok );
+            if ( !*ok || value <= 0 ) {
+                *ok = false;
+                return result;
+            }
+            result.push_back( value );
+        }
+        *ok = !result.isEmpty();
+        return result;
+    }
+
+} // anon namespace
+
+int main( int argc, char ** argv ) {
+    QCoreApplication app( argc, argv );
+
+    int maxThreads = qMax( 1, QThread::idealThreadCount() );
+    int messages = 100000;
+    QList<int> sizes = QList<int>() << 16 << 128 << 1024;
+    QStringList devices = QString::fromLatin1( "stderr stderr-buffered file file-buffered signal composite "
+                                               "binary mmap async threadlocal" ).split( QLatin1Char( ' ' ) );
+
+    const QStringList args = app.arguments();
+    for ( int i = 1 ; i < args.size() ; ++i ) {
+        const QString & arg = args[i];
+        bool ok = i + 1 < args.size();
+        if ( ok && arg == QLatin1String( "--threads" ) )
+            maxThreads = args[++i].toInt( &ok );
+        else if ( ok && arg == QLatin1String( "--messages" ) )
+            messages = args[++i].toInt( &ok );
+        else if ( ok && arg == QLatin1String( "--sizes" ) )
+            sizes = toIntList( args[++i], &ok );
+        else if ( ok && arg == QLatin1String( "--devices" ) )
+            devices = args[++i].split( QLatin1Char( ',' ), QString::SkipEmptyParts );
+        else
+            ok = false;
+        if ( !ok || maxThreads <= 0 || messages <= 0 ) {
+            usage( argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::printf( "%-16s %7s %7s %-10s %12s %10s %10s %10s\n",
+                 "device", "threads", "size", "mode", "msgs/s", "p50(ns)", "p99(ns)", "p999(ns)" );
+
+    Q_FOREACH( const QString & device, devices )
+        for ( int threads = 1 ; threads <= maxThreads ; threads = threads < maxThreads ? qMin( 2 * threads, maxThreads ) : threads + 1 )
+            Q_FOREACH( const int size, sizes )
+                if ( !run( device, threads, size, messages ) ) {
+                    std::fprintf( stderr, "Unknown device: %s\n", qPrintable( device ) );
+                    usage( argv[0] );
+                    return EXIT_FAILURE;
+                }
+
+    Q_FOREACH( const char * name, QList<const char*>() << "file.log" << "composite.log" << "binary.kdblog"
+                                                      << "mmap.flightrec" << "async.log" << "threadlocal.log" )
+        QFile::remove( tempFile( name ) );
+
+    return EXIT_SUCCESS;
+}
+
+#include "main.moc"
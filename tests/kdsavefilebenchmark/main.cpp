@@ -0,0 +1,186 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+
+#include <KDToolsCore/KDSaveFile>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+#include <QVector>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+  Measures what KDSaveFile::commit() costs with each sync policy: for
+  every policy and file size, a file is written and committed N times
+  (overwriting the previous version, as an application saving its
+  settings would), and the commit rate and the latencies of the
+  individual open/write/commit cycles are reported.
+
+  The result depends entirely on the file system and the storage
+  device, so run it in the directory you care about (--dir); the
+  default, the current directory, is more likely to be on a real disk
+  than QDir::tempPath(), which often is a tmpfs.
+*/
+
+namespace {
+
+    struct Policy {
+        const char * name;
+        KDSaveFile::SyncPolicy policy;
+    };
+
+    static const Policy policies[] = {
+        { "none", KDSaveFile::NoSync },
+        { "data", KDSaveFile::SyncData },
+        { "data+dir", KDSaveFile::SyncDataAndDirectory }
+    };
+    static const int numPolicies = sizeof policies / sizeof *policies;
+
+    static qint64 percentile( const QVector<qint64> & sorted, double p ) {
+        if ( sorted.isEmpty() )
+            return 0;
+        const int index = qMin( sorted.size() - 1, static_cast<int>( p * sorted.size() ) );
+        return sorted[index];
+    }
+
+    static bool run( const QString & fileName, const Policy & policy, int size, int commits ) {
+        const QByteArray payload( size, 'x' );
+        QVector<qint64> latencies;
+        latencies.reserve( commits );
+
+        QElapsedTimer wall;
+        wall.start();
+        for ( int i = 0 ; i < commits ; ++i ) {
+            const qint64 begin = wall.nsecsElapsed();
+            KDSaveFile file( fileName );
+            file.setSyncPolicy( policy.policy );
+            if ( !file.open( QIODevice::WriteOnly ) || file.write( payload ) != payload.size()
+                 || !file.commit( KDSaveFile::OverwriteExistingFile ) ) {
+                std::fprintf( stderr, "Could not save %s: %s\n", qPrintable( fileName ), qPrintable( file.errorString() ) );
+                return false;
+            }
+            latencies.push_back( wall.nsecsElapsed() - begin );
+        }
+        const qint64 elapsed = qMax<qint64>( wall.nsecsElapsed(), 1 );
+        std::sort( latencies.begin(), latencies.end() );
+
+        std::printf( "%-10s %9d %12.1f %10lld %10lld %10lld\n",
+                     policy.name, size, double( commits ) * 1e9 / elapsed,
+                     percentile( latencies, 0.5 ) / 1000, percentile( latencies, 0.99 ) / 1000,
+                     latencies.isEmpty() ? 0 : latencies.back() / 1000 );
+        std::fflush( stdout );
+        return true;
+    }
+
+    static void usage( const char * argv0 ) {
+        std::fprintf( stderr,
+                      "Usage: %s [--dir D] [--commits N] [--sizes S,...] [--policies P,...]\n"
+                      "Saves a file of S bytes (default: 4096,65536,1048576) N times (default: 200)\n"
+                      "in directory D (default: the current directory) with every sync policy.\n"
+                      "Policies: none data data+dir (default: all)\n"
+                      "Latencies are per open/write/commit cycle, in us.\n",
+                      argv0 );
+    }
+
+    static QList<int> toIntList( const QString & s, bool * ok ) {
+        QList<int> result;
+        Q_FOREACH( const QString & item, s.split( QLatin1Char( ',' ), QString::SkipEmptyParts ) ) {
+            const int value = item.toInt( ok );
+            if ( !*ok || value <= 0 ) {
+                *ok = false;
+                return result;
+            }
+            result.push_back( value );
+        }
+        *ok = !result.isEmpty();
+        return result;
+    }
+
+    static const Policy * findPolicy( const QString & name ) {
+        for ( int i = 0 ; i < numPolicies ; ++i )
+            if ( name == QLatin1String( policies[i].name ) )
+                return &policies[i];
+        return 0;
+    }
+
+} // anon namespace
+
+int main( int argc, char ** argv ) {
+    QCoreApplication app( argc, argv );
+
+    QDir dir = QDir::current();
+    int commits = 200;
+    QList<int> sizes = QList<int>() << 4096 << 65536 << 1048576;
+    QList<const Policy*> selected;
+    for ( int i = 0 ; i < numPolicies ; ++i )
+        selected.push_back( &policies[i] );
+
+    const QStringList args = app.arguments();
+    for ( int i = 1 ; i < args.size() ; ++i ) {
+        const QString & arg = args[i];
+        bool ok = i + 1 < args.size();
+        if ( ok && arg == QLatin1String( "--dir" ) ) {
+            dir = QDir( args[++i] );
+            ok = dir.exists();
+        } else if ( ok && arg == QLatin1String( "--commits" ) ) {
+            commits = args[++i].toInt( &ok );
+        } else if ( ok && arg == QLatin1String( "--sizes" ) ) {
+            sizes = toIntList( args[++i], &ok );
+        } else if ( ok && arg == QLatin1String( "--policies" ) ) {
+            selected.clear();
+            Q_FOREACH( const QString & name, args[++i].split( QLatin1Char( ',' ), QString::SkipEmptyParts ) )
+                if ( const Policy * p = findPolicy( name ) )
+                    selected.push_back( p );
+                else
+                    ok = false;
+            ok = ok && !selected.isEmpty();
+        } else {
+            ok = false;
+        }
+        if ( !ok || commits <= 0 ) {
+            usage( argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    const QString fileName = dir.absoluteFilePath( QLatin1String( "kdsavefilebenchmark.dat" ) );
+
+    std::printf( "%-10s %9s %12s %10s %10s %10s\n",
+                 "policy", "size", "commits/s", "p50(us)", "p99(us)", "max(us)" );
+
+    bool ok = true;
+    Q_FOREACH( const Policy * policy, selected )
+        Q_FOREACH( const int size, sizes )
+            if ( ok )
+                ok = run( fileName, *policy, size, commits );
+
+    QFile::remove( fileName );
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,21 @@
+TEMPLATE    = app
+
+TARGET      = kdsharedmemorystresstest
+
+include(../stage.pri)
+
+# a plain command-line program, not a QTestLib test, and KDToolsCore is all it needs:
+CONFIG      -= qtestlib
+QT          -= gui xml network
+KDTOOLS     -= updater
+KDTOOLS     += core
+
+include(../../features/kdtools.prf)
+
+SOURCES     += main.cpp
+
+# unlike the benchmarks, this one fails on error, so it's run by "make test":
+test.target = test
+test.commands = ./$(TARGET)
+test.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += test
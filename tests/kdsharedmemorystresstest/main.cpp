@@ -0,0 +1,420 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+#include <KDToolsCore/KDSeqlockSharedMemoryPointer>
+#include <KDToolsCore/KDSharedMemoryArena>
+#include <KDToolsCore/KDSharedMemoryFutexLocker>
+#include <KDToolsCore/KDSharedMemoryRingBuffer>
+
+#include <QCoreApplication>
+#include <QProcess>
+#include <QSharedMemory>
+#include <QStringList>
+#include <QUuid>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+/*
+  Stresses the KDToolsCore shared memory classes across processes: the
+  program creates a segment and runs copies of itself, attached to it,
+  as writers and readers. A reader that sees an inconsistent value
+  fails, and so does the whole run.
+*/
+
+using namespace kdtools;
+
+namespace {
+
+    enum Role { Writer, Reader };
+
+    //
+    // seqlock: one writer stores increasing values, the readers
+    // poll them without locking:
+    //
+
+    // all fields are derived from n, so a torn copy is detectable:
+    struct Status {
+        explicit Status( quint32 v = 0 ) : n( v ), twice( 2 * v ), negated( ~v ), d( v ) {}
+        bool isConsistent() const { return twice == 2 * n && negated == ~n && d == n; }
+        quint32 n;
+        quint32 twice;
+        quint32 negated;
+        char padding[100];
+        double d;
+    };
+
+    static int seqlockSegmentSize() {
+        return KDSeqlockSharedMemoryPointer<Status>::segmentSize();
+    }
+
+    static bool seqlock( Role role, QSharedMemory & mem, quint32 writes, int ) {
+        KDSeqlockSharedMemoryPointer<Status> p( mem );
+        if ( !p ) {
+            std::fprintf( stderr, "seqlock: segment too small\n" );
+            return false;
+        }
+        if ( role == Writer ) {
+            for ( quint32 i = 1 ; i <= writes ; ++i )
+                p.store( Status( i ) );
+            return true;
+        }
+        quint32 last = 0, reads = 0, torn = 0;
+        do {
+            const Status s = p.load();
+            ++reads;
+            if ( !s.isConsistent() || s.n < last )
+                ++torn;
+            last = s.n;
+        } while ( last != writes );
+        std::printf( "seqlock: reader %lld: %u reads, %u torn\n",
+                     static_cast<long long>( QCoreApplication::applicationPid() ), reads, torn );
+        return torn == 0;
+    }
+
+    //
+    // ringbuffer: one writer pushes increasing values, the readers
+    // pop them, each getting a part:
+    //
+
+    enum { RingCapacity = 1024 };
+
+    struct Sample {
+        quint32 n;      // 0 tells a reader to stop
+        quint32 check;
+        char payload[56];
+    };
+
+    static Sample makeSample( quint32 n ) {
+        Sample s;
+        s.n = n;
+        s.check = ~( n * 2654435761u );
+        std::memset( s.payload, static_cast<char>( n ), sizeof s.payload );
+        return s;
+    }
+
+    static bool isConsistent( const Sample & s ) {
+        for ( unsigned int i = 0 ; i < sizeof s.payload ; ++i )
+            if ( s.payload[i] != static_cast<char>( s.n ) )
+                return false;
+        return s.check == makeSample( s.n ).check;
+    }
+
+    static int ringBufferSegmentSize() {
+        return KDSharedMemoryRingBuffer<Sample>::segmentSize( RingCapacity );
+    }
+
+    static bool initializeRingBuffer( QSharedMemory & mem ) {
+        return KDSharedMemoryRingBuffer<Sample>( mem ).initialize( RingCapacity );
+    }
+
+    static bool ringBuffer( Role role, QSharedMemory & mem, quint32 writes, int readers ) {
+        KDSharedMemoryRingBuffer<Sample> ring( mem );
+        if ( !ring ) {
+            std::fprintf( stderr, "ringbuffer: not initialized\n" );
+            return false;
+        }
+        if ( role == Writer ) {
+            for ( quint32 i = 1 ; i <= writes ; ++i )
+                ring.push( makeSample( i ) );
+            for ( int i = 0 ; i < readers ; ++i )
+                ring.push( makeSample( 0 ) );
+            return true;
+        }
+        quint32 last = 0, reads = 0, broken = 0;
+        Sample s;
+        while ( ring.pop( &s ) && s.n != 0 ) {
+            ++reads;
+            // with a single writer, every reader gets increasing values:
+            if ( !isConsistent( s ) || s.n <= last )
+                ++broken;
+            last = s.n;
+        }
+        std::printf( "ringbuffer: reader %lld: %u reads, %u broken\n",
+                     static_cast<long long>( QCoreApplication::applicationPid() ), reads, broken );
+        return broken == 0;
+    }
+
+    //
+    // futexlocker: everybody increments a pair of counters under the
+    // lock; on Linux, the writer first lets a process die holding it:
+    //
+
+    struct Counters {
+        quint32 a;
+        quint32 b; // ~a while unlocked
+        quint32 ownerDeaths;
+    };
+
+    static int futexLockerSegmentSize() {
+        return KDSharedMemoryFutexLocker::HeaderSize + int( sizeof( Counters ) );
+    }
+
+    static bool futexLocker( Role role, QSharedMemory & mem, quint32 writes, int ) {
+#ifdef Q_OS_LINUX
+        if ( role == Writer ) {
+            const pid_t pid = ::fork();
+            if ( pid == 0 ) {
+                const KDSharedMemoryFutexLocker locker( mem );
+                ::_exit( locker.isLocked() ? 0 : 1 ); // dies holding the lock
+            }
+            int status = 0;
+            if ( pid < 0 || ::waitpid( pid, &status, 0 ) != pid || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) {
+                std::fprintf( stderr, "futexlocker: could not let a lock owner die\n" );
+                return false;
+            }
+        }
+#endif
+        quint32 broken = 0;
+        for ( quint32 i = 0 ; i < writes ; ++i ) {
+            const KDSharedMemoryFutexLocker locker( mem );
+            Counters * const c = static_cast<Counters*>( locker.data() );
+            if ( !c )
+                return false;
+            if ( locker.ownerDied() )
+                ++c->ownerDeaths;
+            else if ( c->b != ~c->a )
+                ++broken;
+            ++c->a;
+            c->b = ~c->a;
+        }
+        std::printf( "futexlocker: %s %lld: %u broken\n", role == Writer ? "writer" : "reader",
+                     static_cast<long long>( QCoreApplication::applicationPid() ), broken );
+        return broken == 0;
+    }
+
+    static bool verifyFutexLocker( QSharedMemory & mem, quint32 writes, int readers ) {
+        const KDSharedMemoryFutexLocker locker( mem );
+        const Counters * const c = static_cast<const Counters*>( locker.data() );
+#ifdef Q_OS_LINUX
+        const quint32 expectedDeaths = 1;
+#else
+        const quint32 expectedDeaths = 0;
+#endif
+        if ( !c || c->a != ( readers + 1 ) * writes || c->b != ~c->a || c->ownerDeaths != expectedDeaths ) {
+            std::fprintf( stderr, "futexlocker: counted %u of %u, %u owner deaths\n",
+                          c ? c->a : 0, ( readers + 1 ) * writes, c ? c->ownerDeaths : 0 );
+            return false;
+        }
+        return true;
+    }
+
+    //
+    // arena: everybody allocates and frees records of varying sizes,
+    // filled with a pattern, keeping some of them alive at any time:
+    //
+
+    enum { ArenaSize = 4 * 1024 * 1024, LiveRecords = 64 };
+
+    static int arenaSegmentSize() {
+        return ArenaSize;
+    }
+
+    static bool initializeArena( QSharedMemory & mem ) {
+        return KDSharedMemoryArena( mem ).initialize();
+    }
+
+    static bool arena( Role, QSharedMemory & mem, quint32 writes, int ) {
+        KDSharedMemoryArena arena( mem );
+        if ( !arena ) {
+            std::fprintf( stderr, "arena: not initialized\n" );
+            return false;
+        }
+        std::srand( static_cast<unsigned int>( QCoreApplication::applicationPid() ) );
+        char * live[LiveRecords] = { 0 };
+        int sizes[LiveRecords] = { 0 };
+        quint32 broken = 0, failed = 0;
+        for ( quint32 i = 0 ; i < writes ; ++i ) {
+            const int slot = std::rand() % LiveRecords;
+            if ( char * const p = live[slot] ) {
+                for ( int j = 0 ; j < sizes[slot] ; ++j )
+                    if ( p[j] != static_cast<char>( sizes[slot] ) )
+                        ++broken;
+                arena.deallocate( p );
+            }
+            sizes[slot] = 1 + std::rand() % 2000;
+            live[slot] = static_cast<char*>( arena.allocate( sizes[slot] ) );
+            if ( live[slot] )
+                std::memset( live[slot], static_cast<char>( sizes[slot] ), sizes[slot] );
+            else
+                ++failed;
+        }
+        for ( int slot = 0 ; slot < LiveRecords ; ++slot )
+            arena.deallocate( live[slot] );
+        std::printf( "arena: %lld: %u broken, %u failed allocations\n",
+                     static_cast<long long>( QCoreApplication::applicationPid() ), broken, failed );
+        return broken == 0 && failed == 0;
+    }
+
+    static bool verifyArena( QSharedMemory & mem, quint32, int ) {
+        const std::size_t allocated = KDSharedMemoryArena( mem ).bytesAllocated();
+        if ( allocated != 0 ) {
+            std::fprintf( stderr, "arena: %lu bytes still allocated\n", static_cast<unsigned long>( allocated ) );
+            return false;
+        }
+        return true;
+    }
+
+    struct Test {
+        const char * name;
+        int ( *segmentSize )();
+        bool ( *initialize )( QSharedMemory & mem ); // may be 0
+        bool ( *run )( Role role, QSharedMemory & mem, quint32 writes, int readers );
+        bool ( *verify )( QSharedMemory & mem, quint32 writes, int readers ); // may be 0
+    };
+
+    static const Test tests[] = {
+        { "seqlock", &seqlockSegmentSize, 0, &seqlock, 0 },
+        { "ringbuffer", &ringBufferSegmentSize, &initializeRingBuffer, &ringBuffer, 0 },
+        { "futexlocker", &futexLockerSegmentSize, 0, &futexLocker, &verifyFutexLocker },
+        { "arena", &arenaSegmentSize, &initializeArena, &arena, &verifyArena },
+    };
+    static const int numTests = sizeof tests / sizeof *tests;
+
+    static const Test * findTest( const QString & name ) {
+        for ( int i = 0 ; i < numTests ; ++i )
+            if ( name == QLatin1String( tests[i].name ) )
+                return &tests[i];
+        return 0;
+    }
+
+    // runs in a child process:
+    static int child( const Test * test, Role role, const QString & key, quint32 writes, int readers ) {
+        QSharedMemory mem( key );
+        if ( !mem.attach() ) {
+            std::fprintf( stderr, "%s: cannot attach: %s\n", test->name, qPrintable( mem.errorString() ) );
+            return EXIT_FAILURE;
+        }
+        return test->run( role, mem, writes, readers ) ? EXIT_SUCCESS : EXIT_FAILURE ;
+    }
+
+    static QProcess * startChild( const Test * test, Role role, const QString & key, quint32 writes, int readers ) {
+        QProcess * const process = new QProcess;
+        process->setProcessChannelMode( QProcess::ForwardedChannels );
+        process->start( QCoreApplication::applicationFilePath(),
+                        QStringList() << QLatin1String( "--child" ) << QLatin1String( test->name )
+                                      << QLatin1String( role == Writer ? "writer" : "reader" )
+                                      << key << QString::number( writes ) << QString::number( readers ) );
+        return process;
+    }
+
+    static bool runTest( const Test * test, int readers, quint32 writes ) {
+        QSharedMemory mem( QUuid::createUuid().toString() );
+        if ( !mem.create( test->segmentSize() ) ) {
+            std::fprintf( stderr, "%s: cannot create segment: %s\n", test->name, qPrintable( mem.errorString() ) );
+            return false;
+        }
+        if ( test->initialize && !test->initialize( mem ) ) {
+            std::fprintf( stderr, "%s: cannot initialize segment\n", test->name );
+            return false;
+        }
+
+        QList<QProcess*> processes;
+        for ( int i = 0 ; i < readers ; ++i )
+            processes.push_back( startChild( test, Reader, mem.key(), writes, readers ) );
+        processes.push_back( startChild( test, Writer, mem.key(), writes, readers ) );
+
+        bool ok = true;
+        Q_FOREACH( QProcess * process, processes ) {
+            if ( !process->waitForFinished( 5 * 60 * 1000 ) ) {
+                process->kill();
+                process->waitForFinished();
+                ok = false;
+            } else if ( process->exitStatus() != QProcess::NormalExit || process->exitCode() != EXIT_SUCCESS ) {
+                ok = false;
+            }
+            delete process;
+        }
+        if ( ok && test->verify )
+            ok = test->verify( mem, writes, readers );
+
+        std::printf( "%s: %s\n", test->name, ok ? "passed" : "FAILED" );
+        return ok;
+    }
+
+    static void usage( const char * argv0 ) {
+        std::fprintf( stderr,
+                      "Usage: %s [--readers N] [--writes M] [test...]\n"
+                      "Runs each test (default: all) with N reader processes (default: 4) and\n"
+                      "writer processes doing M writes (default: 200000). Tests:",
+                      argv0 );
+        for ( int i = 0 ; i < numTests ; ++i )
+            std::fprintf( stderr, " %s", tests[i].name );
+        std::fprintf( stderr, "\n" );
+    }
+
+} // anon namespace
+
+int main( int argc, char ** argv ) {
+    QCoreApplication app( argc, argv );
+
+    const QStringList args = app.arguments();
+
+    if ( args.size() == 7 && args[1] == QLatin1String( "--child" ) ) {
+        const Test * const test = findTest( args[2] );
+        if ( !test )
+            return EXIT_FAILURE;
+        return child( test, args[3] == QLatin1String( "writer" ) ? Writer : Reader, args[4], args[5].toUInt(), args[6].toInt() );
+    }
+
+    int readers = 4;
+    int writes = 200000;
+    QList<const Test*> selected;
+    for ( int i = 1 ; i < args.size() ; ++i ) {
+        int * const option =
+            args[i] == QLatin1String( "--readers" ) ? &readers :
+            args[i] == QLatin1String( "--writes" ) ? &writes : 0;
+        bool ok;
+        if ( option ) {
+            ok = i + 1 < args.size();
+            if ( ok )
+                *option = args[++i].toInt( &ok );
+            ok = ok && *option > 0;
+        } else if ( const Test * const test = findTest( args[i] ) ) {
+            selected.push_back( test );
+            ok = true;
+        } else {
+            ok = false;
+        }
+        if ( !ok ) {
+            usage( argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+    if ( selected.empty() )
+        for ( int i = 0 ; i < numTests ; ++i )
+            selected.push_back( &tests[i] );
+
+    bool ok = true;
+    Q_FOREACH( const Test * test, selected )
+        ok = runTest( test, readers, writes ) && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE ;
+}
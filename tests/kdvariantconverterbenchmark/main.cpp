@@ -0,0 +1,209 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+
+#include <KDToolsCore/KDVariantConverter>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/*
+  Measures what the QVariant conversions and comparisons that
+  KDVariantConverter hooks into cost per call, for a registered user
+  type and, as a baseline that only passes through KDVariantConverter's
+  handler, for a built-in type.
+
+  It then sorts a large number of variants of a type without an
+  operator<, once ordered by string conversion (the fallback) and once
+  by a kdtools::variant_sort_key.
+
+  Only public API is used, so the per-call part of the program can be
+  built against older KDTools versions (without the sort key
+  specialization) to compare.
+*/
+
+namespace kdvariantconverterbenchmark {
+
+    class Value {
+    public:
+        explicit Value( int v = 0 ) : value( v ) {}
+        QString toString() const { return s_string; }
+        int toInt( bool * ok = 0 ) const { if ( ok ) *ok = true; return value; }
+        double toDouble( bool * ok = 0 ) const { if ( ok ) *ok = true; return value; }
+        int value;
+        static QString s_string;
+    };
+
+    QString Value::s_string = QLatin1String( "value" );
+
+    inline bool operator==( const Value & lhs, const Value & rhs ) { return lhs.value == rhs.value; }
+    inline bool operator<( const Value & lhs, const Value & rhs ) { return lhs.value < rhs.value; }
+
+    // neither has an operator<; only Keyed has a variant_sort_key:
+    class Unkeyed {
+    public:
+        explicit Unkeyed( int v = 0 ) : value( v ) {}
+        QString toString() const { return QString::number( value ); }
+        int value;
+    };
+
+    class Keyed {
+    public:
+        explicit Keyed( int v = 0 ) : value( v ) {}
+        QString toString() const { return QString::number( value ); }
+        int value;
+    };
+
+    inline bool operator==( const Unkeyed & lhs, const Unkeyed & rhs ) { return lhs.value == rhs.value; }
+    inline bool operator==( const Keyed & lhs, const Keyed & rhs ) { return lhs.value == rhs.value; }
+
+} // namespace kdvariantconverterbenchmark
+
+Q_DECLARE_METATYPE( kdvariantconverterbenchmark::Value )
+Q_DECLARE_METATYPE( kdvariantconverterbenchmark::Unkeyed )
+Q_DECLARE_METATYPE( kdvariantconverterbenchmark::Keyed )
+
+namespace kdtools {
+    template <> struct variant_sort_key<kdvariantconverterbenchmark::Keyed> {
+        typedef int key_type;
+        static key_type key( const kdvariantconverterbenchmark::Keyed & k ) { return k.value; }
+    };
+}
+
+using namespace kdvariantconverterbenchmark;
+
+namespace {
+
+    // keeps the compiler from dropping the benchmarked calls
+    static volatile qint64 sink = 0;
+
+    enum Operation { ToString, ToInt, ToDouble, Equals, LessThan, NumOperations };
+    static const char * const operationNames[NumOperations] = { "toString", "toInt", "toDouble", "operator==", "operator<" };
+
+    static double run( const QVariant & a, const QVariant & b, Operation op, int iterations ) {
+        QElapsedTimer timer;
+        timer.start();
+        qint64 acc = 0;
+        for ( int i = 0 ; i < iterations ; ++i ) {
+            switch ( op ) {
+            case ToString:  acc += a.toString().size(); break;
+            case ToInt:     acc += a.toInt(); break;
+            case ToDouble:  acc += static_cast<qint64>( a.toDouble() ); break;
+            case Equals:    acc += a == b; break;
+            case LessThan:  acc += a < b; break;
+            case NumOperations: break;
+            }
+        }
+        sink = sink + acc;
+        return double( timer.nsecsElapsed() ) / iterations;
+    }
+
+    struct VariantLess {
+        bool operator()( const QVariant & lhs, const QVariant & rhs ) const {
+            return ::operator<( lhs, rhs );
+        }
+    };
+
+    // returns the time to sort the variants of T made from values, in ms
+    template <typename T>
+    static double sort( const std::vector<int> & values ) {
+        std::vector<QVariant> variants;
+        variants.reserve( values.size() );
+        for ( std::vector<int>::const_iterator it = values.begin() ; it != values.end() ; ++it )
+            variants.push_back( qVariantFromValue( T( *it ) ) );
+        QElapsedTimer timer;
+        timer.start();
+        std::sort( variants.begin(), variants.end(), VariantLess() );
+        const double result = double( timer.nsecsElapsed() ) / 1e6;
+        sink = sink + variants.front().toString().size();
+        return result;
+    }
+
+    static void usage( const char * argv0 ) {
+        std::fprintf( stderr,
+                      "Usage: %s [--iterations N] [--sort-size M]\n"
+                      "Calls every operation N times (default: 2000000) and reports ns per call,\n"
+                      "then sorts M variants (default: 1000000) and reports ms per sort.\n",
+                      argv0 );
+    }
+
+} // anon namespace
+
+int main( int argc, char ** argv ) {
+    QCoreApplication app( argc, argv );
+
+    int iterations = 2000000;
+    int sortSize = 1000000;
+    const QStringList args = app.arguments();
+    for ( int i = 1 ; i < args.size() ; ++i ) {
+        int * const option =
+            args[i] == QLatin1String( "--iterations" ) ? &iterations :
+            args[i] == QLatin1String( "--sort-size" ) ? &sortSize : 0;
+        bool ok = option && i + 1 < args.size();
+        if ( ok )
+            *option = args[++i].toInt( &ok );
+        if ( !ok || *option <= 0 ) {
+            usage( argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    KDVariantConverter::registerConversion< Value >();
+    KDVariantConverter::registerConversion< Value, QVariant::Int >();
+    KDVariantConverter::registerConversion< Value, QVariant::Double >();
+    KDVariantConverter::registerConversion< Unkeyed >();
+    KDVariantConverter::registerConversion< Keyed >();
+
+    const QVariant user1 = qVariantFromValue( Value( 1 ) );
+    const QVariant user2 = qVariantFromValue( Value( 2 ) );
+    const QVariant builtin1 = QVariant( 1 );
+    const QVariant builtin2 = QVariant( 2 );
+
+    std::printf( "%-12s %14s %14s\n", "operation", "user (ns)", "builtin (ns)" );
+    for ( int op = 0 ; op < NumOperations ; ++op ) {
+        // warm up, then measure
+        run( user1, user2, Operation( op ), iterations / 10 );
+        const double user = run( user1, user2, Operation( op ), iterations );
+        const double builtin = run( builtin1, builtin2, Operation( op ), iterations );
+        std::printf( "%-12s %14.1f %14.1f\n", operationNames[op], user, builtin );
+        std::fflush( stdout );
+    }
+
+    std::vector<int> values( sortSize );
+    std::srand( 42 );
+    for ( std::vector<int>::iterator it = values.begin() ; it != values.end() ; ++it )
+        *it = std::rand();
+
+    std::printf( "\n%-12s %14s\n", "sort", "time (ms)" );
+    std::printf( "%-12s %14.1f\n", "by string", sort<Unkeyed>( values ) );
+    std::fflush( stdout );
+    std::printf( "%-12s %14.1f\n", "by key", sort<Keyed>( values ) );
+
+    return EXIT_SUCCESS;
+}
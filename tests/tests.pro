@@ -21,6 +21,19 @@ SUBDIRS     += $${TESTDIRS}
 
 } # contains($$list($$[QT_VERSION]), 4.[4-9].*)
 
+# cross-process stress tests of KDToolsCore; these are run by "make test":
+STRESSDIRS  = kdsharedmemorystresstest
+
+TESTDIRS    += $${STRESSDIRS}
+SUBDIRS     += $${STRESSDIRS}
+
+# benchmarks are built along with the tests, but not run by "make test":
+BENCHMARKDIRS = kdlogbenchmark \
+                kdsavefilebenchmark \
+                kdvariantconverterbenchmark
+
+SUBDIRS     += $${BENCHMARKDIRS}
+
 test.target=test
 unix:!macx {
     LIB_PATH=../../lib:\$\$LD_LIBRARY_PATH
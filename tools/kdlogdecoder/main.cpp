@@ -0,0 +1,72 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+#include <KDToolsCore/KDBinaryLogReader>
+
+#include <QFile>
+
+#include <iostream>
+#include <cstdlib>
+
+static const char * severityToString( KDLog::Severity severity ) {
+    switch ( severity & KDLog::LevelMask ) {
+    case KDLog::Info:    return "Info";
+    case KDLog::Debug:   return "Debug";
+    case KDLog::Warning: return "Warning";
+    case KDLog::Error:   return "Error";
+    }
+    return "";
+}
+
+int main( int argc, char** argv )
+{
+    if ( argc < 2 ) {
+        std::cerr << "Usage: " << argv[0] << " <binary-log-file>...\n"
+                     "Prints logs written by KDBinaryLogDevice as text." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    bool ok = true;
+    for ( int i = 1 ; i < argc ; ++i ) {
+        KDBinaryLogReader reader( QFile::decodeName( argv[i] ) );
+        if ( !reader.isOpen() ) {
+            std::cerr << argv[i] << ": " << qPrintable( reader.errorString() ) << std::endl;
+            ok = false;
+            continue;
+        }
+
+        KDBinaryLogReader::Record record;
+        while ( reader.readNext( &record ) )
+            std::cout << qPrintable( record.time.toString( QLatin1String( "yyyy-MM-dd hh:mm:ss.zzz" ) ) )
+                      << " [" << std::hex << record.threadId << std::dec << "] "
+                      << severityToString( record.severity ) << ": "
+                      << record.message.toLocal8Bit().constData() << '\n';
+
+        if ( !reader.errorString().isEmpty() ) {
+            std::cerr << qPrintable( reader.errorString() ) << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,14 @@
+include( ../stage.pri )
+
+TEMPLATE = app
+TARGET = kdmmaplogextract
+QT -= gui
+CONFIG += console kdtools
+KDTOOLS += core
+macx:CONFIG -= app_bundle
+
+DESTDIR = $$KDTOOLS_BASE/bin
+
+SOURCES += main.cpp
+
+include( ../../features/kdtools.prf )
@@ -0,0 +1,75 @@
+/****************************************************************************
+** Copyright (C) 2001-2016 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com.
+** All rights reserved.
+**
+** This file is part of the KD Tools library.
+**
+** Licensees holding valid commercial KD Tools licenses may use this file in
+** accordance with the KD Tools Commercial License Agreement provided with
+** the Software.
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU Lesser General Public License version 2.1 and version 3 as published by the
+** Free Software Foundation and appearing in the file LICENSE.LGPL.txt included.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Contact info@kdab.com if any conditions of this licensing are not
+** clear to you.
+**
+**********************************************************************/
+
+
+
+#include <KDToolsCore/KDMmapRingLogReader>
+
+#include <QFile>
+
+#include <iostream>
+#include <cstdlib>
+
+static const char * severityToString( KDLog::Severity severity ) {
+    switch ( severity & KDLog::LevelMask ) {
+    case KDLog::Info:    return "Info";
+    case KDLog::Debug:   return "Debug";
+    case KDLog::Warning: return "Warning";
+    case KDLog::Error:   return "Error";
+    }
+    return "";
+}
+
+int main( int argc, char** argv )
+{
+    if ( argc < 2 ) {
+        std::cerr << "Usage: " << argv[0] << " <flight-recording>...\n"
+                     "Prints the entries kept by KDMmapRingLogDevice as text, oldest first." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    bool ok = true;
+    for ( int i = 1 ; i < argc ; ++i ) {
+        KDMmapRingLogReader reader( QFile::decodeName( argv[i] ) );
+        if ( !reader.isOpen() ) {
+            std::cerr << argv[i] << ": " << qPrintable( reader.errorString() ) << std::endl;
+            ok = false;
+            continue;
+        }
+
+        KDMmapRingLogReader::Record record;
+        while ( reader.readNext( &record ) )
+            std::cout << '#' << record.sequence << ' '
+                      << qPrintable( record.time.toString( QLatin1String( "yyyy-MM-dd hh:mm:ss.zzz" ) ) )
+                      << qPrintable( QString::number( record.usecsSinceEpoch % 1000 ).rightJustified( 3, QLatin1Char( '0' ) ) )
+                      << " [" << std::hex << record.threadId << std::dec << "] "
+                      << severityToString( record.severity ) << ": "
+                      << record.message.toLocal8Bit().constData() << '\n';
+
+        if ( !reader.errorString().isEmpty() ) {
+            std::cerr << argv[i] << ": " << qPrintable( reader.errorString() ) << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -37,12 +37,29 @@ KDAB_IMPORT_UNITTEST_SIMPLE( KDVariantConverter )
 #endif
 #if QT_VERSION >= 0x040400 && !defined(QT_NO_SHAREDMEMORY)
 KDAB_IMPORT_UNITTEST_SIMPLE( KDLockedSharedMemoryPointer )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDSeqlockSharedMemoryPointer )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDSharedMemoryRingBuffer )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDSharedMemoryFutexLocker )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDSharedMemoryArena )
 #endif
 KDAB_IMPORT_UNITTEST_SIMPLE( KDEmailValidator )
 KDAB_IMPORT_UNITTEST( KDGenericFactoryTest )
 KDAB_IMPORT_UNITTEST_SIMPLE( KDSaveFile )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDSaveFileGroup )
 KDAB_IMPORT_UNITTEST_SIMPLE( KDMetaMethodIterator )
 KDAB_IMPORT_UNITTEST_SIMPLE( KDThreadRunner )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDThreadRunnerOptions )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDThreadRunnerAsync )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDThreadRunnerChannel )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDThreadRunnerPool )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDLog )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDAsyncLogDevice )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDRotatingFileLogDevice )
+#ifdef Q_OS_UNIX
+KDAB_IMPORT_UNITTEST_SIMPLE( KDSystemLogDevice )
+#endif
+KDAB_IMPORT_UNITTEST_SIMPLE( KDBinaryLogDevice )
+KDAB_IMPORT_UNITTEST_SIMPLE( KDMmapRingLogDevice )
 KDAB_IMPORT_UNITTEST_SIMPLE( KDMatrixMapper )
 KDAB_IMPORT_UNITTEST_SIMPLE( KDTransformMapper )
 